@@ -40,7 +40,7 @@ BinaryData & BinaryData::append(BinaryDataRef const & bd2)
    if(getSize()==0) 
       copyFrom(bd2.getPtr(), bd2.getSize());
    else
-      data_.insert(data_.end(), bd2.getPtr(), bd2.getPtr()+bd2.getSize());
+      data_.append(bd2.getPtr(), bd2.getSize());
 
    return (*this);
 }
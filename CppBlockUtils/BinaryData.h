@@ -41,6 +41,7 @@
 #include <vector>
 #include <string>
 #include <assert.h>
+#include <algorithm>
 
 // We can remove these includes (Crypto++ ) if we remove the GenerateRandom()
 #include "cryptlib.h"
@@ -49,12 +50,121 @@
 #define DEFAULT_BUFFER_SIZE 25*1048576
 
 #include "UniversalTimer.h"
+#include "SecureArena.h"
 
 
 using namespace std;
 
 class BinaryDataRef;
 
+////////////////////////////////////////////////////////////////////////////////
+// The bytes behind a BinaryData:  a vector<uint8_t> with only the parts 
+// BinaryData uses, allocated with SecureArena::allocateBuffer so that the 
+// SecureBinaryData buffers can come from the locked arena.  (A std::vector 
+// with a custom allocator would fill and copy one byte at a time.)  Grows
+// by doubling, and clear() keeps the capacity, like the vector did.
+//
+// A buffer allocated inside a SecureAllocScope is marked secure.  It stays
+// secure when it grows (even outside a scope), and every byte it gives up
+// is zeroed:  the tail on a shrinking resize, and the whole capacity when
+// it's freed.  Arena blocks are zeroed by the arena itself.
+class BinaryDataBuffer
+{
+public:
+   BinaryDataBuffer(void) : 
+      ptr_(NULL), size_(0), capacity_(0), isSecure_(false) {}
+   BinaryDataBuffer(BinaryDataBuffer const & buf) : 
+      ptr_(NULL), size_(0), capacity_(0), isSecure_(false)
+                                          { append(buf.ptr_, buf.size_); }
+   ~BinaryDataBuffer(void)                { release();                  }
+
+   BinaryDataBuffer & operator=(BinaryDataBuffer const & buf)
+   {
+      if(&buf != this)
+      {
+         clear();
+         append(buf.ptr_, buf.size_);
+      }
+      return (*this);
+   }
+
+   size_t          size(void) const             { return size_;   }
+   uint8_t       & operator[](size_t i)         { return ptr_[i]; }
+   uint8_t const & operator[](size_t i) const   { return ptr_[i]; }
+
+   // New bytes are zeroed
+   void resize(size_t sz)
+   {
+      if(sz > capacity_)
+         grow(max(sz, 2*size_), NULL, 0);
+      if(sz > size_)
+         memset(ptr_ + size_, 0, sz - size_);
+      else if(isSecure_)
+         SecureArena::secureZero(ptr_ + sz, size_ - sz);
+      size_ = sz;
+   }
+
+   void reserve(size_t sz)  { if(sz > capacity_) grow(sz, NULL, 0); }
+   void clear(void)         { resize(0); }
+
+   // src may point into this buffer
+   void append(uint8_t const * src, size_t n)
+   {
+      if(n == 0)
+         return;
+      if(size_ + n > capacity_)
+         grow(max(size_ + n, 2*size_), src, n);
+      else
+         memcpy(ptr_ + size_, src, n);
+      size_ += n;
+   }
+
+   void swap(BinaryDataBuffer & buf)
+   {
+      std::swap(ptr_,      buf.ptr_);
+      std::swap(size_,     buf.size_);
+      std::swap(capacity_, buf.capacity_);
+      std::swap(isSecure_, buf.isSecure_);
+   }
+
+private:
+   // New buffer of newCapacity, with the current bytes and then n bytes
+   // from src, which are copied before the old buffer is freed
+   void grow(size_t newCapacity, uint8_t const * src, size_t n)
+   {
+      bool newIsSecure = (isSecure_ || SecureArena::isSecureScope());
+      uint8_t * newPtr = SecureArena::allocateBuffer(newCapacity, newIsSecure);
+      if(size_ > 0)
+         memcpy(newPtr, ptr_, size_);
+      if(n > 0)
+         memcpy(newPtr + size_, src, n);
+      release();
+      ptr_      = newPtr;
+      capacity_ = newCapacity;
+      isSecure_ = newIsSecure;
+   }
+
+   void release(void)
+   {
+      if(ptr_ != NULL)
+      {
+         if(isSecure_ && !SecureArena::contains(ptr_))
+            SecureArena::secureZero(ptr_, capacity_);
+         SecureArena::freeBuffer(ptr_, capacity_);
+      }
+      ptr_      = NULL;
+      capacity_ = 0;
+      isSecure_ = false;
+   }
+
+   uint8_t * ptr_;
+   size_t    size_;
+   size_t    capacity_;
+   bool      isSecure_;   // allocated in a SecureAllocScope
+};
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 class BinaryData
@@ -63,7 +173,7 @@ public:
 
 
    /////////////////////////////////////////////////////////////////////////////
-   BinaryData(void) : data_(0)                 {                         }
+   BinaryData(void) : data_()                  {                         }
    BinaryData(size_t sz)                       { alloc(sz);              }
    BinaryData(uint8_t const * inData, size_t sz)      
                                                { copyFrom(inData, sz);   }
@@ -147,7 +257,7 @@ public:
       if(getSize()==0) 
          copyFrom(bd2.getPtr(), bd2.getSize());
       else
-         data_.insert(data_.end(), bd2.data_.begin(), bd2.data_.end());
+         data_.append(bd2.getPtr(), bd2.getSize());
       return (*this);
    }
 
@@ -160,7 +270,7 @@ public:
    /////////////////////////////////////////////////////////////////////////////
    BinaryData & append(uint8_t byte)
    {
-      data_.insert(data_.end(), byte);
+      data_.append(&byte, 1);
       return (*this);
    }
 
@@ -249,6 +359,7 @@ public:
 
    void resize(size_t sz) { data_.resize(sz); }
    void reserve(size_t sz) { data_.reserve(sz); }
+   void swap(BinaryData & bd) { data_.swap(bd.data_); }
 
    /////////////////////////////////////////////////////////////////////////////
    // Swap endianness of the bytes in the index range [pos1, pos2)
@@ -371,7 +482,7 @@ public:
    void clear(void) { data_.clear(); }
 
 private:
-   vector<uint8_t> data_;
+   BinaryDataBuffer data_;
 
 private:
    void alloc(size_t sz) 
@@ -1114,6 +1225,12 @@ public:
       theString_.append(targPtr, nBytes);
    }
 
+   /////////////////////////////////////////////////////////////////////////////
+   void put_BinaryDataRef(BinaryDataRef const & str)
+   {
+      theString_.append(str);
+   }
+
 
    /////////////////////////////////////////////////////////////////////////////
    BinaryData const & getData(void)
@@ -81,6 +81,9 @@ void BlockHeaderRef::unserialize(uint8_t const * ptr)
    BtcUtils::getHash256(self_.getPtr(), HEADER_SIZE, thisHash_);
    difficultyDbl_ = BtcUtils::convertDiffBitsToDouble( 
                               BinaryDataRef(self_.getPtr()+72, 4));
+   blockWork_ = BtcUtils::convertDiffBitsToWork(
+                              BinaryDataRef(self_.getPtr()+72, 4));
+   chainWork_ = UInt256();
    isInitialized_ = true;
    nextHash_ = BinaryData(0);
    blockHeight_ = UINT32_MAX;
@@ -164,18 +167,77 @@ vector<BinaryData> BlockHeaderRef::getTxHashList(void)
 
    return vectOut;
 }
+////////////////////////////////////////////////////////////////////////////////
+// Tx hashes packed end-to-end, for the flat merkle methods in BtcUtils
+void BlockHeaderRef::copyTxHashesTo(BinaryData & flatHashes, uint32_t extraBytes)
+{
+   uint32_t numTx = getNumTx();
+   flatHashes.resize(32*numTx + extraBytes);
+   for(uint32_t i=0; i<numTx; i++)
+      txPtrList_[i]->getThisHashRef().copyTo(flatHashes.getPtr() + 32*i, 32);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 BinaryData BlockHeaderRef::calcMerkleRoot(vector<BinaryData>* treeOut) 
 {
+   uint32_t numTx = getNumTx();
+   if(numTx == 0)
+      return BinaryData(32);
+
+   // Headers on different threads can do this at once, so nothing static
+   CryptoPP::SHA256 sha256;
+   BinaryData scratch;
+
    if(treeOut == NULL)
-      return BtcUtils::calculateMerkleRoot( getTxHashList() );
+   {
+      copyTxHashesTo(scratch);
+      BtcUtils::calculateMerkleRootInPlace(scratch.getPtr(), numTx, sha256);
+      return scratch.getSliceCopy(0, 32);
+   }
    else
    {
-      *treeOut = BtcUtils::calculateMerkleTree( getTxHashList() );
-      return (*treeOut)[treeOut->size()-1];
+      uint32_t treeSize = BtcUtils::getMerkleTreeSize(numTx);
+      copyTxHashesTo(scratch, 32*(treeSize-numTx));
+      BtcUtils::calculateMerkleTreeFlat(scratch.getPtr(), numTx, sha256);
+      treeOut->resize(treeSize);
+      for(uint32_t i=0; i<treeSize; i++)
+         (*treeOut)[i].copyFrom(scratch.getPtr() + 32*i, 32);
+      return (*treeOut)[treeSize-1];
    }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Sibling hashes, bottom-up, 32 bytes each.  Empty if there's no such tx
+// (or we're in headers-only mode and don't have the tx list)
+BinaryData BlockHeaderRef::getMerkleBranch(uint32_t txIndex)
+{
+   uint32_t numTx = getNumTx();
+   if(txIndex >= numTx)
+      return BinaryData(0);
+
+   CryptoPP::SHA256 sha256;
+   BinaryData scratch;
+   uint8_t branch[32*MERKLE_MAX_DEPTH];
+   copyTxHashesTo(scratch);
+   uint32_t depth = BtcUtils::calculateMerkleBranchInPlace(scratch.getPtr(), 
+                                                           numTx, 
+                                                           txIndex, 
+                                                           branch, 
+                                                           sha256);
+   return BinaryData(branch, 32*depth);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool BlockHeaderRef::verifyMerkleBranch(BinaryData const & txHash,
+                                        uint32_t txIndex,
+                                        BinaryData const & branch) const
+{
+   return BtcUtils::verifyMerkleBranch(txHash.getRef(), 
+                                       txIndex, 
+                                       branch.getRef(), 
+                                       getMerkleRootRef());
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 bool BlockHeaderRef::verifyMerkleRoot(void)
 {
@@ -189,9 +251,8 @@ bool BlockHeaderRef::verifyIntegrity(void)
    // Calculate the merkle root, and compare to the one already stored in header
    bool merkleIsGood = (calcMerkleRoot() == getMerkleRoot());
 
-   // Check that the last four bytes of the hash are zeros
-   BinaryData fourzerobytes = BtcUtils::EmptyHash_.getSliceCopy(0,4);
-   bool headerIsGood = (thisHash_.getSliceCopy(28,4) == fourzerobytes);
+   // Check the hash against the full target, not just for leading zeros
+   bool headerIsGood = BtcUtils::checkProofOfWork(getThisHashRef(), getDiffBitsRef());
    return (merkleIsGood && headerIsGood);
 }
 
@@ -446,6 +507,19 @@ void TxRef::unserialize(uint8_t const * ptr)
    isMainBranch_ = false;  // only BDM::organizeChain() can set this
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// For when the hash was already computed, usually with a whole block's
+// worth of tx in BtcUtils::getHash256Batch
+void TxRef::unserialize(uint8_t const * ptr, BinaryDataRef txHash)
+{
+   nBytes_ = BtcUtils::TxCalcLength(ptr, &offsetsTxIn_, &offsetsTxOut_);
+   thisHash_.copyFrom(txHash);
+   self_.setRef(ptr, nBytes_);
+   headerPtr_ = NULL;
+   isInitialized_ = true;
+   isMainBranch_ = false;  // only BDM::organizeChain() can set this
+}
+
 /////////////////////////////////////////////////////////////////////////////
 void TxRef::unserialize(BinaryRefReader & brr)
 {
@@ -538,13 +612,24 @@ uint32_t TxRef::getBlockTxIndex(void)
    if(headerPtr_ == NULL)
       return UINT32_MAX;
 
-   vector<TxRef*> txlist = headerPtr_->getTxRefPtrList();
+   vector<TxRef*> const & txlist = headerPtr_->getTxRefPtrList();
    for(uint32_t i=0; i<txlist.size(); i++)
       if( txlist[i] == this )
          return i;
    return UINT32_MAX;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// With getBlockTxIndex and the header, this is all an SPV client needs to 
+// check that the tx is in the block
+BinaryData TxRef::getMerkleBranch(void)
+{
+   uint32_t txIndex = getBlockTxIndex();
+   if(txIndex == UINT32_MAX)
+      return BinaryData(0);
+   return headerPtr_->getMerkleBranch(txIndex);
+}
+
 void TxRef::pprint(ostream & os, int nIndent, bool pBigendian) 
 {
    string indent = "";
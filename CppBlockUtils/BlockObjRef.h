@@ -68,6 +68,8 @@ public:
    bool               isOrphan(void) const        { return isOrphan_;                  }
    double             getDifficulty(void) const   { return difficultyDbl_;             }
    double             getDifficultySum(void) const{ return difficultySum_;             }
+   UInt256 const &    getBlockWork(void) const    { return blockWork_;                 }
+   UInt256 const &    getChainWork(void) const    { return chainWork_;                 }
 
    BinaryDataRef getThisHashRef(void) const   { return thisHash_.getRef();            }
    BinaryDataRef getPrevHashRef(void) const   { return BinaryDataRef(getPtr()+4, 32); }
@@ -87,6 +89,10 @@ public:
    vector<TxRef*> &   getTxRefPtrList(void) {return txPtrList_;}
    vector<BinaryData> getTxHashList(void);
    BinaryData         calcMerkleRoot(vector<BinaryData>* treeOut=NULL);
+   BinaryData         getMerkleBranch(uint32_t txIndex);
+   bool               verifyMerkleBranch(BinaryData const & txHash,
+                                         uint32_t txIndex,
+                                         BinaryData const & branch) const;
    bool               verifyMerkleRoot(void);
    bool               verifyIntegrity(void);
 
@@ -110,6 +116,9 @@ public:
    void unserialize(BinaryRefReader & brr);
 
 
+private:
+   void           copyTxHashesTo(BinaryData & flatHashes, uint32_t extraBytes=0);
+
 private:
    BinaryDataRef  self_;
    bool isInitialized_;
@@ -124,6 +133,8 @@ private:
    uint32_t       blockHeight_;
    uint64_t       blkByteLoc_;
    double         difficultySum_;
+   UInt256        blockWork_;    // from nBits, set on unserialize
+   UInt256        chainWork_;    // zero until the BDM links it to genesis
    bool           isMainBranch_;
    bool           isOrphan_;
    bool           isFinishedCalc_;
@@ -369,6 +380,7 @@ public:
    void unserialize(BinaryData const & str) { unserialize(str.getPtr()); }
    void unserialize(BinaryDataRef const & str) { unserialize(str.getPtr()); }
    void unserialize(BinaryRefReader & brr);
+   void unserialize(uint8_t const * ptr, BinaryDataRef txHash);
 
    // We actually can't get the sum of inputs without going and finding the 
    // referenced TxOuts -- need BDM to help with this
@@ -388,6 +400,7 @@ public:
    uint32_t  getBlockTimestamp(void);
    uint32_t  getBlockHeight(void);
    uint32_t  getBlockTxIndex(void);
+   BinaryData getMerkleBranch(void);
 
    /////////////////////////////////////////////////////////////////////////////
    void pprint(ostream & os=cout, int nIndent=0, bool pBigendian=true);
@@ -9,6 +9,9 @@
 #include <algorithm>
 #include <time.h>
 #include <stdio.h>
+#ifndef _MSC_VER
+   #include <unistd.h>
+#endif
 #include "BlockUtils.h"
 
 
@@ -245,6 +248,93 @@ void TxIOPair::clearZCFields(void)
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+// Snapshot data comes off the disk, so check that the stream actually has
+// room for the number of items it claims, before we start reading them
+static bool readScanStateCount(BinaryRefReader & brr, 
+                               uint32_t minBytesEach,
+                               uint32_t & countOut)
+{
+   if(brr.getSizeRemaining() < 1)
+      return false;
+
+   uint8_t firstByte = *(brr.getCurrPtr());
+   uint32_t viSize = (firstByte < 0xfd ? 1 : (firstByte == 0xfd ? 3 : 
+                     (firstByte == 0xfe ? 5 : 9)));
+   if(brr.getSizeRemaining() < viSize)
+      return false;
+
+   uint64_t count = brr.get_var_int();
+   if(count > brr.getSizeRemaining() / minBytesEach)
+      return false;
+
+   countOut = (uint32_t)count;
+   return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Flags:  0x01 has TxOut,  0x02 has TxIn,  0x04 sent-to-self
+void TxIOPair::serialize(BinaryWriter & bw) const
+{
+   uint8_t flags = (hasTxOut()    ? 0x01 : 0x00) |
+                   (hasTxIn()     ? 0x02 : 0x00) |
+                   (isSentToSelf_ ? 0x04 : 0x00);
+   bw.put_uint64_t(amount_);
+   bw.put_uint8_t(flags);
+   if(hasTxOut())
+   {
+      bw.put_BinaryData(txPtrOfOutput_->getThisHash());
+      bw.put_uint32_t(indexOfOutput_);
+   }
+   if(hasTxIn())
+   {
+      bw.put_BinaryData(txPtrOfInput_->getThisHash());
+      bw.put_uint32_t(indexOfInput_);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool TxIOPair::unserialize(BinaryRefReader & brr, 
+                           BlockDataManager_FullRAM & bdm)
+{
+   if(brr.getSizeRemaining() < 9)
+      return false;
+
+   amount_ = brr.get_uint64_t();
+   uint8_t flags = brr.get_uint8_t();
+
+   clearZCFields();
+   isSentToSelf_  = (flags & 0x04) > 0;
+   txPtrOfOutput_ = NULL;
+   indexOfOutput_ = 0;
+   txPtrOfInput_  = NULL;
+   indexOfInput_  = 0;
+
+   BinaryData txHash(32);
+   if(flags & 0x01)
+   {
+      if(brr.getSizeRemaining() < 36)
+         return false;
+      brr.get_BinaryData(txHash, 32);
+      indexOfOutput_ = brr.get_uint32_t();
+      txPtrOfOutput_ = bdm.getTxByHash(txHash);
+      if(txPtrOfOutput_ == NULL || !txPtrOfOutput_->isMainBranch())
+         return false;
+   }
+   if(flags & 0x02)
+   {
+      if(brr.getSizeRemaining() < 36)
+         return false;
+      brr.get_BinaryData(txHash, 32);
+      indexOfInput_ = brr.get_uint32_t();
+      txPtrOfInput_ = bdm.getTxByHash(txHash);
+      if(txPtrOfInput_ == NULL || !txPtrOfInput_->isMainBranch())
+         return false;
+   }
+   return true;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -293,6 +383,46 @@ void LedgerEntry::pprintOneLine(void)
                            getBlockNum());
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Flags:  0x01 isValid,  0x02 sent-to-self,  0x04 change-back
+void LedgerEntry::serialize(BinaryWriter & bw) const
+{
+   uint8_t flags = (isValid_      ? 0x01 : 0x00) |
+                   (isSentToSelf_ ? 0x02 : 0x00) |
+                   (isChangeBack_ ? 0x04 : 0x00);
+   bw.put_var_int(addr20_.getSize());
+   bw.put_BinaryData(addr20_);
+   bw.put_uint64_t((uint64_t)value_);
+   bw.put_uint32_t(blockNum_);
+   bw.put_BinaryData(txHash_);
+   bw.put_uint32_t(index_);
+   bw.put_uint64_t(txTime_);
+   bw.put_uint8_t(flags);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool LedgerEntry::unserialize(BinaryRefReader & brr)
+{
+   uint32_t addrLen;
+   if(!readScanStateCount(brr, 1, addrLen))
+      return false;
+   if(brr.getSizeRemaining() < addrLen + 57)
+      return false;
+
+   brr.get_BinaryData(addr20_, addrLen);
+   value_    = (int64_t)brr.get_uint64_t();
+   blockNum_ = brr.get_uint32_t();
+   brr.get_BinaryData(txHash_, 32);
+   index_    = brr.get_uint32_t();
+   txTime_   = brr.get_uint64_t();
+
+   uint8_t flags = brr.get_uint8_t();
+   isValid_      = (flags & 0x01) > 0;
+   isSentToSelf_ = (flags & 0x02) > 0;
+   isChangeBack_ = (flags & 0x04) > 0;
+   return true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -488,6 +618,14 @@ void BtcAddress::pprintLedger(void)
 // BtcWallet Methods
 //
 ////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+// The BDM retracts evicted zero-conf tx from every wallet it has scanned
+// the pool for, so it can't be left holding a pointer to this one
+BtcWallet::~BtcWallet(void)
+{
+   BlockDataManager_FullRAM::forgetWallet(this);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 void BtcWallet::addAddress(BinaryData    addr, 
                            uint32_t      firstTimestamp,
@@ -579,36 +717,32 @@ void BtcWallet::scanTx(TxRef & tx,
    for(uint32_t iin=0; iin<tx.getNumTxIn(); iin++)
    {
       // We have the txin, now check if it contains one of our TxOuts
-      static OutPoint op;
-      op.unserialize(txStartPtr + tx.getTxInOffset(iin));
-      if(txioMap_.find(op) != txioMap_.end())
+      scanOutPoint_.unserialize(txStartPtr + tx.getTxInOffset(iin));
+      if(txioMap_.find(scanOutPoint_) != txioMap_.end())
          anyTxInIsOurs = true;
    }
 
    // TxOuts are a little more complicated, because we have to process each
    // different type separately.  Nonetheless, 99% of transactions use the
-   // 25-byte repr which is ridiculously fast
+   // 25-byte repr which is ridiculously fast.  The 67-byte (pay-to-pubkey,
+   // mostly coinbase) scripts need a hash160 each:  collect them and hash
+   // them in one batch after the loop
+   scanPubKeyPtrs_.resize(0);
    for(uint32_t iout=0; iout<tx.getNumTxOut(); iout++)
    {
-      static uint8_t scriptLenFirstByte;
-      static BinaryData addr20(20);
-
       uint8_t const * ptr = (txStartPtr + tx.getTxOutOffset(iout) + 8);
-      scriptLenFirstByte = *(uint8_t*)ptr;
+      uint8_t scriptLenFirstByte = *(uint8_t*)ptr;
       if(scriptLenFirstByte == 25)
       {
          // Std TxOut with 25-byte script
-         addr20.copyFrom(ptr+4, 20);
-         if( hasAddr(addr20) )
+         scanAddr20_.copyFrom(ptr+4, 20);
+         if( hasAddr(scanAddr20_) )
             anyTxOutIsOurs = true;
       }
       else if(scriptLenFirstByte==67)
       {
          // Std spend-coinbase TxOut script
-         static BinaryData addr20(20);
-         BtcUtils::getHash160_NoSafetyCheck(ptr+2, 65, addr20);
-         if( hasAddr(addr20) )
-            anyTxOutIsOurs = true;
+         scanPubKeyPtrs_.push_back(ptr+2);
       }
       else
       {
@@ -616,7 +750,6 @@ void BtcWallet::scanTx(TxRef & tx,
          for(uint32_t i=0; i<addrPtrVect_.size(); i++)
          {
             BtcAddress & thisAddr = *(addrPtrVect_[i]);
-            BinaryData const & addr20 = thisAddr.getAddrStr20();
             if(txout.getScriptRef().find(thisAddr.getAddrStr20()) > -1)
                scanNonStdTx(blknum, txIndex, tx, iout, thisAddr);
             continue;
@@ -625,6 +758,20 @@ void BtcWallet::scanTx(TxRef & tx,
       }
    }
 
+   uint32_t numPubKeys = scanPubKeyPtrs_.size();
+   if(numPubKeys > 0 && !anyTxOutIsOurs)
+   {
+      scanPubKeyLens_.assign(numPubKeys, 65);
+      scanPubKeyHashes_.resize(20*numPubKeys);
+      BtcUtils::getHash160Batch(&scanPubKeyPtrs_[0], &scanPubKeyLens_[0], 
+                                numPubKeys, scanPubKeyHashes_.getPtr());
+      for(uint32_t i=0; i<numPubKeys && !anyTxOutIsOurs; i++)
+      {
+         scanAddr20_.copyFrom(scanPubKeyHashes_.getPtr() + 20*i, 20);
+         anyTxOutIsOurs = hasAddr(scanAddr20_);
+      }
+   }
+
    if( !anyTxOutIsOurs && !anyTxInIsOurs)
       return;
    ////////////////////////////////////////////////////////////////////////////
@@ -661,6 +808,10 @@ void BtcWallet::scanTx(TxRef & tx,
             if(txio.hasTxIn() || (isZeroConf && txio.hasTxInZC()))
                continue;
 
+            // Kept for its zero-conf spend, TxOut not scanned yet
+            if(!txio.hasTxOut() && !txio.hasTxOutZC())
+               continue;
+
             TxOutRef const  & txout = txio.getTxOutRef();
             //if(!txio.hasTxIn() && txout.getRecipientAddr()==thisAddr.getAddrStr20())
             if(txout.getRecipientAddr()==thisAddr.getAddrStr20()  && 
@@ -675,6 +826,13 @@ void BtcWallet::scanTx(TxRef & tx,
                if(!legit)
                   continue;
 
+               WalletBlockUndo & undo = (isZeroConf ? 
+                                         zcUndoMap_[tx.getThisHash()] :
+                                         blockUndoMap_[blknum]);
+               undo.blockNum_ = blknum;
+               undo.txInsSpent_.push_back(outpt);
+               undo.addrList_.push_back(&thisAddr);
+
                int64_t thisVal = (int64_t)txout.getValue();
                LedgerEntry newEntry(addr20, 
                                    -(int64_t)thisVal,
@@ -730,21 +888,45 @@ void BtcWallet::scanTx(TxRef & tx,
             insResult = txioMap_.insert(toBeInserted);
             TxIOPair & thisTxio = insResult.first->second;
 
-            // Maybe insert failed because a zero-conf is already there
+            // Maybe insert failed because a zero-conf is already there, or
+            // undoZeroConfTx kept it (no TxOut at all) for a pooled spender
             bool insertSucceeded = insResult.second;
             bool prevZC =  thisTxio.hasTxOutZC() && 
                           !thisTxio.hasTxOut();
-            if(insertSucceeded || prevZC) 
+            bool noTxOut = !thisTxio.hasTxOutZC() && 
+                           !thisTxio.hasTxOut();
+            if(insertSucceeded || prevZC || noTxOut) 
             {
-               // If insert failed, there's already a TxIO needing update
+               // If insert failed, there's already a TxIO needing update.
+               // If it's now in a block, it belongs in the confirmed list
+               // too -- it only comes off the ZC list when the ZC tx leaves
+               // the pool
                if(prevZC)
+               {
                   thisTxio.setTxOutRef(&tx, iout, isZeroConf);
+                  if(!isZeroConf)
+                     thisAddr.addTxIO( thisTxio, false);
+               }
                else
+               {
+                  if(noTxOut)
+                  {
+                     thisTxio.setTxOutRef(&tx, iout, isZeroConf);
+                     thisTxio.setSentToSelf(anyTxInIsOurs);
+                  }
                   thisAddr.addTxIO( thisTxio, isZeroConf);
+               }
 
                anyNewTxOutIsOurs = true;
                thisTxOutIsOurs[iout] = true;
 
+               WalletBlockUndo & undo = (isZeroConf ? 
+                                         zcUndoMap_[tx.getThisHash()] :
+                                         blockUndoMap_[blknum]);
+               undo.blockNum_ = blknum;
+               undo.txOutsCreated_.push_back(outpt);
+               undo.addrList_.push_back(&thisAddr);
+
 
                int64_t thisVal = (int64_t)(txout.getValue());
                LedgerEntry newLedger(addr20, 
@@ -804,9 +986,17 @@ void BtcWallet::scanTx(TxRef & tx,
                       isChangeBack);
 
       if(isZeroConf)
+      {
          ledgerAllAddrZC_.push_back(le);
+         zcUndoMap_[tx.getThisHash()].txList_.push_back(&tx);
+      }
       else
+      {
          ledgerAllAddr_.push_back(le);
+         WalletBlockUndo & undo = blockUndoMap_[blknum];
+         undo.blockNum_ = blknum;
+         undo.txList_.push_back(&tx);
+      }
 
    }
 }
@@ -1113,6 +1303,536 @@ void BtcWallet::sortLedger(void)
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+static bool compareLedgerBlkNum(LedgerEntry const & le1, LedgerEntry const & le2)
+{
+   return le1.getBlockNum() < le2.getBlockNum();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Ledgers are sorted by block number, so everything above the branch point 
+// is at the tail.  We only touch that tail, never the rest of the ledger.
+static void undoLedgerAbove(vector<LedgerEntry> & ledger,
+                            uint32_t branchHeight,
+                            set<HashString> const & txNowInvalid)
+{
+   LedgerEntry branchLE(BinaryData(0), 0, branchHeight, BinaryData(0), 0);
+   vector<LedgerEntry>::iterator tailStart = upper_bound(ledger.begin(), 
+                                                         ledger.end(), 
+                                                         branchLE,
+                                                         compareLedgerBlkNum);
+   vector<LedgerEntry>::iterator iter;
+   vector<LedgerEntry>::iterator keepIter = tailStart;
+   for(iter = tailStart; iter != ledger.end(); iter++)
+   {
+      // Entries invalidated by previous reorgs stay as they are
+      if(iter->isValid() && txNowInvalid.count(iter->getTxHash()) == 0)
+         continue;
+
+      if(iter->isValid())
+         iter->setValid(false);
+      *keepIter = *iter;
+      keepIter++;
+   }
+   ledger.erase(keepIter, ledger.end());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// After the new branch is scanned, the tail holds the entries invalidated by
+// the reorg followed by the ones just added, which may have lower block nums
+static void sortLedgerTail(vector<LedgerEntry> & ledger, uint32_t branchHeight)
+{
+   LedgerEntry branchLE(BinaryData(0), 0, branchHeight, BinaryData(0), 0);
+   vector<LedgerEntry>::iterator tailStart = upper_bound(ledger.begin(), 
+                                                         ledger.end(), 
+                                                         branchLE,
+                                                         compareLedgerBlkNum);
+   stable_sort(tailStart, ledger.end());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BtcWallet::sortLedgerAbove(uint32_t branchHeight)
+{
+   for(uint32_t i=0; i<addrPtrVect_.size(); i++)
+      sortLedgerTail(addrPtrVect_[i]->getTxLedger(), branchHeight);
+   sortLedgerTail(ledgerAllAddr_, branchHeight);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Walk the undo journal backwards from the newest block, so that spends are 
+// undone before the TxIOPairs they spent.  The caller should then re-scan
+// the new branch, starting at branchHeight+1
+uint32_t BtcWallet::undoBlocksAbove(uint32_t branchHeight)
+{
+   map<uint32_t, WalletBlockUndo>::iterator firstUndo;
+   firstUndo = blockUndoMap_.upper_bound(branchHeight);
+   if(firstUndo == blockUndoMap_.end())
+      return 0;
+
+   set<BtcAddress*>  addrAffected;
+   set<TxIOPair*>    txioRemoved;
+   set<HashString>   txNowInvalid;
+   list< map<OutPoint, TxIOPair>::iterator > txioRmList;
+
+   uint32_t nUndo = 0;
+   map<uint32_t, WalletBlockUndo>::reverse_iterator undoIter;
+   for(undoIter  = blockUndoMap_.rbegin();
+       undoIter != map<uint32_t, WalletBlockUndo>::reverse_iterator(firstUndo);
+       undoIter++)
+   {
+      WalletBlockUndo & undo = undoIter->second;
+      nUndo++;
+
+      map<OutPoint, TxIOPair>::iterator txioIter;
+      for(uint32_t i=0; i<undo.txInsSpent_.size(); i++)
+      {
+         txioIter = txioMap_.find(undo.txInsSpent_[i]);
+         if(txioIter != txioMap_.end())
+            txioIter->second.clearTxIn();
+      }
+
+      for(uint32_t i=0; i<undo.txOutsCreated_.size(); i++)
+      {
+         txioIter = txioMap_.find(undo.txOutsCreated_[i]);
+         if(txioIter != txioMap_.end() && 
+            txioRemoved.insert(&(txioIter->second)).second)
+            txioRmList.push_back(txioIter);
+      }
+
+      for(uint32_t i=0; i<undo.txList_.size(); i++)
+      {
+         TxRef * txptr = undo.txList_[i];
+         txrefSet_.erase(txptr);
+         if(!txptr->isMainBranch())
+            txNowInvalid.insert(txptr->getThisHash());
+      }
+
+      addrAffected.insert(undo.addrList_.begin(), undo.addrList_.end());
+   }
+
+   // Only the affected addresses need their TxIO lists & ledgers fixed
+   set<BtcAddress*>::iterator addrIter;
+   for(addrIter  = addrAffected.begin();
+       addrIter != addrAffected.end();
+       addrIter++)
+   {
+      BtcAddress & addr = **addrIter;
+      vector<TxIOPair*> & txioList = addr.getTxIOList();
+      uint32_t nKeep = 0;
+      for(uint32_t i=0; i<txioList.size(); i++)
+         if(txioRemoved.count(txioList[i]) == 0)
+            txioList[nKeep++] = txioList[i];
+      txioList.resize(nKeep);
+
+      undoLedgerAbove(addr.getTxLedger(), branchHeight, txNowInvalid);
+   }
+   undoLedgerAbove(ledgerAllAddr_, branchHeight, txNowInvalid);
+
+   // Don't erase until no more pointers to these TxIOPairs are in use
+   list< map<OutPoint, TxIOPair>::iterator >::iterator rmIter;
+   for(rmIter  = txioRmList.begin();
+       rmIter != txioRmList.end();
+       rmIter++)
+      txioMap_.erase(*rmIter);
+
+   blockUndoMap_.erase(firstUndo, blockUndoMap_.end());
+   return nUndo;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+static void removeLedgerEntriesForTx(vector<LedgerEntry> & ledger,
+                                     set<HashString> const & txHashes)
+{
+   uint32_t nKeep = 0;
+   for(uint32_t i=0; i<ledger.size(); i++)
+      if(txHashes.count(ledger[i].getTxHash()) == 0)
+         ledger[nKeep++] = ledger[i];
+   ledger.resize(nKeep);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Same idea as undoBlocksAbove, for tx that left the zero-conf pool.  The 
+// TxRef pointers in the records may already be gone from the pool, so we
+// only ever compare them, never dereference them.  All the hashes are done
+// in one pass so each ZC ledger is only filtered once, no matter how many
+// tx were evicted at once.
+uint32_t BtcWallet::undoZeroConfTx(set<HashString> const & txHashes)
+{
+   set<BtcAddress*>  addrAffected;
+   set<TxIOPair*>    txioNoLongerZC;
+   list< map<OutPoint, TxIOPair>::iterator > txioRmList;
+
+   // The spends go first, for all the tx at once:  after that, any TxInZC
+   // left on a TxIOPair belongs to a tx that is still in the pool
+   vector< map<HashString, WalletBlockUndo>::iterator > undoList;
+   map<OutPoint, TxIOPair>::iterator txioIter;
+   set<HashString>::const_iterator hashIter;
+   for(hashIter  = txHashes.begin();
+       hashIter != txHashes.end();
+       hashIter++)
+   {
+      map<HashString, WalletBlockUndo>::iterator undoIter;
+      undoIter = zcUndoMap_.find(*hashIter);
+      if(undoIter == zcUndoMap_.end())
+         continue;
+
+      undoList.push_back(undoIter);
+      WalletBlockUndo & undo = undoIter->second;
+      for(uint32_t i=0; i<undo.txInsSpent_.size(); i++)
+      {
+         txioIter = txioMap_.find(undo.txInsSpent_[i]);
+         if(txioIter != txioMap_.end())
+            txioIter->second.clearTxInZC();
+      }
+   }
+
+   uint32_t nUndo = undoList.size();
+   for(uint32_t u=0; u<nUndo; u++)
+   {
+      WalletBlockUndo & undo = undoList[u]->second;
+
+      // TxIOPairs that only exist because of this tx are removed.  If the
+      // tx made it into a block, the TxIOPair stays, minus its ZC fields.
+      // So does one a pooled tx still spends, even if the block with its 
+      // TxOut hasn't been scanned yet:  the scan fills in the TxOut, and
+      // the spend is never scanned again
+      for(uint32_t i=0; i<undo.txOutsCreated_.size(); i++)
+      {
+         txioIter = txioMap_.find(undo.txOutsCreated_[i]);
+         if(txioIter == txioMap_.end() || 
+            !txioNoLongerZC.insert(&(txioIter->second)).second)
+            continue;
+
+         if(txioIter->second.hasTxOut() || txioIter->second.hasTxInZC())
+            txioIter->second.clearTxOutZC();
+         else
+            txioRmList.push_back(txioIter);
+      }
+
+      for(uint32_t i=0; i<undo.txList_.size(); i++)
+         txrefSet_.erase(undo.txList_[i]);
+
+      addrAffected.insert(undo.addrList_.begin(), undo.addrList_.end());
+      zcUndoMap_.erase(undoList[u]);
+   }
+
+   if(nUndo == 0)
+      return 0;
+
+   set<BtcAddress*>::iterator addrIter;
+   for(addrIter  = addrAffected.begin();
+       addrIter != addrAffected.end();
+       addrIter++)
+   {
+      BtcAddress & addr = **addrIter;
+      vector<TxIOPair*> & txioList = addr.getTxIOListZC();
+      uint32_t nKeep = 0;
+      for(uint32_t i=0; i<txioList.size(); i++)
+         if(txioNoLongerZC.count(txioList[i]) == 0)
+            txioList[nKeep++] = txioList[i];
+      txioList.resize(nKeep);
+
+      removeLedgerEntriesForTx(addr.getZeroConfLedger(), txHashes);
+   }
+   removeLedgerEntriesForTx(ledgerAllAddrZC_, txHashes);
+
+   // Don't erase until no more pointers to these TxIOPairs are in use
+   list< map<OutPoint, TxIOPair>::iterator >::iterator rmIter;
+   for(rmIter  = txioRmList.begin();
+       rmIter != txioRmList.end();
+       rmIter++)
+      txioMap_.erase(*rmIter);
+
+   return nUndo;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BtcWallet::setZeroConfMarks(uint64_t scannedSeq, uint64_t evictSeen)
+{
+   zcSynced_     = true;
+   zcScannedSeq_ = scannedSeq;
+   zcEvictSeen_  = evictSeen;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Drop everything the blockchain scans put into this wallet, but keep the
+// address list itself
+void BtcWallet::clearScanState(void)
+{
+   clearZeroConfPool();
+   for(uint32_t i=0; i<addrPtrVect_.size(); i++)
+   {
+      addrPtrVect_[i]->getTxIOList().clear();
+      addrPtrVect_[i]->getTxLedger().clear();
+   }
+   txioMap_.clear();
+   ledgerAllAddr_.clear();
+   lockedTxOuts_.clear();
+   orphanTxIns_.clear();
+   txrefSet_.clear();
+   nonStdTxioMap_.clear();
+   nonStdUnspentOutPoints_.clear();
+   blockUndoMap_.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// TxIOPairs go first, because everything after them refers to TxIOs by the
+// OutPoint of their TxOut.  TxIOs that only exist because of a zero-conf tx
+// are skipped;  those get rebuilt by rescanWalletZeroConf after loading.
+void BtcWallet::serializeScanState(BinaryWriter & bw)
+{
+   map<OutPoint, TxIOPair>::iterator txioIter;
+   uint32_t nTxio = 0;
+   for(txioIter  = txioMap_.begin();
+       txioIter != txioMap_.end();
+       txioIter++)
+      if(txioIter->second.hasTxOut())
+         nTxio++;
+   bw.put_var_int(nTxio);
+   for(txioIter  = txioMap_.begin();
+       txioIter != txioMap_.end();
+       txioIter++)
+      if(txioIter->second.hasTxOut())
+         txioIter->second.serialize(bw);
+
+   bw.put_var_int(nonStdTxioMap_.size());
+   for(txioIter  = nonStdTxioMap_.begin();
+       txioIter != nonStdTxioMap_.end();
+       txioIter++)
+      txioIter->second.serialize(bw);
+
+   set<OutPoint>::iterator opIter;
+   bw.put_var_int(nonStdUnspentOutPoints_.size());
+   for(opIter  = nonStdUnspentOutPoints_.begin();
+       opIter != nonStdUnspentOutPoints_.end();
+       opIter++)
+      OutPoint(*opIter).serialize(bw);
+
+   // Addresses:  metadata, ledger, and OutPoints of its TxIOs
+   bw.put_var_int(addrPtrVect_.size());
+   for(uint32_t i=0; i<addrPtrVect_.size(); i++)
+   {
+      BtcAddress & addr = *(addrPtrVect_[i]);
+      bw.put_BinaryData(addr.getAddrStr20());
+      bw.put_uint32_t(addr.getFirstBlockNum());
+      bw.put_uint32_t(addr.getFirstTimestamp());
+      bw.put_uint32_t(addr.getLastBlockNum());
+      bw.put_uint32_t(addr.getLastTimestamp());
+
+      vector<LedgerEntry> & ledger = addr.getTxLedger();
+      bw.put_var_int(ledger.size());
+      for(uint32_t j=0; j<ledger.size(); j++)
+         ledger[j].serialize(bw);
+
+      vector<TxIOPair*> & txioList = addr.getTxIOList();
+      uint32_t nAddrTxio = 0;
+      for(uint32_t j=0; j<txioList.size(); j++)
+         if(txioList[j]->hasTxOut())
+            nAddrTxio++;
+      bw.put_var_int(nAddrTxio);
+      for(uint32_t j=0; j<txioList.size(); j++)
+         if(txioList[j]->hasTxOut())
+            txioList[j]->getOutPoint().serialize(bw);
+   }
+
+   bw.put_var_int(ledgerAllAddr_.size());
+   for(uint32_t i=0; i<ledgerAllAddr_.size(); i++)
+      ledgerAllAddr_[i].serialize(bw);
+
+   // txrefSet_ also collects zero-conf tx, which we don't want here
+   set<TxRef*>::iterator txIter;
+   uint32_t nTx = 0;
+   for(txIter = txrefSet_.begin(); txIter != txrefSet_.end(); txIter++)
+      if((*txIter)->isMainBranch())
+         nTx++;
+   bw.put_var_int(nTx);
+   for(txIter = txrefSet_.begin(); txIter != txrefSet_.end(); txIter++)
+      if((*txIter)->isMainBranch())
+         bw.put_BinaryData((*txIter)->getThisHash());
+
+   // Undo journal, so we can still handle a reorg below the snapshot tip
+   map<uint32_t, WalletBlockUndo>::iterator undoIter;
+   bw.put_var_int(blockUndoMap_.size());
+   for(undoIter  = blockUndoMap_.begin();
+       undoIter != blockUndoMap_.end();
+       undoIter++)
+   {
+      WalletBlockUndo & undo = undoIter->second;
+      bw.put_uint32_t(undoIter->first);
+
+      bw.put_var_int(undo.txList_.size());
+      for(uint32_t i=0; i<undo.txList_.size(); i++)
+         bw.put_BinaryData(undo.txList_[i]->getThisHash());
+
+      bw.put_var_int(undo.addrList_.size());
+      for(uint32_t i=0; i<undo.addrList_.size(); i++)
+         bw.put_BinaryData(undo.addrList_[i]->getAddrStr20());
+
+      bw.put_var_int(undo.txOutsCreated_.size());
+      for(uint32_t i=0; i<undo.txOutsCreated_.size(); i++)
+         undo.txOutsCreated_[i].serialize(bw);
+
+      bw.put_var_int(undo.txInsSpent_.size());
+      for(uint32_t i=0; i<undo.txInsSpent_.size(); i++)
+         undo.txInsSpent_[i].serialize(bw);
+   }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// The snapshot must contain exactly the addresses in this wallet -- if any
+// were added since it was written, they need a full scan anyway.  Returns
+// false on any inconsistency, leaving a partially-loaded wallet:  the caller
+// should clearScanState() and rescan.
+bool BtcWallet::unserializeScanState(BinaryRefReader & brr, 
+                                     BlockDataManager_FullRAM & bdm)
+{
+   clearScanState();
+
+   uint32_t nItems;
+   OutPoint op;
+   BinaryData hash32(32);
+   BinaryData addr20(20);
+
+   if(!readScanStateCount(brr, 9, nItems))
+      return false;
+   for(uint32_t i=0; i<nItems; i++)
+   {
+      TxIOPair txio;
+      if(!txio.unserialize(brr, bdm) || !txio.hasTxOut())
+         return false;
+      txioMap_[txio.getOutPoint()] = txio;
+   }
+
+   if(!readScanStateCount(brr, 9, nItems))
+      return false;
+   for(uint32_t i=0; i<nItems; i++)
+   {
+      TxIOPair txio;
+      if(!txio.unserialize(brr, bdm) || !txio.hasTxOut())
+         return false;
+      nonStdTxioMap_[txio.getOutPoint()] = txio;
+   }
+
+   if(!readScanStateCount(brr, 36, nItems))
+      return false;
+   for(uint32_t i=0; i<nItems; i++)
+   {
+      op.unserialize(brr);
+      nonStdUnspentOutPoints_.insert(op);
+   }
+
+   if(!readScanStateCount(brr, 36, nItems) || nItems != addrMap_.size())
+      return false;
+   for(uint32_t i=0; i<nItems; i++)
+   {
+      if(brr.getSizeRemaining() < 36)
+         return false;
+      brr.get_BinaryData(addr20, 20);
+      map<BinaryData, BtcAddress>::iterator addrIter = addrMap_.find(addr20);
+      if(addrIter == addrMap_.end())
+         return false;
+
+      BtcAddress & addr = addrIter->second;
+      addr.setFirstBlockNum( brr.get_uint32_t());
+      addr.setFirstTimestamp(brr.get_uint32_t());
+      addr.setLastBlockNum(  brr.get_uint32_t());
+      addr.setLastTimestamp( brr.get_uint32_t());
+
+      uint32_t nLedger;
+      if(!readScanStateCount(brr, 58, nLedger))
+         return false;
+      vector<LedgerEntry> & ledger = addr.getTxLedger();
+      ledger.resize(nLedger);
+      for(uint32_t j=0; j<nLedger; j++)
+         if(!ledger[j].unserialize(brr))
+            return false;
+
+      uint32_t nAddrTxio;
+      if(!readScanStateCount(brr, 36, nAddrTxio))
+         return false;
+      vector<TxIOPair*> & txioList = addr.getTxIOList();
+      for(uint32_t j=0; j<nAddrTxio; j++)
+      {
+         op.unserialize(brr);
+         map<OutPoint, TxIOPair>::iterator txioIter = txioMap_.find(op);
+         if(txioIter == txioMap_.end())
+            return false;
+         txioList.push_back(&(txioIter->second));
+      }
+   }
+
+   if(!readScanStateCount(brr, 58, nItems))
+      return false;
+   ledgerAllAddr_.resize(nItems);
+   for(uint32_t i=0; i<nItems; i++)
+      if(!ledgerAllAddr_[i].unserialize(brr))
+         return false;
+
+   if(!readScanStateCount(brr, 32, nItems))
+      return false;
+   for(uint32_t i=0; i<nItems; i++)
+   {
+      brr.get_BinaryData(hash32, 32);
+      TxRef* txptr = bdm.getTxByHash(hash32);
+      if(txptr == NULL)
+         return false;
+      txrefSet_.insert(txptr);
+   }
+
+   uint32_t nUndo;
+   if(!readScanStateCount(brr, 8, nUndo))
+      return false;
+   for(uint32_t b=0; b<nUndo; b++)
+   {
+      if(brr.getSizeRemaining() < 4)
+         return false;
+      uint32_t blkNum = brr.get_uint32_t();
+      WalletBlockUndo & undo = blockUndoMap_[blkNum];
+      undo.blockNum_ = blkNum;
+
+      if(!readScanStateCount(brr, 32, nItems))
+         return false;
+      for(uint32_t i=0; i<nItems; i++)
+      {
+         brr.get_BinaryData(hash32, 32);
+         TxRef* txptr = bdm.getTxByHash(hash32);
+         if(txptr == NULL)
+            return false;
+         undo.txList_.push_back(txptr);
+      }
+
+      if(!readScanStateCount(brr, 20, nItems))
+         return false;
+      for(uint32_t i=0; i<nItems; i++)
+      {
+         brr.get_BinaryData(addr20, 20);
+         map<BinaryData, BtcAddress>::iterator addrIter = addrMap_.find(addr20);
+         if(addrIter == addrMap_.end())
+            return false;
+         undo.addrList_.push_back(&(addrIter->second));
+      }
+
+      if(!readScanStateCount(brr, 36, nItems))
+         return false;
+      undo.txOutsCreated_.resize(nItems);
+      for(uint32_t i=0; i<nItems; i++)
+         undo.txOutsCreated_[i].unserialize(brr);
+
+      if(!readScanStateCount(brr, 36, nItems))
+         return false;
+      undo.txInsSpent_.resize(nItems);
+      for(uint32_t i=0; i<nItems; i++)
+         undo.txInsSpent_[i].unserialize(brr);
+   }
+
+   return true;
+}
+
+
+
 bool BtcWallet::isOutPointMine(BinaryData const & hsh, uint32_t idx)
 {
    OutPoint op(hsh, idx);
@@ -1154,17 +1874,46 @@ BlockDataManager_FullRAM::BlockDataManager_FullRAM(void) :
    headerHashMap_.clear();
    txHashMap_.clear();
 
-   zeroConfTxList_.clear();
+   bdmMode_ = BDM_MODE_FULL_BLOCKCHAIN;
+   headerArena_.resize(0);
+   headerArenaEnd_ = 0;
+   numBadMerkleBlocks_ = 0;
+   firstBadBlockHeight_ = -1;
+   scriptCheckEnabled_ = false;
+   scriptCheckThreads_ = 0;
+
+   zcArena_.resize(0);
+   zcArenaEnd_  = 0;
+   zcPoolBytes_ = 0;
    zeroConfMap_.clear();
+   zcSpentOutPoints_.clear();
+   zeroConfSeqMap_.clear();
+   zcNextSeq_ = 1;
+   zcEvictLog_.clear();
+   zcEvictLogStart_ = 0;
+   zcFeeRateIndex_.clear();
+   zcPoolMaxBytes_  = ZC_POOL_DEFAULT_MAX_BYTES;
+   zcPoolMaxAgeSec_ = ZC_POOL_DEFAULT_MAX_AGE_SEC;
+   resetZeroConfPoolStats();
    zcEnabled_ = false;
    zcFilename_ = string("");
+   zcJournalQueue_.resize(0);
+   zcJournalLiveBytes_ = 0;
+   zcJournalDeadBytes_ = 0;
+   zcCompactRunning_   = false;
+   zcCompactDone_      = false;
+   pthread_mutex_init(&zcCompactLock_, NULL);
 
    headersByHeight_.clear();
    txFileRefs_.clear();
    headerFileRefs_.clear();
    blockchainFilenames_.clear();
    previouslyValidBlockHeaderPtrs_.clear();
-   orphanChainStartBlocks_.clear();
+   orphanPool_.clear();
+   orphanArrival_.clear();
+   orphansJustReconnected_.clear();
+   orphanPoolMaxBlocks_ = ORPHAN_POOL_DEFAULT_MAX_BLOCKS;
+   numOrphansEvicted_ = 0;
 }
 
 
@@ -1214,8 +1963,52 @@ void BlockDataManager_FullRAM::SelectNetwork(string netName)
 }
 
 /////////////////////////////////////////////////////////////////////////////
-// The only way to "create" a BDM is with this method, which creates it
-// if one doesn't exist yet, or returns a reference to the only one
+bool BlockDataManager_FullRAM::SelectMode(BDM_MODE mode)
+{
+   if(mode != BDM_MODE_FULL_BLOCKCHAIN && mode != BDM_MODE_NO_STORAGE)
+   {
+      cout << "***ERROR: Only full and headers-only modes are implemented" << endl;
+      cerr << "***ERROR: Only full and headers-only modes are implemented" << endl;
+      return false;
+   }
+
+   if(headerHashMap_.size() > 0)
+   {
+      cout << "***ERROR: Can't change the BDM mode after loading blocks" << endl;
+      cerr << "***ERROR: Can't change the BDM mode after loading blocks" << endl;
+      return false;
+   }
+
+   if(mode == BDM_MODE_NO_STORAGE && scriptCheckEnabled_)
+   {
+      cout << "***ERROR: Script validation needs the full blockchain" << endl;
+      cerr << "***ERROR: Script validation needs the full blockchain" << endl;
+      return false;
+   }
+
+   bdmMode_ = mode;
+   return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool BlockDataManager_FullRAM::setScriptValidation(bool enable, 
+                                                   uint32_t numThreads)
+{
+   if(enable && bdmMode_ == BDM_MODE_NO_STORAGE)
+   {
+      cout << "***ERROR: Script validation needs the full blockchain" << endl;
+      cerr << "***ERROR: Script validation needs the full blockchain" << endl;
+      return false;
+   }
+
+   scriptCheckEnabled_ = enable;
+   scriptCheckThreads_ = numThreads;
+   return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// The only way to "create" a BDM is with this method, which creates it
+// if one doesn't exist yet, or returns a reference to the only one
 // that will ever exist
 BlockDataManager_FullRAM & BlockDataManager_FullRAM::GetInstance(void) 
 {
@@ -1228,6 +2021,14 @@ BlockDataManager_FullRAM & BlockDataManager_FullRAM::GetInstance(void)
    return (*theOnlyBDM_);
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// Don't create the BDM just to tell it about a wallet it never saw
+void BlockDataManager_FullRAM::forgetWallet(BtcWallet* wlt)
+{
+   if(theOnlyBDM_ != NULL)
+      theOnlyBDM_->zcWallets_.erase(wlt);
+}
+
 
 /////////////////////////////////////////////////////////////////////////////
 void BlockDataManager_FullRAM::Reset(void)
@@ -1239,6 +2040,14 @@ void BlockDataManager_FullRAM::Reset(void)
    headerHashMap_.clear();
    txHashMap_.clear();
 
+   // The mode sticks, like the zero-conf pool limits do
+   BinaryData(0).swap(headerArena_);
+   headerArenaEnd_ = 0;
+   numBadMerkleBlocks_ = 0;
+   firstBadBlockHeight_ = -1;
+   lastScriptCheck_ = ScriptCheckResult();
+   sigCheckCache_.clear();
+
    // If we decided to store ALL addresses
    allAddrTxMap_.clear();
    isAllAddrLoaded_ = false;
@@ -1262,17 +2071,43 @@ void BlockDataManager_FullRAM::Reset(void)
 
    // Reset orphan chains
    previouslyValidBlockHeaderPtrs_.clear();
-   orphanChainStartBlocks_.clear();
+   orphanPool_.clear();
+   orphanArrival_.clear();
+   orphansJustReconnected_.clear();
+   numOrphansEvicted_ = 0;
    
    lastEOFByteLoc_ = 0;
    totalBlockchainBytes_ = 0;
 
    isInitialized_ = false;
 
+   // Don't pull the pool out from under the compaction thread
+   finishZeroConfCompaction(true);
+
    zcEnabled_ = false;
    zcFilename_ = "";
    zeroConfMap_.clear();
-   zeroConfTxList_.clear();
+   zcSpentOutPoints_.clear();
+   zcFeeRateIndex_.clear();
+   zcJournalQueue_.resize(0);
+   BinaryData(0).swap(zcArena_);
+   zcArenaEnd_  = 0;
+   zcPoolBytes_ = 0;
+   resetZeroConfPoolStats();
+
+   // Wallets can't catch up across a reset.  Keep the counters increasing,
+   // but move the log start past every wallet's mark, so they all rebuild.
+   // The ones we know about drop their pointers into the pool right away
+   set<BtcWallet*>::iterator wltIter;
+   for(wltIter  = zcWallets_.begin();
+       wltIter != zcWallets_.end();
+       wltIter++)
+      (*wltIter)->clearZeroConfPool();
+   zeroConfSeqMap_.clear();
+   zcEvictLogStart_ += zcEvictLog_.size() + 1;
+   zcEvictLog_.clear();
+   zcJournalLiveBytes_ = 0;
+   zcJournalDeadBytes_ = 0;
 }
 
 
@@ -1492,12 +2327,11 @@ void BlockDataManager_FullRAM::scanBlockchainForTx(BtcWallet & myWallet,
    //myWallet.pprintAlot();
    ////////////////////////////////////////////////////////////////////////////
    
-   // We should clean up any dangling TxIOs in the wallet then rescan
+   // Retract ZC tx that left the pool (e.g. because they were in the block
+   // we just scanned), and pick up new ones.  Only a reorg needs a full 
+   // zero-conf rebuild, which updateWalletAfterReorg does itself
    if(zcEnabled_)
-   {
-      myWallet.clearZeroConfPool();
       rescanWalletZeroConf(myWallet);
-   }
    PDEBUG("Done scanning blockchain for tx");
 
    ////////////////////////////////////////////////////////////////////////////
@@ -1737,6 +2571,19 @@ uint32_t BlockDataManager_FullRAM::readBlkFile_FromScratch(string filename,
    is.seekg(0, ios::beg);
    cout << blkfilePath_.c_str() << " is " << filesize/(float)(1024*1024) << " MB" << endl;
 
+   uint32_t nBlkRead = 0;
+   if(bdmMode_ == BDM_MODE_NO_STORAGE)
+   {
+      nBlkRead = readBlkFileHeadersOnly(is, filesize);
+      is.close();
+      totalBlockchainBytes_ = filesize;
+      lastEOFByteLoc_       = filesize;
+      if(doOrganize)
+         organizeChain();
+      isInitialized_ = true;
+      return nBlkRead;
+   }
+
    //////////////////////////////////////////////////////////////////////////
    TIMER_START("ReadBlockchainIntoRAM");
    blockchainData_ALL_.resize(filesize);
@@ -1751,7 +2598,6 @@ uint32_t BlockDataManager_FullRAM::readBlkFile_FromScratch(string filename,
 
    // Blockchain data is now in its permanent location in memory
    BinaryRefReader brr(blockchainData_ALL_);
-   uint32_t nBlkRead = 0;
    bool keepGoing = true;
 
    TIMER_START("ScanBlockchainInRAM");
@@ -1772,7 +2618,10 @@ uint32_t BlockDataManager_FullRAM::readBlkFile_FromScratch(string filename,
    // think of a use case where you would want only an unorganized blockchain
    // in memory (except for timing the two ops separately)
    if(doOrganize)
+   {
       organizeChain();
+      checkNewMainChainScripts(0);
+   }
 
    // Return the number of blocks read from blkfile (this includes invalids)
    isInitialized_ = true;
@@ -1820,57 +2669,23 @@ uint32_t BlockDataManager_FullRAM::readBlkFileUpdate(string filename)
    }
 
    
-   // Seek to the beginning of the new data and read it
-   // TODO:  Check why we need the -1 on lastEOFByteLoc_.  And if it is 
-   //        necessary, do we need it elsewhere, too?
-   BinaryData newBlockDataRaw(nBytesToRead);
+   // Read the new data straight into its permanent location, and add it
+   // all as one batch, so the chain is only organized once
+   blockchainData_NEW_.push_back(BinaryData(nBytesToRead));
+   BinaryData & newBlockDataRaw = blockchainData_NEW_.back();
    is.seekg(lastEOFByteLoc_, ios::beg);
    is.read((char*)newBlockDataRaw.getPtr(), nBytesToRead);
    is.close();
 
-   cout << newBlockDataRaw.getSliceCopy(0,4).toHexStr() << endl;
-    
-   // Use the specialized "addNewBlockData()" methods to add the data
-   // to the permanent memory pool and parse it into our header/tx maps
-   BinaryRefReader brr(newBlockDataRaw);
-   uint32_t nBlkRead = 0;
-   vector<bool> blockAddResults;
-   bool keepGoing = true;
-   while(keepGoing)
-   {
-      ////////////
-      // The reader should be at the start of magic bytes of the new block
-      uint32_t nextBlockSize = *(uint32_t*)(brr.getCurrPtr()+4);
-      BinaryDataRef nextRawBlockRef(brr.getCurrPtr(), nextBlockSize+8);
-      blockAddResults = addNewBlockDataRef( nextRawBlockRef );
-      brr.advance(nextBlockSize+8);
-      ////////////
-
-      bool blockAddSucceeded = blockAddResults[0];
-      bool blockIsNewTop     = blockAddResults[1];
-      bool blockchainReorg   = blockAddResults[2];
-
-      if(blockAddSucceeded)
-         nBlkRead++;
-      else
-      {
-         if(!blockIsNewTop)
-         {
-            cout << "Block data did not extend the main chain!" << endl;
-            // TODO:  add anything extra to do here (is there anything?)
-         }
-   
-         if(blockchainReorg)
-         {
-            cout << "This block forced a reorg!  (and we're going to do nothing else...)" << endl;
-            // TODO:  add anything extra to do here (is there anything?)
-         }
-      }
-      
-
-      if(brr.isEndOfStream() || brr.getSizeRemaining() < 8)
-         keepGoing = false;
-   }
+   BlockBatchResult batchResult = addNewBlockBatch(newBlockDataRaw, false);
+   if(bdmMode_ == BDM_MODE_NO_STORAGE)
+      blockchainData_NEW_.pop_back();
+   uint32_t nBlkRead = batchResult.getNumBlocksAdded();
+   if(batchResult.getNumOrphans() > 0)
+      cout << "Block data did not connect to the chain: " 
+           << batchResult.getNumOrphans() << " blocks" << endl;
+   if(batchResult.isReorg())
+      cout << "New block data forced a reorg!" << endl;
    TIMER_STOP("getBlockfileUpdates");
 
 
@@ -1886,70 +2701,36 @@ uint32_t BlockDataManager_FullRAM::readBlkFileUpdate(string filename)
 // BDM detects the reorg, but is wallet-agnostic so it can't update any wallets
 // You have to call this yourself after you check whether the last organizeChain
 // call indicated that a reorg happened
+//
+// The wallet keeps a journal of what each block added to it, so we only undo
+// the blocks above the branch point and then scan the new branch.  Neither
+// step depends on how much history the wallet has.
 void BlockDataManager_FullRAM::updateWalletAfterReorg(BtcWallet & wlt)
 {
-   // Fix the wallet's ledger
-   for(uint32_t i=0; i<wlt.getTxLedger().size(); i++)
+   if(reorgBranchPoint_ == NULL)
    {
-      HashString const & txHash = wlt.getTxLedger()[i].getTxHash();
-      if(txJustInvalidated_.count(txHash) > 0)
-         wlt.getTxLedger()[i].setValid(false);
-
-      if(txJustAffected_.count(txHash) > 0)
-         wlt.getTxLedger()[i].changeBlkNum(getTxByHash(txHash)->getBlockHeight());
+      cout << "***WARNING: updateWalletAfterReorg called, but no reorg" << endl;
+      return;
    }
 
+   uint32_t branchHeight = reorgBranchPoint_->getBlockHeight();
+   wlt.undoBlocksAbove(branchHeight);
 
-   // UPDATE JAN 2012:  I don't think this part is necessary anymore.
-   //                   The decision was made not to bother with maintaining
-   //                   an unspent list anymore, since it can be done on the 
-   //                   fly from the txioMap.  Mainly because it's extra work
-   //                   to maintain the synchronous list, it's easy to generate
-   //                   on the fly, and it doesn't actually help us distinguish
-   //                   "spendable" or "unconfirmed."
-   /*
-   // Need to fix the TxIO pairs, and recompute unspentTxOuts
-   // All addresses point to the wallet's TxIOPairs, so we only need 
-   // to do this check on the wallet -- no need on the individual addrs
-   map<OutPoint, TxIOPair>::iterator txioIter;
-   for(txioIter  = wlt.getTxIOMap().begin();
-       txioIter != wlt.getTxIOMap().end();
-       txioIter++)
+   uint32_t nHeaders = headersByHeight_.size();
+   for(uint32_t h=branchHeight+1; h<nHeaders; h++)
    {
-      pair<bool, bool> reassessValid = txioIter->second.reassessValidity();
-      bool txoutIsValid = reassessValid.first;
-      bool txinIsValid  = reassessValid.second;
-
-      if(txoutIsValid)
-      {
-         if(txinIsValid)
-            wlt.getUnspentOutPoints().erase(txioIter->first);
-         else
-            wlt.getUnspentOutPoints().insert(txioIter->first);
-      }
-      else
-      {
-         if(txinIsValid)
-            cout << "***ERROR: Invalid TxOut but valid TxIn!?" << endl;
-         else
-            wlt.getUnspentOutPoints().erase(txioIter->first);
-      }
+      BlockHeaderRef & bhr = *(headersByHeight_[h]);
+      vector<TxRef*> const & txlist = bhr.getTxRefPtrList();
+      for(uint32_t itx=0; itx<txlist.size(); itx++)
+         wlt.scanTx(*(txlist[itx]), itx, bhr.getTimestamp(), h);
    }
-   */
+   wlt.sortLedgerAbove(branchHeight);
 
-   // Now fix the individual address ledgers
-   for(uint32_t a=0; a<wlt.getNumAddr(); a++)
+   // TxIOPairs under the zero-conf tx may have just changed
+   if(zcEnabled_)
    {
-      BtcAddress & addr = wlt.getAddrByIndex(a);
-      for(uint32_t i=0; i<addr.getTxLedger().size(); i++)
-      {
-         HashString const & txHash = addr.getTxLedger()[i].getTxHash();
-         if(txJustInvalidated_.count(txHash) > 0)
-            addr.getTxLedger()[i].setValid(false);
-   
-         if(txJustAffected_.count(txHash) > 0) 
-            addr.getTxLedger()[i].changeBlkNum(getTxByHash(txHash)->getBlockHeight());
-      }
+      wlt.clearZeroConfPool();
+      rescanWalletZeroConf(wlt);
    }
 }
 
@@ -1960,33 +2741,444 @@ void BlockDataManager_FullRAM::updateWalletsAfterReorg(vector<BtcWallet*> wltvec
       updateWalletAfterReorg(*wltvect[i]);
 }
 
+
+/////////////////////////////////////////////////////////////////////////////
+// Snapshot layout:
+//
+//    MagicBytes_(4) | version(4) | tipHash(32) | tipHeight(4) |
+//    wallet scan state (variable) | first 4 bytes of hash256 of the above
+//
+// The wallet must be synced to the current top block when this is called,
+// since that is the tip we tag it with
+BinaryData BlockDataManager_FullRAM::getWalletScanState(BtcWallet & wlt)
+{
+   if(topBlockPtr_ == NULL)
+   {
+      cout << "***ERROR: No blockchain loaded, can't tag wallet state" << endl;
+      cerr << "***ERROR: No blockchain loaded, can't tag wallet state" << endl;
+      return BinaryData(0);
+   }
+
+   BinaryWriter bw;
+   bw.put_BinaryData(MagicBytes_);
+   bw.put_uint32_t(WALLET_SCAN_STATE_VERSION);
+   bw.put_BinaryData(topBlockPtr_->getThisHash());
+   bw.put_uint32_t(topBlockPtr_->getBlockHeight());
+   wlt.serializeScanState(bw);
+   
+   BinaryData snapshot = bw.getData();
+   snapshot.append(BtcUtils::getHash256(snapshot).getSliceCopy(0,4));
+   return snapshot;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// If the snapshot is good and its tip is still in the main chain, we only
+// scan the blocks after it.  Otherwise, fall back to the full rescan.  
+// Either way the wallet is fully synced when this returns.
+bool BlockDataManager_FullRAM::loadWalletScanState(BtcWallet & wlt, 
+                                                   BinaryData const & snapshot)
+{
+   PDEBUG("Loading wallet scan state");
+   string     errMsg("");
+   uint32_t   tipHeight = 0;
+   uint32_t   minSize   = 4 + 4 + 32 + 4 + 4;
+   uint32_t   bodySize  = (snapshot.getSize() < minSize ? 0 : 
+                                                      snapshot.getSize() - 4);
+   BinaryRefReader brr(snapshot.getPtr(), bodySize);
+
+   if(snapshot.getSize() < minSize)
+      errMsg = "is missing or truncated";
+   else if( !(BtcUtils::getHash256(snapshot.getPtr(), bodySize).getSliceCopy(0,4)
+                 == snapshot.getSliceCopy(bodySize, 4)) )
+      errMsg = "failed checksum";
+   else if( !(brr.get_BinaryDataRef(4) == MagicBytes_) )
+      errMsg = "is for a different network";
+   else if(brr.get_uint32_t() != WALLET_SCAN_STATE_VERSION)
+      errMsg = "is an unsupported version";
+
+   if(errMsg.size() == 0)
+   {
+      BinaryData tipHash(32);
+      brr.get_BinaryData(tipHash, 32);
+      tipHeight = brr.get_uint32_t();
+      BlockHeaderRef* tipPtr = getHeaderByHash(tipHash);
+      if(tipPtr == NULL                       || 
+         !tipPtr->isMainBranch()              ||
+         tipPtr->getBlockHeight() != tipHeight)
+         errMsg = "tip is no longer in the main chain";
+   }
+
+   if(errMsg.size() == 0 && !wlt.unserializeScanState(brr, *this))
+      errMsg = "does not match this wallet or blockchain";
+
+   if(errMsg.size() == 0 && !brr.isEndOfStream())
+      errMsg = "has extra data at the end";
+
+   if(errMsg.size() > 0)
+   {
+      cout << "***WARNING: Wallet scan state " << errMsg.c_str() 
+           << ", rescanning from block 0" << endl;
+      wlt.clearScanState();
+      scanBlockchainForTx(wlt);
+      return false;
+   }
+
+   // Only need the blocks we haven't seen yet (and the zero-conf pool)
+   scanBlockchainForTx(wlt, tipHeight+1);
+   PDEBUG("Done loading wallet scan state");
+   return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Write to a temp file and rename, so that a crash mid-write can't leave
+// a truncated snapshot in place of a good one
+bool BlockDataManager_FullRAM::writeWalletScanStateFile(BtcWallet & wlt, 
+                                                        string filename)
+{
+   BinaryData snapshot = getWalletScanState(wlt);
+   if(snapshot.getSize() == 0)
+      return false;
+
+   string tempname = filename + ".tmp";
+   ofstream os(tempname.c_str(), ios::out | ios::binary);
+   os.write((char const *)snapshot.getPtr(), snapshot.getSize());
+   os.close();
+   if(os.fail() || rename(tempname.c_str(), filename.c_str()) != 0)
+   {
+      cout << "***ERROR: Could not write wallet scan state: " 
+           << filename.c_str() << endl;
+      cerr << "***ERROR: Could not write wallet scan state: " 
+           << filename.c_str() << endl;
+      return false;
+   }
+   return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+bool BlockDataManager_FullRAM::readWalletScanStateFile(BtcWallet & wlt, 
+                                                       string filename)
+{
+   BinaryData snapshot(0);
+   ifstream is(filename.c_str(), ios::in | ios::binary);
+   if(is)
+   {
+      is.seekg(0, ios::end);
+      uint32_t filesize = (uint32_t)is.tellg();
+      is.seekg(0, ios::beg);
+      snapshot.resize(filesize);
+      is.read((char*)snapshot.getPtr(), filesize);
+      is.close();
+   }
+   return loadWalletScanState(wlt, snapshot);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Shared by the verifyBlkFileIntegrity threads.  Only nextIdx_ and badIdx_
+// change while they run, and only under the lock
+struct IntegrityCheckJob
+{
+   vector<BlockHeaderRef*> const * headers_;
+   bool                            checkMerkle_;
+   uint32_t                        nextIdx_;
+   vector<uint32_t>                badIdx_;
+   pthread_mutex_t                 lock_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Header hash, proof-of-work against the full target, and (if we have the 
+// tx) the merkle root, computed in scratch so nothing is allocated per block
+static bool checkHeaderIntegrity(BlockHeaderRef & bhr,
+                                 bool checkMerkle,
+                                 BinaryData & scratch,
+                                 CryptoPP::SHA256 & sha256)
+{
+   uint8_t hash[32];
+   sha256.CalculateDigest(hash, bhr.getPtr(), HEADER_SIZE);
+   sha256.CalculateDigest(hash, hash, 32);
+   if( !(bhr.getThisHashRef() == BinaryDataRef(hash,32)) )
+      return false;
+
+   if( !BtcUtils::checkProofOfWork(bhr.getThisHashRef(), bhr.getDiffBitsRef()) )
+      return false;
+
+   if(!checkMerkle)
+      return true;
+
+   vector<TxRef*> & txList = bhr.getTxRefPtrList();
+   uint32_t numTx = txList.size();
+   if(numTx == 0)
+      return false;
+
+   if(scratch.getSize() < 32*numTx)
+      scratch.resize(32*numTx);
+   for(uint32_t i=0; i<numTx; i++)
+      txList[i]->getThisHashRef().copyTo(scratch.getPtr() + 32*i, 32);
+
+   BtcUtils::calculateMerkleRootInPlace(scratch.getPtr(), numTx, sha256);
+   return (memcmp(scratch.getPtr(), bhr.getPtr()+36, 32) == 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static void* integrityCheckThread(void* jobPtr)
+{
+   IntegrityCheckJob & job = *(IntegrityCheckJob*)jobPtr;
+   vector<BlockHeaderRef*> const & headers = *job.headers_;
+   uint32_t numHeaders = headers.size();
+
+   CryptoPP::SHA256 sha256;
+   BinaryData scratch(32*1024);
+   vector<uint32_t> badIdx;
+   while(true)
+   {
+      pthread_mutex_lock(&job.lock_);
+      uint32_t chunkStart = job.nextIdx_;
+      job.nextIdx_ = min(numHeaders, chunkStart + VERIFY_BLOCKS_PER_CHUNK);
+      uint32_t chunkEnd = job.nextIdx_;
+      pthread_mutex_unlock(&job.lock_);
+
+      if(chunkStart >= chunkEnd)
+         break;
+
+      for(uint32_t i=chunkStart; i<chunkEnd; i++)
+         if( !checkHeaderIntegrity(*headers[i], job.checkMerkle_, scratch, sha256) )
+            badIdx.push_back(i);
+   }
+
+   pthread_mutex_lock(&job.lock_);
+   job.badIdx_.insert(job.badIdx_.end(), badIdx.begin(), badIdx.end());
+   pthread_mutex_unlock(&job.lock_);
+   return NULL;
+}
+
 /////////////////////////////////////////////////////////////////////////////
-bool BlockDataManager_FullRAM::verifyBlkFileIntegrity(void)
+bool BlockDataManager_FullRAM::verifyBlkFileIntegrity(uint32_t numThreads)
 {
    PDEBUG("Verifying blk0001.dat integrity");
-   bool isGood = true;
+   firstBadBlockHeight_ = -1;
+
+   if(numThreads == 0)
+   {
+#ifdef _SC_NPROCESSORS_ONLN
+      long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+      numThreads = (numCores > 0 ? (uint32_t)numCores : 1);
+#else
+      numThreads = 1;
+#endif
+   }
+
+   // Main chain first, in order, so the threads finish it roughly bottom-up
+   vector<BlockHeaderRef*> headers;
+   headers.reserve(headerHashMap_.size());
+   for(uint32_t h=0; h<headersByHeight_.size(); h++)
+      headers.push_back(headersByHeight_[h]);
+
    map<HashString, BlockHeaderRef>::iterator headIter;
    for(headIter  = headerHashMap_.begin();
        headIter != headerHashMap_.end();
        headIter++)
+      if( !headIter->second.isMainBranch() )
+         headers.push_back(&(headIter->second));
+
+   // In headers-only mode there's no tx data to check against, but the
+   // merkle roots were already checked on the way in
+   IntegrityCheckJob job;
+   job.headers_     = &headers;
+   job.checkMerkle_ = (bdmMode_ != BDM_MODE_NO_STORAGE);
+   job.nextIdx_     = 0;
+   pthread_mutex_init(&job.lock_, NULL);
+
+   uint32_t maxThreads = headers.size()/VERIFY_BLOCKS_PER_CHUNK + 1;
+   numThreads = min(numThreads, maxThreads);
+   vector<pthread_t> threads(numThreads-1);
+   uint32_t numStarted = 0;
+   for(uint32_t t=0; t<threads.size(); t++, numStarted++)
+      if(pthread_create(&threads[t], NULL, integrityCheckThread, &job) != 0)
+         break;
+
+   // This thread does its share too, and all of it if none could be started
+   integrityCheckThread(&job);
+   for(uint32_t t=0; t<numStarted; t++)
+      pthread_join(threads[t], NULL);
+   pthread_mutex_destroy(&job.lock_);
+
+   sort(job.badIdx_.begin(), job.badIdx_.end());
+   for(uint32_t i=0; i<job.badIdx_.size(); i++)
    {
-      BlockHeaderRef & bhr = headIter->second;
-      bool thisHeaderIsGood = bhr.verifyIntegrity();
-      if( !thisHeaderIsGood )
-      {
-         cout << "Blockfile contains incorrect header or tx data:" << endl;
-         cout << "  Block number:    " << bhr.getBlockHeight() << endl;
-         cout << "  Block hash (BE):   " << endl;
-         cout << "    " << bhr.getThisHash().copySwapEndian().toHexStr() << endl;
-         cout << "  Num Tx :         " << bhr.getNumTx() << endl;
-         cout << "  Tx Hash List: (compare to raw tx data on blockexplorer)" << endl;
-         for(uint32_t t=0; t<bhr.getNumTx(); t++)
-            cout << "    " << bhr.getTxRefPtrList()[t]->getThisHash().copySwapEndian().toHexStr() << endl;
-      }
-      isGood = isGood && thisHeaderIsGood;
+      BlockHeaderRef & bhr = *headers[job.badIdx_[i]];
+      cout << "Blockfile contains incorrect header or tx data:" << endl;
+      cout << "  Block number:    " << bhr.getBlockHeight() << endl;
+      cout << "  Block hash (BE):   " << endl;
+      cout << "    " << bhr.getThisHash().copySwapEndian().toHexStr() << endl;
+      cout << "  Num Tx :         " << bhr.getNumTx() << endl;
+      cout << "  Tx Hash List: (compare to raw tx data on blockexplorer)" << endl;
+      for(uint32_t t=0; t<bhr.getNumTx(); t++)
+         cout << "    " << bhr.getTxRefPtrList()[t]->getThisHash().copySwapEndian().toHexStr() << endl;
+
+      uint32_t hgt = bhr.getBlockHeight();
+      if(hgt != UINT32_MAX && 
+         (firstBadBlockHeight_ < 0 || hgt < (uint32_t)firstBadBlockHeight_))
+         firstBadBlockHeight_ = (int32_t)hgt;
    }
-   return isGood;
+
    PDEBUG("Done verifying blockfile integrity");
+   return (job.badIdx_.size() == 0 && numBadMerkleBlocks_ == 0);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+ScriptCheckResult BlockDataManager_FullRAM::checkBlockScripts(
+                                                      BlockHeaderRef & bhr,
+                                                      uint32_t numThreads)
+{
+   vector<BlockHeaderRef*> headers(1, &bhr);
+   return checkScripts(headers, numThreads);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+ScriptCheckResult BlockDataManager_FullRAM::checkMainChainScripts(
+                                                      uint32_t startHeight,
+                                                      uint32_t endHeight,
+                                                      uint32_t numThreads)
+{
+   vector<BlockHeaderRef*> headers;
+   for(uint32_t h=startHeight; h<=endHeight && h<headersByHeight_.size(); h++)
+      headers.push_back(headersByHeight_[h]);
+   return checkScripts(headers, numThreads);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// The messages are built as the TxIns are queued, so the batch holds no
+// pointers into the blocks.  Once enough signatures are waiting, they're
+// all verified and the results are tallied up against their tx and blocks.
+ScriptCheckResult BlockDataManager_FullRAM::checkScripts(
+                                       vector<BlockHeaderRef*> const & headers,
+                                       uint32_t numThreads)
+{
+   ScriptCheckResult result;
+   if(bdmMode_ == BDM_MODE_NO_STORAGE)
+   {
+      cout << "***ERROR: No tx data to check scripts in headers-only mode" << endl;
+      cerr << "***ERROR: No tx data to check scripts in headers-only mode" << endl;
+      return result;
+   }
+
+   PDEBUG("Checking block scripts");
+   ScriptCheckBatch batch;
+   batch.setSigCache(&sigCheckCache_);
+   vector<TxRef*>          queuedTx;   // one per queued TxIn
+   vector<BlockHeaderRef*> queuedBlk;
+   for(uint32_t b=0; b<=headers.size(); b++)
+   {
+      if(b<headers.size())
+      {
+         BlockHeaderRef & bhr = *headers[b];
+         bool evalP2SH = (bhr.getTimestamp() >= P2SH_ACTIVATION_TIME);
+         vector<TxRef*> & txList = bhr.getTxRefPtrList();
+         result.numBlocks_++;
+
+         // The coinbase has no scripts to check
+         for(uint32_t t=1; t<txList.size(); t++)
+         {
+            TxRef & tx = *txList[t];
+            for(uint32_t i=0; i<tx.getNumTxIn(); i++)
+            {
+               queuedTx.push_back(&tx);
+               queuedBlk.push_back(&bhr);
+
+               OutPointRef opr = tx.getTxInRef(i).getOutPointRef();
+               TxRef * prevTx = getTxByHash(opr.getTxHash());
+               if(prevTx == NULL || opr.getTxOutIndex() >= prevTx->getNumTxOut())
+               {
+                  batch.addTxInNoPrevOut();
+                  continue;
+               }
+               TxOutRef prevOut = prevTx->getTxOutRef(opr.getTxOutIndex());
+               batch.addTxIn(tx, i, prevOut.getScriptRef(), evalP2SH);
+            }
+         }
+
+         if(batch.getNumPendingSigChecks() < SCRIPT_CHECK_SIGS_PER_BATCH)
+            continue;
+      }
+
+      // Verify everything queued so far (and whatever's left at the end)
+      batch.verifyAll(numThreads);
+      result.numSigChecks_    += batch.getNumSigChecks();
+      result.numSigCacheHits_ += batch.getNumSigCacheHits();
+      BlockHeaderRef * lastBadBlk = NULL;
+      TxRef *          lastBadTx  = NULL;
+      for(uint32_t q=0; q<batch.getNumTxIn(); q++)
+      {
+         result.numTxIn_++;
+         switch(batch.getResult(q))
+         {
+            case TXIN_CHECK_VALID:        result.numValid_++;       break;
+            case TXIN_CHECK_NONSTANDARD:  result.numNonStandard_++; break;
+            case TXIN_CHECK_NO_PREVOUT:   result.numNoPrevOut_++;   break;
+            default:
+               // TxIns of one tx, and tx of one block, are queued together
+               result.numInvalid_++;
+               if(queuedTx[q] != lastBadTx)
+                  result.badTxHashes_.push_back(queuedTx[q]->getThisHash());
+               if(queuedBlk[q] != lastBadBlk)
+                  result.badBlockHashes_.push_back(queuedBlk[q]->getThisHash());
+               lastBadTx  = queuedTx[q];
+               lastBadBlk = queuedBlk[q];
+         }
+      }
+      batch.clear();
+      queuedTx.clear();
+      queuedBlk.clear();
+   }
+
+   for(uint32_t i=0; i<result.badBlockHashes_.size(); i++)
+   {
+      BlockHeaderRef * bhptr = getHeaderByHash(result.badBlockHashes_[i]);
+      cout << "***WARNING: Block has invalid tx signatures or scripts:" << endl;
+      cout << "  Block number:    " << bhptr->getBlockHeight() << endl;
+      cout << "  Block hash (BE):   " << endl;
+      cout << "    " << bhptr->getThisHash().copySwapEndian().toHexStr() << endl;
+   }
+
+   PDEBUG("Done checking block scripts");
+   return result;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void BlockDataManager_FullRAM::checkNewMainChainScripts(uint32_t fromHeight)
+{
+   if(!scriptCheckEnabled_ || fromHeight >= headersByHeight_.size())
+      return;
+
+   lastScriptCheck_ = checkMainChainScripts(fromHeight, UINT32_MAX, 
+                                            scriptCheckThreads_);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Only a definitely-invalid TxIn fails the tx:  we may not have seen the
+// parent yet, or it may use a script we don't evaluate.  P2SH is always
+// on for new tx.
+bool BlockDataManager_FullRAM::checkZeroConfScripts(TxRef & tx)
+{
+   ScriptCheckBatch batch;
+   batch.setSigCache(&sigCheckCache_, true);
+   for(uint32_t i=0; i<tx.getNumTxIn(); i++)
+   {
+      OutPointRef opr = tx.getTxInRef(i).getOutPointRef();
+      TxRef * prevTx = getTxByHash(opr.getTxHash());
+      if(prevTx == NULL || opr.getTxOutIndex() >= prevTx->getNumTxOut())
+      {
+         batch.addTxInNoPrevOut();
+         continue;
+      }
+      TxOutRef prevOut = prevTx->getTxOutRef(opr.getTxOutIndex());
+      batch.addTxIn(tx, i, prevOut.getScriptRef(), true);
+   }
+   batch.verifyAll(scriptCheckThreads_);
+   return (batch.countResults(TXIN_CHECK_INVALID) == 0);
 }
 
 
@@ -2008,6 +3200,15 @@ bool BlockDataManager_FullRAM::parseNewBlockData(BinaryRefReader & brr,
    if(brr.isEndOfStream() || brr.getSizeRemaining() < nBytes)
       return false;
 
+   if(bdmMode_ == BDM_MODE_NO_STORAGE)
+   {
+      uint8_t const * blkPtr = brr.getCurrPtr();
+      uint64_t blkByteLoc = currBlockchainSize;
+      brr.advance(nBytes);
+      currBlockchainSize += nBytes+8;
+      return parseNewBlockHeaderOnly(blkPtr, nBytes, blkByteLoc);
+   }
+
    // Create the objects once that will be used for insertion
    static pair<HashString, TxRef>                               txInputPair;
    static pair<HashString, BlockHeaderRef>                      bhInputPair;
@@ -2028,11 +3229,31 @@ bool BlockDataManager_FullRAM::parseNewBlockData(BinaryRefReader & brr,
    bhptr->blkByteLoc_    = currBlockchainSize;
    uint64_t txOffset = 8 + HEADER_SIZE + viSize; // usually 89
 
+   // Hash all the tx in one batch first:  the multi-buffer SHA-256 needs
+   // several independent messages at once to fill its lanes
+   vector<uint8_t const *> & txPtrs   = parseTxPtrs_;
+   vector<uint32_t> &        txLens   = parseTxLens_;
+   BinaryData &              txHashes = parseTxHashes_;
+   txPtrs.resize(nTx);
+   txLens.resize(nTx);
+   txHashes.resize(32*nTx);
+   uint8_t const * txPtr = brr.getCurrPtr();
+   for(uint32_t i=0; i<nTx; i++)
+   {
+      txPtrs[i] = txPtr;
+      txLens[i] = BtcUtils::TxCalcLength(txPtr);
+      txPtr += txLens[i];
+   }
+   if(nTx > 0)
+      BtcUtils::getHash256Batch(&txPtrs[0], &txLens[0], nTx, txHashes.getPtr());
+
    // Read each of the Tx
    bhptr->txPtrList_.clear();
    for(uint32_t i=0; i<nTx; i++)
    {
-      txInputPair.second.unserialize(brr);
+      txInputPair.second.unserialize(brr.getCurrPtr(), 
+                                     txHashes.getSliceRef(32*i, 32));
+      brr.advance(txLens[i]);
       txInputPair.first = txInputPair.second.getThisHash();
       txInsResult = txHashMap_.insert(txInputPair);
       TxRef * txptr = &(txInsResult.first->second);
@@ -2050,35 +3271,171 @@ bool BlockDataManager_FullRAM::parseNewBlockData(BinaryRefReader & brr,
    currBlockchainSize += nBytes+8;
    return true;
 }
-   
 
 
-////////////////////////////////////////////////////////////////////////////////
-// This method returns three booleans:
-//    (1)  Block data was added to memory pool successfully
-//    (2)  New block added is at the top of the chain
-//    (3)  Adding block data caused blockchain reorganization
-//
-// This method assumes the data is not in the permanent memory pool yet, and
-// we will need to copy it to its permanent memory location before parsing it.
-// Btw, yes I know I could've used a bitset here, but I was too lazy to add
-// the #include and look up the members for using it...
-vector<bool> BlockDataManager_FullRAM::addNewBlockData(BinaryData rawBlock,
-                                                       bool writeToBlk0001)
+/////////////////////////////////////////////////////////////////////////////
+// Headers-only version of parseNewBlockData:  check the merkle root against
+// the tx data (we won't have another chance), then keep only the header.
+// Returns false if the block is malformed or the merkle root is wrong.
+bool BlockDataManager_FullRAM::parseNewBlockHeaderOnly(uint8_t const * blkPtr,
+                                                       uint32_t nBytes,
+                                                       uint64_t blkByteLoc)
 {
-   // TODO:  maybe we should check whether we already have this block...?
-   vector<bool> vb(3);
-   blockchainData_NEW_.push_back(rawBlock);
-   list<BinaryData>::iterator listEnd = blockchainData_NEW_.end();
-   listEnd--;
-   BinaryRefReader newBRR( listEnd->getPtr(), rawBlock.getSize() );
-   bool addDataSucceeded = parseNewBlockData(newBRR, totalBlockchainBytes_);
+   if(nBytes < HEADER_SIZE+1)
+      return false;
 
-   if( ! addDataSucceeded ) 
+   BinaryRefReader brr(blkPtr, nBytes);
+   brr.advance(HEADER_SIZE);
+   uint32_t nTx = (uint32_t)brr.get_var_int();
+   if(nTx == 0 || nTx > nBytes)
    {
-      cout << "Adding new block data to memory pool failed!";
-      vb[ADD_BLOCK_SUCCEEDED]     = false;  // Added to memory pool
-      vb[ADD_BLOCK_NEW_TOP_BLOCK] = false;  // New block is new top of chain
+      numBadMerkleBlocks_++;
+      return false;
+   }
+
+   CryptoPP::SHA256          sha256;
+   vector<uint8_t const *> & txPtrs   = parseTxPtrs_;
+   vector<uint32_t> &        txLens   = parseTxLens_;
+   BinaryData &              txHashes = parseTxHashes_;
+   txPtrs.resize(0);
+   txLens.resize(0);
+   for(uint32_t i=0; i<nTx; i++)
+   {
+      if(brr.getSizeRemaining() == 0)
+         break;
+      uint32_t txSize = BtcUtils::TxCalcLength(brr.getCurrPtr());
+      if(txSize > brr.getSizeRemaining())
+         break;
+      txPtrs.push_back(brr.getCurrPtr());
+      txLens.push_back(txSize);
+      brr.advance(txSize);
+   }
+
+   bool merkleIsGood = (txPtrs.size() == nTx);
+   if(merkleIsGood)
+   {
+      txHashes.resize(32*nTx);
+      BtcUtils::getHash256Batch(&txPtrs[0], &txLens[0], nTx, txHashes.getPtr());
+      BtcUtils::calculateMerkleRootInPlace(txHashes.getPtr(), nTx, sha256);
+      merkleIsGood = (memcmp(txHashes.getPtr(), blkPtr+36, 32) == 0);
+   }
+
+   if(!merkleIsGood)
+   {
+      numBadMerkleBlocks_++;
+      cout << "***WARNING: Block at byte " << blkByteLoc 
+           << " has bad tx data, skipping it" << endl;
+      return false;
+   }
+
+   BinaryData headHash = BtcUtils::getHash256(blkPtr, HEADER_SIZE);
+   if(headerHashMap_.find(headHash) != headerHashMap_.end())
+      return true;
+
+   // Make room for the header.  If the array moves, re-point all headers
+   if(headerArenaEnd_ + HEADER_SIZE > headerArena_.getSize())
+   {
+      uint8_t const * oldBase = headerArena_.getPtr();
+      headerArena_.resize(max((uint64_t)HEADER_ARENA_INITIAL_BYTES, 
+                              2*headerArena_.getSize()));
+      if(headerArena_.getPtr() != oldBase)
+      {
+         map<HashString, BlockHeaderRef>::iterator iter;
+         for(iter  = headerHashMap_.begin(); 
+             iter != headerHashMap_.end(); 
+             iter++)
+         {
+            uint8_t const * oldPtr = iter->second.self_.getPtr();
+            iter->second.self_.setRef(headerArena_.getPtr() + (oldPtr-oldBase),
+                                      HEADER_SIZE);
+         }
+      }
+   }
+
+   uint8_t * hdrPtr = headerArena_.getPtr() + headerArenaEnd_;
+   memcpy(hdrPtr, blkPtr, HEADER_SIZE);
+   headerArenaEnd_ += HEADER_SIZE;
+
+   BlockHeaderRef & bhr = headerHashMap_[headHash];
+   bhr.unserialize(hdrPtr);
+   bhr.blockNumBytes_ = nBytes;
+   bhr.blkByteLoc_    = blkByteLoc;
+   return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Headers-only version of the blk-file read:  stream it through a buffer
+// instead of reading the whole file into RAM.  Returns the number of blocks
+// read, including any that were rejected.
+uint32_t BlockDataManager_FullRAM::readBlkFileHeadersOnly(ifstream & is,
+                                                          uint64_t filesize)
+{
+   TIMER_START("StreamHeadersFromBlkFile");
+   BinaryStreamBuffer bsb;
+   bsb.attachAsStreamBuffer(is, (uint32_t)filesize);
+
+   uint32_t nBlkRead   = 0;
+   uint64_t blkByteLoc = 0;
+   bool     keepGoing  = true;
+   while(keepGoing && bsb.streamPull())
+   {
+      BinaryReader & br = bsb.reader();
+      while(br.getSizeRemaining() >= 8)
+      {
+         uint32_t nBytes = *(uint32_t*)(br.getCurrPtr()+4);
+         if(nBytes < HEADER_SIZE || nBytes+8 > bsb.getBufferSize())
+         {
+            // The rest of the file is padding, or garbage
+            keepGoing = false;
+            break;
+         }
+
+         if(br.getSizeRemaining() < nBytes+8)
+            break;
+
+         parseNewBlockHeaderOnly(br.getCurrPtr()+8, nBytes, blkByteLoc);
+         br.advance(nBytes+8);
+         blkByteLoc += nBytes+8;
+         nBlkRead++;
+      }
+   }
+   TIMER_STOP("StreamHeadersFromBlkFile");
+   return nBlkRead;
+}
+   
+
+
+////////////////////////////////////////////////////////////////////////////////
+// This method returns three booleans:
+//    (1)  Block data was added to memory pool successfully
+//    (2)  New block added is at the top of the chain
+//    (3)  Adding block data caused blockchain reorganization
+//
+// This method assumes the data is not in the permanent memory pool yet, and
+// we will need to copy it to its permanent memory location before parsing it.
+// Btw, yes I know I could've used a bitset here, but I was too lazy to add
+// the #include and look up the members for using it...
+vector<bool> BlockDataManager_FullRAM::addNewBlockData(BinaryData rawBlock,
+                                                       bool writeToBlk0001)
+{
+   // TODO:  maybe we should check whether we already have this block...?
+   vector<bool> vb(3);
+   uint32_t prevTopHeight = (topBlockPtr_==NULL ? 0 : 
+                                                  topBlockPtr_->getBlockHeight());
+   blockchainData_NEW_.push_back(rawBlock);
+   list<BinaryData>::iterator listEnd = blockchainData_NEW_.end();
+   listEnd--;
+   BinaryRefReader newBRR( listEnd->getPtr(), rawBlock.getSize() );
+   bool addDataSucceeded = parseNewBlockData(newBRR, totalBlockchainBytes_);
+   if(bdmMode_ == BDM_MODE_NO_STORAGE)
+      blockchainData_NEW_.pop_back();
+
+   if( ! addDataSucceeded ) 
+   {
+      cout << "Adding new block data to memory pool failed!";
+      vb[ADD_BLOCK_SUCCEEDED]     = false;  // Added to memory pool
+      vb[ADD_BLOCK_NEW_TOP_BLOCK] = false;  // New block is new top of chain
       vb[ADD_BLOCK_CAUSED_REORG]  = false;  // Add caused reorganization
       return vb;
    }
@@ -2089,6 +3446,7 @@ vector<bool> BlockDataManager_FullRAM::addNewBlockData(BinaryData rawBlock,
    //       I was plannign to do already
    PDEBUG("New block!  Re-assess blockchain state after adding new data...");
    bool prevTopBlockStillValid = organizeChain(); 
+   lastBlockWasReorg_ = !prevTopBlockStillValid;
 
    // I cannot just do a rescan:  the user needs this to be done manually so
    // that we can identify headers/txs that were previously valid, but no more
@@ -2112,19 +3470,43 @@ vector<bool> BlockDataManager_FullRAM::addNewBlockData(BinaryData rawBlock,
    // Since this method only adds one block, if it's not on the main branch,
    // then it's not the new head
    BinaryData newHeadHash = BtcUtils::getHash256(rawBlock.getSliceRef(8,80));
-   bool newBlockIsNewTop = getHeaderByHash(newHeadHash)->isMainBranch();
+   BlockHeaderRef * newHeadPtr = getHeaderByHash(newHeadHash);
+   bool newBlockIsNewTop = (newHeadPtr != NULL && newHeadPtr->isMainBranch());
 
-   // Write this block to file if is on the main chain and we requested it
+   // Write this block to file if is on the main chain and we requested it.
+   // Not in headers-only mode:  we don't keep the data for the orphans this
+   // block may have reconnected, so blk0001 would end up with gaps
    // TODO: this isn't right, because this logic won't write any blocks that
    //       that might eventually be in the main chain but aren't currently.
-   if(newBlockIsNewTop && writeToBlk0001)
+   if(newBlockIsNewTop && writeToBlk0001 && bdmMode_ != BDM_MODE_NO_STORAGE)
    {
       ofstream fileAppend(blkfilePath_.c_str(), ios::app | ios::binary);
       fileAppend.write((char const *)(rawBlock.getPtr()), rawBlock.getSize());
+
+      // If this block was the missing parent of some orphans, they're on
+      // the main chain now, too
+      map<uint32_t, BlockHeaderRef*> reconnected;
+      for(uint32_t i=0; i<orphansJustReconnected_.size(); i++)
+         if(orphansJustReconnected_[i]->isMainBranch())
+            reconnected[orphansJustReconnected_[i]->getBlockHeight()] = 
+                                                   orphansJustReconnected_[i];
+      map<uint32_t, BlockHeaderRef*>::iterator iter;
+      for(iter = reconnected.begin(); iter != reconnected.end(); iter++)
+         fileAppend.write((char const *)(iter->second->getPtr()-8), 
+                          iter->second->blockNumBytes_+8);
       fileAppend.close();
    }
 
-   purgeZeroConfPool();
+   // Only the blocks that just joined the main chain can affect the pool.
+   // That can be more than one even without a reorg, if orphans got linked
+   uint32_t purgeFrom = (prevTopBlockStillValid ? prevTopHeight : 
+                                          reorgBranchPoint_->getBlockHeight());
+   if(newBlockIsNewTop || !prevTopBlockStillValid)
+   {
+      checkNewMainChainScripts(purgeFrom+1);
+      for(uint32_t h=purgeFrom+1; h<headersByHeight_.size(); h++)
+         purgeZeroConfPoolForBlock(*(headersByHeight_[h]));
+   }
 
    vb[ADD_BLOCK_SUCCEEDED]     =  addDataSucceeded;
    vb[ADD_BLOCK_NEW_TOP_BLOCK] =  newBlockIsNewTop;
@@ -2143,6 +3525,171 @@ vector<bool> BlockDataManager_FullRAM::addNewBlockDataRef(BinaryDataRef bdr,
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+BlockBatchResult BlockDataManager_FullRAM::addNewBlocks(
+                                          vector<BinaryData> const & rawBlocks,
+                                          bool writeToBlk0001)
+{
+   // One permanent copy of the whole batch, instead of one per block
+   uint64_t totalBytes = 0;
+   for(uint32_t i=0; i<rawBlocks.size(); i++)
+      totalBytes += rawBlocks[i].getSize();
+
+   blockchainData_NEW_.push_back(BinaryData(totalBytes));
+   BinaryData & permData = blockchainData_NEW_.back();
+   uint64_t offset = 0;
+   for(uint32_t i=0; i<rawBlocks.size(); i++)
+   {
+      if(rawBlocks[i].getSize() == 0)
+         continue;
+      memcpy(permData.getPtr()+offset, rawBlocks[i].getPtr(), rawBlocks[i].getSize());
+      offset += rawBlocks[i].getSize();
+   }
+   BlockBatchResult result = addNewBlockBatch(permData, writeToBlk0001);
+   if(bdmMode_ == BDM_MODE_NO_STORAGE)
+      blockchainData_NEW_.pop_back();
+   return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+BlockBatchResult BlockDataManager_FullRAM::addNewBlocksRaw(
+                                                BinaryDataRef rawBlocksConcat,
+                                                bool writeToBlk0001)
+{
+   blockchainData_NEW_.push_back(rawBlocksConcat.copy());
+   BlockBatchResult result = addNewBlockBatch(blockchainData_NEW_.back(), 
+                                              writeToBlk0001);
+   if(bdmMode_ == BDM_MODE_NO_STORAGE)
+      blockchainData_NEW_.pop_back();
+   return result;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// This is what addNewBlockData does, except that all the blocks are parsed
+// before we organize the chain.  organizeChain walks every header in the 
+// map, so doing it once per block made catching up after some downtime 
+// quadratic in the number of new blocks.
+BlockBatchResult BlockDataManager_FullRAM::addNewBlockBatch(
+                                             BinaryData const & permBlockData,
+                                             bool writeToBlk0001)
+{
+   BlockBatchResult result;
+   if(topBlockPtr_ != NULL)
+      result.prevTopHash_ = topBlockPtr_->getThisHash();
+   uint32_t prevTopHeight = (topBlockPtr_==NULL ? 0 : 
+                                                  topBlockPtr_->getBlockHeight());
+
+   // Keep hashes, not pointers:  organizeChain may evict orphans
+   vector<BinaryData> addedHashes;
+   BinaryRefReader brr(permBlockData);
+   while(brr.getSizeRemaining() >= 8+HEADER_SIZE)
+   {
+      uint32_t nBytes = *(uint32_t*)(brr.getCurrPtr()+4);
+      if(brr.getSizeRemaining() < nBytes+8 || nBytes < HEADER_SIZE)
+      {
+         cout << "***WARNING: Block batch ends with a partial block" << endl;
+         result.numFailed_++;
+         break;
+      }
+
+      BinaryData headHash = BtcUtils::getHash256(brr.getCurrPtr()+8, HEADER_SIZE);
+      if(headerHashMap_.find(headHash) != headerHashMap_.end())
+      {
+         result.numDuplicates_++;
+         brr.advance(nBytes+8);
+         continue;
+      }
+
+      if( !parseNewBlockData(brr, totalBlockchainBytes_) )
+      {
+         result.numFailed_++;
+         break;
+      }
+      addedHashes.push_back(headHash);
+      result.numBlocksAdded_++;
+   }
+
+   if(addedHashes.size() == 0)
+   {
+      if(topBlockPtr_ != NULL)
+      {
+         result.newTopHash_        = topBlockPtr_->getThisHash();
+         result.newTopHeight_      = topBlockPtr_->getBlockHeight();
+         result.branchPointHash_   = result.newTopHash_;
+         result.branchPointHeight_ = result.newTopHeight_;
+      }
+      return result;
+   }
+
+   PDEBUG("New block batch!  Re-assess blockchain state after adding it...");
+   bool prevTopBlockStillValid = organizeChain(); 
+   lastBlockWasReorg_ = !prevTopBlockStillValid;
+
+   BlockHeaderRef * branchPtr = prevTopBlockPtr_;
+   if(!prevTopBlockStillValid)
+   {
+      cout << "Blockchain Reorganization detected!" << endl;
+      reassessAfterReorg(prevTopBlockPtr_, topBlockPtr_, reorgBranchPoint_);
+      branchPtr = reorgBranchPoint_;
+   }
+
+   result.isReorg_           = !prevTopBlockStillValid;
+   result.numOrphansReconnected_ = orphansJustReconnected_.size();
+   result.newTopHash_        = topBlockPtr_->getThisHash();
+   result.newTopHeight_      = topBlockPtr_->getBlockHeight();
+   result.branchPointHash_   = branchPtr->getThisHash();
+   result.branchPointHeight_ = branchPtr->getBlockHeight();
+
+   // Write the new main-chain blocks in chain order, so each block's parent
+   // is already in the file (the same caveat as addNewBlockData applies to
+   // blocks that only join the main chain later).  Orphans from earlier
+   // calls that were just linked into the main chain were never written
+   map<uint32_t, BlockHeaderRef*> newMainBlocks;
+   for(uint32_t i=0; i<addedHashes.size(); i++)
+   {
+      BlockHeaderRef * bhptr = getHeaderByHash(addedHashes[i]);
+      if(bhptr == NULL || bhptr->isOrphan())
+         result.orphanHashes_.push_back(addedHashes[i]);
+      else if(bhptr->isMainBranch())
+         newMainBlocks[bhptr->getBlockHeight()] = bhptr;
+   }
+   for(uint32_t i=0; i<orphansJustReconnected_.size(); i++)
+   {
+      BlockHeaderRef * bhptr = orphansJustReconnected_[i];
+      if(bhptr->isMainBranch())
+         newMainBlocks[bhptr->getBlockHeight()] = bhptr;
+   }
+
+   // In headers-only mode the headers don't point at the block data
+   if(writeToBlk0001 && newMainBlocks.size() > 0 && 
+      bdmMode_ != BDM_MODE_NO_STORAGE)
+   {
+      ofstream fileAppend(blkfilePath_.c_str(), ios::app | ios::binary);
+      map<uint32_t, BlockHeaderRef*>::iterator iter;
+      for(iter  = newMainBlocks.begin();
+          iter != newMainBlocks.end();
+          iter++)
+      {
+         // The header is right after the magic bytes and block size
+         BlockHeaderRef & bhr = *(iter->second);
+         fileAppend.write((char const *)(bhr.getPtr()-8), bhr.blockNumBytes_+8);
+      }
+      fileAppend.close();
+   }
+
+   // Everything that joined the main chain may have confirmed or 
+   // double-spent something in the zero-conf pool
+   uint32_t purgeFrom = (prevTopBlockStillValid ? prevTopHeight : 
+                                                  result.branchPointHeight_);
+   checkNewMainChainScripts(purgeFrom+1);
+   for(uint32_t h=purgeFrom+1; h<headersByHeight_.size(); h++)
+      purgeZeroConfPoolForBlock(*(headersByHeight_[h]));
+
+   return result;
+}
+
+
 // This piece may be useful for adding new data, but I don't want to enforce it,
 // yet
 /*
@@ -2247,12 +3794,9 @@ vector<BlockHeaderRef*> BlockDataManager_FullRAM::getHeadersNotOnMainChain(void)
 bool BlockDataManager_FullRAM::organizeChain(bool forceRebuild)
 {
    PDEBUG2("Organizing chain", (forceRebuild ? "w/ rebuild" : ""));
-   // If rebuild, we zero out any original organization data and do a 
-   // rebuild of the chain from scratch.  This will need to be done in
-   // the event that our first call to organizeChain returns false, which
-   // means part of blockchain that was previously valid, has become
-   // invalid.  Rather than get fancy, just rebuild all which takes less
-   // than a second, anyway.
+   // If rebuild, we zero out the main-chain markings and pick the top block
+   // again from scratch.  Chain work and heights only depend on a block's
+   // ancestors, so those stay.  Reorgs don't need this anymore (see below)
    if(forceRebuild)
    {
       map<BinaryData, BlockHeaderRef>::iterator iter;
@@ -2260,8 +3804,7 @@ bool BlockDataManager_FullRAM::organizeChain(bool forceRebuild)
            iter != headerHashMap_.end(); 
            iter++)
       {
-         iter->second.difficultySum_  = -1;
-         iter->second.blockHeight_    =  0;
+         iter->second.isMainBranch_   = false;
          iter->second.isFinishedCalc_ = false;
          iter->second.nextHash_       =  BtcUtils::EmptyHash_;
       }
@@ -2273,14 +3816,21 @@ bool BlockDataManager_FullRAM::organizeChain(bool forceRebuild)
    genBlock.blockHeight_    = 0;
    genBlock.difficultyDbl_  = 1.0;
    genBlock.difficultySum_  = 1.0;
+   genBlock.chainWork_      = genBlock.blockWork_;
    genBlock.isMainBranch_   = true;
    genBlock.isOrphan_       = false;
    genBlock.isFinishedCalc_ = true;
    genBlock.isInitialized_  = true; 
-   genBlock.txPtrList_      = vector<TxRef*>(1);
-   genBlock.txPtrList_[0]   = getTxByHash(GenesisTxHash_);
-   genBlock.txPtrList_[0]->setMainBranch(true);
-   genBlock.txPtrList_[0]->setHeaderPtr(&genBlock);
+   genBlock.txPtrList_      = vector<TxRef*>(0);
+
+   // (there are no tx in headers-only mode)
+   TxRef * genTxPtr = getTxByHash(GenesisTxHash_);
+   if(genTxPtr != NULL)
+   {
+      genBlock.txPtrList_.push_back(genTxPtr);
+      genTxPtr->setMainBranch(true);
+      genTxPtr->setHeaderPtr(&genBlock);
+   }
 
 
    // If this is the first run, the topBlock is the genesis block
@@ -2290,28 +3840,42 @@ bool BlockDataManager_FullRAM::organizeChain(bool forceRebuild)
    // Store the old top block so we can later check whether it is included 
    // in the new chain organization
    prevTopBlockPtr_ = topBlockPtr_;
+   if(!forceRebuild)
+      orphansJustReconnected_.clear();
 
-   // Iterate over all blocks, track the maximum difficulty-sum block
+   // Iterate over all blocks, track the maximum chain-work block
    map<BinaryData, BlockHeaderRef>::iterator iter;
-   double   maxDiffSum     = prevTopBlockPtr_->getDifficultySum();
+   UInt256 maxChainWork = prevTopBlockPtr_->chainWork_;
    for( iter = headerHashMap_.begin(); iter != headerHashMap_.end(); iter ++)
    {
       // *** Walk down the chain following prevHash fields, until
       //     you find a "solved" block.  Then walk back up and 
-      //     fill in the difficulty-sum values (do not set next-
+      //     fill in the chain-work values (do not set next-
       //     hash ptrs, as we don't know if this is the main branch)
       //     Method returns instantly if block is already "solved"
-      double thisDiffSum = traceChainDown(iter->second);
-      
-      // Determine if this is the top block.  If it's the same diffsum
-      // as the prev top block, don't do anything
-      if(thisDiffSum > maxDiffSum)
+      //
+      // Determine if this is the top block.  The sums are exact, so a 
+      // block with the same work as the prev top block really is a tie,
+      // and we keep the one we saw first
+      if(traceChainDown(iter->second) > maxChainWork)
       {
-         maxDiffSum     = thisDiffSum;
+         maxChainWork   = iter->second.chainWork_;
          topBlockPtr_   = &(iter->second);
       }
    }
 
+   // Orphans linked in during the loop may have been visited (and skipped)
+   // before their parent showed up, so check them separately
+   for(uint32_t i=0; i<orphansJustReconnected_.size(); i++)
+   {
+      if(orphansJustReconnected_[i]->chainWork_ > maxChainWork)
+      {
+         maxChainWork = orphansJustReconnected_[i]->chainWork_;
+         topBlockPtr_ = orphansJustReconnected_[i];
+      }
+   }
+   enforceOrphanPoolLimit();
+
    // Walk down the list one more time, set nextHash fields
    // Also set headersByHeight_;
    bool prevChainStillValid = (topBlockPtr_ == prevTopBlockPtr_);
@@ -2347,20 +3911,24 @@ bool BlockDataManager_FullRAM::organizeChain(bool forceRebuild)
    headersByHeight_[thisHeaderPtr->getBlockHeight()] = thisHeaderPtr;
 
 
-   // Force a full rebuild to make sure everything is marked properly
-   // On a full rebuild, prevChainStillValid should ALWAYS be true
+   // The walk above stopped at the branch point, the highest block that
+   // was already on the main chain.  If that wasn't the old top block, 
+   // un-mark the old chain above it.  This used to be a full rebuild, but
+   // nothing else depends on which chain was the main one.
+   // (on a full rebuild, prevChainStillValid should ALWAYS be true)
    if( !prevChainStillValid )
    {
       PDEBUG("Reorg detected!");
       reorgBranchPoint_ = thisHeaderPtr;
 
-      // This is a dangerous bug -- I should probably consider rewriting this
-      // method to avoid this problem:  prevTopBlockPtr_ is set correctly 
-      // RIGHT NOW, but won't be once I make the recursive call to organizeChain
-      // I need to save it now, and re-assign it after the organizeChain call.
-      BlockHeaderRef* prevtopblk = prevTopBlockPtr_;
-      organizeChain(true); // force-rebuild blockchain (takes less than 1s)
-      prevTopBlockPtr_ = prevtopblk;
+      BlockHeaderRef* oldHeaderPtr = prevTopBlockPtr_;
+      while(oldHeaderPtr != NULL && oldHeaderPtr != reorgBranchPoint_)
+      {
+         oldHeaderPtr->isMainBranch_   = false;
+         oldHeaderPtr->isFinishedCalc_ = false;
+         oldHeaderPtr->nextHash_       = BtcUtils::EmptyHash_;
+         oldHeaderPtr = getHeaderByHash(oldHeaderPtr->getPrevHash());
+      }
       return false;
    }
 
@@ -2372,29 +3940,32 @@ bool BlockDataManager_FullRAM::organizeChain(bool forceRebuild)
 
 /////////////////////////////////////////////////////////////////////////////
 // Start from a node, trace down to the highest solved block, accumulate
-// difficulties and difficultySum values.  Return the difficultySum of 
-// this block.
-double BlockDataManager_FullRAM::traceChainDown(BlockHeaderRef & bhpStart)
+// chain work and difficultySum values.  Return the chain work of this 
+// block (zero if it's an orphan).
+UInt256 BlockDataManager_FullRAM::traceChainDown(BlockHeaderRef & bhpStart)
 {
-   if(bhpStart.difficultySum_ > 0)
-      return bhpStart.difficultySum_;
+   if(!bhpStart.chainWork_.isZero())
+      return bhpStart.chainWork_;
 
-   // Prepare some data structures for walking down the chain
-   vector<BlockHeaderRef*>   headerPtrStack(headerHashMap_.size());
-   vector<double>           difficultyStack(headerHashMap_.size());
-   uint32_t blkIdx = 0;
-   double thisDiff;
+   // Prepare the stack for walking down the chain.  Usually there's only
+   // one or two unsolved blocks, so don't size it for the whole header map
+   vector<BlockHeaderRef*>   headerPtrStack;
 
    // Walk down the chain of prevHash_ values, until we find a block
-   // that has a definitive difficultySum value (i.e. >0). 
+   // that has a definitive chain-work value (i.e. >0). 
    BlockHeaderRef* thisPtr = &bhpStart;
    map<BinaryData, BlockHeaderRef>::iterator iter;
-   while( thisPtr->difficultySum_ < 0)
+   while( thisPtr->chainWork_.isZero() )
    {
-      thisDiff                = thisPtr->difficultyDbl_;
-      difficultyStack[blkIdx] = thisDiff;
-      headerPtrStack[blkIdx]  = thisPtr;
-      blkIdx++;
+      // Anything built on an orphan is an orphan, too.  It will be linked
+      // in when the missing block shows up
+      if(isInOrphanPool(*thisPtr))
+      {
+         markOrphanChain(headerPtrStack);
+         return UInt256();
+      }
+
+      headerPtrStack.push_back(thisPtr);
 
       iter = headerHashMap_.find(thisPtr->getPrevHash());
       if( iter != headerHashMap_.end() )
@@ -2404,63 +3975,202 @@ double BlockDataManager_FullRAM::traceChainDown(BlockHeaderRef & bhpStart)
          // We didn't hit a known block, but we don't have this block's
          // ancestor in the memory pool, so this is an orphan chain...
          // at least temporarily
-         markOrphanChain(bhpStart);
-         return 0.0;
+         markOrphanChain(headerPtrStack);
+         return UInt256();
       }
    }
 
 
-   // Now we have a stack of difficulties and pointers.  Walk back up
-   // (by pointer) and accumulate the difficulty values 
-   double   seedDiffSum = thisPtr->difficultySum_;
-   uint32_t blkHeight   = thisPtr->blockHeight_;
-   for(int32_t i=blkIdx-1; i>=0; i--)
+   // Now we have a stack of pointers.  Walk back up (by pointer) and 
+   // accumulate the work and difficulty values 
+   for(int32_t i=headerPtrStack.size()-1; i>=0; i--)
    {
-      seedDiffSum += difficultyStack[i];
-      blkHeight++;
+      BlockHeaderRef* parentPtr = thisPtr;
       thisPtr                 = headerPtrStack[i];
-      thisPtr->difficultyDbl_ = difficultyStack[i];
-      thisPtr->difficultySum_ = seedDiffSum;
-      thisPtr->blockHeight_   = blkHeight;
+      thisPtr->chainWork_     = parentPtr->chainWork_ + thisPtr->blockWork_;
+      thisPtr->difficultySum_ = parentPtr->difficultySum_ + 
+                                thisPtr->difficultyDbl_;
+      thisPtr->blockHeight_   = parentPtr->blockHeight_ + 1;
+      thisPtr->isOrphan_      = false;
+
+      if(orphanPool_.size() > 0)
+         connectOrphanChildren(*thisPtr);
    }
    
-   // Finally, we have all the difficulty sums calculated, return this one
-   return bhpStart.difficultySum_;
+   // Finally, we have all the chain work calculated, return this one
+   return bhpStart.chainWork_;
   
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
-void BlockDataManager_FullRAM::markOrphanChain(BlockHeaderRef & bhpStart)
+// Put every block in the chain into the orphan pool, under its parent's
+// hash.  The chain is ordered top-down, as traceChainDown collects it.
+void BlockDataManager_FullRAM::markOrphanChain(
+                                       vector<BlockHeaderRef*> const & chain)
 {
    PDEBUG("Marking orphan chain");
-   bhpStart.isMainBranch_ = true;
-   map<BinaryData, BlockHeaderRef>::iterator iter;
-   iter = headerHashMap_.find(bhpStart.getPrevHash());
-   HashStringRef lastHeadHash(32);
-   while( iter != headerHashMap_.end() )
+   for(uint32_t i=0; i<chain.size(); i++)
    {
+      BlockHeaderRef & bhr = *(chain[i]);
+
       // I don't see how it's possible to have a header that used to be 
       // in the main branch, but is now an ORPHAN (meaning it has no
       // parent).  It will be good to detect this case, though
-      if(iter->second.isMainBranch() == true)
+      if(bhr.isMainBranch() == true)
       {
          cout << "***ERROR: Block previously main branch, now orphan!?"
-              << iter->second.getThisHash().toHexStr() << endl;
+              << bhr.getThisHash().toHexStr() << endl;
          cerr << "***ERROR: Block previously main branch, now orphan!?"
-              << iter->second.getThisHash().toHexStr() << endl;
-         previouslyValidBlockHeaderPtrs_.push_back(&(iter->second));
+              << bhr.getThisHash().toHexStr() << endl;
+         previouslyValidBlockHeaderPtrs_.push_back(&bhr);
       }
-      iter->second.isOrphan_ = true;
-      iter->second.isMainBranch_ = false;
-      lastHeadHash.setRef(iter->second.thisHash_);
-      iter = headerHashMap_.find(iter->second.getPrevHash());
+      bhr.isOrphan_ = true;
+      bhr.isMainBranch_ = false;
+      orphanPool_.insert(make_pair(bhr.getPrevHash(), &bhr));
+      orphanArrival_.push_back(bhr.getThisHash());
    }
-   orphanChainStartBlocks_.push_back(&(headerHashMap_[lastHeadHash.copy()]));
    PDEBUG("Done marking orphan chain");
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+bool BlockDataManager_FullRAM::isInOrphanPool(BlockHeaderRef & bhr)
+{
+   if(orphanPool_.size() == 0)
+      return false;
+
+   pair<multimap<HashString, BlockHeaderRef*>::iterator,
+        multimap<HashString, BlockHeaderRef*>::iterator> range;
+   range = orphanPool_.equal_range(bhr.getPrevHash());
+   multimap<HashString, BlockHeaderRef*>::iterator iter;
+   for(iter = range.first; iter != range.second; iter++)
+      if(iter->second == &bhr)
+         return true;
+   return false;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// The parent was just solved:  give all its waiting descendants their 
+// difficulty sums and heights, and take them out of the pool.  Only touches
+// the blocks that are actually reconnected.
+void BlockDataManager_FullRAM::connectOrphanChildren(BlockHeaderRef & parent)
+{
+   pair<multimap<HashString, BlockHeaderRef*>::iterator,
+        multimap<HashString, BlockHeaderRef*>::iterator> range;
+   multimap<HashString, BlockHeaderRef*>::iterator iter;
+
+   vector<BlockHeaderRef*> parentStack(1, &parent);
+   while(parentStack.size() > 0)
+   {
+      BlockHeaderRef* parentPtr = parentStack.back();
+      parentStack.pop_back();
+
+      range = orphanPool_.equal_range(parentPtr->getThisHash());
+      for(iter = range.first; iter != range.second; iter++)
+      {
+         BlockHeaderRef* childPtr = iter->second;
+         childPtr->chainWork_     = parentPtr->chainWork_ + 
+                                    childPtr->blockWork_;
+         childPtr->difficultySum_ = parentPtr->difficultySum_ + 
+                                    childPtr->difficultyDbl_;
+         childPtr->blockHeight_   = parentPtr->blockHeight_ + 1;
+         childPtr->isOrphan_      = false;
+         orphansJustReconnected_.push_back(childPtr);
+         parentStack.push_back(childPtr);
+      }
+      orphanPool_.erase(range.first, range.second);
+   }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Forget the oldest orphans until the pool fits.  Their raw data stays in
+// RAM like everything else, but the headers and tx are gone, so they are 
+// treated as never-seen if they arrive again.  Their descendants stay in 
+// the pool and get evicted in turn, unless the evicted block comes back 
+// first.  A tx is only dropped if no block we still have contains it:  
+// main-chain tx have their header pointer set, and the few side-branch
+// and orphan headers are checked in one pass at the end.
+void BlockDataManager_FullRAM::enforceOrphanPoolLimit(void)
+{
+   set<TxRef*> txMaybeDead;
+   while(orphanPool_.size() > orphanPoolMaxBlocks_ && orphanArrival_.size() > 0)
+   {
+      HashString hash = orphanArrival_.front();
+      orphanArrival_.pop_front();
+
+      // Already reconnected, or evicted once before
+      map<HashString, BlockHeaderRef>::iterator hiter = headerHashMap_.find(hash);
+      if(hiter == headerHashMap_.end() || !isInOrphanPool(hiter->second))
+         continue;
+
+      BlockHeaderRef & bhr = hiter->second;
+      pair<multimap<HashString, BlockHeaderRef*>::iterator,
+           multimap<HashString, BlockHeaderRef*>::iterator> range;
+      range = orphanPool_.equal_range(bhr.getPrevHash());
+      multimap<HashString, BlockHeaderRef*>::iterator iter;
+      for(iter = range.first; iter != range.second; iter++)
+      {
+         if(iter->second == &bhr)
+         {
+            orphanPool_.erase(iter);
+            break;
+         }
+      }
+
+      vector<TxRef*> const & txlist = bhr.getTxRefPtrList();
+      for(uint32_t itx=0; itx<txlist.size(); itx++)
+         if(txlist[itx]->getHeaderPtr() == NULL)
+            txMaybeDead.insert(txlist[itx]);
+
+      headerHashMap_.erase(hiter);
+      numOrphansEvicted_++;
+   }
+
+   if(txMaybeDead.size() > 0)
+   {
+      map<HashString, BlockHeaderRef>::iterator hiter;
+      for(hiter  = headerHashMap_.begin();
+          hiter != headerHashMap_.end();
+          hiter++)
+      {
+         if(hiter->second.isMainBranch())
+            continue;
+         vector<TxRef*> const & txlist = hiter->second.getTxRefPtrList();
+         for(uint32_t itx=0; itx<txlist.size(); itx++)
+            txMaybeDead.erase(txlist[itx]);
+      }
+
+      // Copy the hash:  it's held by the TxRef we're erasing
+      set<TxRef*>::iterator txIter;
+      for(txIter  = txMaybeDead.begin();
+          txIter != txMaybeDead.end();
+          txIter++)
+      {
+         BinaryData txHash = (*txIter)->getThisHash();
+         txHashMap_.erase(txHash);
+      }
+   }
+
+   // Stale entries pile up in the arrival queue as orphans get reconnected
+   if(orphanPool_.size() == 0)
+      orphanArrival_.clear();
+   else if(orphanArrival_.size() > 2*orphanPool_.size() + 64)
+   {
+      deque<HashString> stillPooled;
+      for(uint32_t i=0; i<orphanArrival_.size(); i++)
+      {
+         BlockHeaderRef* bhptr = getHeaderByHash(orphanArrival_[i]);
+         if(bhptr != NULL && isInOrphanPool(*bhptr))
+            stillPooled.push_back(orphanArrival_[i]);
+      }
+      orphanArrival_.swap(stillPooled);
+   }
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // We're going to need the BDM's help to get the sender for a TxIn since it
 // sometimes requires going and finding the TxOut from the distant past
@@ -2511,40 +4221,123 @@ void BlockDataManager_FullRAM::enableZeroConf(string zcFilename)
 }
 
 ////////////////////////////////////////////////////////////////////////////////
+// The file is replayed straight out of the buffer we read it into:  the only
+// copy of each raw tx is the one that goes into the pool, and tx that were
+// tombstoned later in the journal are never added at all.  Files in the old
+// format ([txtime|rawtx] repeated) are converted to the journal format.
 void BlockDataManager_FullRAM::readZeroConfFile(string zcFilename)
 {
+   finishZeroConfCompaction(true);
+   zcJournalLiveBytes_ = 0;
+   zcJournalDeadBytes_ = 0;
+
+   BinaryData zcData(0);
    ifstream zcFile(zcFilename_.c_str(),  ios::in | ios::binary);
    if(zcFile)
    {
       zcFile.seekg(0, ios::end);
       uint64_t filesize = (size_t)zcFile.tellg();
-      if(filesize < 8)
-      {
-         zcFile.close();
-         return;
-      }
       zcFile.seekg(0, ios::beg);
-      BinaryData zcData(filesize);
+      zcData.resize(filesize);
       zcFile.read((char*)zcData.getPtr(), filesize);
+      zcFile.close();
+   }
 
-      // We succeeded opening the file...
-      BinaryRefReader brr(zcData);
+   BinaryData journalMagic = BinaryData::CreateFromHex(ZC_JOURNAL_MAGIC_HEX);
+   bool isJournal   = (zcData.getSize() >= 4 && 
+                       zcData.getSliceRef(0,4) == journalMagic);
+   bool needRewrite = !isJournal;
+
+   vector<BinaryDataRef> txRefs;
+   vector<BinaryData>    txHashes;
+   vector<uint64_t>      txTimes;
+   vector<bool>          txIsLive;
+   BinaryRefReader brr(zcData);
+   if(isJournal)
+   {
+      map<HashString, uint32_t> liveIndex;
+      brr.advance(4);
+      while(brr.getSizeRemaining() > 0)
+      {
+         uint8_t recType = brr.get_uint8_t();
+         if(recType == ZC_JOURNAL_ADD && brr.getSizeRemaining() > 8)
+         {
+            uint64_t txTime = brr.get_uint64_t();
+            uint32_t txLen  = BtcUtils::TxCalcLengthBounded(brr.getCurrPtr(),
+                                                     brr.getSizeRemaining());
+            if(txLen == UINT32_MAX)
+            {
+               needRewrite = true;
+               break;
+            }
+            BinaryDataRef txRef = brr.get_BinaryDataRef(txLen);
+            BinaryData txHash = BtcUtils::getHash256(txRef.getPtr(), txLen);
+            liveIndex[txHash] = txRefs.size();
+            txRefs.push_back(txRef);
+            txHashes.push_back(txHash);
+            txTimes.push_back(txTime);
+            txIsLive.push_back(true);
+         }
+         else if(recType == ZC_JOURNAL_TOMBSTONE && brr.getSizeRemaining() >= 32)
+         {
+            BinaryData txHash(32);
+            brr.get_BinaryData(txHash, 32);
+            map<HashString, uint32_t>::iterator iter = liveIndex.find(txHash);
+            if(iter != liveIndex.end())
+            {
+               txIsLive[iter->second] = false;
+               liveIndex.erase(iter);
+            }
+         }
+         else
+         {
+            // Most likely a crash in the middle of an append.  Keep what we
+            // have, and rewrite the file so we don't append after garbage
+            cout << "***WARNING: Zero-conf file has a bad record, truncating"
+                 << endl;
+            needRewrite = true;
+            break;
+         }
+      }
+   }
+   else
+   {
       while(brr.getSizeRemaining() > 8)
       {
          uint64_t txTime = brr.get_uint64_t();
-         uint32_t txLen = BtcUtils::TxCalcLength(brr.getCurrPtr());
-         BinaryData rawtx(txLen);
-         brr.get_BinaryData(rawtx.getPtr(), txLen);
-         addNewZeroConfTx(rawtx, txTime, false);
+         uint32_t txLen  = BtcUtils::TxCalcLengthBounded(brr.getCurrPtr(),
+                                                     brr.getSizeRemaining());
+         if(txLen == UINT32_MAX)
+            break;
+         BinaryDataRef txRef = brr.get_BinaryDataRef(txLen);
+         txRefs.push_back(txRef);
+         txHashes.push_back(BtcUtils::getHash256(txRef.getPtr(), txLen));
+         txTimes.push_back(txTime);
+         txIsLive.push_back(true);
       }
-      zcFile.close();
    }
+
+   for(uint32_t i=0; i<txRefs.size(); i++)
+   {
+      if(!txIsLive[i] || !addNewZeroConfTxRef(txRefs[i], txTimes[i], false))
+         continue;
+
+      zeroConfMap_[txHashes[i]].inJournal_ = true;
+      zcJournalLiveBytes_ += 9 + txRefs[i].getSize();
+   }
+
+   if(needRewrite)
+      rewriteZeroConfFile();
+   else
+      zcJournalDeadBytes_ = zcData.getSize() - 4 - zcJournalLiveBytes_;
+
    purgeZeroConfPool();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 void BlockDataManager_FullRAM::disableZeroConf(string zcFilename)
 {
+   finishZeroConfCompaction(true);
    zcEnabled_  = false; 
 }
 
@@ -2554,33 +4347,113 @@ bool BlockDataManager_FullRAM::addNewZeroConfTx(BinaryData const & rawTx,
                                                 uint64_t txtime,
                                                 bool writeToFile)
 {
-   // TODO:  We should do some kind of verification check on this tx
-   //        to make sure it's potentially valid.  Right now, it doesn't 
-   //        matter, because the Satoshi client is sitting between
-   //        us and the network and doing the checking for us.
+   return addNewZeroConfTxRef(rawTx.getRef(), txtime, writeToFile);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool BlockDataManager_FullRAM::addNewZeroConfTxRef(BinaryDataRef rawTx, 
+                                                   uint64_t txtime,
+                                                   bool writeToFile)
+{
+   double startSec = UniversalTimer::getMonotonicSec();
+   bool added = insertZeroConfTx(rawTx, txtime, writeToFile);
+
+   double insertSec = UniversalTimer::getMonotonicSec() - startSec;
+   zcNumInsertCalls_++;
+   zcInsertSecTotal_ += insertSec;
+   if(insertSec > zcInsertSecMax_)
+      zcInsertSecMax_ = insertSec;
+   return added;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool BlockDataManager_FullRAM::insertZeroConfTx(BinaryDataRef rawTx, 
+                                                uint64_t txtime,
+                                                bool writeToFile)
+{
+   // Without script checks, we're counting on the Satoshi client sitting
+   // between us and the network to do the checking for us
 
    if(txtime==0)
       txtime = time(NULL);
 
-   BinaryData txHash = BtcUtils::getHash256(rawTx);
+   // Too big to ever fit, or already too old to keep
+   uint32_t txSize = rawTx.getSize();
+   if(txSize == 0 || txSize > zcPoolMaxBytes_)
+      return false;
+   if(zcPoolMaxAgeSec_ > 0 && txtime + zcPoolMaxAgeSec_ < (uint64_t)time(NULL))
+      return false;
+
+   BinaryData txHash = BtcUtils::getHash256(rawTx.getPtr(), txSize);
    if(zeroConfMap_.find(txHash) != zeroConfMap_.end() ||
       txHashMap_.find(txHash)   != txHashMap_.end())
       return false;
+
+   if(scriptCheckEnabled_)
+   {
+      TxRef txToCheck(rawTx);
+      if(!checkZeroConfScripts(txToCheck))
+      {
+         cout << "***WARNING: Zero-conf tx has invalid signatures:  "
+              << txHash.copySwapEndian().toHexStr() << endl;
+         return false;
+      }
+   }
    
+   // The arena may move here, so do it before we add the new map entry. 
+   // The tx only officially takes the space once it's been accepted.
+   makeRoomInZeroConfArena(txSize);
+   uint8_t * txDest = zcArena_.getPtr() + zcArenaEnd_;
+   memcpy(txDest, rawTx.getPtr(), txSize);
    
    zeroConfMap_[txHash] = ZeroConfData();
    ZeroConfData & zc = zeroConfMap_[txHash];
-   zc.iter_ = zeroConfTxList_.insert(zeroConfTxList_.end(), rawTx);
-   zc.txref_.unserialize(*(zc.iter_));
+   zc.arenaOffset_ = zcArenaEnd_;
+   zc.txref_.unserialize(txDest);
    zc.txtime_ = txtime;
 
-   // Record time.  Write to file
+   // First-seen wins:  a tx spending an outpoint that's already spent by
+   // something in the pool is a double-spend, and we don't keep it
+   uint8_t const * txStartPtr = zc.txref_.getPtr();
+   vector<OutPoint> spentOutPoints(zc.txref_.getNumTxIn());
+   for(uint32_t iin=0; iin<spentOutPoints.size(); iin++)
+   {
+      spentOutPoints[iin].unserialize(txStartPtr + zc.txref_.getTxInOffset(iin));
+      if(zcSpentOutPoints_.find(spentOutPoints[iin]) != zcSpentOutPoints_.end())
+      {
+         zeroConfMap_.erase(txHash);
+         return false;
+      }
+   }
+
+   for(uint32_t iin=0; iin<spentOutPoints.size(); iin++)
+      zcSpentOutPoints_[spentOutPoints[iin]] = txHash;
+
+   zcArenaEnd_  += txSize;
+   zcPoolBytes_ += txSize;
+   zc.seq_ = zcNextSeq_++;
+   zeroConfSeqMap_[zc.seq_] = txHash;
+   zc.feeRate_ = calcZeroConfFeeRate(zc.txref_);
+   zcFeeRateIndex_.insert(make_pair(zc.feeRate_, zc.seq_));
+
+   // This may evict the new tx itself, if it's the cheapest one in the pool
+   enforceZeroConfPoolLimits();
+   if(zeroConfMap_.find(txHash) == zeroConfMap_.end())
+   {
+      if(writeToFile)
+         flushZeroConfJournal();
+      return false;
+   }
+
+   // Record time.  Append to the journal
    if(writeToFile)
    {
-      ofstream zcFile(zcFilename_.c_str(), ios::app | ios::binary);
-      zcFile.write( (char*)(&zc.txtime_), sizeof(uint64_t) );
-      zcFile.write( (char*)zc.txref_.getPtr(),  zc.txref_.getSize());
-      zcFile.close();
+      zcJournalQueue_.append((uint8_t)ZC_JOURNAL_ADD);
+      zcJournalQueue_.append((uint8_t*)(&zc.txtime_), sizeof(uint64_t));
+      zcJournalQueue_.append(zc.txref_.getPtr(), zc.txref_.getSize());
+      zcJournalLiveBytes_ += 9 + zc.txref_.getSize();
+      zc.inJournal_ = true;
+      flushZeroConfJournal();
    }
    return true;
 }
@@ -2611,53 +4484,529 @@ void BlockDataManager_FullRAM::purgeZeroConfPool(void)
        rmIter != mapRmList.end();
        rmIter++)
    {
-      zeroConfTxList_.erase( (*rmIter)->second.iter_ );
-      zeroConfMap_.erase( *rmIter );
+      removeZeroConfTx( (*rmIter)->first, false );
    }
+   retractZeroConfEvictions();
 
-   // Rewrite the zero-conf pool file
-   if(mapRmList.size() > 0)
-      rewriteZeroConfFile();
+   // Append the tombstones for whatever we removed
+   flushZeroConfJournal();
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-void BlockDataManager_FullRAM::rewriteZeroConfFile(void)
+// Same as purgeZeroConfPool, but only looks at the tx in one newly-connected
+// block, so the cost scales with the block, not with the pool.  Anything in
+// the pool that spends the same outpoints as a block tx is a double-spend 
+// that lost, and is dropped along with its zero-conf descendants.
+uint32_t BlockDataManager_FullRAM::purgeZeroConfPoolForBlock(BlockHeaderRef & bhr)
 {
-   ofstream zcFile(zcFilename_.c_str(), ios::out | ios::binary);
+   if(zeroConfMap_.size() == 0)
+      return 0;
 
-   map<HashString, ZeroConfData>::iterator iter;
-   for(iter  = zeroConfMap_.begin();
-       iter != zeroConfMap_.end();
-       iter++)
+   uint32_t nRemoved = 0;
+   OutPoint op;
+   vector<TxRef*> const & txlist = bhr.getTxRefPtrList();
+   for(uint32_t itx=0; itx<txlist.size(); itx++)
+   {
+      TxRef & tx = *(txlist[itx]);
+      BinaryData const & txHash = tx.getThisHash();
+
+      // It confirmed:  its children in the pool are still perfectly valid
+      if(zeroConfMap_.find(txHash) != zeroConfMap_.end())
+         nRemoved += removeZeroConfTx(txHash, false);
+
+      uint8_t const * txStartPtr = tx.getPtr();
+      for(uint32_t iin=0; iin<tx.getNumTxIn(); iin++)
+      {
+         op.unserialize(txStartPtr + tx.getTxInOffset(iin));
+         map<OutPoint, HashString>::iterator spentIter;
+         spentIter = zcSpentOutPoints_.find(op);
+         if(spentIter == zcSpentOutPoints_.end())
+            continue;
+
+         BinaryData conflictHash = spentIter->second;
+         cout << "Zero-conf tx double-spent by block tx, removing: " 
+              << conflictHash.copySwapEndian().toHexStr().c_str() << endl;
+         nRemoved += removeZeroConfTx(conflictHash, true);
+      }
+   }
+
+   retractZeroConfEvictions();
+   flushZeroConfJournal();
+   return nRemoved;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+uint32_t BlockDataManager_FullRAM::removeZeroConfTx(HashString const & txHash,
+                                                   bool removeChildren)
+{
+   map<HashString, ZeroConfData>::iterator zcIter = zeroConfMap_.find(txHash);
+   if(zcIter == zeroConfMap_.end())
+      return 0;
+
+   // txHash may be a reference to the key we're about to erase
+   BinaryData thisHash = txHash;
+   TxRef & txref = zcIter->second.txref_;
+   uint32_t nTxOut = txref.getNumTxOut();
+
+   OutPoint op;
+   uint8_t const * txStartPtr = txref.getPtr();
+   for(uint32_t iin=0; iin<txref.getNumTxIn(); iin++)
+   {
+      op.unserialize(txStartPtr + txref.getTxInOffset(iin));
+      map<OutPoint, HashString>::iterator spentIter;
+      spentIter = zcSpentOutPoints_.find(op);
+      if(spentIter != zcSpentOutPoints_.end() && spentIter->second == thisHash)
+         zcSpentOutPoints_.erase(spentIter);
+   }
+
+   if(zcIter->second.inJournal_)
+   {
+      zcJournalQueue_.append((uint8_t)ZC_JOURNAL_TOMBSTONE);
+      zcJournalQueue_.append(thisHash);
+      uint64_t addRecordSize = 9 + txref.getSize();
+      zcJournalLiveBytes_ -= addRecordSize;
+      zcJournalDeadBytes_ += addRecordSize + 33;
+   }
+
+   zeroConfSeqMap_.erase(zcIter->second.seq_);
+   zcFeeRateIndex_.erase(make_pair(zcIter->second.feeRate_, zcIter->second.seq_));
+   zcPoolBytes_ -= txref.getSize();
+   zcEvictLog_.push_back(thisHash);
+   if(zcEvictLog_.size() > ZC_EVICT_LOG_MAX)
+   {
+      zcEvictLog_.pop_front();
+      zcEvictLogStart_++;
+   }
+
+   zeroConfMap_.erase(zcIter);
+   if(zeroConfMap_.size() == 0)
+      zcArenaEnd_ = 0;
+
+   uint32_t nRemoved = 1;
+   if(removeChildren)
+   {
+      for(uint32_t iout=0; iout<nTxOut; iout++)
+      {
+         map<OutPoint, HashString>::iterator spentIter;
+         spentIter = zcSpentOutPoints_.find(OutPoint(thisHash, iout));
+         if(spentIter != zcSpentOutPoints_.end())
+         {
+            BinaryData childHash = spentIter->second;
+            nRemoved += removeZeroConfTx(childHash, true);
+         }
+      }
+   }
+   return nRemoved;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// If the new tx doesn't fit at the end of the arena, squeeze out the holes
+// left by removed tx.  Only grow it if that wouldn't leave a reasonable 
+// amount of free space, so we're not doing this on every insert.
+void BlockDataManager_FullRAM::makeRoomInZeroConfArena(uint32_t nBytes)
+{
+   uint64_t capacity = zcArena_.getSize();
+   if(zcArenaEnd_ + nBytes <= capacity)
+      return;
+
+   uint64_t needBytes = zcPoolBytes_ + nBytes;
+   if(needBytes <= capacity/4*3)
+   {
+      relocateZeroConfArena(capacity);
+      return;
+   }
+
+   uint64_t newCapacity = (capacity==0 ? ZC_ARENA_INITIAL_BYTES : 2*capacity);
+   while(needBytes > newCapacity/4*3)
+      newCapacity *= 2;
+   relocateZeroConfArena(newCapacity);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pack all the live tx at the start of an arena of the given size, in
+// insertion order.  Since they were appended in that order, their offsets
+// only ever decrease, so compacting in place is safe with memmove.
+void BlockDataManager_FullRAM::relocateZeroConfArena(uint64_t newCapacity)
+{
+   bool inPlace = (newCapacity == zcArena_.getSize());
+   BinaryData newArena(0);
+   if(!inPlace)
+      newArena.resize(newCapacity);
+
+   uint8_t * base = (inPlace ? zcArena_.getPtr() : newArena.getPtr());
+   uint64_t  newEnd = 0;
+   map<uint64_t, HashString>::iterator seqIter;
+   for(seqIter  = zeroConfSeqMap_.begin();
+       seqIter != zeroConfSeqMap_.end();
+       seqIter++)
+   {
+      ZeroConfData & zc = zeroConfMap_[seqIter->second];
+      uint32_t txSize = zc.txref_.getSize();
+      memmove(base + newEnd, zcArena_.getPtr() + zc.arenaOffset_, txSize);
+      zc.arenaOffset_ = newEnd;
+      zc.txref_.self_.setRef(base + newEnd, txSize);
+      newEnd += txSize;
+   }
+
+   if(!inPlace)
+      zcArena_.swap(newArena);
+   zcArenaEnd_ = newEnd;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// We can only compute the fee if we have every tx it spends from, either in
+// the blockchain or in the pool.  If not, we call it zero:  without the
+// inputs, we can't tell it apart from a tx that pays nothing.
+uint64_t BlockDataManager_FullRAM::calcZeroConfFeeRate(TxRef & tx)
+{
+   uint64_t sumIn = 0;
+   for(uint32_t iin=0; iin<tx.getNumTxIn(); iin++)
+   {
+      OutPoint op = tx.getTxInRef(iin).getOutPoint();
+      TxRef * prevTx = getTxByHash(op.getTxHash());
+      if(prevTx == NULL || op.getTxOutIndex() >= prevTx->getNumTxOut())
+         return 0;
+      sumIn += prevTx->getTxOutRef(op.getTxOutIndex()).getValue();
+   }
+
+   uint64_t sumOut = tx.getSumOfOutputs();
+   if(sumIn <= sumOut)
+      return 0;
+   return (sumIn - sumOut) * 1000 / tx.getSize();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Drop expired tx, then drop the lowest fee-rate tx until we're within the
+// byte budget.  Either way, their descendants go with them, and they are
+// tombstoned in the journal & logged for the wallets like any other removal.
+uint32_t BlockDataManager_FullRAM::enforceZeroConfPoolLimits(void)
+{
+   uint32_t nRemoved = 0;
+
+   // Insertion order is close enough to txtime order for this purpose
+   if(zcPoolMaxAgeSec_ > 0)
+   {
+      uint64_t now = time(NULL);
+      while(zeroConfSeqMap_.size() > 0)
+      {
+         BinaryData oldestHash = zeroConfSeqMap_.begin()->second;
+         if(zeroConfMap_[oldestHash].txtime_ + zcPoolMaxAgeSec_ >= now)
+            break;
+         uint32_t nExpired = removeZeroConfTx(oldestHash, true);
+         zcNumExpired_ += nExpired;
+         nRemoved      += nExpired;
+      }
+   }
+
+   while(zcPoolBytes_ > zcPoolMaxBytes_ && zcFeeRateIndex_.size() > 0)
+   {
+      uint64_t cheapestSeq = zcFeeRateIndex_.begin()->second;
+      BinaryData cheapestHash = zeroConfSeqMap_[cheapestSeq];
+      uint32_t nEvicted = removeZeroConfTx(cheapestHash, true);
+      zcNumEvicted_ += nEvicted;
+      nRemoved      += nEvicted;
+   }
+
+   if(nRemoved > 0)
+   {
+      PDEBUG("Zero-conf pool limits reached, removed some tx");
+      retractZeroConfEvictions();
+   }
+   return nRemoved;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Every path that removes tx from the pool calls this before returning.  The
+// removed ZeroConfData nodes are already gone, but the wallets still have 
+// TxIOPairs pointing at their TxRefs, and any balance or ledger query would
+// follow them.  undoZeroConfTx only compares those pointers, so it's safe to
+// retract after the erase, as long as nothing else touches the wallets first
+void BlockDataManager_FullRAM::retractZeroConfEvictions(void)
+{
+   uint64_t evictEnd = zcEvictLogStart_ + zcEvictLog_.size();
+   set<BtcWallet*>::iterator wltIter;
+   for(wltIter  = zcWallets_.begin();
+       wltIter != zcWallets_.end();
+       wltIter++)
    {
-      ZeroConfData & zc = iter->second;
-      zcFile.write( (char*)(&zc.txtime_), sizeof(uint64_t) );
-      zcFile.write( (char*)(zc.txref_.getPtr()),  zc.txref_.getSize());
+      BtcWallet & wlt = **wltIter;
+      uint64_t evictSeen = wlt.getZeroConfEvictSeen();
+      if(!wlt.isZeroConfSynced() || evictSeen == evictEnd)
+         continue;
+
+      // Fell off the front of the log:  drop all its ZC data, and the next
+      // rescanWalletZeroConf will rebuild it from scratch
+      if(evictSeen < zcEvictLogStart_ || evictSeen > evictEnd)
+      {
+         wlt.clearZeroConfPool();
+         continue;
+      }
+
+      set<HashString> evicted;
+      for(uint64_t i=evictSeen-zcEvictLogStart_; i<zcEvictLog_.size(); i++)
+         evicted.insert(zcEvictLog_[i]);
+      wlt.undoZeroConfTx(evicted);
+      wlt.setZeroConfMarks(wlt.getZeroConfScannedSeq(), evictEnd);
    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void BlockDataManager_FullRAM::setZeroConfPoolMaxBytes(uint64_t nBytes)
+{
+   zcPoolMaxBytes_ = nBytes;
+   if(enforceZeroConfPoolLimits() > 0)
+      flushZeroConfJournal();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Zero means tx never expire
+void BlockDataManager_FullRAM::setZeroConfPoolMaxAgeSec(uint64_t nSec)
+{
+   zcPoolMaxAgeSec_ = nSec;
+   if(enforceZeroConfPoolLimits() > 0)
+      flushZeroConfJournal();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+double BlockDataManager_FullRAM::getZeroConfInsertSecAvg(void)
+{
+   if(zcNumInsertCalls_ == 0)
+      return 0;
+   return zcInsertSecTotal_ / (double)zcNumInsertCalls_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BlockDataManager_FullRAM::resetZeroConfPoolStats(void)
+{
+   zcNumExpired_     = 0;
+   zcNumEvicted_     = 0;
+   zcNumInsertCalls_ = 0;
+   zcInsertSecTotal_ = 0;
+   zcInsertSecMax_   = 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Synchronous compaction:  replace the journal with just the live records
+void BlockDataManager_FullRAM::rewriteZeroConfFile(void)
+{
+   finishZeroConfCompaction(true);
+   if(zcFilename_.size() == 0)
+      return;
 
+   BinaryData journal = serializeZeroConfPool();
+   zcJournalQueue_.resize(0);
+
+   string tempname = zcFilename_ + ".compact";
+   ofstream zcFile(tempname.c_str(), ios::out | ios::binary);
+   zcFile.write( (char*)(journal.getPtr()), journal.getSize());
    zcFile.close();
+   if(zcFile.fail() || rename(tempname.c_str(), zcFilename_.c_str()) != 0)
+   {
+      cout << "***ERROR: Could not rewrite zero-conf file" << endl;
+      cerr << "***ERROR: Could not rewrite zero-conf file" << endl;
+   }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Header plus one ADD record per pooled tx, in the order they arrived.  
+// Resets the live/dead counters to describe the journal being returned.
+BinaryData BlockDataManager_FullRAM::serializeZeroConfPool(void)
+{
+   BinaryWriter bw;
+   bw.put_BinaryData(BinaryData::CreateFromHex(ZC_JOURNAL_MAGIC_HEX));
+
+   bw.reserve(4 + zcPoolBytes_ + 9*zeroConfMap_.size());
+   map<uint64_t, HashString>::iterator seqIter;
+   for(seqIter  = zeroConfSeqMap_.begin();
+       seqIter != zeroConfSeqMap_.end();
+       seqIter++)
+   {
+      ZeroConfData & zc = zeroConfMap_[seqIter->second];
+      bw.put_uint8_t((uint8_t)ZC_JOURNAL_ADD);
+      bw.put_uint64_t(zc.txtime_);
+      bw.put_BinaryData((uint8_t*)zc.txref_.getPtr(), zc.txref_.getSize());
+      zc.inJournal_ = true;
+   }
+
+   zcJournalLiveBytes_ = bw.getData().getSize() - 4;
+   zcJournalDeadBytes_ = 0;
+   return bw.getData();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Append whatever records are queued, in one write.  Then see whether the 
+// file is worth compacting.  The pool itself is serialized here on the 
+// calling thread (it's just a memory copy), only the disk I/O goes to the 
+// background thread.
+void BlockDataManager_FullRAM::flushZeroConfJournal(void)
+{
+   // If a compaction just finished, we want to append to the new file
+   finishZeroConfCompaction(false);
+
+   if(zcJournalQueue_.getSize() > 0 && zcFilename_.size() > 0)
+   {
+      ofstream zcFile(zcFilename_.c_str(), ios::app | ios::binary);
+      zcFile.write((char*)zcJournalQueue_.getPtr(), zcJournalQueue_.getSize());
+      zcFile.close();
+
+      // These also need to go at the end of the file being compacted
+      if(zcCompactRunning_)
+         zcCompactPending_.append(zcJournalQueue_);
+   }
+   zcJournalQueue_.resize(0);
+
+   if(!zcCompactRunning_                                &&
+      zcFilename_.size() > 0                            &&
+      zcJournalDeadBytes_ > zcJournalLiveBytes_         &&
+      zcJournalDeadBytes_ > ZC_JOURNAL_COMPACT_MIN_BYTES )
+      startZeroConfCompaction();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void BlockDataManager_FullRAM::startZeroConfCompaction(void)
+{
+   PDEBUG("Compacting zero-conf journal");
+   zcCompactData_      = serializeZeroConfPool();
+   zcCompactPending_.resize(0);
+   zcCompactFilename_  = zcFilename_ + ".compact";
+   zcCompactDone_      = false;
+   zcCompactRunning_   = true;
+
+   if(pthread_create(&zcCompactThread_, NULL, zeroConfCompactThread, this) != 0)
+   {
+      // Couldn't get a thread, so just do it the slow way
+      zcCompactRunning_ = false;
+      zcCompactData_.resize(0);
+      rewriteZeroConfFile();
+   }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Only touches the members that the main thread leaves alone until the
+// compaction is finished:  zcCompactData_ and zcCompactFilename_, plus
+// zcCompactDone_ under the lock.  Returns NULL if the write failed, which
+// the main thread gets from pthread_join
+void* BlockDataManager_FullRAM::zeroConfCompactThread(void* bdmPtr)
+{
+   BlockDataManager_FullRAM* bdm = (BlockDataManager_FullRAM*)bdmPtr;
+   ofstream os(bdm->zcCompactFilename_.c_str(), ios::out | ios::binary);
+   os.write((char*)bdm->zcCompactData_.getPtr(), bdm->zcCompactData_.getSize());
+   os.close();
+   bool succeeded = !os.fail();
+
+   pthread_mutex_lock(&bdm->zcCompactLock_);
+   bdm->zcCompactDone_ = true;
+   pthread_mutex_unlock(&bdm->zcCompactLock_);
+   return (succeeded ? bdmPtr : NULL);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Returns true if a compaction was finished and swapped in.  If it is still
+// running and we're not asked to wait, we'll pick it up on a later call
+bool BlockDataManager_FullRAM::finishZeroConfCompaction(bool waitForThread)
+{
+   if(!zcCompactRunning_)
+      return false;
+
+   if(!waitForThread)
+   {
+      pthread_mutex_lock(&zcCompactLock_);
+      bool isDone = zcCompactDone_;
+      pthread_mutex_unlock(&zcCompactLock_);
+      if(!isDone)
+         return false;
+   }
+
+   void* threadResult = NULL;
+   bool succeeded = (pthread_join(zcCompactThread_, &threadResult) == 0 &&
+                     threadResult != NULL);
+   zcCompactRunning_ = false;
+
+   if(succeeded && zcCompactPending_.getSize() > 0)
+   {
+      ofstream os(zcCompactFilename_.c_str(), ios::app | ios::binary);
+      os.write((char*)zcCompactPending_.getPtr(), zcCompactPending_.getSize());
+      os.close();
+      succeeded = !os.fail();
+   }
+
+   if(succeeded)
+      succeeded = (rename(zcCompactFilename_.c_str(), zcFilename_.c_str()) == 0);
+
+   if(!succeeded)
+   {
+      // The old journal is still complete, it's just bigger than it should be
+      cout << "***WARNING: Zero-conf journal compaction failed" << endl;
+      remove(zcCompactFilename_.c_str());
+   }
+
+   zcCompactData_.resize(0);
+   zcCompactPending_.resize(0);
+   return succeeded;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
+// I used to clear the wallet's ZC data and rescan the whole pool for every
+// wallet, every time.  That's fine for a handful of tx, but every new block
+// or tx triggers it for every wallet.  Now each wallet remembers how far 
+// into the pool (by insertion sequence) it has scanned, and how many 
+// evictions it has seen, so each ZC tx is scanned once per wallet.  If the
+// wallet was never synced, or fell behind the eviction log, we fall back to
+// the full rebuild.
 void BlockDataManager_FullRAM::rescanWalletZeroConf(BtcWallet & wlt)
 {
-   // Clear the whole list, rebuild
-   // Inefficient but also irrelevant unless we have millions of
-   // zero-conf transactions per second... I'll take the risk...
+   zcWallets_.insert(&wlt);
+
    //cout << "Pre rescan:" << endl;
    //wlt.pprintAlot();
 
-   wlt.clearZeroConfPool();
-   map<HashString, ZeroConfData>::iterator iter;
-   for(iter  = zeroConfMap_.begin();
-       iter != zeroConfMap_.end();
-       iter++)
+   uint64_t evictEnd   = zcEvictLogStart_ + zcEvictLog_.size();
+   uint64_t evictSeen  = wlt.getZeroConfEvictSeen();
+   uint64_t scannedSeq = wlt.getZeroConfScannedSeq();
+   if(!wlt.isZeroConfSynced()     || 
+       evictSeen < zcEvictLogStart_ || 
+       evictSeen > evictEnd        ||
+       scannedSeq >= zcNextSeq_)
+   {
+      wlt.clearZeroConfPool();
+      scannedSeq = 0;
+   }
+   else if(evictSeen < evictEnd)
    {
-      wlt.scanTx(iter->second.txref_, 0, iter->second.txtime_, UINT32_MAX);
+      // Retract evictions before scanning new tx:  a new tx may spend the
+      // same outputs as one that was just evicted
+      set<HashString> evicted;
+      for(uint64_t i=evictSeen-zcEvictLogStart_; i<zcEvictLog_.size(); i++)
+         evicted.insert(zcEvictLog_[i]);
+      wlt.undoZeroConfTx(evicted);
    }
 
+   map<uint64_t, HashString>::iterator seqIter;
+   for(seqIter  = zeroConfSeqMap_.upper_bound(scannedSeq);
+       seqIter != zeroConfSeqMap_.end();
+       seqIter++)
+   {
+      ZeroConfData & zc = zeroConfMap_[seqIter->second];
+      wlt.scanTx(zc.txref_, 0, zc.txtime_, UINT32_MAX);
+   }
+
+   wlt.setZeroConfMarks(zcNextSeq_-1, evictEnd);
+
    //cout << "After rescan:" << endl;
    //wlt.pprintAlot();
 }
@@ -2689,9 +5038,14 @@ void BtcAddress::clearZeroConfPool(void)
 
 
 ////////////////////////////////////////////////////////////////////////////////
+// This also forces the next BDM::rescanWalletZeroConf to do a full rebuild
 void BtcWallet::clearZeroConfPool(void)
 {
    ledgerAllAddrZC_.clear();
+   zcUndoMap_.clear();
+   zcSynced_     = false;
+   zcScannedSeq_ = 0;
+   zcEvictSeen_  = 0;
    for(uint32_t i=0; i<addrMap_.size(); i++)
       addrPtrVect_[i]->clearZeroConfPool();
 
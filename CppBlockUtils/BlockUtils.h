@@ -27,11 +27,13 @@
 #include <map>
 #include <set>
 #include <limits>
+#include <pthread.h>
 
 #include "BinaryData.h"
 #include "BtcUtils.h"
 #include "BlockObj.h"
 #include "BlockObjRef.h"
+#include "TxValidation.h"
 
 #include "cryptlib.h"
 #include "sha.h"
@@ -43,6 +45,44 @@
 #define TX_NOT_EXIST       -1
 #define TX_OFF_MAIN_BRANCH -2
 
+#define WALLET_SCAN_STATE_VERSION  1
+
+// Zero-conf journal file starts with "ZCJ" + version byte.  Compaction is 
+// triggered when dead records outweigh live ones, and exceed this size
+#define ZC_JOURNAL_MAGIC_HEX          "5a434a01"
+#define ZC_JOURNAL_COMPACT_MIN_BYTES  (64*1024)
+
+// Wallets that fall further behind than this many zero-conf evictions get
+// their zero-conf state rebuilt from scratch, instead of incrementally
+#define ZC_EVICT_LOG_MAX              10000
+
+// Zero-conf pool limits:  raw tx bytes kept in the pool, and how long a tx
+// can sit in the pool before it's dropped.  Both can be changed at runtime
+#define ZC_POOL_DEFAULT_MAX_BYTES     (32*1024*1024)
+#define ZC_POOL_DEFAULT_MAX_AGE_SEC   (14*24*3600)
+#define ZC_ARENA_INITIAL_BYTES        (256*1024)
+
+// Blocks we have, but whose parent we don't.  Past this many, the oldest
+// are forgotten (they can be re-requested if the chain ever needs them)
+#define ORPHAN_POOL_DEFAULT_MAX_BLOCKS  750
+
+// In headers-only mode (BDM_MODE_NO_STORAGE), the 80-byte headers are packed
+// into one array that starts this big and doubles when full
+#define HEADER_ARENA_INITIAL_BYTES      (4096*HEADER_SIZE)
+
+// verifyBlkFileIntegrity hands headers out to its threads this many at a time
+#define VERIFY_BLOCKS_PER_CHUNK         256
+
+// Script checks queue up signatures from this many blocks' worth of TxIns
+// (give or take a block) before verifying them all at once
+#define SCRIPT_CHECK_SIGS_PER_BATCH     16384
+
+typedef enum
+{
+  ZC_JOURNAL_TOMBSTONE,
+  ZC_JOURNAL_ADD
+} ZC_JOURNAL_RECORD_TYPE;
+
 
 using namespace std;
 
@@ -114,6 +154,16 @@ public:
    bool isSpendable(void);      
    bool isMineButUnconfirmed(uint32_t currBlk, uint32_t minConf=6);
    void clearZCFields(void);
+   void clearTxIn(void) { txPtrOfInput_ = NULL;  indexOfInput_ = 0; }
+   void clearTxInZC(void)  { txPtrOfInputZC_ = NULL;  indexOfInputZC_ = 0; }
+   void clearTxOutZC(void) { txPtrOfOutputZC_ = NULL; indexOfOutputZC_ = 0;
+                             isSentToSelf_ = false; }
+
+   // Only the blockchain fields are written, ZC fields are rebuilt from the
+   // zero-conf pool.  Tx pointers are stored by hash, and looked up in the
+   // BDM on unserialize -- which fails if any tx is not in the main chain
+   void serialize(BinaryWriter & bw) const;
+   bool unserialize(BinaryRefReader & brr, BlockDataManager_FullRAM & bdm);
 
 private:
    uint64_t  amount_;
@@ -216,6 +266,9 @@ public:
    void pprint(void);
    void pprintOneLine(void);
 
+   void serialize(BinaryWriter & bw) const;
+   bool unserialize(BinaryRefReader & brr);
+
 private:
    
 
@@ -293,7 +346,8 @@ public:
    vector<LedgerEntry> & getTxLedger(void)       { return ledger_;   }
    vector<LedgerEntry> & getZeroConfLedger(void) { return ledgerZC_; }
 
-   vector<TxIOPair*> &   getTxIOList(void) { return relevantTxIOPtrs_; }
+   vector<TxIOPair*> &   getTxIOList(void)   { return relevantTxIOPtrs_;   }
+   vector<TxIOPair*> &   getTxIOListZC(void) { return relevantTxIOPtrsZC_; }
 
    void addTxIO(TxIOPair * txio, bool isZeroConf=false);
    void addTxIO(TxIOPair & txio, bool isZeroConf=false);
@@ -318,6 +372,32 @@ private:
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// WalletBlockUndo
+//
+// Everything that BtcWallet::scanTx added to the wallet for one block.  If
+// a reorg disconnects the block, we undo exactly these records, instead of
+// sweeping every ledger in the wallet looking for affected transactions.
+// The same records are kept per zero-conf tx, so that a tx leaving the 
+// zero-conf pool can be retracted without rebuilding the wallet's whole
+// zero-conf state.
+//
+////////////////////////////////////////////////////////////////////////////////
+class WalletBlockUndo
+{
+public:
+   WalletBlockUndo(void) : blockNum_(UINT32_MAX) {}
+
+   uint32_t             blockNum_;
+   vector<TxRef*>       txList_;         // relevant tx in this block
+   vector<BtcAddress*>  addrList_;       // addresses that got ledger entries
+   vector<OutPoint>     txOutsCreated_;  // TxIOPairs created by this block
+   vector<OutPoint>     txInsSpent_;     // TxIOPairs spent by this block
+};
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // BtcWallet
@@ -328,7 +408,9 @@ class BtcWallet
 
 
 public:
-   BtcWallet(void) {}
+   BtcWallet(void) : zcSynced_(false), zcScannedSeq_(0), zcEvictSeen_(0),
+                     scanAddr20_(20) {}
+   ~BtcWallet(void);
 
    /////////////////////////////////////////////////////////////////////////////
    void addAddress(BtcAddress const & newAddr);
@@ -400,6 +482,38 @@ public:
 
    bool isOutPointMine(BinaryData const & hsh, uint32_t idx);
 
+   // Disconnect every block above the branch point, using the undo journal.
+   // Ledger entries for tx that are no longer in the main chain are marked
+   // invalid;  those still in the main chain are removed, to be re-added
+   // with the correct block number when the new branch is scanned
+   uint32_t undoBlocksAbove(uint32_t branchHeight);
+   uint32_t getNumUndoBlocks(void) { return blockUndoMap_.size(); }
+
+   // Re-sort only the ledger entries above the branch point, once the new
+   // branch has been scanned after undoBlocksAbove
+   void     sortLedgerAbove(uint32_t branchHeight);
+
+   // Remove everything the given zero-conf tx added to the wallet.  Hashes
+   // of tx that we never scanned (or weren't relevant) are ignored
+   uint32_t undoZeroConfTx(set<HashString> const & txHashes);
+
+   // Where this wallet is, in the BDM's zero-conf pool:  the last insertion
+   // sequence number scanned, and the number of pool evictions processed.
+   // Set by BDM::rescanWalletZeroConf, cleared by clearZeroConfPool
+   bool     isZeroConfSynced(void)      { return zcSynced_;     }
+   uint64_t getZeroConfScannedSeq(void) { return zcScannedSeq_; }
+   uint64_t getZeroConfEvictSeen(void)  { return zcEvictSeen_;  }
+   void     setZeroConfMarks(uint64_t scannedSeq, uint64_t evictSeen);
+
+   // Compact snapshot of everything the blockchain scan has produced (TxIOs,
+   // ledgers, address metadata, undo journal), so that we don't have to 
+   // rescan from block 0 on every restart.  Zero-conf data is not included.
+   // Use BDM::getWalletScanState/loadWalletScanState, which add the tip hash
+   void serializeScanState(BinaryWriter & bw);
+   bool unserializeScanState(BinaryRefReader & brr, 
+                             BlockDataManager_FullRAM & bdm);
+   void clearScanState(void);
+
    void pprintLedger(void);
    void pprintAlot(void);
 
@@ -422,6 +536,23 @@ private:
    // For non-std transactions
    map<OutPoint, TxIOPair>      nonStdTxioMap_;
    set<OutPoint>                nonStdUnspentOutPoints_;
+
+   // Undo journal, keyed by block height, and by tx hash for zero-conf
+   map<uint32_t, WalletBlockUndo> blockUndoMap_;
+   map<HashString, WalletBlockUndo> zcUndoMap_;
+
+   bool                         zcSynced_;
+   uint64_t                     zcScannedSeq_;
+   uint64_t                     zcEvictSeen_;
+
+   // Scratch space for the scanTx bulk filter, kept so that scanning a whole
+   // blockchain doesn't allocate per tx.  Per-wallet, so that two wallets
+   // can be scanned from different threads
+   OutPoint                     scanOutPoint_;
+   BinaryData                   scanAddr20_;
+   vector<uint8_t const *>      scanPubKeyPtrs_;
+   vector<uint32_t>             scanPubKeyLens_;
+   BinaryData                   scanPubKeyHashes_;
 };
 
 
@@ -430,9 +561,15 @@ private:
 class ZeroConfData
 {
 public:
-   TxRef         txref_;   
+   ZeroConfData(void) : 
+      txtime_(0), arenaOffset_(0), inJournal_(false), seq_(0), feeRate_(0) {}
+
+   TxRef         txref_;       // points into the BDM's zero-conf arena
    uint64_t      txtime_;
-   list<BinaryData>::iterator iter_;
+   uint64_t      arenaOffset_;
+   bool          inJournal_;   // has an ADD record in the zero-conf file
+   uint64_t      seq_;         // insertion order, key into zeroConfSeqMap_
+   uint64_t      feeRate_;     // satoshis per 1000 bytes, 0 if unknown
 
 };
 
@@ -511,6 +648,116 @@ typedef enum
 class BlockDataManager_FullRAM;
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// BlockBatchResult
+//
+// What happened when a batch of blocks was added with BDM::addNewBlocks.
+// The branch point is the highest block that the old and new main chains
+// have in common -- if there was no reorg, it's just the previous top block.
+//
+////////////////////////////////////////////////////////////////////////////////
+class BlockBatchResult
+{
+   friend class BlockDataManager_FullRAM;
+
+public:
+   BlockBatchResult(void) :
+      numBlocksAdded_(0),
+      numDuplicates_(0),
+      numFailed_(0),
+      numOrphansReconnected_(0),
+      isReorg_(false),
+      prevTopHash_(0),
+      newTopHash_(0),
+      newTopHeight_(0),
+      branchPointHash_(0),
+      branchPointHeight_(0) {}
+
+   uint32_t             getNumBlocksAdded(void) const  { return numBlocksAdded_; }
+   uint32_t             getNumDuplicates(void) const   { return numDuplicates_;  }
+   uint32_t             getNumFailed(void) const       { return numFailed_;      }
+   uint32_t             getNumOrphans(void) const { return orphanHashes_.size(); }
+   uint32_t             getNumOrphansReconnected(void) const 
+                                             { return numOrphansReconnected_; }
+   bool                 isReorg(void) const            { return isReorg_;        }
+   BinaryData const &   getPrevTopHash(void) const     { return prevTopHash_;    }
+   BinaryData const &   getNewTopHash(void) const      { return newTopHash_;     }
+   uint32_t             getNewTopHeight(void) const    { return newTopHeight_;   }
+   BinaryData const &   getBranchPointHash(void) const { return branchPointHash_;}
+   uint32_t             getBranchPointHeight(void) const 
+                                                 { return branchPointHeight_; }
+   vector<BinaryData> const & getOrphanHashes(void) const 
+                                                 { return orphanHashes_;      }
+
+private:
+   uint32_t             numBlocksAdded_;   // parsed & added to the maps
+   uint32_t             numDuplicates_;    // already had these, skipped
+   uint32_t             numFailed_;        // bad/truncated data
+   uint32_t             numOrphansReconnected_; // linked in when their parent came
+   bool                 isReorg_;
+   BinaryData           prevTopHash_;
+   BinaryData           newTopHash_;
+   uint32_t             newTopHeight_;
+   BinaryData           branchPointHash_;
+   uint32_t             branchPointHeight_;
+   vector<BinaryData>   orphanHashes_;     // added, but parent is unknown
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ScriptCheckResult
+//
+// Totals from BDM::checkBlockScripts and friends.  Every non-coinbase TxIn
+// ends up in exactly one of the valid/invalid/nonstandard/no-prevout counts
+// (see TxValidation.h).  A block is listed as bad if it has any invalid
+// TxIn, and a tx if any of its TxIns are invalid.
+//
+////////////////////////////////////////////////////////////////////////////////
+class ScriptCheckResult
+{
+   friend class BlockDataManager_FullRAM;
+
+public:
+   ScriptCheckResult(void) :
+      numBlocks_(0),
+      numTxIn_(0),
+      numValid_(0),
+      numInvalid_(0),
+      numNonStandard_(0),
+      numNoPrevOut_(0),
+      numSigChecks_(0),
+      numSigCacheHits_(0) {}
+
+   uint32_t  getNumBlocks(void) const      { return numBlocks_;      }
+   uint32_t  getNumTxIn(void) const        { return numTxIn_;        }
+   uint32_t  getNumValid(void) const       { return numValid_;       }
+   uint32_t  getNumInvalid(void) const     { return numInvalid_;     }
+   uint32_t  getNumNonStandard(void) const { return numNonStandard_; }
+   uint32_t  getNumNoPrevOut(void) const   { return numNoPrevOut_;   }
+   uint32_t  getNumSigChecks(void) const   { return numSigChecks_;   }
+   uint32_t  getNumSigCacheHits(void) const { return numSigCacheHits_; }
+   bool      allValid(void) const { return badBlockHashes_.size() == 0; }
+   vector<BinaryData> const & getBadBlockHashes(void) const 
+                                                 { return badBlockHashes_; }
+   vector<BinaryData> const & getBadTxHashes(void) const 
+                                                 { return badTxHashes_;    }
+
+private:
+   uint32_t             numBlocks_;
+   uint32_t             numTxIn_;
+   uint32_t             numValid_;
+   uint32_t             numInvalid_;
+   uint32_t             numNonStandard_;
+   uint32_t             numNoPrevOut_;
+   uint32_t             numSigChecks_;     // EC verifications actually done
+   uint32_t             numSigCacheHits_;  // skipped, already verified
+   vector<BinaryData>   badBlockHashes_;
+   vector<BinaryData>   badTxHashes_;
+};
+
 
 
 
@@ -523,6 +770,8 @@ class BlockDataManager_FullRAM;
 ////////////////////////////////////////////////////////////////////////////////
 class BlockDataManager_FullRAM
 {
+   friend class BtcWallet;
+
 private:
 
    // These four data structures contain all the *real* data.  Everything 
@@ -533,14 +782,85 @@ private:
    map<HashString, BlockHeaderRef>    headerHashMap_;
    map<HashString, TxRef>             txHashMap_;
 
-   // Need a separate memory pool just for zero-confirmation transactions
-   // We need the second map to make sure we can find the data to remove
-   // it, when necessary
-   list<BinaryData>                   zeroConfTxList_;
+   // In headers-only mode, none of the block data is kept:  the headers 
+   // point into this array instead, and txHashMap_ stays empty
+   BDM_MODE                           bdmMode_;
+   BinaryData                         headerArena_;
+   uint64_t                           headerArenaEnd_;
+   uint32_t                           numBadMerkleBlocks_;
+
+   // Lowest block height that failed the last verifyBlkFileIntegrity, or -1
+   int32_t                            firstBadBlockHeight_;
+
+   // Scratch for parsing one block:  its tx, and their hashes done in one
+   // batch.  Reused from block to block, so it only grows to the largest
+   vector<uint8_t const *>            parseTxPtrs_;
+   vector<uint32_t>                   parseTxLens_;
+   BinaryData                         parseTxHashes_;
+
+   // Optional script/signature checks on blocks as they're loaded or added.
+   // Bad blocks are reported, but still accepted like any other block.  
+   // Zero-conf tx with bad signatures are rejected, and the signatures of 
+   // the ones we keep are cached for when they show up in a block
+   bool                               scriptCheckEnabled_;
+   uint32_t                           scriptCheckThreads_;
+   ScriptCheckResult                  lastScriptCheck_;
+   SigCheckCache                      sigCheckCache_;
+
+   // Need a separate memory pool just for zero-confirmation transactions.
+   // The raw tx are packed end-to-end in one arena, in insertion order.  
+   // Removed tx leave holes, which are squeezed out when we run out of 
+   // room at the end.  Moving the arena re-points the TxRefs in the map,
+   // so TxRef* into the pool stay valid, but their data pointers do not.
+   BinaryData                         zcArena_;
+   uint64_t                           zcArenaEnd_;
+   uint64_t                           zcPoolBytes_;      // live tx bytes
    map<HashString, ZeroConfData>      zeroConfMap_;
+   map<OutPoint, HashString>          zcSpentOutPoints_;  // -> ZC tx spending it
+
+   // Wallets only scan tx added since their last rescan, and retract tx 
+   // that were evicted since then.  Sequence numbers are never reused, and
+   // zcEvictLogStart_ is the total eviction count before zcEvictLog_[0]
+   map<uint64_t, HashString>          zeroConfSeqMap_;
+   uint64_t                           zcNextSeq_;
+   deque<HashString>                  zcEvictLog_;
+   uint64_t                           zcEvictLogStart_;
+
+   // Wallets holding TxIOPairs that point into the pool.  Removed tx are
+   // retracted from all of them before we return, since the TxRefs they
+   // point to are gone.  Wallets add themselves by rescanning, and drop out
+   // when they're destroyed
+   set<BtcWallet*>                    zcWallets_;
+
+   // When the pool is over budget, tx past the max age go first, then the
+   // lowest fee-rate (oldest first among equals).  Key is (feeRate, seq)
+   set< pair<uint64_t, uint64_t> >    zcFeeRateIndex_;
+   uint64_t                           zcPoolMaxBytes_;
+   uint64_t                           zcPoolMaxAgeSec_;
+   uint64_t                           zcNumExpired_;
+   uint64_t                           zcNumEvicted_;
+   uint64_t                           zcNumInsertCalls_;
+   double                             zcInsertSecTotal_;
+   double                             zcInsertSecMax_;
+
    bool                               zcEnabled_;
    string                             zcFilename_;
 
+   // The zero-conf file is an append-only journal:  ADD records for new tx,
+   // TOMBSTONE records when they leave the pool.  Records are queued and 
+   // written once per operation, and the file is rewritten with only the 
+   // live records by a background thread once it's mostly dead weight.
+   BinaryData                         zcJournalQueue_;
+   uint64_t                           zcJournalLiveBytes_;
+   uint64_t                           zcJournalDeadBytes_;
+   pthread_t                          zcCompactThread_;
+   bool                               zcCompactRunning_;
+   bool                               zcCompactDone_;    // under the lock
+   pthread_mutex_t                    zcCompactLock_;
+   BinaryData                         zcCompactData_;
+   BinaryData                         zcCompactPending_;
+   string                             zcCompactFilename_;
+
    // This is for detecting external changes made to the blk0001.dat file
    uint64_t                           lastEOFByteLoc_;
    uint64_t                           totalBlockchainBytes_;
@@ -569,9 +889,15 @@ private:
    set<HashString>                   txJustInvalidated_;
    set<HashString>                   txJustAffected_;
 
-   // Store info on orphan chains
+   // Store info on orphan chains.  Every orphan header is in the pool, keyed
+   // by its parent's hash -- for the bottom of an orphan chain that's the
+   // hash of the block we're missing, for the rest it's another orphan.
    vector<BlockHeaderRef*>           previouslyValidBlockHeaderPtrs_;
-   vector<BlockHeaderRef*>           orphanChainStartBlocks_;
+   multimap<HashString, BlockHeaderRef*> orphanPool_;
+   deque<HashString>                 orphanArrival_;
+   vector<BlockHeaderRef*>           orphansJustReconnected_;
+   uint32_t                          orphanPoolMaxBlocks_;
+   uint32_t                          numOrphansEvicted_;
 
    static BlockDataManager_FullRAM* theOnlyBDM_;
    static bool bdmCreatedYet_;
@@ -597,6 +923,13 @@ public:
                              BinaryData const & MagicBytes);
    void SelectNetwork(string netName);
 
+   // Only BDM_MODE_FULL_BLOCKCHAIN and BDM_MODE_NO_STORAGE (headers-only)
+   // are implemented.  Must be selected before any blocks are loaded.
+   bool     SelectMode(BDM_MODE mode);
+   BDM_MODE getMode(void)                { return bdmMode_;             }
+   uint64_t getHeaderArenaBytes(void)    { return headerArena_.getSize(); }
+   uint32_t getNumBadMerkleBlocks(void)  { return numBadMerkleBlocks_;  }
+
    /////////////////////////////////////////////////////////////////////////////
    void Reset(void);
    int32_t          getNumConfirmations(BinaryData txHash);
@@ -620,6 +953,15 @@ public:
    vector<bool>     addNewBlockDataRef(BinaryDataRef nonPermBlockDataRef,
                                        bool writeToBlk0001=false);
 
+   // Same thing for many blocks at once, but the chain is only organized
+   // (and the ZC pool purged) once, after all the blocks are parsed.  Each
+   // raw block is in the same [magic|size|block] format as the blk file, 
+   // and the Raw version takes them all concatenated, like the blk file.
+   BlockBatchResult addNewBlocks(vector<BinaryData> const & rawBlocks,
+                                 bool writeToBlk0001=false);
+   BlockBatchResult addNewBlocksRaw(BinaryDataRef rawBlocksConcat,
+                                    bool writeToBlk0001=false);
+
    void             reassessAfterReorg(BlockHeaderRef* oldTopPtr,
                                        BlockHeaderRef* newTopPtr,
                                        BlockHeaderRef* branchPtr );
@@ -649,7 +991,28 @@ public:
    // This is extremely slow and RAM-hungry, but may be useful on occasion
    uint32_t       readBlkFile_FromScratch(string filename, bool doOrganize=true);
    uint32_t       readBlkFileUpdate(string filename="");
-   bool           verifyBlkFileIntegrity(void);
+   // Merkle roots and proof-of-work for every header, split across 
+   // numThreads threads (0 means one per core)
+   bool           verifyBlkFileIntegrity(uint32_t numThreads=0);
+   int32_t        getFirstBadBlockHeight(void) { return firstBadBlockHeight_; }
+
+   // Checks the scripts and signatures of every non-coinbase TxIn, looking
+   // up the TxOuts they spend in the BDM.  Signatures from many blocks are
+   // verified together, split across numThreads threads (0: one per core).
+   // When enabled, readBlkFile_FromScratch checks the whole main chain, 
+   // addNewBlockData/addNewBlocks check the blocks that joined it, and
+   // addNewZeroConfTx turns away tx with invalid signatures.
+   ScriptCheckResult checkBlockScripts(BlockHeaderRef & bhr, 
+                                       uint32_t numThreads=0);
+   ScriptCheckResult checkMainChainScripts(uint32_t startHeight=0,
+                                           uint32_t endHeight=UINT32_MAX,
+                                           uint32_t numThreads=0);
+   // Refused in headers-only mode, where there are no tx to check
+   bool     setScriptValidation(bool enable, uint32_t numThreads=0);
+   bool     isScriptValidationEnabled(void) { return scriptCheckEnabled_; }
+   ScriptCheckResult const & getLastScriptCheckResult(void) 
+                                                { return lastScriptCheck_; }
+   SigCheckCache &  getSigCheckCache(void)     { return sigCheckCache_;   }
    void           scanBlockchainForTx_FromScratch_AllAddr(void);
    vector<TxRef*> findAllNonStdTx(void);
    
@@ -659,9 +1022,30 @@ public:
    void disableZeroConf(string);
    void readZeroConfFile(string);
    bool addNewZeroConfTx(BinaryData const & rawTx, uint64_t txtime, bool writeToFile);
+   bool addNewZeroConfTxRef(BinaryDataRef rawTx, uint64_t txtime, bool writeToFile);
    void purgeZeroConfPool(void);
+   uint32_t purgeZeroConfPoolForBlock(BlockHeaderRef & bhr);
    void pprintZeroConfPool(void);
    void rewriteZeroConfFile(void);
+
+   // Pool limits, and some stats for keeping an eye on it.  Lowering the
+   // limits evicts immediately.  Insert times include any evictions.
+   void     setZeroConfPoolMaxBytes(uint64_t nBytes);
+   void     setZeroConfPoolMaxAgeSec(uint64_t nSec);
+   uint64_t getZeroConfPoolMaxBytes(void)  { return zcPoolMaxBytes_;       }
+   uint64_t getZeroConfPoolMaxAgeSec(void) { return zcPoolMaxAgeSec_;      }
+   uint32_t getZeroConfPoolSize(void)      { return zeroConfMap_.size();   }
+   uint64_t getZeroConfPoolBytes(void)     { return zcPoolBytes_;          }
+   uint64_t getZeroConfArenaBytes(void)    { return zcArena_.getSize();    }
+   uint64_t getZeroConfNumExpired(void)    { return zcNumExpired_;         }
+   uint64_t getZeroConfNumEvicted(void)    { return zcNumEvicted_;         }
+   uint64_t getZeroConfNumInsertCalls(void){ return zcNumInsertCalls_;     }
+   double   getZeroConfInsertSecMax(void)  { return zcInsertSecMax_;       }
+   double   getZeroConfInsertSecAvg(void);
+   void     resetZeroConfPoolStats(void);
+
+   // Only scans tx added to the pool since the wallet's last rescan, and 
+   // retracts the ones evicted since then
    void rescanWalletZeroConf(BtcWallet & wlt);
 
 
@@ -670,11 +1054,29 @@ public:
    //        blockchain containing two equal-length chains
    bool organizeChain(bool forceRebuild=false);
 
+   // Orphans are linked in as soon as their parent shows up.  Lowering the
+   // limit evicts the oldest orphans on the next organizeChain call
+   void     setOrphanPoolMaxBlocks(uint32_t n) { orphanPoolMaxBlocks_ = n;    }
+   uint32_t getOrphanPoolMaxBlocks(void)  { return orphanPoolMaxBlocks_;      }
+   uint32_t getOrphanPoolSize(void)       { return orphanPool_.size();        }
+   uint32_t getNumOrphansEvicted(void)    { return numOrphansEvicted_;        }
+   uint32_t getNumOrphansJustReconnected(void) 
+                                    { return orphansJustReconnected_.size(); }
+
    /////////////////////////////////////////////////////////////////////////////
    bool             isLastBlockReorg(void)     {return lastBlockWasReorg_;}
    set<HashString>  getTxJustInvalidated(void) {return txJustInvalidated_;}
    set<HashString>  getTxJustAffected(void)    {return txJustAffected_;}
    void             updateWalletAfterReorg(BtcWallet & wlt);
+
+   // Wallet scan snapshots, tagged with the top block they were synced to.
+   // Loading one scans only the blocks after that tip, or does a full rescan
+   // if the snapshot is unusable (returns false in that case)
+   BinaryData       getWalletScanState(BtcWallet & wlt);
+   bool             loadWalletScanState(BtcWallet & wlt, 
+                                        BinaryData const & snapshot);
+   bool             writeWalletScanStateFile(BtcWallet & wlt, string filename);
+   bool             readWalletScanStateFile(BtcWallet & wlt, string filename);
    void             updateWalletsAfterReorg(vector<BtcWallet*> wlt);
 
    // Use these two methods to get ALL information about your unused TxOuts
@@ -692,13 +1094,50 @@ private:
 
    /////////////////////////////////////////////////////////////////////////////
    // Start from a node, trace down to the highest solved block, accumulate
-   // difficulties and difficultySum values.  Return the difficultySum of 
-   // this block.
-   double traceChainDown(BlockHeaderRef & bhpStart);
-   void   markOrphanChain(BlockHeaderRef & bhpStart);
-
-
-   
+   // chain work and difficultySum values.  Return the chain work of this
+   // block.
+   UInt256 traceChainDown(BlockHeaderRef & bhpStart);
+   bool    parseNewBlockHeaderOnly(uint8_t const * blkPtr, 
+                                   uint32_t nBytes,
+                                   uint64_t blkByteLoc);
+   uint32_t readBlkFileHeadersOnly(ifstream & is, uint64_t filesize);
+   void    markOrphanChain(vector<BlockHeaderRef*> const & chain);
+   bool    isInOrphanPool(BlockHeaderRef & bhr);
+   void    connectOrphanChildren(BlockHeaderRef & parent);
+   void    enforceOrphanPoolLimit(void);
+
+   // Script checks for a list of headers, and the hook for the ones that
+   // just joined the main chain above the given height
+   ScriptCheckResult checkScripts(vector<BlockHeaderRef*> const & headers,
+                                  uint32_t numThreads);
+   void    checkNewMainChainScripts(uint32_t fromHeight);
+   bool    checkZeroConfScripts(TxRef & tx);
+
+   // Parse & organize a batch that's already in its permanent location
+   BlockBatchResult addNewBlockBatch(BinaryData const & permBlockData,
+                                     bool writeToBlk0001);
+
+   // Remove one tx from the zero-conf pool and the spent-outpoint index.  If
+   // it was double-spent, anything in the pool spending its outputs goes too
+   uint32_t removeZeroConfTx(HashString const & txHash, bool removeChildren);
+
+   // Zero-conf journal helpers
+   void       flushZeroConfJournal(void);
+   BinaryData serializeZeroConfPool(void);
+   void       startZeroConfCompaction(void);
+   bool       finishZeroConfCompaction(bool waitForThread);
+   static void* zeroConfCompactThread(void* bdmPtr);
+
+   // Zero-conf arena and pool limits
+   bool       insertZeroConfTx(BinaryDataRef rawTx, 
+                               uint64_t txtime, 
+                               bool writeToFile);
+   void       makeRoomInZeroConfArena(uint32_t nBytes);
+   void       relocateZeroConfArena(uint64_t newCapacity);
+   uint64_t   calcZeroConfFeeRate(TxRef & tx);
+   uint32_t   enforceZeroConfPoolLimits(void);
+   void       retractZeroConfEvictions(void);
+   static void forgetWallet(BtcWallet* wlt);
 };
 
 
@@ -2,12 +2,17 @@
 #include <fstream>
 #include <string>
 #include <sstream>
+#include <cstdlib>
 #include "UniversalTimer.h"
 #include "BinaryData.h"
 #include "BtcUtils.h"
 #include "BlockUtils.h"
 #include "EncryptionUtils.h"
+#include "CoinSelection.h"
 
+#ifdef USE_NATIVE_SECP256K1
+   #include "Secp256k1.h"
+#endif
 
 using namespace std;
 
@@ -21,15 +26,56 @@ void copyFile(string src, string dst)
    while(!fin.eof()) { fin.get(c); fout.put(c); }
 }
 
+// Scratch files go in the temp dir, not wherever the tests are run from
+string getTempFilePath(string name)
+{
+   char const * tmpDir = getenv("TMPDIR");
+#ifdef _MSC_VER
+   if(tmpDir == NULL)
+      tmpDir = getenv("TEMP");
+   if(tmpDir == NULL)
+      tmpDir = ".";
+#else
+   if(tmpDir == NULL)
+      tmpDir = "/tmp";
+#endif
+   return string(tmpDir) + "/" + name;
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////
 void TestReadAndOrganizeChain(string blkfile);
+void TestHeadersOnly(string blkfile);
+void TestVerifyIntegrity(string blkfile);
+void TestBlockScripts(string blkfile);
+void TestSigCheckCache(string blkfile);
+void TestSigHashAndMultisig(void);
+void TestMerkleBranch(string blkfile);
 void TestFindNonStdTx(string blkfile);
 void TestScanForWalletTx(string blkfile);
 void TestReorgBlockchain(string blkfile);
+void TestWalletScanState(string blkfile);
+void TestAddNewBlocks(void);
+void TestOrphanPool(void);
+void TestChainWork(void);
 void TestZeroConf(void);
+void TestZeroConfEviction(void);
+void TestZeroConfMinedParent(void);
+void TestReorgLedgerOrder(void);
+void TestTxCalcLengthBounded(void);
 void TestCrypto(void);
+void TestKdfBenchmark(void);
+void TestKdfCalibration(void);
+void TestAesReencryptBatch(void);
+void TestSecureArena(void);
+void TestHash256Batch(void);
+void TestHash160Batch(void);
 void TestECDSA(void);
+void TestSecp256k1Benchmark(void);
+void TestVerifyBatch(void);
+void TestSignBatch(void);
+void TestChainedKeyBatch(void);
+void TestCoinSelection(void);
 ////////////////////////////////////////////////////////////////////////////////
 
 void printTestHeader(string TestName)
@@ -53,6 +99,24 @@ int main(void)
    //printTestHeader("Read-and-Organize-Blockchain");
    //TestReadAndOrganizeChain(blkfile);
 
+   //printTestHeader("Read-Blockchain-Headers-Only");
+   //TestHeadersOnly(blkfile);
+
+   //printTestHeader("Verify-Blockchain-Integrity");
+   //TestVerifyIntegrity(blkfile);
+
+   //printTestHeader("Block-Script-Validation");
+   //TestBlockScripts(blkfile);
+
+   //printTestHeader("Signature-Cache-ZC-Then-Block");
+   //TestSigCheckCache(blkfile);
+
+   //printTestHeader("SigHash-DER-Multisig-Known-Answers");
+   //TestSigHashAndMultisig();
+
+   //printTestHeader("Merkle-Branches");
+   //TestMerkleBranch(blkfile);
+
    //printTestHeader("Find-Non-Standard-Tx");
    //TestFindNonStdTx(blkfile);
 
@@ -62,15 +126,72 @@ int main(void)
    //printTestHeader("Blockchain-Reorg-Unit-Test");
    //TestReorgBlockchain(blkfile);
 
+   //printTestHeader("Wallet-Scan-State-Snapshot");
+   //TestWalletScanState(blkfile);
+
+   //printTestHeader("Add-Block-Batch-With-Reorg");
+   //TestAddNewBlocks();
+
+   //printTestHeader("Orphan-Blocks-Reconnect");
+   //TestOrphanPool();
+
+   //printTestHeader("Chain-Work-Known-Answers");
+   //TestChainWork();
+
    printTestHeader("Testing Zero-conf handling");
    TestZeroConf();
 
+   //printTestHeader("Zero-conf-Eviction-Before-Rescan");
+   //TestZeroConfEviction();
+
+   //printTestHeader("Zero-conf-Child-Of-Mined-Parent");
+   //TestZeroConfMinedParent();
+
+   //printTestHeader("Ledger-Order-After-Reorg");
+   //TestReorgLedgerOrder();
+
+   //printTestHeader("Tx-Length-Of-Torn-Records");
+   //TestTxCalcLengthBounded();
+
    //printTestHeader("Crypto-KDF-and-AES-methods");
    //TestCrypto();
 
+   //printTestHeader("KDF-Fixed-Params-Wall-Time");
+   //TestKdfBenchmark();
+
+   //printTestHeader("KDF-Calibration-Profile");
+   //TestKdfCalibration();
+
+   //printTestHeader("Wallet-Passphrase-Change-100k-Keys");
+   //TestAesReencryptBatch();
+
+   //printTestHeader("Secure-Memory-Arena");
+   //TestSecureArena();
+
+   //printTestHeader("Batched-Hash256-Throughput");
+   //TestHash256Batch();
+
+   //printTestHeader("Batched-Hash160-Throughput");
+   //TestHash160Batch();
+
    //printTestHeader("Crypto-ECDSA-sign-verify");
    //TestECDSA();
 
+   //printTestHeader("Native-secp256k1-vs-CryptoPP");
+   //TestSecp256k1Benchmark();
+
+   //printTestHeader("Batched-ECDSA-Verification");
+   //TestVerifyBatch();
+
+   //printTestHeader("Batched-ECDSA-Signing");
+   //TestSignBatch();
+
+   //printTestHeader("Batched-Chained-Keys-vs-One-At-A-Time");
+   //TestChainedKeyBatch();
+
+   //printTestHeader("Coin-Selection-Synthetic-UTXOs");
+   //TestCoinSelection();
+
    /////////////////////////////////////////////////////////////////////////////
    // ***** Print out all timings to stdout and a csv file *****
    //       Any method, anywhere, that called UniversalTimer
@@ -110,16 +231,503 @@ void TestReadAndOrganizeChain(string blkfile)
    cout << endl << endl;
 
    /////////////////////////////////////////////////////////////////////////////
-   // TESTNET has some 0.125-difficulty blocks which violates the assumption
-   // that it never goes below 1.  So, need to comment this out for testnet
-   /*  For whatever reason, this doesn't work on testnet...
-   cout << "Verify integrity of blockchain file (merkleroots leading zeros on headers)" << endl;
+   // Headers are checked against their full target now, so the testnet
+   // 0.125-difficulty blocks pass too
+   cout << "Verify integrity of blockchain file (merkle roots, proof-of-work)" << endl;
    TIMER_START("Verify blk0001.dat integrity");
    bool isVerified = bdm.verifyBlkFileIntegrity();
    TIMER_STOP("Verify blk0001.dat integrity");
    cout << "Done!   Your blkfile " << (isVerified ? "is good!" : " HAS ERRORS") << endl;
    cout << endl << endl;
-   */
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Should give the same answer on any number of threads, and get faster with
+// more of them, up to the number of cores
+void TestVerifyIntegrity(string blkfile)
+{
+   BlockDataManager_FullRAM & bdm = BlockDataManager_FullRAM::GetInstance(); 
+   bdm.Reset();
+   bdm.SelectNetwork("Main");
+   bdm.readBlkFile_FromScratch(blkfile);
+
+   uint32_t threadCounts[5] = {1, 2, 4, 8, 0};
+   for(uint32_t i=0; i<5; i++)
+   {
+      // UniversalTimer uses clock(), which adds up the CPU time of all the
+      // threads, so use the wall clock here
+      time_t startTime = time(0);
+      bool isVerified = bdm.verifyBlkFileIntegrity(threadCounts[i]);
+      cout << "Threads: " << threadCounts[i] 
+           << "   Good: " << (isVerified ? "yes" : "NO")
+           << "   First bad height: " << bdm.getFirstBadBlockHeight()
+           << "   Time: " << (time(0)-startTime) << " sec" << endl;
+   }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Checks every TxIn script and signature on the main chain.  The counts 
+// should be the same on any number of threads, with no invalid TxIns on
+// the real blockchain, and the TxIn rate should go up with more cores
+void TestBlockScripts(string blkfile)
+{
+   BlockDataManager_FullRAM & bdm = BlockDataManager_FullRAM::GetInstance(); 
+   bdm.Reset();
+   bdm.SelectNetwork("Main");
+
+   // As a load stage, with one thread per core
+   bdm.setScriptValidation(true);
+   time_t startTime = time(0);
+   bdm.readBlkFile_FromScratch(blkfile);
+   ScriptCheckResult const & loadResult = bdm.getLastScriptCheckResult();
+   cout << "Load with script checks: " << (time(0)-startTime) << " sec, "
+        << loadResult.getBadBlockHashes().size() << " bad blocks" << endl;
+   bdm.setScriptValidation(false);
+
+   uint32_t threadCounts[5] = {1, 2, 4, 8, 0};
+   for(uint32_t i=0; i<5; i++)
+   {
+      // Wall clock, like TestVerifyIntegrity
+      startTime = time(0);
+      ScriptCheckResult result = bdm.checkMainChainScripts(0, UINT32_MAX,
+                                                           threadCounts[i]);
+      uint32_t nSec = max((uint32_t)(time(0)-startTime), (uint32_t)1);
+      cout << "Threads: " << threadCounts[i] 
+           << "   Blocks: "  << result.getNumBlocks()
+           << "   TxIns: "   << result.getNumTxIn()
+           << "   Sigs: "    << result.getNumSigChecks()
+           << "   Time: "    << nSec << " sec"
+           << "   TxIn/s: "  << result.getNumTxIn()/nSec << endl;
+      cout << "   Valid: "       << result.getNumValid()
+           << "   Invalid: "     << result.getNumInvalid()
+           << "   Nonstandard: " << result.getNumNonStandard()
+           << "   No prevout: "  << result.getNumNoPrevOut() << endl;
+   }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// The last few hundred blocks, checked with an empty signature cache, and 
+// again after their tx went through the cache the way zero-conf tx do.
+// The second pass should do (almost) no EC verifications at all
+void TestSigCheckCache(string blkfile)
+{
+   BlockDataManager_FullRAM & bdm = BlockDataManager_FullRAM::GetInstance(); 
+   bdm.Reset();
+   bdm.SelectNetwork("Main");
+   bdm.readBlkFile_FromScratch(blkfile);
+
+   uint32_t topHeight = bdm.getTopBlockHeader().getBlockHeight();
+   uint32_t startHeight = (topHeight > 300 ? topHeight-300 : 0);
+   SigCheckCache & cache = bdm.getSigCheckCache();
+   cache.clear();
+
+   TIMER_START("CheckScripts_Cold");
+   ScriptCheckResult cold = bdm.checkMainChainScripts(startHeight, topHeight);
+   TIMER_STOP("CheckScripts_Cold");
+
+   // What addNewZeroConfTx does with script checks on, minus the pool
+   ScriptCheckBatch batch;
+   batch.setSigCache(&cache, true);
+   for(uint32_t h=startHeight; h<=topHeight; h++)
+   {
+      vector<TxRef*> & txList = bdm.getHeaderByHeight(h)->getTxRefPtrList();
+      for(uint32_t t=1; t<txList.size(); t++)
+         for(uint32_t i=0; i<txList[t]->getNumTxIn(); i++)
+         {
+            TxInRef txin = txList[t]->getTxInRef(i);
+            TxOutRef prevOut = bdm.getPrevTxOut(txin);
+            batch.addTxIn(*txList[t], i, prevOut.getScriptRef());
+         }
+   }
+   batch.verifyAll();
+   cout << "Cache entries: " << cache.getNumEntries() << endl;
+
+   TIMER_START("CheckScripts_Warm");
+   ScriptCheckResult warm = bdm.checkMainChainScripts(startHeight, topHeight);
+   TIMER_STOP("CheckScripts_Warm");
+
+   double coldSec = TIMER_READ_SEC("CheckScripts_Cold");
+   double warmSec = TIMER_READ_SEC("CheckScripts_Warm");
+   cout << "Cold:  " << cold.getNumValid() << "/" << cold.getNumTxIn() 
+        << " valid, " << cold.getNumSigChecks() << " EC checks, "
+        << cold.getNumTxIn()/coldSec << " TxIn/s" << endl;
+   cout << "Warm:  " << warm.getNumValid() << "/" << warm.getNumTxIn() 
+        << " valid, " << warm.getNumSigChecks() << " EC checks, "
+        << warm.getNumSigCacheHits() << " cache hits, "
+        << warm.getNumTxIn()/warmSec << " TxIn/s" << endl;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// DER-encode a 64-byte r||s, the way a wallet puts it in a TxIn script
+static BinaryData derEncodeSig(BinaryData const & sig64)
+{
+   BinaryData rs[2];
+   for(uint32_t part=0; part<2; part++)
+   {
+      uint32_t start = 32*part;
+      uint32_t end   = start + 32;
+      while(start < end-1 && sig64[start] == 0x00)
+         start++;
+      if(sig64[start] & 0x80)
+         rs[part].append((uint8_t)0x00);
+      rs[part].append(sig64.getSliceRef(start, end-start));
+   }
+
+   BinaryWriter bw;
+   bw.put_uint8_t(0x30);
+   bw.put_uint8_t(4 + rs[0].getSize() + rs[1].getSize());
+   for(uint32_t part=0; part<2; part++)
+   {
+      bw.put_uint8_t(0x02);
+      bw.put_uint8_t(rs[part].getSize());
+      bw.put_BinaryData(rs[part]);
+   }
+   return bw.getData();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// One TxIn with the given script, one anyone-can-spend TxOut
+static BinaryData makeSpendTx(BinaryData const & txInScript)
+{
+   BinaryWriter bw;
+   bw.put_uint32_t(1);
+   bw.put_var_int(1);
+   bw.put_BinaryData(BtcUtils::getHash256(BinaryData(4)));
+   bw.put_uint32_t(0);
+   bw.put_var_int(txInScript.getSize());
+   bw.put_BinaryData(txInScript);
+   bw.put_uint32_t(UINT32_MAX);
+   bw.put_var_int(1);
+   bw.put_uint64_t(40000);
+   bw.put_var_int(1);
+   bw.put_uint8_t(OP_TRUE);
+   bw.put_uint32_t(0);
+   return bw.getData();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Known answers for the message each hash type signs, for the DER parser 
+// and for the push-only script parser.  The expected hashes were computed 
+// separately, following the original client's SignatureHash.  Then a 2-of-3
+// multisig TxIn signed with the first and third keys:  the signatures in and
+// out of order, damaged, missing, or undecodable.
+void TestSigHashAndMultisig(void)
+{
+   // 3 TxIns with scripts that have to be blanked, only 2 TxOuts
+   BinaryWriter bwTx;
+   bwTx.put_uint32_t(1);
+   bwTx.put_var_int(3);
+   for(uint32_t i=0; i<3; i++)
+   {
+      bwTx.put_BinaryData(BtcUtils::getHash256(BinaryData(1+i)));
+      bwTx.put_uint32_t(i);
+      bwTx.put_var_int(3);
+      bwTx.put_BinaryData(BinaryData::CreateFromHex("515253"));
+      bwTx.put_uint32_t(0xfffffff0 + i);
+   }
+   bwTx.put_var_int(2);
+   for(uint32_t i=0; i<2; i++)
+   {
+      bwTx.put_uint64_t((i+1)*50000ULL);
+      bwTx.put_var_int(1);
+      bwTx.put_uint8_t(OP_1 + i);
+   }
+   bwTx.put_uint32_t(0x12345678);
+   BinaryData rawTx = bwTx.getData();
+   TxRef tx(rawTx);
+
+   BinaryData subscript = BinaryData::CreateFromHex(
+          "76a914" "5555555555555555555555555555555555555555" "88ac");
+
+   uint32_t const nHash = 6;
+   char const * hashName[nHash] = { "ALL, TxIn 1                ",
+                                    "NONE, TxIn 1               ",
+                                    "SINGLE, TxIn 1             ",
+                                    "ALL|ANYONECANPAY, TxIn 1   ",
+                                    "SINGLE|ANYONECANPAY, TxIn 0",
+                                    "SINGLE, TxIn 2 (no TxOut)  " };
+   uint32_t hashIn[nHash]   = { 1, 1, 1, 1, 0, 2 };
+   uint32_t hashType[nHash] = { SIGHASH_ALL,
+                                SIGHASH_NONE,
+                                SIGHASH_SINGLE,
+                                SIGHASH_ALL    | SIGHASH_ANYONECANPAY,
+                                SIGHASH_SINGLE | SIGHASH_ANYONECANPAY,
+                                SIGHASH_SINGLE };
+   char const * hashExpect[nHash] = { 
+      "b385a4476871d6138ac6e4386e33cab010bec2f6d4b63d0acaf39b9652588e15",
+      "49573a923b579551adaa461f7179e30e71c09bef9db4e51466f32fada0d7b394",
+      "33dd8213b0c33fb325f17e70f3e466f42af7c295536a954e9fe0637114d226a0",
+      "acb7d264143780acb1661ff3664f1bdca1717cbd80fb2034aefab5f15e7d4979",
+      "78175ca954ac7b894ae706a7ac3622b4d5e2727f41c88300616f720008d666ec",
+      "" };
+   for(uint32_t c=0; c<nHash; c++)
+   {
+      BinaryData preimage = ScriptCheckBatch::getSigHashPreimage(
+                                 tx, hashIn[c], subscript.getRef(), hashType[c]);
+      string got = (preimage.getSize()==0 ? string("") :
+                              BtcUtils::getHash256(preimage).toHexStr());
+      cout << "SigHash " << hashName[c] << ": " 
+           << (got == hashExpect[c] ? "ok" : "WRONG") << "  " << got << endl;
+   }
+
+   // DER:  minimal, a padded r with a short s, extra leading zeros, a 
+   // trailing byte, then malformed ones that have to be rejected
+   string r80 = "80";
+   string s7f = "";
+   for(uint32_t i=0; i<31; i++)
+   {
+      r80 += "01";
+      s7f += "7f";
+   }
+   string zeros31 = string(62, '0');
+   string sig12   = zeros31 + "01" + zeros31 + "02";
+
+   uint32_t const nDer = 10;
+   char const * derName[nDer] = { "r=1, s=2             ",
+                                  "padded r, short s    ",
+                                  "extra leading zeros  ",
+                                  "trailing byte        ",
+                                  "not a sequence       ",
+                                  "sequence past the end",
+                                  "empty r              ",
+                                  "33-byte r            ",
+                                  "s past the sequence  ",
+                                  "too short            " };
+   string derHex[nDer] = { "3006020101020102",
+                           "3044022100" + r80 + "021f" + s7f,
+                           "30080203000001020102",
+                           "300602010102010201",
+                           "3106020101020102",
+                           "3007020101020102",
+                           "3005020002010200",
+                           "3026022101" + string(64,'0') + "020102",
+                           "3006020101020502",
+                           "30050201010200" };
+   string derExpect[nDer] = { sig12, r80 + "00" + s7f, sig12, sig12,
+                              "", "", "", "", "", "" };
+   for(uint32_t c=0; c<nDer; c++)
+   {
+      BinaryData der = BinaryData::CreateFromHex(derHex[c]);
+      BinaryData sig64;
+      bool parsed = ScriptCheckBatch::parseDERSignature(der.getRef(), sig64);
+      string got = (parsed ? sig64.toHexStr() : string(""));
+      cout << "DER " << derName[c] << ": " 
+           << (got == derExpect[c] ? "ok" : "WRONG") << endl;
+   }
+
+   // Push-only scripts:  the small-number opcodes push one byte each, 
+   // OP_RESERVED (between OP_1NEGATE and OP_1) is not a push
+   uint32_t const nPush = 4;
+   char const * pushName[nPush] = { "OP_0 OP_1 OP_16 <aa>  ",
+                                    "OP_1NEGATE <bbcc>     ",
+                                    "OP_RESERVED           ",
+                                    "OP_2 OP_DUP           " };
+   char const * pushHex[nPush] = { "00516001aa", "4f02bbcc", "50", "5276" };
+   char const * pushExpect[nPush] = { "|01|10|aa|", "81|bbcc|", "", "" };
+   for(uint32_t c=0; c<nPush; c++)
+   {
+      BinaryData script = BinaryData::CreateFromHex(pushHex[c]);
+      vector<BinaryDataRef> pushes;
+      string got = "";
+      if(ScriptCheckBatch::getScriptPushes(script.getRef(), pushes))
+         for(uint32_t i=0; i<pushes.size(); i++)
+            got += pushes[i].toHexStr() + "|";
+      cout << "Pushes " << pushName[c] << ": " 
+           << (got == pushExpect[c] ? "ok" : "WRONG") << "  " << got << endl;
+   }
+
+   // OP_2 <pub1> <pub2> <pub3> OP_3 OP_CHECKMULTISIG, private keys 1, 2, 3
+   CryptoECDSA ecdsa;
+   SecureBinaryData packedPriv;
+   BinaryWriter bwMs;
+   bwMs.put_uint8_t(OP_2);
+   for(uint32_t k=0; k<3; k++)
+   {
+      SecureBinaryData priv(32);
+      priv.fill(0x00);
+      priv[31] = k+1;
+      packedPriv.append(priv);
+      BinaryData pub = ecdsa.ComputePublicKey(priv).getRawCopy();
+      bwMs.put_uint8_t(pub.getSize());
+      bwMs.put_BinaryData(pub);
+   }
+   bwMs.put_uint8_t(OP_3);
+   bwMs.put_uint8_t(OP_CHECKMULTISIG);
+   BinaryData msScript = bwMs.getData();
+
+   // The TxIn script isn't part of the signed message, so the signatures 
+   // made over the unsigned tx work for every version of it below
+   BinaryData unsignedTx = makeSpendTx(BinaryData(0));
+   TxRef unsignedRef(unsignedTx);
+   vector<BinaryData> msgList(3);
+   vector<int>        keyIdx(3);
+   msgList[0] = ScriptCheckBatch::getSigHashPreimage(unsignedRef, 0, 
+                                       msScript.getRef(), SIGHASH_ALL);
+   msgList[1] = msgList[0];
+   msgList[2] = ScriptCheckBatch::getSigHashPreimage(unsignedRef, 0, 
+                msScript.getRef(), SIGHASH_NONE | SIGHASH_ANYONECANPAY);
+   keyIdx[0] = 0;
+   keyIdx[1] = 2;
+   keyIdx[2] = 2;
+   SecureBinaryData sigs = ecdsa.SignBatch(msgList, keyIdx, packedPriv, 1);
+   if(sigs.getSize() != 3*64)
+   {
+      cout << "SignBatch failed" << endl;
+      return;
+   }
+
+   BinaryData sig1   = derEncodeSig(sigs.getSliceCopy(  0, 64).getRawCopy());
+   BinaryData sig3   = derEncodeSig(sigs.getSliceCopy( 64, 64).getRawCopy());
+   BinaryData sig3NA = derEncodeSig(sigs.getSliceCopy(128, 64).getRawCopy());
+   sig1.append((uint8_t)SIGHASH_ALL);
+   sig3.append((uint8_t)SIGHASH_ALL);
+   sig3NA.append((uint8_t)(SIGHASH_NONE | SIGHASH_ANYONECANPAY));
+   BinaryData sig3Bad(sig3);
+   sig3Bad[10] ^= 0x01;
+   BinaryData sigJunk = BinaryData::CreateFromHex("30020201");
+   sigJunk.append((uint8_t)SIGHASH_ALL);
+
+   // Each TxIn script is OP_0 followed by up to two signatures
+   uint32_t const nSpend = 8;
+   char const * spendName[nSpend] = { "keys 1 and 3              ",
+                                      "keys 1 and 3, NONE|ACP    ",
+                                      "keys 3 and 1 (wrong order)",
+                                      "key 1 twice               ",
+                                      "key 3 damaged             ",
+                                      "one signature             ",
+                                      "undecodable signature     ",
+                                      "not push-only             " };
+   BinaryData const * spendSigs[nSpend][2] = { { &sig1, &sig3    },
+                                               { &sig1, &sig3NA  },
+                                               { &sig3, &sig1    },
+                                               { &sig1, &sig1    },
+                                               { &sig1, &sig3Bad },
+                                               { &sig1, NULL     },
+                                               { &sig1, &sigJunk },
+                                               { &sig1, &sig3    } };
+   TXIN_CHECK_RESULT spendExpect[nSpend] = { TXIN_CHECK_VALID,
+                                             TXIN_CHECK_VALID,
+                                             TXIN_CHECK_INVALID,
+                                             TXIN_CHECK_INVALID,
+                                             TXIN_CHECK_INVALID,
+                                             TXIN_CHECK_INVALID,
+                                             TXIN_CHECK_NONSTANDARD,
+                                             TXIN_CHECK_NONSTANDARD };
+   char const * resultName[] = { "VALID", "INVALID", "NONSTANDARD",
+                                 "NO_PREVOUT", "PENDING" };
+
+   // Every tx has to stay put until they're all in the batch
+   vector<BinaryData> rawSpends(nSpend);
+   for(uint32_t v=0; v<nSpend; v++)
+   {
+      BinaryWriter bw;
+      bw.put_uint8_t(OP_0);
+      for(uint32_t s=0; s<2; s++)
+         if(spendSigs[v][s] != NULL)
+         {
+            bw.put_uint8_t(spendSigs[v][s]->getSize());
+            bw.put_BinaryData(*spendSigs[v][s]);
+         }
+      if(v == nSpend-1)
+         bw.put_uint8_t(OP_DUP);
+      rawSpends[v] = makeSpendTx(bw.getData());
+   }
+
+   ScriptCheckBatch batch;
+   vector<TxRef> spends(nSpend);
+   vector<uint32_t> resultIdx(nSpend);
+   for(uint32_t v=0; v<nSpend; v++)
+   {
+      spends[v].unserialize(rawSpends[v]);
+      resultIdx[v] = batch.addTxIn(spends[v], 0, msScript.getRef());
+   }
+   batch.verifyAll(1);
+
+   for(uint32_t v=0; v<nSpend; v++)
+   {
+      TXIN_CHECK_RESULT r = batch.getResult(resultIdx[v]);
+      cout << "2-of-3 " << spendName[v] << ": " 
+           << (r == spendExpect[v] ? "ok" : "WRONG") << "  " 
+           << resultName[r] << endl;
+   }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Same blkfile, but only the headers are kept.  Everything that only needs
+// the headers (heights, timestamps, the top block) should match
+void TestHeadersOnly(string blkfile)
+{
+   BlockDataManager_FullRAM & bdm = BlockDataManager_FullRAM::GetInstance(); 
+   bdm.Reset();
+   bdm.SelectNetwork("Main");
+   assert(bdm.SelectMode(BDM_MODE_NO_STORAGE));
+
+   TIMER_START("BDM_Load_Headers_Only");
+   bdm.readBlkFile_FromScratch(blkfile);
+   TIMER_STOP("BDM_Load_Headers_Only");
+
+   cout << "Num blocks:        " << bdm.getNumBlocks() << endl;
+   cout << "Num tx (expect 0): " << bdm.getNumTx() << endl;
+   cout << "Bad merkle roots:  " << bdm.getNumBadMerkleBlocks() << endl;
+   cout << "Header array size: " << bdm.getHeaderArenaBytes() << endl;
+   cout << "Top block height:  " << bdm.getTopBlockHeader().getBlockHeight() << endl;
+   cout << "Top block time:    " << bdm.getTopBlockHeader().getTimestamp() << endl;
+   cout << "Script check (expect 0): " << bdm.setScriptValidation(true) << endl;
+
+   // Put it back the way the other tests expect
+   bdm.Reset();
+   bdm.SelectMode(BDM_MODE_FULL_BLOCKCHAIN);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Every tx in the last few hundred blocks should prove out against its own
+// header, and fail against the wrong index or a damaged branch
+void TestMerkleBranch(string blkfile)
+{
+   BlockDataManager_FullRAM & bdm = BlockDataManager_FullRAM::GetInstance(); 
+   bdm.Reset();
+   bdm.SelectNetwork("Main");
+   bdm.readBlkFile_FromScratch(blkfile);
+
+   uint32_t topHeight = bdm.getTopBlockHeader().getBlockHeight();
+   uint32_t startHeight = (topHeight > 500 ? topHeight-500 : 0);
+   uint32_t numGood = 0;
+   uint32_t numBad  = 0;
+   TIMER_START("Merkle_Branches");
+   for(uint32_t h=startHeight; h<=topHeight; h++)
+   {
+      BlockHeaderRef & bhr = *bdm.getHeaderByHeight(h);
+      for(uint32_t i=0; i<bhr.getNumTx(); i++)
+      {
+         TxRef & tx = *bhr.getTxRefPtrList()[i];
+         BinaryData branch = tx.getMerkleBranch();
+         bool isGood = bhr.verifyMerkleBranch(tx.getThisHash(), i, branch);
+         // (The last tx of an odd-sized level is its own sibling, so it
+         //  proves out at i+1 too -- that's how bitcoin merkle trees work)
+         if(i+1 < bhr.getNumTx())
+            isGood = isGood && !bhr.verifyMerkleBranch(tx.getThisHash(), i+1, branch);
+         if(branch.getSize() > 0)
+         {
+            branch[0] ^= 0x01;
+            isGood = isGood && !bhr.verifyMerkleBranch(tx.getThisHash(), i, branch);
+         }
+         (isGood ? numGood : numBad)++;
+      }
+   }
+   TIMER_STOP("Merkle_Branches");
+   cout << "Merkle branches checked: " << numGood+numBad 
+        << "   Failed: " << numBad << endl;
 }
 
 
@@ -367,7 +975,6 @@ void TestReorgBlockchain(string blkfile)
    if(result[ADD_BLOCK_CAUSED_REORG] == true)
    {
       cout << "Reorg happened after pushing block 5A" << endl;
-      bdm.scanBlockchainForTx(wlt2);
       bdm.updateWalletAfterReorg(wlt2);
    }
 
@@ -503,6 +1110,721 @@ void TestZeroConf(void)
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+// One ZC tx pays the wallet and is scanned, then a second one fills the pool
+// and pushes the first one out.  The wallet must not be left pointing at the
+// evicted TxRef:  the balance and the TxOut list (which reads the TxOut
+// through that pointer) are checked before the wallet is rescanned.  Run it 
+// under ASan/valgrind to see the difference.
+void TestZeroConfEviction(void)
+{
+   BlockDataManager_FullRAM & bdm = BlockDataManager_FullRAM::GetInstance(); 
+   bdm.Reset();
+
+   BinaryData myAddress;
+   myAddress.createFromHex("4c98e1fb7aadce864b310b2e52b685c09bdfd5e7");
+   BtcWallet wlt;
+   wlt.addAddress(myAddress);
+
+   // Same size & fee rate, so the older one is the one evicted
+   vector<BinaryData> rawTxs(2);
+   for(uint32_t i=0; i<2; i++)
+   {
+      BinaryWriter bw;
+      bw.put_uint32_t(1);
+      bw.put_var_int(1);
+      bw.put_BinaryData(BtcUtils::getHash256(BinaryData(1+i)));
+      bw.put_uint32_t(0);
+      bw.put_var_int(0);
+      bw.put_uint32_t(UINT32_MAX);
+      bw.put_var_int(1);
+      bw.put_uint64_t((i+1)*100000000ULL);
+      bw.put_var_int(25);
+      bw.put_BinaryData(BinaryData::CreateFromHex("76a914"));
+      bw.put_BinaryData(myAddress);
+      bw.put_BinaryData(BinaryData::CreateFromHex("88ac"));
+      bw.put_uint32_t(0);
+      rawTxs[i] = bw.getData();
+   }
+
+   uint64_t oldMaxBytes = bdm.getZeroConfPoolMaxBytes();
+   bdm.addNewZeroConfTx(rawTxs[0], 0, false);
+   bdm.rescanWalletZeroConf(wlt);
+   cout << "Balance with first tx:   " << wlt.getFullBalance() 
+        << " (expect 100000000)" << endl;
+
+   bdm.setZeroConfPoolMaxBytes(rawTxs[1].getSize());
+   bdm.addNewZeroConfTx(rawTxs[1], 0, false);
+   cout << "Pool size:               " << bdm.getZeroConfPoolSize()
+        << " (expect 1)" << endl;
+
+   vector<UnspentTxOut> utxoList = wlt.getFullTxOutList(0);
+   uint64_t utxoSum = 0;
+   for(uint32_t i=0; i<utxoList.size(); i++)
+      utxoSum += utxoList[i].getValue();
+   cout << "Balance before rescan:   " << wlt.getFullBalance() 
+        << " (expect 0)" << endl;
+   cout << "TxOut sum before rescan: " << utxoSum << " (expect 0)" << endl;
+
+   bdm.rescanWalletZeroConf(wlt);
+   cout << "Balance after rescan:    " << wlt.getFullBalance() 
+        << " (expect 200000000)" << endl;
+
+   bdm.setZeroConfPoolMaxBytes(oldMaxBytes);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Raw block (with the magic bytes and size in front) on top of prevHash, 
+// with a coinbase that pays nobody and then txList.  No proof-of-work:  the 
+// BDM doesn't check it
+static BinaryData makeTestBlock(BinaryData const & magic,
+                                BinaryData const & prevHash,
+                                uint32_t           cbSeed,
+                                vector<BinaryData> const & txList)
+{
+   BinaryWriter bwCb;
+   bwCb.put_uint32_t(1);
+   bwCb.put_var_int(1);
+   bwCb.put_BinaryData(BinaryData(32));
+   bwCb.put_uint32_t(UINT32_MAX);
+   bwCb.put_var_int(4);
+   bwCb.put_uint32_t(cbSeed);
+   bwCb.put_uint32_t(UINT32_MAX);
+   bwCb.put_var_int(1);
+   bwCb.put_uint64_t(5000000000ULL);
+   bwCb.put_var_int(0);
+   bwCb.put_uint32_t(0);
+
+   vector<BinaryData> allTx(1, bwCb.getData());
+   allTx.insert(allTx.end(), txList.begin(), txList.end());
+   vector<BinaryData> txHashes(allTx.size());
+   for(uint32_t i=0; i<allTx.size(); i++)
+      txHashes[i] = BtcUtils::getHash256(allTx[i]);
+
+   BinaryWriter bwBlk;
+   bwBlk.put_uint32_t(1);
+   bwBlk.put_BinaryData(prevHash);
+   bwBlk.put_BinaryData(BtcUtils::calculateMerkleRoot(txHashes));
+   bwBlk.put_uint32_t(1300000000 + cbSeed);
+   bwBlk.put_BinaryData(BinaryData::CreateFromHex("ffff7f20"));
+   bwBlk.put_uint32_t(0);
+   bwBlk.put_var_int(allTx.size());
+   for(uint32_t i=0; i<allTx.size(); i++)
+      bwBlk.put_BinaryData(allTx[i]);
+
+   BinaryWriter bw;
+   bw.put_BinaryData(magic);
+   bw.put_uint32_t(bwBlk.getData().getSize());
+   bw.put_BinaryData(bwBlk.getData());
+   return bw.getData();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Zero-conf parent A pays us, zero-conf child B spends it somewhere else.
+// A gets mined, B doesn't.  A's TxOut must still show as spent by B after
+// the wallet scans the block, not come back as spendable
+void TestZeroConfMinedParent(void)
+{
+   BlockDataManager_FullRAM & bdm = BlockDataManager_FullRAM::GetInstance(); 
+   bdm.Reset();
+
+   BinaryData magic = BinaryData::CreateFromHex("fabfb5da");
+   BinaryData genesis = makeTestBlock(magic, BinaryData(32), 0, 
+                                      vector<BinaryData>(0));
+   BinaryData genHash = BtcUtils::getHash256(genesis.getSliceRef(8, 80));
+   BinaryData genTxHash = BtcUtils::getHash256(
+                    genesis.getSliceRef(8+80+1, genesis.getSize()-(8+80+1)));
+   bdm.SetBtcNetworkParams(genHash, genTxHash, magic);
+   bdm.addNewBlockData(genesis);
+
+   BinaryData myAddress;
+   myAddress.createFromHex("4c98e1fb7aadce864b310b2e52b685c09bdfd5e7");
+   BtcWallet wlt;
+   wlt.addAddress(myAddress);
+
+   // A:  from an outpoint we don't know, to us.  B:  spends A:0, to nobody
+   BinaryWriter bwA;
+   bwA.put_uint32_t(1);
+   bwA.put_var_int(1);
+   bwA.put_BinaryData(BtcUtils::getHash256(BinaryData(1)));
+   bwA.put_uint32_t(0);
+   bwA.put_var_int(0);
+   bwA.put_uint32_t(UINT32_MAX);
+   bwA.put_var_int(1);
+   bwA.put_uint64_t(100000000ULL);
+   bwA.put_var_int(25);
+   bwA.put_BinaryData(BinaryData::CreateFromHex("76a914"));
+   bwA.put_BinaryData(myAddress);
+   bwA.put_BinaryData(BinaryData::CreateFromHex("88ac"));
+   bwA.put_uint32_t(0);
+   BinaryData rawA = bwA.getData();
+
+   BinaryWriter bwB;
+   bwB.put_uint32_t(1);
+   bwB.put_var_int(1);
+   bwB.put_BinaryData(BtcUtils::getHash256(rawA));
+   bwB.put_uint32_t(0);
+   bwB.put_var_int(0);
+   bwB.put_uint32_t(UINT32_MAX);
+   bwB.put_var_int(1);
+   bwB.put_uint64_t(90000000ULL);
+   bwB.put_var_int(1);
+   bwB.put_uint8_t(OP_TRUE);
+   bwB.put_uint32_t(0);
+   BinaryData rawB = bwB.getData();
+
+   bdm.scanBlockchainForTx(wlt);
+   bdm.addNewZeroConfTx(rawA, 0, false);
+   bdm.addNewZeroConfTx(rawB, 0, false);
+   bdm.rescanWalletZeroConf(wlt);
+   cout << "Before block:  full " << wlt.getFullBalance() 
+        << ", spendable " << wlt.getSpendableBalance() 
+        << " (expect 0, 0)" << endl;
+
+   bdm.addNewBlockData(makeTestBlock(magic, genHash, 1, 
+                                     vector<BinaryData>(1, rawA)));
+   bdm.scanBlockchainForTx(wlt, 1);
+   bdm.rescanWalletZeroConf(wlt);
+   cout << "Top height:    " << bdm.getTopBlockHeader().getBlockHeight() 
+        << " (expect 1)" << endl;
+   cout << "Pool size:     " << bdm.getZeroConfPoolSize() 
+        << " (expect 1)" << endl;
+   cout << "After block:   full " << wlt.getFullBalance() 
+        << ", spendable " << wlt.getSpendableBalance() 
+        << ", spendable TxOuts " << wlt.getSpendableTxOutList(1).size()
+        << " (expect 0, 0, 0)" << endl;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Tx from an outpoint we don't know, paying 1 BTC to addr160
+static BinaryData makePayToTx(BinaryData const & prevHash,
+                              BinaryData const & addr160)
+{
+   BinaryWriter bw;
+   bw.put_uint32_t(1);
+   bw.put_var_int(1);
+   bw.put_BinaryData(prevHash);
+   bw.put_uint32_t(0);
+   bw.put_var_int(0);
+   bw.put_uint32_t(UINT32_MAX);
+   bw.put_var_int(1);
+   bw.put_uint64_t(100000000ULL);
+   bw.put_var_int(25);
+   bw.put_BinaryData(BinaryData::CreateFromHex("76a914"));
+   bw.put_BinaryData(addr160);
+   bw.put_BinaryData(BinaryData::CreateFromHex("88ac"));
+   bw.put_uint32_t(0);
+   return bw.getData();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Main chain 0-1-2-3 with tx A (ours) in block 3.  Branch 2'-3'-4' off block
+// 1 has tx C (ours) in 2'.  After the reorg A is invalid at height 3 and C 
+// is valid at height 2, and both ledgers must still be in block order
+void TestReorgLedgerOrder(void)
+{
+   BlockDataManager_FullRAM & bdm = BlockDataManager_FullRAM::GetInstance(); 
+   bdm.Reset();
+
+   BinaryData magic = BinaryData::CreateFromHex("fabfb5da");
+   BinaryData genesis = makeTestBlock(magic, BinaryData(32), 0, 
+                                      vector<BinaryData>(0));
+   BinaryData genHash = BtcUtils::getHash256(genesis.getSliceRef(8, 80));
+   BinaryData genTxHash = BtcUtils::getHash256(
+                    genesis.getSliceRef(8+80+1, genesis.getSize()-(8+80+1)));
+   bdm.SetBtcNetworkParams(genHash, genTxHash, magic);
+   bdm.addNewBlockData(genesis);
+
+   BinaryData myAddress;
+   myAddress.createFromHex("4c98e1fb7aadce864b310b2e52b685c09bdfd5e7");
+   BtcWallet wlt;
+   wlt.addAddress(myAddress);
+
+   vector<BinaryData> txA(1, makePayToTx(BtcUtils::getHash256(BinaryData(1)),
+                                         myAddress));
+   vector<BinaryData> txC(1, makePayToTx(BtcUtils::getHash256(BinaryData(2)),
+                                         myAddress));
+   vector<BinaryData> noTx(0);
+
+   BinaryData blk1 = makeTestBlock(magic, genHash, 1, noTx);
+   BinaryData hash1 = BtcUtils::getHash256(blk1.getSliceRef(8, 80));
+   BinaryData blk2 = makeTestBlock(magic, hash1, 2, noTx);
+   BinaryData hash2 = BtcUtils::getHash256(blk2.getSliceRef(8, 80));
+   BinaryData blk3 = makeTestBlock(magic, hash2, 3, txA);
+   bdm.addNewBlockData(blk1);
+   bdm.addNewBlockData(blk2);
+   bdm.addNewBlockData(blk3);
+   bdm.scanBlockchainForTx(wlt);
+
+   BinaryData blk2b = makeTestBlock(magic, hash1, 12, txC);
+   BinaryData hash2b = BtcUtils::getHash256(blk2b.getSliceRef(8, 80));
+   BinaryData blk3b = makeTestBlock(magic, hash2b, 13, noTx);
+   BinaryData hash3b = BtcUtils::getHash256(blk3b.getSliceRef(8, 80));
+   BinaryData blk4b = makeTestBlock(magic, hash3b, 14, noTx);
+   bdm.addNewBlockData(blk2b);
+   bdm.addNewBlockData(blk3b);
+   vector<bool> result = bdm.addNewBlockData(blk4b);
+   cout << "Reorg:         " << (result[ADD_BLOCK_CAUSED_REORG] ? 1 : 0)
+        << " (expect 1)" << endl;
+   if(result[ADD_BLOCK_CAUSED_REORG])
+      bdm.updateWalletAfterReorg(wlt);
+
+   for(uint32_t pass=0; pass<2; pass++)
+   {
+      BinaryData const * addrPtr = (pass==0 ? NULL : &myAddress);
+      vector<LedgerEntry> ledger = wlt.getTxLedger(addrPtr);
+      cout << (pass==0 ? "Wallet ledger: " : "Addr ledger:   ");
+      bool isSorted = true;
+      for(uint32_t i=0; i<ledger.size(); i++)
+      {
+         cout << ledger[i].getBlockNum() 
+              << (ledger[i].isValid() ? "" : "(invalid)") << " ";
+         if(i>0 && ledger[i] < ledger[i-1])
+            isSorted = false;
+      }
+      cout << "sorted " << (isSorted ? 1 : 0) 
+           << " (expect 2 3(invalid) sorted 1)" << endl;
+   }
+   cout << "Balance:       " << wlt.getFullBalance() 
+        << " (expect 100000000)" << endl;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// What the zero-conf journal replay sees at the end of a file that was cut
+// off mid-append:  every prefix of a tx must come back as not-a-whole-tx
+// without reading past the prefix (run it under valgrind to see that part)
+void TestTxCalcLengthBounded(void)
+{
+   BinaryWriter bw;
+   bw.put_uint32_t(1);
+   bw.put_var_int(2);
+   for(uint32_t i=0; i<2; i++)
+   {
+      bw.put_BinaryData(BinaryData(36));
+      bw.put_var_int(300);                  // 3-byte var_int
+      bw.put_BinaryData(BinaryData(300));
+      bw.put_uint32_t(UINT32_MAX);
+   }
+   bw.put_var_int(1);
+   bw.put_uint64_t(5000000000ULL);
+   bw.put_var_int(25);
+   bw.put_BinaryData(BinaryData(25));
+   bw.put_uint32_t(0);
+   BinaryData rawTx = bw.getData();
+
+   uint32_t nFalseWhole = 0;
+   for(uint32_t len=0; len<rawTx.getSize(); len++)
+   {
+      // Copy, so anything past the prefix is off the end of the buffer
+      BinaryData prefix(rawTx.getPtr(), len);
+      if(BtcUtils::TxCalcLengthBounded(prefix.getPtr(), len) != UINT32_MAX)
+         nFalseWhole++;
+   }
+
+   // A script length that runs past the end, and one that wraps around
+   BinaryData badLen(rawTx);
+   badLen[4+1+36+1] = 0xff;
+   badLen[4+1+36+2] = 0xff;
+   BinaryData hugeLen = rawTx.getSliceCopy(0, 4+1+36);
+   hugeLen.append(BinaryData::CreateFromHex("ffffffffffffffffff"));
+   hugeLen.append(BinaryData(20));
+
+   cout << "Whole tx:   " << BtcUtils::TxCalcLengthBounded(rawTx.getPtr(), 
+                                                           rawTx.getSize())
+        << " (expected " << rawTx.getSize() << ", unbounded: "
+        << BtcUtils::TxCalcLength(rawTx.getPtr()) << ")" << endl;
+   cout << "Prefixes taken as a whole tx (should be 0): " << nFalseWhole << endl;
+   cout << "Bad script lengths rejected: " 
+        << (BtcUtils::TxCalcLengthBounded(badLen.getPtr(), 
+                                          badLen.getSize()) == UINT32_MAX &&
+            BtcUtils::TxCalcLengthBounded(hugeLen.getPtr(), 
+                                          hugeLen.getSize()) == UINT32_MAX ?
+                                                      "yes" : "NO") << endl;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Wall time for fixed KDF parameters:  a few big-memory iterations (the
+// usual wallet setting) and many small ones (where the per-iteration setup
+// used to matter most).  Then four "wallets" with different parameters, 
+// one after another and all at once.  Keys must match either way.
+void TestKdfBenchmark(void)
+{
+   SecureBinaryData passphrase("This is a passphrase for the KDF benchmark");
+   SecureBinaryData salt = SecureBinaryData().GenerateRandom(32);
+
+   uint32_t memList[2]  = { 8*1024*1024, 1024  };
+   uint32_t iterList[2] = { 8,           20000 };
+   for(uint32_t i=0; i<2; i++)
+   {
+      KdfRomix kdf(memList[i], iterList[i], salt);
+      time_t startTime = time(0);
+      TIMER_RESTART("KDF_Fixed_Params");
+      kdf.DeriveKey(passphrase);
+      TIMER_STOP("KDF_Fixed_Params");
+      cout << "Mem: " << memList[i]/1024 << " kB   Iters: " << iterList[i]
+           << "   CPU: " << TIMER_READ_SEC("KDF_Fixed_Params") << " sec"
+           << "   Wall: " << (time(0)-startTime) << " sec" << endl;
+   }
+
+   KdfRomixBatch batch;
+   vector<SecureBinaryData> serialKeys;
+   time_t startTime = time(0);
+   for(uint32_t w=0; w<4; w++)
+   {
+      KdfRomix kdf((w+1)*4*1024*1024, 4, salt);
+      serialKeys.push_back(kdf.DeriveKey(passphrase));
+      batch.addKdf(kdf, passphrase);
+   }
+   cout << "4 wallets, one at a time: " << (time(0)-startTime) << " sec" << endl;
+
+   // UniversalTimer adds up the CPU time of all threads, so wall clock
+   startTime = time(0);
+   batch.deriveAll();
+   cout << "4 wallets, all at once:   " << (time(0)-startTime) << " sec" << endl;
+
+   uint32_t nMismatch = 0;
+   for(uint32_t w=0; w<4; w++)
+      nMismatch += (batch.getKey(w) == serialKeys[w] ? 0 : 1);
+   cout << "Keys that differ: " << nMismatch << endl;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Calibrates a few times to see how much the parameters move around, then
+// checks that keys derived with them take about the target time.  The 
+// second loadOrCalibrate should come from the file, and only has to time
+// the size it picks.
+void TestKdfCalibration(void)
+{
+   SecureBinaryData passphrase("This is a passphrase for the KDF calibration");
+   KdfCalibration calib;
+   for(uint32_t i=0; i<3; i++)
+   {
+      double startSec = UniversalTimer::getMonotonicSec();
+      calib.calibrate();
+      KdfRomix kdf;
+      kdf.computeKdfParams(calib, 0.25);
+      double calibSec = UniversalTimer::getMonotonicSec() - startSec;
+      cout << "Calibration " << i << ":  " << calibSec << " sec"
+           << "   Mem: " << kdf.getMemoryReqtBytes()/1024 << " kB"
+           << "   Iters: " << kdf.getNumIterations() << endl;
+   }
+   calib.printProfile();
+
+   double targetList[3] = {0.1, 0.25, 1.0};
+   for(uint32_t t=0; t<3; t++)
+   {
+      KdfRomix kdf;
+      kdf.computeKdfParams(calib, targetList[t]);
+      double startSec = UniversalTimer::getMonotonicSec();
+      kdf.DeriveKey(passphrase);
+      double deriveSec = UniversalTimer::getMonotonicSec() - startSec;
+      cout << "Target: " << targetList[t] << " sec"
+           << "   Mem: " << kdf.getMemoryReqtBytes()/1024 << " kB"
+           << "   Iters: " << kdf.getNumIterations()
+           << "   Actual: " << deriveSec << " sec" << endl;
+   }
+
+   string profileFile = getTempFilePath("kdfprofile_test.bin");
+   remove(profileFile.c_str());
+   for(uint32_t i=0; i<2; i++)
+   {
+      KdfCalibration fromFile;
+      double startSec = UniversalTimer::getMonotonicSec();
+      bool wasLoaded = fromFile.loadOrCalibrate(profileFile);
+      KdfRomix kdf;
+      kdf.computeKdfParams(fromFile, 0.25);
+      double setupSec = UniversalTimer::getMonotonicSec() - startSec;
+      cout << (wasLoaded ? "Loaded profile" : "Calibrated   ") 
+           << "   Params in: " << setupSec*1000 << " ms"
+           << "   Mem: " << kdf.getMemoryReqtBytes()/1024 << " kB"
+           << "   Iters: " << kdf.getNumIterations() << endl;
+   }
+   remove(profileFile.c_str());
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Passphrase change on a 100k-key wallet:  one Decrypt/Encrypt pair per key
+// (what PyBtcWallet used to do, minus the python), then the whole thing in 
+// one ReencryptBatch call.  Both must give the same ciphertext, and it has 
+// to decrypt back to the original keys with the new passphrase key.
+void TestAesReencryptBatch(void)
+{
+   uint32_t const numKeys = 100000;
+   SecureBinaryData oldKey = SecureBinaryData().GenerateRandom(32);
+   SecureBinaryData newKey = SecureBinaryData().GenerateRandom(32);
+   CryptoAES aes;
+
+   vector<SecureBinaryData> plainKeys(numKeys);
+   SecureBinaryData keyData(numKeys * AES_REKEY_RECORD_SIZE);
+   for(uint32_t i=0; i<numKeys; i++)
+   {
+      plainKeys[i] = SecureBinaryData().GenerateRandom(32);
+      SecureBinaryData iv = SecureBinaryData().GenerateRandom(16);
+      SecureBinaryData encr = aes.Encrypt(plainKeys[i], oldKey, iv);
+      uint8_t* rec = keyData.getPtr() + i*AES_REKEY_RECORD_SIZE;
+      memcpy(rec,      encr.getPtr(), 32);
+      memcpy(rec + 32, iv.getPtr(),   16);
+   }
+
+   SecureBinaryData oneAtATime(keyData);
+   clock_t start = clock();
+   for(uint32_t i=0; i<numKeys; i++)
+   {
+      uint8_t* rec = oneAtATime.getPtr() + i*AES_REKEY_RECORD_SIZE;
+      SecureBinaryData encr(rec, 32);
+      SecureBinaryData iv(rec+32, 16);
+      SecureBinaryData plain = aes.Decrypt(encr, oldKey, iv);
+      SecureBinaryData reencr = aes.Encrypt(plain, newKey, iv);
+      memcpy(rec, reencr.getPtr(), 32);
+   }
+   double oneSec = (double)(clock()-start) / CLOCKS_PER_SEC;
+   cout << "One key at a time:  " << oneSec << " sec" << endl;
+
+   uint32_t threadCounts[2] = {1, 0};
+   for(uint32_t t=0; t<2; t++)
+   {
+      SecureBinaryData batchData(keyData);
+      time_t startTime = time(0);
+      start = clock();
+      bool isOk = aes.ReencryptBatch(batchData, oldKey, newKey, threadCounts[t]);
+      double batchSec = (double)(clock()-start) / CLOCKS_PER_SEC;
+      cout << "Batch, threads: " << threadCounts[t] 
+           << "   OK: " << (isOk ? "yes" : "NO")
+           << "   CPU: " << batchSec << " sec"
+           << "   Wall: " << (time(0)-startTime) << " sec"
+           << "   Same as one at a time: " 
+           << (batchData == oneAtATime ? "yes" : "NO") << endl;
+   }
+
+   uint32_t nBad = 0;
+   for(uint32_t i=0; i<numKeys; i++)
+   {
+      uint8_t* rec = oneAtATime.getPtr() + i*AES_REKEY_RECORD_SIZE;
+      SecureBinaryData encr(rec, 32);
+      SecureBinaryData iv(rec+32, 16);
+      nBad += (aes.Decrypt(encr, newKey, iv) == plainKeys[i] ? 0 : 1);
+   }
+   cout << "Keys that don't decrypt with the new key: " << nBad << endl;
+
+   SecureBinaryData badSize(AES_REKEY_RECORD_SIZE + 1);
+   cout << "Partial record rejected: " 
+        << (aes.ReencryptBatch(badSize, oldKey, newKey) ? "NO" : "yes") << endl;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Runs the same key-heavy loop twice:  after the first pass has grown the
+// arena, the second shouldn't commit (mlock) anything more or fall back to
+// the heap.  Then checks that freed and outgrown buffers are zeroed.
+static void secureArenaKeyLoop(uint32_t numKeys)
+{
+   SecureBinaryData chaincode = SecureBinaryData().GenerateRandom(32);
+   SecureBinaryData iv        = SecureBinaryData().GenerateRandom(16);
+   SecureBinaryData kdfKey    = SecureBinaryData().GenerateRandom(32);
+   SecureBinaryData privKey   = SecureBinaryData().GenerateRandom(32);
+   for(uint32_t i=0; i<numKeys; i++)
+   {
+      SecureBinaryData pubKey = CryptoECDSA().ComputePublicKey(privKey);
+      SecureBinaryData encr   = CryptoAES().Encrypt(privKey, kdfKey, iv);
+      SecureBinaryData both   = privKey + pubKey;
+      both.append(encr);
+      privKey = CryptoECDSA().ComputeChainedPrivateKey(privKey, chaincode);
+   }
+}
+
+void TestSecureArena(void)
+{
+   uint32_t const numKeys = 20000;
+   clock_t start = clock();
+   secureArenaKeyLoop(numKeys);
+   double firstSec = (double)(clock()-start) / CLOCKS_PER_SEC;
+   uint64_t commitsBefore   = SecureArena::getNumCommits();
+   uint64_t fallbacksBefore = SecureArena::getNumHeapFallbacks();
+
+   start = clock();
+   secureArenaKeyLoop(numKeys);
+   double secondSec = (double)(clock()-start) / CLOCKS_PER_SEC;
+   cout << "First pass:  " << firstSec  << " sec" << endl;
+   cout << "Second pass: " << secondSec << " sec   New commits: " 
+        << (SecureArena::getNumCommits() - commitsBefore) 
+        << "   New heap fallbacks: " 
+        << (SecureArena::getNumHeapFallbacks() - fallbacksBefore) << endl;
+   cout << "Arena committed: " << SecureArena::getNumBytesCommitted()/1024 
+        << " kB   Unlocked: " << SecureArena::getNumBytesUnlocked()/1024 
+        << " kB   Blocks in use: " << SecureArena::getNumBlocksInUse() << endl;
+
+   // Small create/destroy cycles, the case that used to be two syscalls each
+   start = clock();
+   for(uint32_t i=0; i<1000000; i++)
+   {
+      SecureBinaryData key(32);
+      key[0] = (uint8_t)i;
+   }
+   cout << "1M 32-byte keys created and destroyed: " 
+        << (double)(clock()-start) / CLOCKS_PER_SEC << " sec" << endl;
+
+   // Look at the memory right after it's freed.  It's still arena memory,
+   // so this is allowed
+   uint8_t const * freedPtr;
+   uint8_t const * outgrownPtr;
+   {
+      SecureBinaryData key = SecureBinaryData().GenerateRandom(32);
+      freedPtr = key.getPtr();
+
+      SecureBinaryData grows = SecureBinaryData().GenerateRandom(48);
+      outgrownPtr = grows.getPtr();
+      SecureBinaryData more  = SecureBinaryData().GenerateRandom(200);
+      grows.append(more);
+   }
+   cout << "In arena: " << (SecureArena::contains(freedPtr) ? "yes" : "NO");
+   uint32_t nNonZero = 0;
+   for(uint32_t i=sizeof(uint8_t*); i<32; i++)
+      nNonZero += (freedPtr[i]!=0 ? 1 : 0) + (outgrownPtr[i]!=0 ? 1 : 0);
+   cout << "   Nonzero bytes left in freed blocks: " << nNonZero << endl;
+
+   // A shrinking resize zeroes what it drops, and a secure buffer grown 
+   // through a BinaryData method (no SecureAllocScope) stays in the arena
+   SecureBinaryData shrinks = SecureBinaryData().GenerateRandom(64);
+   shrinks.resize(16);
+   uint32_t nTailNonZero = 0;
+   for(uint32_t i=16; i<64; i++)
+      nTailNonZero += (shrinks.getPtr()[i]!=0 ? 1 : 0);
+   BinaryData & asPlain = shrinks;
+   asPlain.append(BinaryData(1000));
+   cout << "Nonzero bytes left past a shrink: " << nTailNonZero
+        << "   Grown as BinaryData, in arena: " 
+        << (SecureArena::contains(shrinks.getPtr()) ? "yes" : "NO") << endl;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Merkle-node-sized, typical-tx-sized and large messages, hashed one at a
+// time and then in batches of each supported width.  Results must match.
+// First, the sizes around the padding boundaries:  up to 55 bytes (or 119)
+// the length fits in the last block, from 56 (or 120) it takes another.
+void TestHash256Batch(void)
+{
+   srand(0);
+   uint32_t msgSizes[3] = {64, 250, 1000};
+   uint32_t laneCounts[3] = {1, 4, 8};
+   cout << "Max lanes on this CPU: " << BtcUtils::getHash256BatchMaxLanes() << endl;
+
+   // Mixed in one batch, so the lanes finish after different block counts
+   uint32_t edgeSizes[6] = {55, 56, 63, 64, 119, 120};
+   uint32_t numEdgeMsgs = 6*8;
+   BinaryData edgeData(120*numEdgeMsgs);
+   for(uint32_t i=0; i<edgeData.getSize(); i++)
+      edgeData[i] = rand() % 256;
+   vector<uint8_t const *> edgePtrs(numEdgeMsgs);
+   vector<uint32_t>        edgeLens(numEdgeMsgs);
+   BinaryData edgeOne(32*numEdgeMsgs);
+   BinaryData edgeBatch(32*numEdgeMsgs);
+   for(uint32_t i=0; i<numEdgeMsgs; i++)
+   {
+      edgePtrs[i] = edgeData.getPtr() + 120*i;
+      edgeLens[i] = edgeSizes[(i + i/6) % 6];
+      BtcUtils::getHash256(edgePtrs[i], edgeLens[i]).copyTo(
+                                               edgeOne.getPtr() + 32*i, 32);
+   }
+   for(uint32_t l=0; l<3; l++)
+   {
+      if(BtcUtils::setHash256BatchLanes(laneCounts[l]) != laneCounts[l])
+         continue;
+      BtcUtils::getHash256Batch(&edgePtrs[0], &edgeLens[0], numEdgeMsgs, 
+                                edgeBatch.getPtr());
+      cout << "55/56/63/64/119/120-byte msgs, " << laneCounts[l] << " lanes: "
+           << (edgeBatch == edgeOne ? "(match)" : "(MISMATCH!)") << endl;
+   }
+   for(uint32_t s=0; s<3; s++)
+   {
+      uint32_t msgSize = msgSizes[s];
+      uint32_t numMsgs = 16*1024*1024 / msgSize;
+      BinaryData msgData(1024*msgSize);
+      for(uint32_t i=0; i<msgData.getSize(); i++)
+         msgData[i] = rand() % 256;
+
+      vector<uint8_t const *> msgPtrs(numMsgs);
+      vector<uint32_t>        msgLens(numMsgs, msgSize);
+      for(uint32_t i=0; i<numMsgs; i++)
+         msgPtrs[i] = msgData.getPtr() + msgSize*(i%1024);
+
+      BinaryData hashOne(32*numMsgs);
+      BinaryData hashBatch(32*numMsgs);
+      clock_t start = clock();
+      for(uint32_t i=0; i<numMsgs; i++)
+      {
+         BinaryData hash = BtcUtils::getHash256(msgPtrs[i], msgSize);
+         hash.copyTo(hashOne.getPtr() + 32*i, 32);
+      }
+      double oneSec = (double)(clock()-start) / CLOCKS_PER_SEC;
+      cout << msgSize << "-byte msgs:   one at a time: " 
+           << (numMsgs*msgSize/oneSec/1.0e6) << " MB/s" << endl;
+
+      for(uint32_t l=0; l<3; l++)
+      {
+         if(BtcUtils::setHash256BatchLanes(laneCounts[l]) != laneCounts[l])
+            continue;
+         start = clock();
+         BtcUtils::getHash256Batch(&msgPtrs[0], &msgLens[0], numMsgs, hashBatch.getPtr());
+         double batchSec = (double)(clock()-start) / CLOCKS_PER_SEC;
+         cout << "                 " << laneCounts[l] << " lanes: " 
+              << (numMsgs*msgSize/batchSec/1.0e6) << " MB/s  "
+              << (hashBatch == hashOne ? "(match)" : "(MISMATCH!)") << endl;
+      }
+   }
+   BtcUtils::setHash256BatchLanes(BtcUtils::getHash256BatchMaxLanes());
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Random 65-byte "public keys", the way address generation would see them
+void TestHash160Batch(void)
+{
+   srand(0);
+   uint32_t numKeys = 200000;
+   BinaryData keys(65*numKeys);
+   for(uint32_t i=0; i<keys.getSize(); i++)
+      keys[i] = rand() % 256;
+
+   BinaryData hashOne(20*numKeys);
+   BinaryData hashBatch(20*numKeys);
+   BinaryData hash20(20);
+   clock_t start = clock();
+   for(uint32_t i=0; i<numKeys; i++)
+   {
+      BtcUtils::getHash160(keys.getPtr() + 65*i, 65, hash20);
+      hash20.copyTo(hashOne.getPtr() + 20*i, 20);
+   }
+   double oneSec = (double)(clock()-start) / CLOCKS_PER_SEC;
+   cout << "One at a time:  " << (numKeys/oneSec) << " keys/s" << endl;
+
+   uint32_t laneCounts[3] = {1, 4, 8};
+   for(uint32_t l=0; l<3; l++)
+   {
+      if(BtcUtils::setHash256BatchLanes(laneCounts[l]) != laneCounts[l])
+         continue;
+      start = clock();
+      BtcUtils::getHash160Batch(keys.getPtr(), 65, numKeys, hashBatch.getPtr());
+      double batchSec = (double)(clock()-start) / CLOCKS_PER_SEC;
+      cout << laneCounts[l] << " lanes:        " << (numKeys/batchSec) << " keys/s  "
+           << (hashBatch == hashOne ? "(match)" : "(MISMATCH!)") << endl;
+   }
+   BtcUtils::setHash256BatchLanes(BtcUtils::getHash256BatchMaxLanes());
+}
+
+
+
 void TestCrypto(void)
 {
 
@@ -851,6 +2173,612 @@ void TestECDSA(void)
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+// Time the four ECDSA ops the wallet uses, through the Crypto++ objects and
+// through the Secp256k1 engine, and check that both give the same answers
+void TestSecp256k1Benchmark(void)
+{
+#ifndef USE_NATIVE_SECP256K1
+   cout << "Not built with USE_NATIVE_SECP256K1, nothing to compare" << endl;
+#else
+   uint32_t const nTest = 200;
+
+   vector<SecureBinaryData> privList(nTest);
+   vector<SecureBinaryData> pubList(nTest);
+   vector<SecureBinaryData> chainList(nTest);
+   vector<SecureBinaryData> hashList(nTest);
+   for(uint32_t i=0; i<nTest; i++)
+   {
+      privList[i]  = SecureBinaryData().GenerateRandom(32);
+      chainList[i] = SecureBinaryData().GenerateRandom(32);
+      hashList[i]  = SecureBinaryData().GenerateRandom(32);
+   }
 
+   /////////////////////////////////////////////////////////////////////////////
+   // Public key from private key
+   uint32_t nPubMatch = 0;
+   TIMER_START("PubKey_CryptoPP");
+   for(uint32_t i=0; i<nTest; i++)
+   {
+      BTC_PRIVKEY priv = CryptoECDSA::ParsePrivateKey(privList[i]);
+      pubList[i] = CryptoECDSA::SerializePublicKey(
+                                    CryptoECDSA::ComputePublicKey(priv));
+   }
+   TIMER_STOP("PubKey_CryptoPP");
 
+   SecureBinaryData pubNative(65);
+   TIMER_START("PubKey_Native");
+   for(uint32_t i=0; i<nTest; i++)
+   {
+      Secp256k1::computePublicKey(privList[i].getPtr(), pubNative.getPtr());
+      nPubMatch += (pubNative == pubList[i] ? 1 : 0);
+   }
+   TIMER_STOP("PubKey_Native");
 
+   /////////////////////////////////////////////////////////////////////////////
+   // Chained public key (the EC part of ComputeChainedPublicKey)
+   uint32_t nChainMatch = 0;
+   vector<SecureBinaryData> chainedPub(nTest);
+   TIMER_START("ChainPub_CryptoPP");
+   for(uint32_t i=0; i<nTest; i++)
+   {
+      CryptoPP::Integer mult;
+      mult.Decode(chainList[i].getPtr(), 32, UNSIGNED);
+      BTC_PUBKEY oldPub = CryptoECDSA::ParsePublicKey(pubList[i]);
+      BTC_PUBKEY newPub = CryptoECDSA::ParsePublicKey(pubList[i]);
+      newPub.SetPublicElement( oldPub.ExponentiatePublicElement(mult) );
+      chainedPub[i] = CryptoECDSA::SerializePublicKey(newPub);
+   }
+   TIMER_STOP("ChainPub_CryptoPP");
+
+   TIMER_START("ChainPub_Native");
+   for(uint32_t i=0; i<nTest; i++)
+   {
+      Secp256k1::multiplyPublicKey(pubList[i].getPtr(), 
+                                   chainList[i].getPtr(), 
+                                   pubNative.getPtr());
+      nChainMatch += (pubNative == chainedPub[i] ? 1 : 0);
+   }
+   TIMER_STOP("ChainPub_Native");
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Signing.  Each engine's signatures get checked by the other's verifier
+   vector<SecureBinaryData> sigCryptoPP(nTest);
+   vector<SecureBinaryData> sigNative(nTest);
+   TIMER_START("Sign_CryptoPP");
+   for(uint32_t i=0; i<nTest; i++)
+   {
+      BTC_PRIVKEY priv = CryptoECDSA::ParsePrivateKey(privList[i]);
+      sigCryptoPP[i] = CryptoECDSA::SignData(hashList[i], priv);
+   }
+   TIMER_STOP("Sign_CryptoPP");
+
+   TIMER_START("Sign_Native");
+   for(uint32_t i=0; i<nTest; i++)
+   {
+      BinaryData hash2 = hashList[i].getHash256();
+      SecureBinaryData nonce = SecureBinaryData().GenerateRandom(32);
+      sigNative[i] = SecureBinaryData(64);
+      Secp256k1::signHash(hash2.getPtr(), privList[i].getPtr(), 
+                          nonce.getPtr(), sigNative[i].getPtr());
+   }
+   TIMER_STOP("Sign_Native");
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Verification
+   uint32_t nCppOK = 0;
+   uint32_t nNativeOK = 0;
+   TIMER_START("Verify_CryptoPP");
+   for(uint32_t i=0; i<nTest; i++)
+   {
+      BTC_PUBKEY pub = CryptoECDSA::ParsePublicKey(pubList[i]);
+      nCppOK += (CryptoECDSA::VerifyData(hashList[i], sigNative[i], pub) ? 1:0);
+   }
+   TIMER_STOP("Verify_CryptoPP");
+
+   TIMER_START("Verify_Native");
+   for(uint32_t i=0; i<nTest; i++)
+   {
+      BinaryData hash2 = hashList[i].getHash256();
+      nNativeOK += (Secp256k1::verifyHash(hash2.getPtr(),
+                                          sigCryptoPP[i].getPtr(),
+                                          pubList[i].getPtr()) ? 1 : 0);
+   }
+   TIMER_STOP("Verify_Native");
+
+   cout << "Public keys matching         : " << nPubMatch   << "/" << nTest << endl;
+   cout << "Chained keys matching        : " << nChainMatch << "/" << nTest << endl;
+   cout << "Native sigs OK for Crypto++  : " << nCppOK      << "/" << nTest << endl;
+   cout << "Crypto++ sigs OK for native  : " << nNativeOK   << "/" << nTest << endl;
+   cout << endl;
+
+   char const * ops[4] = {"PubKey", "ChainPub", "Sign", "Verify"};
+   for(uint32_t op=0; op<4; op++)
+   {
+      double cppSec = TIMER_READ_SEC(string(ops[op]) + "_CryptoPP");
+      double natSec = TIMER_READ_SEC(string(ops[op]) + "_Native");
+      cout << ops[op] << ":  Crypto++ " << nTest/cppSec << " op/s,  native "
+           << nTest/natSec << " op/s  (" << cppSec/natSec << "x)" << endl;
+   }
+#endif
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// A block's worth of signatures from a handful of keys, some of them broken,
+// through VerifyData one at a time and through VerifyBatch
+void TestVerifyBatch(void)
+{
+   CryptoECDSA ecdsa;
+   uint32_t const nKeys = 50;
+   uint32_t const nSigs = 2000;
+
+   vector<SecureBinaryData> privList(nKeys);
+   vector<SecureBinaryData> pubList(nKeys);
+   for(uint32_t k=0; k<nKeys; k++)
+   {
+      privList[k] = ecdsa.GenerateNewPrivateKey();
+      pubList[k]  = ecdsa.ComputePublicKey(privList[k]);
+   }
+
+   vector<BinaryData> msgList(nSigs);
+   vector<BinaryData> sigList(nSigs);
+   vector<BinaryData> pubKeyList(nSigs);
+   for(uint32_t i=0; i<nSigs; i++)
+   {
+      SecureBinaryData msg = SecureBinaryData().GenerateRandom(200);
+      msgList[i]    = msg.getRawCopy();
+      sigList[i]    = ecdsa.SignData(msg, privList[i%nKeys]).getRawCopy();
+      pubKeyList[i] = pubList[i%nKeys].getRawCopy();
+
+      // Every tenth one gets a bad signature
+      if(i%10 == 0)
+         sigList[i].getPtr()[20] ^= 0x01;
+   }
+
+   vector<int> singleResults(nSigs);
+   TIMER_START("VerifyData_Single");
+   for(uint32_t i=0; i<nSigs; i++)
+      singleResults[i] = (ecdsa.VerifyData(SecureBinaryData(msgList[i]),
+                                           SecureBinaryData(sigList[i]),
+                                           SecureBinaryData(pubKeyList[i])) ? 1 : 0);
+   TIMER_STOP("VerifyData_Single");
+
+   TIMER_START("VerifyBatch");
+   vector<int> batchResults = ecdsa.VerifyBatch(msgList, sigList, pubKeyList);
+   TIMER_STOP("VerifyBatch");
+
+   uint32_t nValid = 0;
+   uint32_t nMismatch = 0;
+   for(uint32_t i=0; i<nSigs; i++)
+   {
+      nValid    += batchResults[i];
+      nMismatch += (batchResults[i] != singleResults[i] ? 1 : 0);
+   }
+
+   double singleSec = TIMER_READ_SEC("VerifyData_Single");
+   double batchSec  = TIMER_READ_SEC("VerifyBatch");
+   cout << "Valid signatures    : " << nValid    << "/" << nSigs << endl;
+   cout << "Batch/single differ : " << nMismatch << endl;
+   cout << "VerifyData  : " << nSigs/singleSec << " sig/s" << endl;
+   cout << "VerifyBatch : " << nSigs/batchSec  << " sig/s  (" 
+        << singleSec/batchSec << "x)" << endl;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Like a sweep:  a few thousand inputs, spread over a set of keys
+void TestSignBatch(void)
+{
+   CryptoECDSA ecdsa;
+   uint32_t const nKeys = 50;
+   uint32_t const nSigs = 2000;
+
+   vector<SecureBinaryData> privList(nKeys);
+   SecureBinaryData packedPriv;
+   for(uint32_t k=0; k<nKeys; k++)
+   {
+      privList[k] = ecdsa.GenerateNewPrivateKey();
+      packedPriv.append(privList[k]);
+   }
+
+   vector<BinaryData> msgList(nSigs);
+   vector<int>        keyIdx(nSigs);
+   vector<BinaryData> pubKeyList(nSigs);
+   for(uint32_t i=0; i<nSigs; i++)
+   {
+      msgList[i]    = SecureBinaryData().GenerateRandom(200).getRawCopy();
+      keyIdx[i]     = rand() % nKeys;
+      pubKeyList[i] = ecdsa.ComputePublicKey(privList[keyIdx[i]]).getRawCopy();
+   }
+
+   TIMER_START("SignData_Single");
+   for(uint32_t i=0; i<nSigs; i++)
+      ecdsa.SignData(SecureBinaryData(msgList[i]), privList[keyIdx[i]]);
+   TIMER_STOP("SignData_Single");
+
+   TIMER_START("SignBatch");
+   SecureBinaryData sigs = ecdsa.SignBatch(msgList, keyIdx, packedPriv);
+   TIMER_STOP("SignBatch");
+
+   // Deterministic nonces:  same signatures again, with any number of threads
+   SecureBinaryData sigs1 = ecdsa.SignBatch(msgList, keyIdx, packedPriv, 1);
+
+   vector<BinaryData> sigList(nSigs);
+   for(uint32_t i=0; i<nSigs && sigs.getSize()==64*nSigs; i++)
+      sigList[i] = sigs.getSliceCopy(64*i, 64).getRawCopy();
+   vector<int> results = ecdsa.VerifyBatch(msgList, sigList, pubKeyList);
+   uint32_t nValid = 0;
+   for(uint32_t i=0; i<nSigs; i++)
+      nValid += results[i];
+
+   vector<int> badIdx(keyIdx);
+   badIdx[nSigs/2] = nKeys;
+
+   double singleSec = TIMER_READ_SEC("SignData_Single");
+   double batchSec  = TIMER_READ_SEC("SignBatch");
+   cout << "Valid signatures      : " << nValid << "/" << nSigs << endl;
+   cout << "Same with one thread  : " << (sigs==sigs1 ? "yes" : "no") << endl;
+   cout << "Bad key index rejected: " 
+        << (ecdsa.SignBatch(msgList, badIdx, packedPriv).getSize()==0 ? 
+                                                           "yes" : "no") << endl;
+   cout << "SignData  : " << nSigs/singleSec << " sig/s" << endl;
+   cout << "SignBatch : " << nSigs/batchSec  << " sig/s  (" 
+        << singleSec/batchSec << "x)" << endl;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// The batch chain extension (what fillAddressPool uses for more than one
+// address) has to give exactly the keys that stepping down the chain one
+// link at a time does.  40 links takes the public-key batch through its
+// fixed-point table path (16 or more), 5 links through the plain one.
+void TestChainedKeyBatch(void)
+{
+   SecureBinaryData privKey   = SecureBinaryData::CreateFromHex(
+      "b1d3a8f2c44e6b6e3c7a1f9e0d2c5b4a39281706f5e4d3c2b1a0998877665544");
+   SecureBinaryData chainCode = SecureBinaryData::CreateFromHex(
+      "0123456789abcdeffedcba98765432100f1e2d3c4b5a69788796a5b4c3d2e1f0");
+   SecureBinaryData pubKey = CryptoECDSA().ComputePublicKey(privKey);
+
+   uint32_t numLinks[2] = {5, 40};
+   for(uint32_t t=0; t<2; t++)
+   {
+      uint32_t numAddr = numLinks[t];
+      SecureBinaryData pubBatch  = CryptoECDSA().ComputeChainedPublicKeyBatch(
+                                                  pubKey, chainCode, numAddr);
+      SecureBinaryData privBatch = CryptoECDSA().ComputeChainedPrivateKeyBatch(
+                                                  privKey, chainCode, numAddr);
+      SecureBinaryData privBatchWithPub = 
+                                   CryptoECDSA().ComputeChainedPrivateKeyBatch(
+                                          privKey, chainCode, numAddr, pubKey);
+
+      bool sizesOK = 
+         (pubBatch.getSize()  == numAddr*CHAINED_PUBKEY_RECORD_SIZE &&
+          privBatch.getSize() == numAddr*CHAINED_PRIVKEY_RECORD_SIZE);
+      uint32_t nPubMatch  = 0;
+      uint32_t nPrivMatch = 0;
+      SecureBinaryData prevPriv = privKey;
+      SecureBinaryData prevPub  = pubKey;
+      for(uint32_t i=0; sizesOK && i<numAddr; i++)
+      {
+         SecureBinaryData nextPub  = CryptoECDSA().ComputeChainedPublicKey(
+                                                         prevPub, chainCode);
+         SecureBinaryData nextPriv = CryptoECDSA().ComputeChainedPrivateKey(
+                                                prevPriv, chainCode, prevPub);
+         BinaryData next160 = BtcUtils::getHash160(nextPub);
+
+         uint8_t const * pubRec  = pubBatch.getPtr()  + i*CHAINED_PUBKEY_RECORD_SIZE;
+         uint8_t const * privRec = privBatch.getPtr() + i*CHAINED_PRIVKEY_RECORD_SIZE;
+         if(memcmp(pubRec,    nextPub.getPtr(), 65) == 0 &&
+            memcmp(pubRec+65, next160.getPtr(), 20) == 0)
+            nPubMatch++;
+         if(memcmp(privRec,    nextPriv.getPtr(), 32) == 0 &&
+            memcmp(privRec+32, nextPub.getPtr(),  65) == 0 &&
+            memcmp(privRec+97, next160.getPtr(),  20) == 0)
+            nPrivMatch++;
+
+         prevPriv = nextPriv;
+         prevPub  = nextPub;
+      }
+
+      cout << numAddr << " links:" << endl;
+      cout << "   Public  batch matches one at a time: " 
+           << nPubMatch  << "/" << numAddr << endl;
+      cout << "   Private batch matches one at a time: " 
+           << nPrivMatch << "/" << numAddr << endl;
+      cout << "   Same with the public key passed in:  "
+           << (privBatchWithPub == privBatch ? "yes" : "NO") << endl;
+   }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Build a fake UTXO list:  standard TxOut scripts spread over a bunch of 
+// addresses, values from dust to a few hundred BTC, and a few zero-conf
+vector<UnspentTxOut> createSyntheticUtxoList(uint32_t nUtxo, uint32_t nAddr)
+{
+   vector<UnspentTxOut> utxoList(nUtxo);
+   for(uint32_t i=0; i<nUtxo; i++)
+   {
+      UnspentTxOut & utxo = utxoList[i];
+      BinaryWriter bwHash;
+      bwHash.put_uint32_t(i);
+      utxo.txHash_     = BtcUtils::getHash256(bwHash.getData());
+      utxo.txOutIndex_ = i % 3;
+
+      // Standard TxOut script:  OP_DUP OP_HASH160 <addr20> OP_EQUALVERIFY ...
+      BinaryWriter bwAddr;
+      bwAddr.put_uint32_t(rand() % nAddr);
+      BinaryData addr20 = BtcUtils::getHash160(bwAddr.getData());
+      BinaryWriter bwScript;
+      bwScript.put_uint8_t(0x76);
+      bwScript.put_uint8_t(0xa9);
+      bwScript.put_uint8_t(0x14);
+      bwScript.put_BinaryData(addr20);
+      bwScript.put_uint8_t(0x88);
+      bwScript.put_uint8_t(0xac);
+      utxo.script_ = bwScript.getData();
+
+      // Mostly small outputs, with a long tail of large ones
+      uint64_t mag = (uint64_t)pow(10.0, (double)(rand() % 6));
+      utxo.value_      = (uint64_t)(rand() % 100000 + 1) * mag * 10;
+      utxo.numConfirm_ = (rand() % 20 == 0 ? 0 : rand() % 5000 + 1);
+      utxo.txHeight_   = (utxo.numConfirm_==0 ? UINT32_MAX : 200000);
+   }
+   return utxoList;
+}
+
+
+void TestCoinSelection(void)
+{
+   srand(0);
+   uint64_t target = (uint64_t)12345 * CONVERTBTC / 100;
+   uint64_t fee    = 50000;
+
+   uint32_t sizes[4] = {100, 1000, 10000, 50000};
+   for(uint32_t t=0; t<4; t++)
+   {
+      uint32_t nUtxo = sizes[t];
+      vector<UnspentTxOut> utxoList = createSyntheticUtxoList(nUtxo, nUtxo/4+1);
+
+      CoinSelection cs;
+      cs.setTimeBudget(2.0);
+      TIMER_START("CoinSelection");
+      vector<UnspentTxOut> selected = cs.selectCoins(utxoList, target, fee);
+      TIMER_STOP("CoinSelection");
+
+      uint64_t sumIn = 0;
+      for(uint32_t i=0; i<selected.size(); i++)
+         sumIn += selected[i].getValue();
+
+      cout << "Synthetic UTXO set, " << nUtxo << " outputs:" << endl;
+      cout << "   Selected inputs : " << selected.size() << endl;
+      cout << "   Total in / tgt  : " << sumIn/1e8 << " / " << (target+fee)/1e8 << endl;
+      cout << "   Score           : " << cs.evalCoinSelect(selected, target, fee) << endl;
+      cout << "   Candidates eval : " << cs.getNumCandidatesEval() << endl;
+      cout << "   BnB tries       : " << cs.getNumBnbTries() << endl;
+      cout << "   Budget exceeded : " << (cs.wasBudgetExceeded() ? 1 : 0) << endl;
+      cout << "   Select time     : " << cs.getLastSelectSec() << " sec" << endl;
+
+      // Pick a target that is exactly hit by two of the outputs
+      uint64_t exactTarget = utxoList[0].getValue() + utxoList[nUtxo/2].getValue();
+      TIMER_START("CoinSelection_ExactMatch");
+      selected = cs.selectExactMatch(utxoList, exactTarget, 0);
+      TIMER_STOP("CoinSelection_ExactMatch");
+      sumIn = 0;
+      for(uint32_t i=0; i<selected.size(); i++)
+         sumIn += selected[i].getValue();
+      cout << "   Exact match     : " << selected.size() << " inputs, "
+           << (sumIn==exactTarget ? "exact" : "NOT FOUND") << ", "
+           << cs.getNumBnbTries() << " tries" << endl;
+      cout << endl;
+   }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+void TestWalletScanState(string blkfile)
+{
+   BlockDataManager_FullRAM & bdm = BlockDataManager_FullRAM::GetInstance(); 
+   bdm.readBlkFile_FromScratch(blkfile);
+
+   string snapFile = getTempFilePath("walletScanState.bin");
+   BtcWallet wlt, wlt2, wlt3;
+   BinaryData myAddress;
+   myAddress.createFromHex("604875c897a079f4db88e5d71145be2093cae194"); 
+   wlt.addAddress(myAddress); wlt2.addAddress(myAddress); wlt3.addAddress(myAddress);
+   myAddress.createFromHex("8996182392d6f05e732410de4fc3fa273bac7ee6"); 
+   wlt.addAddress(myAddress); wlt2.addAddress(myAddress); wlt3.addAddress(myAddress);
+   myAddress.createFromHex("0e0aec36fe2545fb31a41164fb6954adcd96b342"); 
+   wlt.addAddress(myAddress); wlt2.addAddress(myAddress); wlt3.addAddress(myAddress);
+
+   TIMER_START("Full Wallet Scan");
+   bdm.scanBlockchainForTx(wlt);
+   TIMER_STOP("Full Wallet Scan");
+
+   bdm.writeWalletScanStateFile(wlt, snapFile);
+
+   TIMER_START("Load Wallet Scan State");
+   bool usedSnapshot = bdm.readWalletScanStateFile(wlt2, snapFile);
+   TIMER_STOP("Load Wallet Scan State");
+
+   cout << "Used snapshot:  " << (usedSnapshot ? "yes" : "NO") << endl;
+   cout << "Scan time:      " << TIMER_READ_SEC("Full Wallet Scan") << endl;
+   cout << "Load time:      " << TIMER_READ_SEC("Load Wallet Scan State") << endl;
+   cout << "Full balance:   " << wlt.getFullBalance()/1e8 << "  " 
+                              << wlt2.getFullBalance()/1e8 << endl;
+   cout << "Spendable:      " << wlt.getSpendableBalance()/1e8 << "  " 
+                              << wlt2.getSpendableBalance()/1e8 << endl;
+   cout << "Ledger size:    " << wlt.getTxLedger().size() << "  " 
+                              << wlt2.getTxLedger().size() << endl;
+   cout << "TxIO count:     " << wlt.getTxIOMap().size() << "  " 
+                              << wlt2.getTxIOMap().size() << endl;
+   cout << "Undo blocks:    " << wlt.getNumUndoBlocks() << "  " 
+                              << wlt2.getNumUndoBlocks() << endl;
+   for(uint32_t i=0; i<wlt.getNumAddr(); i++)
+      cout << "   Addr " << i << ": " 
+           << wlt.getAddrByIndex(i).getFullBalance()/1e8 << "  "
+           << wlt2.getAddrByIndex(i).getFullBalance()/1e8 << endl;
+
+   // A corrupted snapshot should be detected and fall back to a full rescan
+   BinaryData snapshot = bdm.getWalletScanState(wlt);
+   snapshot[snapshot.getSize()/2] ^= 0xff;
+   usedSnapshot = bdm.loadWalletScanState(wlt3, snapshot);
+   cout << "Corrupt snapshot used (should be no): " 
+        << (usedSnapshot ? "YES" : "no") << endl;
+   cout << "Balance after fallback rescan: " << wlt3.getFullBalance()/1e8 << endl;
+
+   remove(snapFile.c_str());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Same blocks as TestReorgBlockchain, but 3A/4A/5A go in as one batch, so 
+// there is only one organizeChain, and the reorg shows up in the result
+void TestAddNewBlocks(void)
+{
+   BlockDataManager_FullRAM & bdm = BlockDataManager_FullRAM::GetInstance(); 
+   bdm.Reset();
+   bdm.SelectNetwork("Main");
+   bdm.readBlkFile_FromScratch("reorgTest/blk_0_to_4.dat");
+   BinaryData prevTop = bdm.getTopBlockHeader().getThisHash();
+
+   vector<BinaryData> batch(3);
+   assert(batch[0].readBinaryFile("reorgTest/blk_3A.dat") != -1);
+   assert(batch[1].readBinaryFile("reorgTest/blk_4A.dat") != -1);
+   assert(batch[2].readBinaryFile("reorgTest/blk_5A.dat") != -1);
+
+   // Throw in a block we already have; it should be skipped
+   batch.push_back(batch[0]);
+
+   BlockBatchResult result = bdm.addNewBlocks(batch);
+   cout << "Blocks added:   " << result.getNumBlocksAdded() << " (expect 3)" << endl;
+   cout << "Duplicates:     " << result.getNumDuplicates() << " (expect 1)" << endl;
+   cout << "Orphans:        " << result.getNumOrphans() << " (expect 0)" << endl;
+   cout << "Reorg:          " << (result.isReorg() ? "yes" : "NO") << endl;
+   cout << "Branch height:  " << result.getBranchPointHeight() << " (expect 2)" << endl;
+   cout << "New top height: " << result.getNewTopHeight() << " (expect 5)" << endl;
+   cout << "Prev top match: " 
+        << (result.getPrevTopHash() == prevTop ? "yes" : "NO") << endl;
+   cout << "New top match:  " 
+        << (result.getNewTopHash() == bdm.getTopBlockHeader().getThisHash() ? 
+                                                          "yes" : "NO") << endl;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Same blocks again, but backwards:  5A and 4A have no parent when they show
+// up, and should both be linked in (with a reorg) when 3A arrives
+void TestOrphanPool(void)
+{
+   BlockDataManager_FullRAM & bdm = BlockDataManager_FullRAM::GetInstance(); 
+   bdm.Reset();
+   bdm.SelectNetwork("Main");
+   bdm.readBlkFile_FromScratch("reorgTest/blk_0_to_4.dat");
+
+   BinaryData blk3A, blk4A, blk5A;
+   assert(blk3A.readBinaryFile("reorgTest/blk_3A.dat") != -1);
+   assert(blk4A.readBinaryFile("reorgTest/blk_4A.dat") != -1);
+   assert(blk5A.readBinaryFile("reorgTest/blk_5A.dat") != -1);
+
+   bdm.addNewBlockData(blk5A);
+   bdm.addNewBlockData(blk4A);
+   cout << "Orphan pool size: " << bdm.getOrphanPoolSize() << " (expect 2)" << endl;
+   cout << "Top height:       " << bdm.getTopBlockHeader().getBlockHeight() 
+        << " (expect 4)" << endl;
+
+   vector<bool> result = bdm.addNewBlockData(blk3A);
+   cout << "Reconnected:      " << bdm.getNumOrphansJustReconnected() 
+        << " (expect 2)" << endl;
+   cout << "Orphan pool size: " << bdm.getOrphanPoolSize() << " (expect 0)" << endl;
+   cout << "Reorg:            " 
+        << (result[ADD_BLOCK_CAUSED_REORG] ? "yes" : "NO") << endl;
+   cout << "Top height:       " << bdm.getTopBlockHeader().getBlockHeight() 
+        << " (expect 5)" << endl;
+
+   // With room for only one orphan, 5A is evicted when 4A arrives, and its
+   // tx must go with it:  they'd be left with no header otherwise
+   bdm.Reset();
+   bdm.readBlkFile_FromScratch("reorgTest/blk_0_to_4.dat");
+   uint32_t oldMaxOrphans = bdm.getOrphanPoolMaxBlocks();
+   uint32_t numTxBefore = bdm.getNumTx();
+   bdm.setOrphanPoolMaxBlocks(1);
+   bdm.addNewBlockData(blk5A);
+   bdm.addNewBlockData(blk4A);
+
+   BinaryRefReader brr(blk5A);
+   brr.advance(8 + HEADER_SIZE);
+   brr.get_var_int();
+   uint32_t cbSize = BtcUtils::TxCalcLength(brr.getCurrPtr());
+   BinaryData cbHash5A = BtcUtils::getHash256(brr.getCurrPtr(), cbSize);
+   cout << "Orphan pool size: " << bdm.getOrphanPoolSize() << " (expect 1)" << endl;
+   cout << "Evicted orphan's coinbase gone: " 
+        << (bdm.getTxByHash(cbHash5A) == NULL ? "yes" : "NO") << endl;
+   cout << "Tx added:         " << bdm.getNumTx() - numTxBefore 
+        << " (expect #tx in 4A)" << endl;
+   bdm.setOrphanPoolMaxBlocks(oldMaxOrphans);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Known answers for the 256-bit chain-work math.  The expected work values
+// are floor(2^256 / (target+1)), computed separately with bignums
+void TestChainWork(void)
+{
+   BinaryData genBits  = BinaryData::CreateFromHex("ffff001d"); // 0x1d00ffff
+   BinaryData hardBits = BinaryData::CreateFromHex("ffff7f1c"); // 0x1c7fffff
+   BinaryData realBits = BinaryData::CreateFromHex("cb04041b"); // 0x1b0404cb
+
+   UInt256 genWork  = BtcUtils::convertDiffBitsToWork(genBits.getRef());
+   UInt256 hardWork = BtcUtils::convertDiffBitsToWork(hardBits.getRef());
+   UInt256 realWork = BtcUtils::convertDiffBitsToWork(realBits.getRef());
+   cout << "Genesis work:    " << (genWork  == UInt256(0x100010001ULL)   ? "ok" : "WRONG")
+        << "  " << genWork.getBinaryData().toHexStr() << endl;
+   cout << "0x1c7fffff work: " << (hardWork == UInt256(0x200000400ULL)   ? "ok" : "WRONG")
+        << "  " << hardWork.getBinaryData().toHexStr() << endl;
+   cout << "0x1b0404cb work: " << (realWork == UInt256(0x3fb3ab764c00ULL) ? "ok" : "WRONG")
+        << "  " << realWork.getBinaryData().toHexStr() << endl;
+
+   // Carry out of the low word, and the borrow back into it
+   UInt256 lowAllOnes(0xffffffffffffffffULL);
+   UInt256 sum = lowAllOnes + UInt256(1);
+   UInt256 twoTo64(1);
+   twoTo64 <<= 64;
+   cout << "Carry across limbs:  " 
+        << (sum == twoTo64 && sum.getNumBits() == 65 ? "ok" : "WRONG")
+        << "  " << sum.getBinaryData().toHexStr() << endl;
+   cout << "Borrow across limbs: " 
+        << (sum - UInt256(1) == lowAllOnes ? "ok" : "WRONG") << endl;
+
+   // Carry all the way up:  2^256-1 plus 1 wraps to zero
+   UInt256 allOnes = ~UInt256();
+   cout << "Wrap at 2^256:       " 
+        << ((allOnes + UInt256(1)).isZero() ? "ok" : "WRONG") << endl;
+
+   // Two forks of the same height off a common parent.  One is three blocks
+   // at the genesis difficulty, the other has a harder block on top.  Then 
+   // two forks whose totals are 2^70-ish and differ only in the lowest bit,
+   // which a double can't tell apart
+   UInt256 forkA = genWork + genWork + genWork;
+   UInt256 forkB = genWork + genWork + hardWork;
+   cout << "Harder fork wins:    " 
+        << (forkB > forkA && forkA < forkB && 
+            forkA == UInt256(0x300030003ULL) && 
+            forkB == UInt256(0x400020402ULL) ? "ok" : "WRONG") << endl;
+   UInt256 forkC = forkA;
+   cout << "Equal forks tie:     " 
+        << (forkC == forkA && !(forkC > forkA) && !(forkC < forkA) ? "ok" : "WRONG") 
+        << endl;
+
+   UInt256 bigBase(1);
+   bigBase <<= 70;
+   UInt256 forkD = bigBase + genWork;
+   UInt256 forkE = bigBase + genWork + UInt256(1);
+   cout << "Off by one at 2^70:  " 
+        << (forkE > forkD && forkD.getDouble() == forkE.getDouble() ? 
+                                                      "ok" : "WRONG") << endl;
+}
@@ -11,3 +11,535 @@
 BinaryData BtcUtils::BadAddress_    = BinaryData::CreateFromHex("0000000000000000000000000000000000000000");
 BinaryData BtcUtils::EmptyHash_     = BinaryData::CreateFromHex("0000000000000000000000000000000000000000000000000000000000000000");
 
+
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// Multi-buffer SHA-256 for BtcUtils::getHash256Batch
+//
+// Each lane of a SIMD register holds the state of a different message, so
+// 4 or 8 independent compressions happen for the price of one.  The round
+// function is written once with GCC vector extensions (also understood by
+// clang) and compiled for SSE2 and for AVX2; which one runs is picked from 
+// the CPU at startup.  Other compilers get the one-at-a-time fallback.
+//
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__) || \
+                          defined(__ARM_NEON) || defined(__ARM_NEON__))
+   #define HASH256_MULTIBUFFER
+#endif
+
+#define HASH256_MAX_LANES  8
+
+#ifdef HASH256_MULTIBUFFER
+
+static const uint32_t SHA256_K[64] = 
+{
+   0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 
+   0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 
+   0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 
+   0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 
+   0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 
+   0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 
+   0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b, 
+   0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 
+   0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 
+   0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 
+   0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t SHA256_IV[8] = 
+{
+   0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 
+   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+typedef uint32_t VecU32x4 __attribute__((vector_size(16)));
+typedef uint32_t VecU32x8 __attribute__((vector_size(32)));
+
+////////////////////////////////////////////////////////////////////////////////
+// state is 8 words by LANES, w is 16 message words by LANES (already in host
+// order).  Always inlined, so it gets compiled with the instruction set of
+// whichever wrapper below it lands in.
+template<typename VEC, int LANES>
+static inline __attribute__((always_inline))
+void sha256TransformLanes(uint32_t * state, uint32_t const * w)
+{
+   #define VROTR(x,n)  (((x) >> (n)) | ((x) << (32-(n))))
+   VEC s[8];
+   VEC sched[16];
+   memcpy(s,     state, sizeof(s));
+   memcpy(sched, w,     sizeof(sched));
+
+   VEC a=s[0], b=s[1], c=s[2], d=s[3], e=s[4], f=s[5], g=s[6], h=s[7];
+   for(int t=0; t<64; t++)
+   {
+      if(t >= 16)
+      {
+         VEC w15 = sched[(t-15)&15];
+         VEC w2  = sched[(t-2) &15];
+         VEC sig0 = VROTR(w15,7)  ^ VROTR(w15,18) ^ (w15 >> 3);
+         VEC sig1 = VROTR(w2, 17) ^ VROTR(w2, 19) ^ (w2  >> 10);
+         sched[t&15] += sig0 + sched[(t-7)&15] + sig1;
+      }
+      VEC bigSig1 = VROTR(e,6) ^ VROTR(e,11) ^ VROTR(e,25);
+      VEC ch      = (e & f) ^ (~e & g);
+      VEC t1      = h + bigSig1 + ch + SHA256_K[t] + sched[t&15];
+      VEC bigSig0 = VROTR(a,2) ^ VROTR(a,13) ^ VROTR(a,22);
+      VEC maj     = (a & b) ^ (a & c) ^ (b & c);
+      h = g;  g = f;  f = e;  e = d + t1;
+      d = c;  c = b;  b = a;  a = t1 + bigSig0 + maj;
+   }
+   s[0]+=a; s[1]+=b; s[2]+=c; s[3]+=d; s[4]+=e; s[5]+=f; s[6]+=g; s[7]+=h;
+   memcpy(state, s, sizeof(s));
+   #undef VROTR
+}
+
+static void sha256Transform4(uint32_t * state, uint32_t const * w)
+{
+   sha256TransformLanes<VecU32x4, 4>(state, w);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void sha256Transform8(uint32_t * state, uint32_t const * w)
+{
+   sha256TransformLanes<VecU32x8, 8>(state, w);
+}
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+// One message in one lane.  The whole 64-byte blocks are read straight from
+// the message, the padded tail (one or two blocks) is built here.  For
+// hash256, the digest of the first SHA-256 becomes a one-block second
+// message in the same lane.
+struct Hash256Lane
+{
+   uint8_t const * msg_;
+   uint32_t        numMsgBlocks_;
+   uint32_t        numBlocks_;
+   uint32_t        blockIdx_;
+   bool            isSecondPass_;
+   uint8_t *       out_;
+   uint8_t         firstHash_[32];
+   uint8_t         tail_[128];
+};
+
+static void startHashLane(Hash256Lane & lane, 
+                          uint8_t const * msg, 
+                          uint32_t len,
+                          uint8_t * out,
+                          bool isSecondPass)
+{
+   uint32_t remBytes  = len % 64;
+   uint32_t tailBytes = (remBytes + 9 <= 64 ? 64 : 128);
+
+   lane.msg_          = msg;
+   lane.numMsgBlocks_ = len / 64;
+   lane.numBlocks_    = lane.numMsgBlocks_ + tailBytes/64;
+   lane.blockIdx_     = 0;
+   lane.isSecondPass_ = isSecondPass;
+   lane.out_          = out;
+
+   memset(lane.tail_, 0, tailBytes);
+   if(remBytes > 0)
+      memcpy(lane.tail_, msg + 64*lane.numMsgBlocks_, remBytes);
+   lane.tail_[remBytes] = 0x80;
+   uint64_t bitLen = (uint64_t)len * 8;
+   for(int i=0; i<8; i++)
+      lane.tail_[tailBytes-1-i] = (uint8_t)(bitLen >> (8*i));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<int LANES>
+static void sha256MultiBuffer(void (*transform)(uint32_t*, uint32_t const*),
+                              uint8_t const * const * msgPtrs,
+                              uint32_t const *        msgLens,
+                              uint32_t                numMsgs,
+                              uint8_t *               hashesOut,
+                              bool                    doubleHash)
+{
+   Hash256Lane lanes[LANES];
+   bool        isActive[LANES];
+   uint32_t    state[8*LANES];
+   uint32_t    w[16*LANES];
+
+   uint32_t nextMsg   = 0;
+   uint32_t numActive = 0;
+   for(int l=0; l<LANES; l++)
+   {
+      isActive[l] = (nextMsg < numMsgs);
+      if(isActive[l])
+      {
+         startHashLane(lanes[l], msgPtrs[nextMsg], msgLens[nextMsg], 
+                       hashesOut + 32*nextMsg, false);
+         nextMsg++;
+         numActive++;
+      }
+      for(int i=0; i<8; i++)
+         state[i*LANES+l] = SHA256_IV[i];
+   }
+
+   memset(w, 0, sizeof(w));
+   while(numActive > 0)
+   {
+      // Transpose the next block of each message into the lanes
+      for(int l=0; l<LANES; l++)
+      {
+         if(!isActive[l])
+            continue;
+         Hash256Lane & lane = lanes[l];
+         uint8_t const * blk = (lane.blockIdx_ < lane.numMsgBlocks_ ?
+                       lane.msg_  + 64*lane.blockIdx_ :
+                       lane.tail_ + 64*(lane.blockIdx_-lane.numMsgBlocks_));
+         for(int t=0; t<16; t++)
+            w[t*LANES+l] = ((uint32_t)blk[4*t  ] << 24) | 
+                           ((uint32_t)blk[4*t+1] << 16) |
+                           ((uint32_t)blk[4*t+2] <<  8) | 
+                           ((uint32_t)blk[4*t+3]      );
+      }
+
+      transform(state, w);
+
+      for(int l=0; l<LANES; l++)
+      {
+         Hash256Lane & lane = lanes[l];
+         if(!isActive[l] || ++lane.blockIdx_ < lane.numBlocks_)
+            continue;
+
+         bool needSecondPass = (doubleHash && !lane.isSecondPass_);
+         uint8_t * digest = (needSecondPass ? lane.firstHash_ : lane.out_);
+         for(int i=0; i<8; i++)
+         {
+            uint32_t v = state[i*LANES+l];
+            digest[4*i  ] = (uint8_t)(v >> 24);
+            digest[4*i+1] = (uint8_t)(v >> 16);
+            digest[4*i+2] = (uint8_t)(v >>  8);
+            digest[4*i+3] = (uint8_t)(v      );
+            state[i*LANES+l] = SHA256_IV[i];
+         }
+
+         if(needSecondPass)
+            startHashLane(lane, lane.firstHash_, 32, lane.out_, true);
+         else if(nextMsg < numMsgs)
+         {
+            startHashLane(lane, msgPtrs[nextMsg], msgLens[nextMsg], 
+                          hashesOut + 32*nextMsg, false);
+            nextMsg++;
+         }
+         else
+         {
+            isActive[l] = false;
+            numActive--;
+         }
+      }
+   }
+}
+
+#endif  // HASH256_MULTIBUFFER
+
+
+////////////////////////////////////////////////////////////////////////////////
+uint32_t BtcUtils::getHash256BatchMaxLanes(void)
+{
+#ifdef HASH256_MULTIBUFFER
+   #if defined(__x86_64__) || defined(__i386__)
+      __builtin_cpu_init();
+      if(__builtin_cpu_supports("avx2"))
+         return 8;
+      if(__builtin_cpu_supports("sse2"))
+         return 4;
+      return 1;
+   #else
+      return 4;
+   #endif
+#else
+   return 1;
+#endif
+}
+
+uint32_t BtcUtils::hash256BatchLanes_ = BtcUtils::getHash256BatchMaxLanes();
+
+////////////////////////////////////////////////////////////////////////////////
+uint32_t BtcUtils::setHash256BatchLanes(uint32_t numLanes)
+{
+   uint32_t maxLanes = getHash256BatchMaxLanes();
+   if(numLanes >= 8 && maxLanes >= 8)
+      hash256BatchLanes_ = 8;
+   else if(numLanes >= 4 && maxLanes >= 4)
+      hash256BatchLanes_ = 4;
+   else
+      hash256BatchLanes_ = 1;
+   return hash256BatchLanes_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Runs the batch through the widest multi-buffer SHA-256 that's enabled.
+// Returns false if it didn't (no SIMD, or too few messages to bother)
+static bool sha256Batch(uint8_t const * const * msgPtrs,
+                        uint32_t const *        msgLens,
+                        uint32_t                numMsgs,
+                        uint8_t *               hashesOut,
+                        bool                    doubleHash)
+{
+#ifdef HASH256_MULTIBUFFER
+   // Not worth filling the lanes for just one or two messages
+   if(numMsgs <= 2)
+      return false;
+   #if defined(__x86_64__) || defined(__i386__)
+   if(BtcUtils::getHash256BatchLanes() == 8)
+   {
+      sha256MultiBuffer<8>(sha256Transform8, msgPtrs, msgLens, numMsgs, 
+                           hashesOut, doubleHash);
+      return true;
+   }
+   #endif
+   if(BtcUtils::getHash256BatchLanes() == 4)
+   {
+      sha256MultiBuffer<4>(sha256Transform4, msgPtrs, msgLens, numMsgs, 
+                           hashesOut, doubleHash);
+      return true;
+   }
+#endif
+   return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BtcUtils::getHash256Batch(uint8_t const * const * msgPtrs,
+                               uint32_t const *        msgLens,
+                               uint32_t                numMsgs,
+                               uint8_t *               hashesOut)
+{
+   if(sha256Batch(msgPtrs, msgLens, numMsgs, hashesOut, true))
+      return;
+
+   CryptoPP::SHA256 sha256;
+   for(uint32_t i=0; i<numMsgs; i++)
+   {
+      uint8_t * out = hashesOut + 32*i;
+      sha256.CalculateDigest(out, msgPtrs[i], msgLens[i]);
+      sha256.CalculateDigest(out, out, 32);
+   }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// Multi-buffer RIPEMD-160 for BtcUtils::getHash160Batch.  Only ever sees
+// 32-byte SHA-256 digests, so every message is exactly one padded block.
+//
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef HASH256_MULTIBUFFER
+
+static const uint8_t RMD160_R_LEFT[80] = 
+{
+    0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+    7,  4, 13,  1, 10,  6, 15,  3, 12,  0,  9,  5,  2, 14, 11,  8,
+    3, 10, 14,  4,  9, 15,  8,  1,  2,  7,  0,  6, 13, 11,  5, 12,
+    1,  9, 11, 10,  0,  8, 12,  4, 13,  3,  7, 15, 14,  5,  6,  2,
+    4,  0,  5,  9,  7, 12,  2, 10, 14,  1,  3,  8, 11,  6, 15, 13
+};
+
+static const uint8_t RMD160_R_RIGHT[80] = 
+{
+    5, 14,  7,  0,  9,  2, 11,  4, 13,  6, 15,  8,  1, 10,  3, 12,
+    6, 11,  3,  7,  0, 13,  5, 10, 14, 15,  8, 12,  4,  9,  1,  2,
+   15,  5,  1,  3,  7, 14,  6,  9, 11,  8, 12,  2, 10,  0,  4, 13,
+    8,  6,  4,  1,  3, 11, 15,  0,  5, 12,  2, 13,  9,  7, 10, 14,
+   12, 15, 10,  4,  1,  5,  8,  7,  6,  2, 13, 14,  0,  3,  9, 11
+};
+
+static const uint8_t RMD160_S_LEFT[80] = 
+{
+   11, 14, 15, 12,  5,  8,  7,  9, 11, 13, 14, 15,  6,  7,  9,  8,
+    7,  6,  8, 13, 11,  9,  7, 15,  7, 12, 15,  9, 11,  7, 13, 12,
+   11, 13,  6,  7, 14,  9, 13, 15, 14,  8, 13,  6,  5, 12,  7,  5,
+   11, 12, 14, 15, 14, 15,  9,  8,  9, 14,  5,  6,  8,  6,  5, 12,
+    9, 15,  5, 11,  6,  8, 13, 12,  5, 12, 13, 14, 11,  8,  5,  6
+};
+
+static const uint8_t RMD160_S_RIGHT[80] = 
+{
+    8,  9,  9, 11, 13, 15, 15,  5,  7,  7,  8, 11, 14, 14, 12,  6,
+    9, 13, 15,  7, 12,  8,  9, 11,  7,  7, 12,  7,  6, 15, 13, 11,
+    9,  7, 15, 11,  8,  6,  6, 14, 12, 13,  5, 14, 13, 13,  7,  5,
+   15,  5,  8, 11, 14, 14,  6, 14,  6,  9, 12,  9, 12,  5, 15,  8,
+    8,  5, 12,  9, 12,  5, 14,  6,  8, 13,  6,  5, 15, 13, 11, 11
+};
+
+static const uint32_t RMD160_K_LEFT[5]  = 
+   { 0x00000000, 0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xa953fd4e };
+static const uint32_t RMD160_K_RIGHT[5] = 
+   { 0x50a28be6, 0x5c4dd124, 0x6d703ef3, 0x7a6d76e9, 0x00000000 };
+
+static const uint32_t RMD160_IV[5] = 
+   { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+
+////////////////////////////////////////////////////////////////////////////////
+// The five boolean functions, by round.  The result goes out through a
+// reference:  returning a 256-bit vector by value from a function that
+// isn't compiled for AVX is an ABI mismatch (GCC's -Wpsabi)
+template<typename VEC>
+static inline __attribute__((always_inline))
+void rmd160F(int rnd, VEC const & x, VEC const & y, VEC const & z, VEC & f)
+{
+   switch(rnd)
+   {
+      case 0:  f = x ^ y ^ z;               break;
+      case 1:  f = (x & y) | (~x & z);      break;
+      case 2:  f = (x | ~y) ^ z;            break;
+      case 3:  f = (x & z) | (y & ~z);      break;
+      default: f = x ^ (y | ~z);            break;
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// digests holds LANES 32-byte inputs end-to-end, hashesOut gets LANES 
+// 20-byte RIPEMD-160s.  Same trick as sha256TransformLanes for the ISA.
+template<typename VEC, int LANES>
+static inline __attribute__((always_inline))
+void ripemd160Of32Lanes(uint8_t const * digests, uint8_t * hashesOut)
+{
+   #define VROTL(x,n)  (((x) << (n)) | ((x) >> (32-(n))))
+   uint32_t words[16*LANES];
+   for(int l=0; l<LANES; l++)
+   {
+      uint8_t const * in = digests + 32*l;
+      for(int t=0; t<8; t++)
+         words[t*LANES+l] = ((uint32_t)in[4*t  ]      ) | 
+                            ((uint32_t)in[4*t+1] <<  8) |
+                            ((uint32_t)in[4*t+2] << 16) | 
+                            ((uint32_t)in[4*t+3] << 24);
+      // Padding for a 32-byte message:  0x80, zeros, length 256 bits (LE)
+      words[ 8*LANES+l] = 0x00000080;
+      for(int t=9; t<14; t++)
+         words[t*LANES+l] = 0;
+      words[14*LANES+l] = 256;
+      words[15*LANES+l] = 0;
+   }
+
+   VEC x[16];
+   memcpy(x, words, sizeof(x));
+
+   VEC h[5];
+   for(int i=0; i<5; i++)
+      for(int l=0; l<LANES; l++)
+         h[i][l] = RMD160_IV[i];
+
+   VEC al=h[0], bl=h[1], cl=h[2], dl=h[3], el=h[4];
+   VEC ar=h[0], br=h[1], cr=h[2], dr=h[3], er=h[4];
+   VEC f;
+   for(int j=0; j<80; j++)
+   {
+      int rnd = j/16;
+      rmd160F(rnd, bl, cl, dl, f);
+      VEC t = al + f + x[RMD160_R_LEFT[j]] + RMD160_K_LEFT[rnd];
+      t = VROTL(t, RMD160_S_LEFT[j]) + el;
+      al = el;  el = dl;  dl = VROTL(cl, 10);  cl = bl;  bl = t;
+
+      rmd160F(4-rnd, br, cr, dr, f);
+      t = ar + f + x[RMD160_R_RIGHT[j]] + RMD160_K_RIGHT[rnd];
+      t = VROTL(t, RMD160_S_RIGHT[j]) + er;
+      ar = er;  er = dr;  dr = VROTL(cr, 10);  cr = br;  br = t;
+   }
+
+   VEC out[5];
+   out[0] = h[1] + cl + dr;
+   out[1] = h[2] + dl + er;
+   out[2] = h[3] + el + ar;
+   out[3] = h[4] + al + br;
+   out[4] = h[0] + bl + cr;
+   for(int l=0; l<LANES; l++)
+      for(int i=0; i<5; i++)
+      {
+         uint32_t v = out[i][l];
+         hashesOut[20*l+4*i  ] = (uint8_t)(v      );
+         hashesOut[20*l+4*i+1] = (uint8_t)(v >>  8);
+         hashesOut[20*l+4*i+2] = (uint8_t)(v >> 16);
+         hashesOut[20*l+4*i+3] = (uint8_t)(v >> 24);
+      }
+   #undef VROTL
+}
+
+static void ripemd160Of32x4(uint8_t const * digests, uint8_t * hashesOut)
+{
+   ripemd160Of32Lanes<VecU32x4, 4>(digests, hashesOut);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void ripemd160Of32x8(uint8_t const * digests, uint8_t * hashesOut)
+{
+   ripemd160Of32Lanes<VecU32x8, 8>(digests, hashesOut);
+}
+#endif
+
+#endif  // HASH256_MULTIBUFFER
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Done in chunks, so the intermediate SHA-256 digests can live on the stack
+void BtcUtils::getHash160Batch(uint8_t const * const * msgPtrs,
+                               uint32_t const *        msgLens,
+                               uint32_t                numMsgs,
+                               uint8_t *               hashesOut)
+{
+   static const uint32_t CHUNK = 64;
+   uint8_t sha256Out[32*CHUNK];
+   CryptoPP::SHA256    sha256;
+   CryptoPP::RIPEMD160 ripemd160;
+
+   for(uint32_t c0=0; c0<numMsgs; c0+=CHUNK)
+   {
+      uint32_t nChunk = min(CHUNK, numMsgs-c0);
+      if(!sha256Batch(msgPtrs+c0, msgLens+c0, nChunk, sha256Out, false))
+         for(uint32_t i=0; i<nChunk; i++)
+            sha256.CalculateDigest(sha256Out + 32*i, msgPtrs[c0+i], msgLens[c0+i]);
+
+      uint32_t i = 0;
+#ifdef HASH256_MULTIBUFFER
+      uint32_t lanes = getHash256BatchLanes();
+      for(; lanes > 1 && i+lanes <= nChunk; i+=lanes)
+      {
+   #if defined(__x86_64__) || defined(__i386__)
+         if(lanes == 8)
+         {
+            ripemd160Of32x8(sha256Out + 32*i, hashesOut + 20*(c0+i));
+            continue;
+         }
+   #endif
+         ripemd160Of32x4(sha256Out + 32*i, hashesOut + 20*(c0+i));
+      }
+#endif
+      for(; i<nChunk; i++)
+         ripemd160.CalculateDigest(hashesOut + 20*(c0+i), sha256Out + 32*i, 32);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void BtcUtils::getHash160Batch(uint8_t const * msgs,
+                               uint32_t        msgSize,
+                               uint32_t        numMsgs,
+                               uint8_t *       hashesOut)
+{
+   static const uint32_t CHUNK = 256;
+   uint8_t const * msgPtrs[CHUNK];
+   uint32_t        msgLens[CHUNK];
+   for(uint32_t c0=0; c0<numMsgs; c0+=CHUNK)
+   {
+      uint32_t nChunk = min(CHUNK, numMsgs-c0);
+      for(uint32_t i=0; i<nChunk; i++)
+      {
+         msgPtrs[i] = msgs + msgSize*(c0+i);
+         msgLens[i] = msgSize;
+      }
+      getHash160Batch(msgPtrs, msgLens, nChunk, hashesOut + 20*c0);
+   }
+}
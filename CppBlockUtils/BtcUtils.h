@@ -25,6 +25,7 @@
 #include <sstream>
 #include <assert.h>
 #include <cmath>
+#include <algorithm>
 
 #include "BinaryData.h"
 #include "cryptlib.h"
@@ -32,6 +33,8 @@
 #include "ripemd.h"
 
 #define HEADER_SIZE 80
+#define MERKLE_MAX_DEPTH 32
+#define MERKLE_BATCH_PAIRS 64
 #define CONVERTBTC 100000000
 #define HashString     BinaryData
 #define HashStringRef  BinaryDataRef
@@ -215,6 +218,183 @@ enum OPCODETYPE
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+// Just enough of a 256-bit unsigned integer to do chain-work exactly:  add,
+// compare, and the one division needed to turn a target into work.  Four
+// 64-bit words, least-significant first.  Arithmetic wraps at 2^256.
+class UInt256
+{
+public:
+   UInt256(void)        { w_[0] = w_[1] = w_[2] = w_[3] = 0;   }
+   UInt256(uint64_t v)  { w_[0] = v; w_[1] = w_[2] = w_[3] = 0; }
+
+   bool isZero(void) const { return (w_[0]|w_[1]|w_[2]|w_[3]) == 0; }
+
+   /////////////////////////////////////////////////////////////////////////////
+   int compare(UInt256 const & b) const
+   {
+      for(int i=3; i>=0; i--)
+      {
+         if(w_[i] < b.w_[i]) return -1;
+         if(w_[i] > b.w_[i]) return  1;
+      }
+      return 0;
+   }
+   bool operator< (UInt256 const & b) const { return compare(b) <  0; }
+   bool operator> (UInt256 const & b) const { return compare(b) >  0; }
+   bool operator<=(UInt256 const & b) const { return compare(b) <= 0; }
+   bool operator>=(UInt256 const & b) const { return compare(b) >= 0; }
+   bool operator==(UInt256 const & b) const { return compare(b) == 0; }
+   bool operator!=(UInt256 const & b) const { return compare(b) != 0; }
+
+   /////////////////////////////////////////////////////////////////////////////
+   UInt256 & operator+=(UInt256 const & b)
+   {
+      uint64_t carry = 0;
+      for(int i=0; i<4; i++)
+      {
+         uint64_t sum = w_[i] + b.w_[i] + carry;
+         carry = (sum < w_[i] || (carry && sum == w_[i])) ? 1 : 0;
+         w_[i] = sum;
+      }
+      return *this;
+   }
+   UInt256 operator+(UInt256 const & b) const { UInt256 r(*this); return r += b; }
+
+   /////////////////////////////////////////////////////////////////////////////
+   UInt256 & operator-=(UInt256 const & b)
+   {
+      uint64_t borrow = 0;
+      for(int i=0; i<4; i++)
+      {
+         uint64_t diff = w_[i] - b.w_[i] - borrow;
+         borrow = (w_[i] < b.w_[i] || (borrow && w_[i] == b.w_[i])) ? 1 : 0;
+         w_[i] = diff;
+      }
+      return *this;
+   }
+   UInt256 operator-(UInt256 const & b) const { UInt256 r(*this); return r -= b; }
+
+   UInt256 operator~(void) const
+   {
+      UInt256 r;
+      for(int i=0; i<4; i++)
+         r.w_[i] = ~w_[i];
+      return r;
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   UInt256 & operator<<=(uint32_t nBits)
+   {
+      if(nBits >= 256) { *this = UInt256(); return *this; }
+      uint32_t nWords = nBits/64;
+      uint32_t nShift = nBits%64;
+      for(int i=3; i>=0; i--)
+      {
+         uint64_t hi = (i-(int)nWords   >= 0 ? w_[i-nWords]   : 0);
+         uint64_t lo = (i-(int)nWords-1 >= 0 ? w_[i-nWords-1] : 0);
+         w_[i] = (nShift==0 ? hi : (hi << nShift) | (lo >> (64-nShift)));
+      }
+      return *this;
+   }
+
+   UInt256 & operator>>=(uint32_t nBits)
+   {
+      if(nBits >= 256) { *this = UInt256(); return *this; }
+      uint32_t nWords = nBits/64;
+      uint32_t nShift = nBits%64;
+      for(int i=0; i<4; i++)
+      {
+         uint64_t lo = (i+nWords   < 4 ? w_[i+nWords]   : 0);
+         uint64_t hi = (i+nWords+1 < 4 ? w_[i+nWords+1] : 0);
+         w_[i] = (nShift==0 ? lo : (lo >> nShift) | (hi << (64-nShift)));
+      }
+      return *this;
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Shift-and-subtract, but only over the bit positions where the quotient
+   // can be nonzero.  For a real target that's a few dozen, not 256
+   UInt256 operator/(UInt256 const & divisor) const
+   {
+      UInt256 quot;
+      if(divisor.isZero())
+         return quot;
+
+      UInt256 num(*this);
+      UInt256 div(divisor);
+      int shift = (int)num.getNumBits() - (int)div.getNumBits();
+      if(shift < 0)
+         return quot;
+
+      div <<= shift;
+      while(shift >= 0)
+      {
+         if(num >= div)
+         {
+            num -= div;
+            quot.w_[shift/64] |= (1ULL << (shift%64));
+         }
+         div >>= 1;
+         shift--;
+      }
+      return quot;
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   uint32_t getNumBits(void) const
+   {
+      for(int i=3; i>=0; i--)
+      {
+         if(w_[i] == 0)
+            continue;
+         uint32_t nb = 64;
+         while( (w_[i] >> (nb-1)) == 0 )
+            nb--;
+         return 64*i + nb;
+      }
+      return 0;
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Only for display -- don't compare these
+   double getDouble(void) const
+   {
+      double out = 0;
+      for(int i=3; i>=0; i--)
+         out = out*18446744073709551616.0 + (double)w_[i];
+      return out;
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   // 32 bytes, little-endian -- the way hashes are stored, so a header hash
+   // can be compared directly to its target
+   void unserialize(uint8_t const * ptr)
+   {
+      for(int i=0; i<4; i++)
+      {
+         w_[i] = 0;
+         for(int b=7; b>=0; b--)
+            w_[i] = (w_[i] << 8) | ptr[8*i+b];
+      }
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   // 32 bytes, big-endian, so it reads right with toHexStr()
+   BinaryData getBinaryData(void) const
+   {
+      BinaryData out(32);
+      for(int i=0; i<32; i++)
+         out[31-i] = (uint8_t)(w_[i/8] >> (8*(i%8)));
+      return out;
+   }
+
+private:
+   uint64_t w_[4];
+};
+
+
+
 
 // This class holds only static methods.  
 // NOTE:  added default ctor and a few non-static, to support SWIG
@@ -231,6 +411,7 @@ public:
    // We should keep the genesis hash handy 
    static BinaryData        BadAddress_;
    static BinaryData        EmptyHash_;
+   static uint32_t          hash256BatchLanes_;
 
    /////////////////////////////////////////////////////////////////////////////
    static uint64_t readVarInt(uint8_t const * strmPtr, uint32_t* lenOutPtr=NULL)
@@ -363,18 +544,51 @@ public:
    }
 
    /////////////////////////////////////////////////////////////////////////////
+   // hash256 of numMsgs independent messages, 32 bytes each into hashesOut.
+   // If the CPU allows, they go through a multi-buffer SHA-256 that runs 8
+   // (AVX2) or 4 (SSE2/NEON) messages side by side, and a lane that finishes
+   // its message picks up the next one right away.  Otherwise, it's just
+   // getHash256 in a loop.  No static state, so it's reentrant.
+   // (Defined in BtcUtils.cpp)
+   static void getHash256Batch(uint8_t const * const * msgPtrs,
+                               uint32_t const *        msgLens,
+                               uint32_t                numMsgs,
+                               uint8_t *               hashesOut);
+
+   // Number of messages getHash256Batch hashes at once (1 means no SIMD).
+   // Mostly for benchmarking:  it can be lowered, but never raised past
+   // what the CPU supports.  Returns the value actually set.
+   static uint32_t getHash256BatchLanes(void) { return hash256BatchLanes_; }
+   static uint32_t setHash256BatchLanes(uint32_t numLanes);
+   static uint32_t getHash256BatchMaxLanes(void);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Hash160 of numMsgs independent messages (usually public keys), 20 bytes
+   // each into hashesOut.  Both the SHA-256 and the RIPEMD-160 go through the
+   // same multi-buffer engine as getHash256Batch when the CPU has it.  Uses
+   // nothing static, so it's safe to call from several threads at once.
+   // (Defined in BtcUtils.cpp)
+   static void getHash160Batch(uint8_t const * const * msgPtrs,
+                               uint32_t const *        msgLens,
+                               uint32_t                numMsgs,
+                               uint8_t *               hashesOut);
+
+   // Same, for equal-sized messages packed end-to-end (65-byte pubkeys)
+   static void getHash160Batch(uint8_t const * msgs,
+                               uint32_t        msgSize,
+                               uint32_t        numMsgs,
+                               uint8_t *       hashesOut);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // The hash objects and intermediate digest are on the stack, not static, 
+   // so these are reentrant (they're cheap to construct)
    static void getHash160(uint8_t const * strToHash,
                           uint32_t        nBytes,
                           BinaryData &    hashOutput)
    {
-      static CryptoPP::SHA256 sha256_;
-      static CryptoPP::RIPEMD160 ripemd160_;
-      static BinaryData bd32(32);
       if(hashOutput.getSize() != 20)
          hashOutput.resize(20);
-
-      sha256_.CalculateDigest(bd32.getPtr(), strToHash, nBytes);
-      ripemd160_.CalculateDigest(hashOutput.getPtr(), bd32.getPtr(), 32);
+      getHash160_NoSafetyCheck(strToHash, nBytes, hashOutput);
    }
 
    /////////////////////////////////////////////////////////////////////////////
@@ -383,13 +597,12 @@ public:
                           uint32_t        nBytes,
                           BinaryData &    hashOutput)
    {
-      static CryptoPP::SHA256 sha256_;
-      static CryptoPP::RIPEMD160 ripemd160_;
-      static BinaryData bd32(32);
-
-      sha256_.CalculateDigest(bd32.getPtr(), strToHash, nBytes);
-      ripemd160_.CalculateDigest(hashOutput.getPtr(), bd32.getPtr(), 32);
+      CryptoPP::SHA256 sha256;
+      CryptoPP::RIPEMD160 ripemd160;
+      uint8_t hash32[32];
 
+      sha256.CalculateDigest(hash32, strToHash, nBytes);
+      ripemd160.CalculateDigest(hashOutput.getPtr(), hash32, 32);
    }
 
    /////////////////////////////////////////////////////////////////////////////
@@ -437,69 +650,232 @@ public:
    //  I need a non-static, non-overloaded method to be able to use this in SWIG
    BinaryData ripemd160_SWIG(BinaryData const & strToHash)
    {
-      static CryptoPP::RIPEMD160 ripemd160_;
-      static BinaryData bd20(20);
+      CryptoPP::RIPEMD160 ripemd160;
+      BinaryData bd20(20);
 
-      ripemd160_.CalculateDigest(bd20.getPtr(), strToHash.getPtr(), strToHash.getSize());
+      ripemd160.CalculateDigest(bd20.getPtr(), strToHash.getPtr(), strToHash.getSize());
       return bd20;
    }
 
+   /////////////////////////////////////////////////////////////////////////////
+   // For python:  keys are keySize bytes each, packed end-to-end, and the 
+   // 20-byte hashes come back the same way.  Empty if it doesn't divide up.
+   BinaryData getHash160Batch_SWIG(BinaryData const & packedKeys, 
+                                   uint32_t keySize)
+   {
+      if(keySize == 0 || packedKeys.getSize() % keySize != 0)
+         return BinaryData(0);
+
+      uint32_t numKeys = packedKeys.getSize() / keySize;
+      BinaryData hashes(20*numKeys);
+      if(numKeys > 0)
+         getHash160Batch(packedKeys.getPtr(), keySize, numKeys, hashes.getPtr());
+      return hashes;
+   }
+
 
    /////////////////////////////////////////////////////////////////////////////
    static BinaryData calculateMerkleRoot(vector<BinaryData> const & txhashlist)
    {
-      vector<BinaryData> mtree = calculateMerkleTree(txhashlist);
-      return mtree[mtree.size()-1];
+      uint32_t numTx = txhashlist.size();
+      if(numTx == 0)
+         return BinaryData(32);
+
+      CryptoPP::SHA256 sha256;
+      BinaryData flatHashes(32*numTx);
+      for(uint32_t i=0; i<numTx; i++)
+         txhashlist[i].copyTo(flatHashes.getPtr() + 32*i, 32);
+
+      calculateMerkleRootInPlace(flatHashes.getPtr(), numTx, sha256);
+      return flatHashes.getSliceCopy(0, 32);
    }
 
    /////////////////////////////////////////////////////////////////////////////
+   // Leaves first, then each level up, ending with the root
    static vector<BinaryData> calculateMerkleTree(vector<BinaryData> const & txhashlist)
    {
-      // Don't know in advance how big this list will be, make a list too big
-      // and copy the result to the right size list afterwards
       uint32_t numTx = txhashlist.size();
-      vector<BinaryData> merkleTree(3*numTx);
-      static CryptoPP::SHA256 sha256_;
-      BinaryData hashInput(64);
-      BinaryData hashOutput(32);
-   
+      uint32_t treeSize = getMerkleTreeSize(numTx);
+      CryptoPP::SHA256 sha256;
+      BinaryData flatTree(32*treeSize);
       for(uint32_t i=0; i<numTx; i++)
-         merkleTree[i] = txhashlist[i];
-   
-      uint32_t thisLevelStart = 0;
-      uint32_t nextLevelStart = numTx;
+         txhashlist[i].copyTo(flatTree.getPtr() + 32*i, 32);
+
+      calculateMerkleTreeFlat(flatTree.getPtr(), numTx, sha256);
+
+      vector<BinaryData> merkleTree(treeSize);
+      for(uint32_t i=0; i<treeSize; i++)
+         merkleTree[i].copyFrom(flatTree.getPtr() + 32*i, 32);
+      return merkleTree;
+   }
+
+
+   /////////////////////////////////////////////////////////////////////////////
+   //
+   // The flat merkle engine:  hashes are 32 bytes each, packed end-to-end in
+   // one buffer owned by the caller, who can reuse it from block to block.
+   // These don't allocate or keep static state, so any number of threads
+   // can use them at once, as long as each passes its own sha256.  The 
+   // vector versions above and verifyMerkleBranch below are thread-safe, 
+   // too, but allocate a fresh buffer and hasher on every call.
+   //
+   /////////////////////////////////////////////////////////////////////////////
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Number of 32-byte nodes in the full tree over numTx leaves
+   static uint32_t getMerkleTreeSize(uint32_t numTx)
+   {
+      uint32_t treeSize  = numTx;
       uint32_t levelSize = numTx;
       while(levelSize>1)
       {
-         for(uint32_t j=0; j<(levelSize+1)/2; j++)
+         levelSize = (levelSize+1)/2;
+         treeSize += levelSize;
+      }
+      return treeSize;
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   // One level of the tree:  hash pairs of 32-byte nodes from thisLevel into
+   // nextLevel, and the odd one out (if any) with itself.  nextLevel may be
+   // the same as thisLevel:  pairs are done MERKLE_BATCH_PAIRS at a time and
+   // each batch only writes over nodes that have already been read.
+   static void calculateMerkleLevel(uint8_t const * thisLevel,
+                                    uint32_t levelSize,
+                                    uint8_t * nextLevel,
+                                    CryptoPP::SHA256 & sha256)
+   {
+      uint8_t oddPair[64];
+      uint8_t hashOut[32];
+      uint32_t numPairs = (levelSize+1)/2;
+      if(hash256BatchLanes_ == 1 || numPairs < 2)
+      {
+         for(uint32_t j=0; j<numPairs; j++)
          {
-            uint8_t* half1Ptr = hashInput.getPtr();
-            uint8_t* half2Ptr = hashInput.getPtr()+32;
-         
-            if(j < levelSize/2)
+            uint8_t const * hashInput = thisLevel + 64*j;
+            if(2*j+1 == levelSize)
             {
-               merkleTree[thisLevelStart+(2*j)  ].copyTo(half1Ptr, 32);
-               merkleTree[thisLevelStart+(2*j)+1].copyTo(half2Ptr, 32);
+               // Odd one out gets hashed with itself
+               memcpy(oddPair,    thisLevel + 64*j, 32);
+               memcpy(oddPair+32, thisLevel + 64*j, 32);
+               hashInput = oddPair;
             }
-            else 
+            sha256.CalculateDigest(hashOut, hashInput, 64);
+            sha256.CalculateDigest(nextLevel + 32*j, hashOut, 32);
+         }
+         return;
+      }
+
+      uint8_t const * pairPtrs[MERKLE_BATCH_PAIRS];
+      uint32_t        pairLens[MERKLE_BATCH_PAIRS];
+      uint8_t         batchOut[32*MERKLE_BATCH_PAIRS];
+      for(uint32_t j0=0; j0<numPairs; j0+=MERKLE_BATCH_PAIRS)
+      {
+         uint32_t nBatch = min((uint32_t)MERKLE_BATCH_PAIRS, numPairs-j0);
+         for(uint32_t j=j0; j<j0+nBatch; j++)
+         {
+            pairPtrs[j-j0] = thisLevel + 64*j;
+            pairLens[j-j0] = 64;
+            if(2*j+1 == levelSize)
             {
-               merkleTree[nextLevelStart-1].copyTo(half1Ptr, 32);
-               merkleTree[nextLevelStart-1].copyTo(half2Ptr, 32);
+               memcpy(oddPair,    thisLevel + 64*j, 32);
+               memcpy(oddPair+32, thisLevel + 64*j, 32);
+               pairPtrs[j-j0] = oddPair;
             }
-            
-            sha256_.CalculateDigest(hashOutput.getPtr(), hashInput.getPtr(),  64);
-            sha256_.CalculateDigest(hashOutput.getPtr(), hashOutput.getPtr(), 32);
-            merkleTree[nextLevelStart+j] = hashOutput;
          }
+         getHash256Batch(pairPtrs, pairLens, nBatch, batchOut);
+         memcpy(nextLevel + 32*j0, batchOut, 32*nBatch);
+      }
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   // tree holds getMerkleTreeSize(numTx) nodes, the first numTx of which are
+   // the tx hashes.  The rest are filled in, level by level, root last.
+   static void calculateMerkleTreeFlat(uint8_t * tree, 
+                                       uint32_t numTx,
+                                       CryptoPP::SHA256 & sha256)
+   {
+      uint8_t * thisLevel = tree;
+      uint32_t levelSize = numTx;
+      while(levelSize>1)
+      {
+         uint8_t * nextLevel = thisLevel + 32*levelSize;
+         calculateMerkleLevel(thisLevel, levelSize, nextLevel, sha256);
+         thisLevel = nextLevel;
          levelSize = (levelSize+1)/2;
-         thisLevelStart = nextLevelStart;
-         nextLevelStart = nextLevelStart+levelSize;
       }
+   }
 
-      // nextLevelStart is the size of the merkle tree
-      merkleTree.erase(merkleTree.begin()+nextLevelStart, merkleTree.end());
-      return merkleTree;
-   
+   /////////////////////////////////////////////////////////////////////////////
+   // hashes holds numTx tx hashes, and each level of the tree overwrites the
+   // front of the level below it, so the root ends up in the first 32 bytes.
+   static void calculateMerkleRootInPlace(uint8_t * hashes, 
+                                          uint32_t numTx,
+                                          CryptoPP::SHA256 & sha256)
+   {
+      calculateMerkleBranchInPlace(hashes, numTx, 0, NULL, sha256);
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Same as calculateMerkleRootInPlace, but on the way up it also copies out
+   // the sibling of tx txIndex at each level:  that's the merkle branch that
+   // proves the tx is in the block.  branchOut needs room for 32 hashes
+   // (MERKLE_MAX_DEPTH), and may be NULL.  Returns the branch length.
+   static uint32_t calculateMerkleBranchInPlace(uint8_t * hashes, 
+                                                uint32_t numTx,
+                                                uint32_t txIndex,
+                                                uint8_t * branchOut,
+                                                CryptoPP::SHA256 & sha256)
+   {
+      uint32_t depth = 0;
+      uint32_t levelSize = numTx;
+      while(levelSize>1)
+      {
+         if(branchOut != NULL)
+         {
+            // Odd one out is its own sibling
+            uint32_t sibling = ((txIndex^1) < levelSize ? (txIndex^1) : txIndex);
+            memcpy(branchOut + 32*depth, hashes + 32*sibling, 32);
+         }
+
+         calculateMerkleLevel(hashes, levelSize, hashes, sha256);
+         levelSize = (levelSize+1)/2;
+         txIndex /= 2;
+         depth++;
+      }
+      return depth;
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   // The other end of calculateMerkleBranchInPlace:  branch is the flat list 
+   // of sibling hashes, bottom-up.  Needs nothing but the header's merkle 
+   // root, so it works in headers-only mode, too.
+   static bool verifyMerkleBranch(BinaryDataRef txHash,
+                                  uint32_t txIndex,
+                                  BinaryDataRef branch,
+                                  BinaryDataRef merkleRoot)
+   {
+      uint32_t depth = branch.getSize() / 32;
+      if(txHash.getSize() != 32   || merkleRoot.getSize() != 32 ||
+         branch.getSize() % 32 != 0 || depth > MERKLE_MAX_DEPTH)
+         return false;
+
+      // Every bit of the index has to be used up by the branch
+      if(depth < 32 && (txIndex >> depth) != 0)
+         return false;
+
+      CryptoPP::SHA256 sha256;
+      uint8_t hashInput[64];
+      uint8_t hashOut[32];
+      txHash.copyTo(hashInput + 32*(txIndex&1), 32);
+      for(uint32_t d=0; d<depth; d++)
+      {
+         branch.getSliceRef(32*d, 32).copyTo(hashInput + 32*(1-(txIndex&1)), 32);
+         sha256.CalculateDigest(hashOut, hashInput, 64);
+         txIndex >>= 1;
+         sha256.CalculateDigest(hashInput + 32*(txIndex&1), hashOut, 32);
+      }
+      return (memcmp(hashInput + 32*(txIndex&1), merkleRoot.getPtr(), 32) == 0);
    }
    
    /////////////////////////////////////////////////////////////////////////////
@@ -573,6 +949,56 @@ public:
       return brr.getPosition();
    }
 
+   /////////////////////////////////////////////////////////////////////////////
+   // TxCalcLength for data that may not hold a whole tx, like the tail of a
+   // file that was cut off in the middle of a write.  Never reads at or past
+   // ptr+maxLen, and returns UINT32_MAX if the tx doesn't fit in maxLen.
+   static uint32_t TxCalcLengthBounded(uint8_t const * ptr, uint32_t maxLen)
+   {
+      uint64_t pos = 4;
+      uint64_t nIn, nOut, scrLen;
+      if(!readVarIntBounded(ptr, maxLen, pos, nIn))
+         return UINT32_MAX;
+      for(uint64_t i=0; i<nIn; i++)
+      {
+         pos += 36;
+         if(!readVarIntBounded(ptr, maxLen, pos, scrLen) || scrLen > maxLen)
+            return UINT32_MAX;
+         pos += scrLen + 4;
+      }
+
+      if(!readVarIntBounded(ptr, maxLen, pos, nOut))
+         return UINT32_MAX;
+      for(uint64_t i=0; i<nOut; i++)
+      {
+         pos += 8;
+         if(!readVarIntBounded(ptr, maxLen, pos, scrLen) || scrLen > maxLen)
+            return UINT32_MAX;
+         pos += scrLen;
+      }
+      pos += 4;
+
+      return (pos <= maxLen ? (uint32_t)pos : UINT32_MAX);
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Reads the var_int at ptr+pos and moves pos past it, if all of it is 
+   // before ptr+maxLen
+   static bool readVarIntBounded(uint8_t const * ptr, 
+                                 uint32_t maxLen,
+                                 uint64_t & pos, 
+                                 uint64_t & val)
+   {
+      if(pos >= maxLen)
+         return false;
+      uint32_t viLen = readVarIntLength(ptr + pos);
+      if(pos + viLen > maxLen)
+         return false;
+      val = readVarInt(ptr + pos);
+      pos += viLen;
+      return true;
+   }
+
 
 
    /////////////////////////////////////////////////////////////////////////////
@@ -670,6 +1096,61 @@ public:
    }
 
 
+   /////////////////////////////////////////////////////////////////////////////
+   // The compact "bits" field expanded to the full 256-bit target.  Negative
+   // and overflowing targets come back as zero, which no hash can meet
+   static UInt256 convertDiffBitsToTarget(BinaryDataRef diffBitsRef)
+   {
+      uint32_t diffBits = *(uint32_t*)(diffBitsRef.getPtr());
+      uint32_t nSize    = diffBits >> 24;
+      uint32_t mantissa = diffBits & 0x007fffff;
+      if(mantissa == 0 || (diffBits & 0x00800000) != 0)
+         return UInt256();
+
+      if( nSize > 34 || 
+         (nSize > 33 && mantissa > 0xff) || 
+         (nSize > 32 && mantissa > 0xffff))
+         return UInt256();
+
+      UInt256 target;
+      if(nSize <= 3)
+         target = UInt256(mantissa >> (8*(3-nSize)));
+      else
+      {
+         target = UInt256(mantissa);
+         target <<= 8*(nSize-3);
+      }
+      return target;
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Expected number of hashes to find a block at this target, exactly:
+   // 2^256 / (target+1), computed as ~target/(target+1) + 1 so it fits.  A
+   // negative, zero or overflowing target counts as no work at all.
+   static UInt256 convertDiffBitsToWork(BinaryDataRef diffBitsRef)
+   {
+      UInt256 target = convertDiffBitsToTarget(diffBitsRef);
+      if(target.isZero())
+         return UInt256();
+
+      return (~target / (target + UInt256(1))) + UInt256(1);
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   // The header hash (as stored, little-endian) must not exceed the target
+   static bool checkProofOfWork(BinaryDataRef headerHash, 
+                                BinaryDataRef diffBitsRef)
+   {
+      UInt256 target = convertDiffBitsToTarget(diffBitsRef);
+      if(target.isZero() || headerHash.getSize() != 32)
+         return false;
+
+      UInt256 hashVal;
+      hashVal.unserialize(headerHash.getPtr());
+      return (hashVal <= target);
+   }
+
+
    static string getOpCodeName(OPCODETYPE opcode)
    {
       switch (opcode)
@@ -917,21 +1398,7 @@ public:
 
    static bool verifyProofOfWork(BinaryDataRef bh80, BinaryDataRef bhrHash)
    {
-      // This is only approximate.  I can put in an exact verifier once 
-      // I figure out big integers better in C++, or another way to do
-      // the calculation.  I just want to make sure this isn't a completely
-      // bogus proof of work.
-      double diff = convertDiffBitsToDouble( BinaryDataRef(bh80.getPtr()+72, 4) );
-      double diffFactor = diff * (double)UINT32_MAX;
-      double nZeroBits  = int( log(diffFactor) / log(2.0));
-      int    nZeroBytes = int( log(diffFactor) / log(2.0) / 8.0);
-
-      // TODO: check that I'm comparing the correct end of the hash
-      for(uint32_t i=0; i<nZeroBytes; i++)
-         if(bhrHash[31-i]!=0)
-            return false;
-
-      return true;
+      return checkProofOfWork(bhrHash, BinaryDataRef(bh80.getPtr()+72, 4));
    }
 
 };
@@ -0,0 +1,974 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011, Alan C. Reiner    <alan.reiner@gmail.com>             //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+#include "CoinSelection.h"
+#include "UniversalTimer.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Sort indices by a precomputed key, largest first.  We always use
+// stable_sort so that ties keep the original wallet order, like python's
+// sorted() does
+class CompareKeyDescending
+{
+public:
+   CompareKeyDescending(vector<double> const & key) : keyPtr_(&key) {}
+   bool operator()(uint32_t a, uint32_t b) const
+                              { return (*keyPtr_)[a] > (*keyPtr_)[b]; }
+private:
+   vector<double> const * keyPtr_;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Used for the group-by-address sort:  group priority first, then keep the
+// coins from the same address together, then by individual priority
+class CompareAddrGroup
+{
+public:
+   CompareAddrGroup(vector<double>   const & grpKey,
+                    vector<uint32_t> const & addrID,
+                    vector<double>   const & key) :
+      grpKeyPtr_(&grpKey), addrIDPtr_(&addrID), keyPtr_(&key) {}
+
+   bool operator()(uint32_t a, uint32_t b) const
+   {
+      uint32_t addrA = (*addrIDPtr_)[a];
+      uint32_t addrB = (*addrIDPtr_)[b];
+      if((*grpKeyPtr_)[addrA] != (*grpKeyPtr_)[addrB])
+         return (*grpKeyPtr_)[addrA] > (*grpKeyPtr_)[addrB];
+      if(addrA != addrB)
+         return addrA < addrB;
+      return (*keyPtr_)[a] > (*keyPtr_)[b];
+   }
+
+private:
+   vector<double>   const * grpKeyPtr_;
+   vector<uint32_t> const * addrIDPtr_;
+   vector<double>   const * keyPtr_;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Count trailing (decimal) zeros of a satoshi value, as an indicator of
+// whether an output "looks like" a payment or change
+static uint32_t countTrailingZeros(uint64_t btcVal)
+{
+   uint64_t pow10 = 1;
+   for(uint32_t i=1; i<20; i++)
+   {
+      pow10 *= 10;
+      if(btcVal % pow10 != 0)
+         return i-1;
+   }
+   return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// CoinSelection Methods
+//
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+CoinSelection::CoinSelection(void) :
+   timeBudgetSec_(0.5),
+   utxoListPtr_(NULL),
+   numAddrIDs_(0),
+   addrMarkGen_(0),
+   bestScore_(-1),
+   startSec_(0),
+   numCandidatesEval_(0),
+   numBnbTries_(0),
+   budgetExceeded_(false),
+   lastSelectSec_(0)
+{
+   // Same defaults as WEIGHTS in armoryengine.py:  using different orders
+   // of magnitude, which effectively defines a sort-order on the factors
+   weights_[SELECT_SCORE_ALLOWFREE]  =  100000;
+   weights_[SELECT_SCORE_NOZEROCONF] = 1000000;
+   weights_[SELECT_SCORE_PRIORITY]   =      50;
+   weights_[SELECT_SCORE_NUMADDR]    =  100000;
+   weights_[SELECT_SCORE_TXSIZE]     =     100;
+   weights_[SELECT_SCORE_OUTANONYM]  =      30;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void CoinSelection::setWeight(uint32_t idx, double w)
+{
+   if(idx >= SELECT_SCORE_NUM_FACTORS)
+   {
+      cout << "***ERROR: invalid coin selection weight index: " << idx << endl;
+      cerr << "***ERROR: invalid coin selection weight index: " << idx << endl;
+      return;
+   }
+   weights_[idx] = w;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+double CoinSelection::getWeight(uint32_t idx) const
+{
+   if(idx >= SELECT_SCORE_NUM_FACTORS)
+      return 0;
+   return weights_[idx];
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void CoinSelection::startClock(void)
+{
+   startSec_          = UniversalTimer::getMonotonicSec();
+   budgetExceeded_    = false;
+   numCandidatesEval_ = 0;
+   numBnbTries_       = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Once we've run out of time, we stop generating new candidates and just
+// go with the best one we have so far
+bool CoinSelection::checkBudget(void)
+{
+   if(budgetExceeded_)
+      return true;
+
+   lastSelectSec_ = UniversalTimer::getMonotonicSec() - startSec_;
+   if(timeBudgetSec_ > 0 && lastSelectSec_ > timeBudgetSec_)
+      budgetExceeded_ = true;
+
+   return budgetExceeded_;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pull out the few fields we need, and map recipient addresses to small
+// integer IDs, so that counting distinct addresses doesn't require hashing
+// or comparing 20-byte strings for every candidate
+void CoinSelection::loadCoins(vector<UnspentTxOut> const & unspentTxOuts)
+{
+   uint32_t nCoin = unspentTxOuts.size();
+   utxoListPtr_ = &unspentTxOuts;
+   coinValue_.resize(nCoin);
+   coinNumConf_.resize(nCoin);
+   coinAddrID_.resize(nCoin);
+
+   map<BinaryData, uint32_t> addrToID;
+   map<BinaryData, uint32_t>::iterator iter;
+   for(uint32_t i=0; i<nCoin; i++)
+   {
+      UnspentTxOut const & utxo = unspentTxOuts[i];
+      coinValue_[i]   = utxo.getValue();
+      coinNumConf_[i] = utxo.getNumConfirm();
+
+      BinaryData addr160 = utxo.getRecipientAddr();
+      iter = addrToID.find(addr160);
+      if(iter == addrToID.end())
+      {
+         uint32_t newID = addrToID.size();
+         addrToID[addr160] = newID;
+         coinAddrID_[i] = newID;
+      }
+      else
+         coinAddrID_[i] = iter->second;
+   }
+
+   numAddrIDs_  = addrToID.size();
+   addrMark_.assign(numAddrIDs_, 0);
+   addrMarkGen_ = 0;
+   bestSelect_.clear();
+   bestScore_   = -1;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+vector<UnspentTxOut> CoinSelection::indicesToUtxoList(
+                                             vector<uint32_t> const & select)
+{
+   vector<UnspentTxOut> out(0);
+   if(utxoListPtr_ == NULL)
+      return out;
+
+   out.reserve(select.size());
+   for(uint32_t i=0; i<select.size(); i++)
+      out.push_back( (*utxoListPtr_)[select[i]] );
+   return out;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Same sort methods as PySortCoins.  All of them put the highest-priority
+// coins at the front.
+void CoinSelection::sortIndices(uint32_t sortMethod, vector<uint32_t> & idxOut)
+{
+   uint32_t nCoin = coinValue_.size();
+   idxOut.resize(nCoin);
+   for(uint32_t i=0; i<nCoin; i++)
+      idxOut[i] = i;
+
+   vector<double> key(nCoin);
+   if(sortMethod <= 3)
+   {
+      for(uint32_t i=0; i<nCoin; i++)
+      {
+         double valConf = (double)coinValue_[i] * (double)coinNumConf_[i];
+         switch(sortMethod)
+         {
+            case 0: key[i] = valConf; break;
+            case 1: key[i] = pow(valConf, 1.0/3.0); break;
+            case 2: key[i] = pow(log(valConf+1)+4, 4); break;
+            case 3: key[i] = (coinNumConf_[i]>0 ? (double)coinValue_[i] : 0);
+                    break;
+         }
+      }
+      stable_sort(idxOut.begin(), idxOut.end(), CompareKeyDescending(key));
+   }
+   else if(sortMethod == 4)
+   {
+      // Group coins by address, ordering the groups by their best coin.
+      // Zero-conf coins go at the end, regardless of address
+      vector<double> grpKey(numAddrIDs_, 0);
+      for(uint32_t i=0; i<nCoin; i++)
+      {
+         key[i] = coinNumConf_[i] * pow((double)coinValue_[i], 0.333);
+         if(coinNumConf_[i] > 0 && key[i] > grpKey[coinAddrID_[i]])
+            grpKey[coinAddrID_[i]] = key[i];
+      }
+
+      vector<uint32_t> zeroConf(0);
+      uint32_t nConf = 0;
+      for(uint32_t i=0; i<nCoin; i++)
+      {
+         if(coinNumConf_[i] == 0)
+            zeroConf.push_back(i);
+         else
+            idxOut[nConf++] = i;
+      }
+      idxOut.resize(nConf);
+      stable_sort(idxOut.begin(), idxOut.end(),
+                  CompareAddrGroup(grpKey, coinAddrID_, key));
+      idxOut.insert(idxOut.end(), zeroConf.begin(), zeroConf.end());
+   }
+   else if(sortMethod >= 5 && sortMethod <= 7)
+   {
+      // Rotate the top 1, 2 or 3 elements to the bottom of the list
+      sortIndices(1, idxOut);
+      uint32_t nRot = sortMethod - 4;
+      if(nCoin > nRot)
+         rotate(idxOut.begin(), idxOut.begin()+nRot, idxOut.end());
+   }
+   else if(sortMethod == 8)
+   {
+      // Random shuffle of the confirmed coins, zero-conf at the end
+      vector<uint32_t> zeroConf(0);
+      uint32_t nConf = 0;
+      for(uint32_t i=0; i<nCoin; i++)
+      {
+         if(coinNumConf_[i] == 0)
+            zeroConf.push_back(i);
+         else
+            idxOut[nConf++] = i;
+      }
+      idxOut.resize(nConf);
+      random_shuffle(idxOut.begin(), idxOut.end());
+      idxOut.insert(idxOut.end(), zeroConf.begin(), zeroConf.end());
+   }
+   else if(sortMethod == 9)
+   {
+      // Start with the regular sort, then swap 1/3 of the values at random
+      sortIndices(1, idxOut);
+      uint32_t sz = 0;
+      for(uint32_t i=0; i<nCoin; i++)
+         if(coinNumConf_[i] != 0)
+            sz++;
+
+      uint32_t topsz = min(max(sz/3, (uint32_t)5), sz);
+      for(uint32_t i=0; i<topsz; i++)
+      {
+         uint32_t pick1 = rand() % topsz;
+         uint32_t pick2 = (sz>topsz ? rand() % (sz-topsz) : 0);
+         swap(idxOut[pick1], idxOut[pick2]);
+      }
+   }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Find the single smallest coin that covers the target.  If that would leave
+// us with tiny change, try to find one that leaves at least a CENT instead,
+// to avoid a mandatory fee on the dust output
+void CoinSelection::selectSingleInputSingleValue(
+                                          vector<uint32_t> const & sorted,
+                                          uint64_t targetOutVal,
+                                          uint64_t minFee,
+                                          vector<uint32_t> & selectOut)
+{
+   selectOut.clear();
+   uint64_t target = targetOutVal + minFee;
+   uint64_t bestMatchVal = UINT64_MAX;
+   int32_t  bestMatchIdx = -1;
+   for(uint32_t i=0; i<sorted.size(); i++)
+   {
+      uint64_t val = coinValue_[sorted[i]];
+      if(target <= val && val < bestMatchVal)
+      {
+         bestMatchVal = val;
+         bestMatchIdx = (int32_t)sorted[i];
+      }
+   }
+
+   if(bestMatchIdx < 0)
+      return;
+
+   uint64_t closeness = bestMatchVal - target;
+   if(closeness > 0 && closeness <= COINSEL_CENT)
+   {
+      uint64_t try2Val = UINT64_MAX;
+      int32_t  try2Idx = -1;
+      for(uint32_t i=0; i<sorted.size(); i++)
+      {
+         uint64_t val = coinValue_[sorted[i]];
+         if(target+COINSEL_CENT < val && val < try2Val)
+         {
+            try2Val = val;
+            try2Idx = (int32_t)sorted[i];
+         }
+      }
+      if(try2Idx >= 0)
+         bestMatchIdx = try2Idx;
+   }
+
+   selectOut.push_back((uint32_t)bestMatchIdx);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Just take coins from the front of the list until we've covered the target
+void CoinSelection::selectMultiInputSingleValue(
+                                          vector<uint32_t> const & sorted,
+                                          uint64_t targetOutVal,
+                                          uint64_t minFee,
+                                          vector<uint32_t> & selectOut)
+{
+   selectOut.clear();
+   uint64_t target = targetOutVal + minFee;
+   uint64_t sumVal = 0;
+   for(uint32_t i=0; i<sorted.size(); i++)
+   {
+      sumVal += coinValue_[sorted[i]];
+      selectOut.push_back(sorted[i]);
+      if(sumVal >= target)
+         break;
+   }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Look for a single input that's roughly double the target, so that the
+// change output is about the same size as the recipient output
+void CoinSelection::selectSingleInputDoubleValue(
+                                          vector<uint32_t> const & sorted,
+                                          uint64_t targetOutVal,
+                                          uint64_t minFee,
+                                          vector<uint32_t> & selectOut)
+{
+   selectOut.clear();
+   uint64_t idealTarget = 2*targetOutVal + minFee;
+   uint64_t minTarget   = (uint64_t)(0.75 * idealTarget);
+   uint64_t maxTarget   = (uint64_t)(1.25 * idealTarget);
+   minTarget = max(minTarget, targetOutVal+minFee);
+
+   uint64_t bestMatch = UINT64_MAX;
+   int32_t  bestIdx   = -1;
+   for(uint32_t i=0; i<sorted.size(); i++)
+   {
+      uint64_t val = coinValue_[sorted[i]];
+      if(minTarget <= val && val <= maxTarget)
+      {
+         uint64_t diff = (val > idealTarget ? val-idealTarget : idealTarget-val);
+         if(diff < bestMatch)
+         {
+            bestMatch = diff;
+            bestIdx   = (int32_t)sorted[i];
+         }
+      }
+   }
+
+   if(bestIdx >= 0)
+      selectOut.push_back((uint32_t)bestIdx);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Accumulate coins until we pass the closest sum to double the target
+void CoinSelection::selectMultiInputDoubleValue(
+                                          vector<uint32_t> const & sorted,
+                                          uint64_t targetOutVal,
+                                          uint64_t minFee,
+                                          vector<uint32_t> & selectOut)
+{
+   selectOut.clear();
+   uint64_t idealTarget = 2*targetOutVal;
+   uint64_t minTarget   = (uint64_t)(0.80 * idealTarget);
+   minTarget = max(minTarget, targetOutVal+minFee);
+
+   uint64_t lastDiff = UINT64_MAX;
+   uint64_t sumVal   = 0;
+   for(uint32_t i=0; i<sorted.size(); i++)
+   {
+      sumVal += coinValue_[sorted[i]];
+      selectOut.push_back(sorted[i]);
+      uint64_t currDiff = (sumVal > idealTarget ? sumVal-idealTarget
+                                                : idealTarget-sumVal);
+      // Should switch from decreasing to increasing when best match
+      if(sumVal >= minTarget && currDiff > lastDiff)
+      {
+         selectOut.pop_back();
+         break;
+      }
+      lastDiff = currDiff;
+   }
+
+   if(sumVal < minTarget)
+      selectOut.clear();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Depth-first search over include/exclude decisions, with candidates sorted
+// largest first.  We backtrack as soon as the current branch overshoots the
+// window, or can't reach the target even if we include everything that is
+// left.  Any selection inside the window needs no change output.  Among
+// those, we keep the one wasting the least (then the fewest inputs).
+bool CoinSelection::selectBranchAndBound(vector<uint32_t> const & candidates,
+                                         uint64_t target,
+                                         uint64_t maxOverage,
+                                         vector<uint32_t> & selectOut)
+{
+   selectOut.clear();
+   uint32_t nCand = candidates.size();
+   if(nCand == 0)
+      return false;
+
+   vector<uint64_t> val(nCand);
+   uint64_t availValue = 0;
+   for(uint32_t i=0; i<nCand; i++)
+   {
+      val[i] = coinValue_[candidates[i]];
+      availValue += val[i];
+   }
+
+   uint64_t upperLimit = target + maxOverage;
+   uint64_t currValue  = 0;
+   uint64_t bestWaste  = UINT64_MAX;
+   vector<uint32_t> currSelect(0);
+   vector<uint32_t> bestSelect(0);
+
+   uint32_t currIdx = 0;
+   for(uint32_t nTry=0; nTry<COINSEL_BNB_MAX_TRIES; nTry++, currIdx++)
+   {
+      numBnbTries_++;
+      if(nTry % 1000 == 999 && checkBudget())
+         break;
+
+      bool backtrack = false;
+      if(currValue + availValue < target || currValue > upperLimit)
+         backtrack = true;
+      else if(currValue >= target)
+      {
+         uint64_t waste = currValue - target;
+         if(waste < bestWaste ||
+            (waste == bestWaste && currSelect.size() < bestSelect.size()))
+         {
+            bestWaste  = waste;
+            bestSelect = currSelect;
+         }
+         if(bestWaste == 0)
+            break;
+         backtrack = true;
+      }
+
+      if(backtrack)
+      {
+         if(currSelect.size() == 0)
+            break;
+
+         // Put the skipped coins back into the lookahead, then try the
+         // branch that excludes the last coin we included
+         for(--currIdx; currIdx > currSelect.back(); --currIdx)
+            availValue += val[currIdx];
+
+         currValue -= val[currIdx];
+         currSelect.pop_back();
+      }
+      else
+      {
+         availValue -= val[currIdx];
+
+         // If we just excluded a coin of the same value, including this one
+         // would only reproduce a branch we've already explored
+         if(currSelect.size() == 0 ||
+            currIdx-1 == currSelect.back() ||
+            val[currIdx] != val[currIdx-1])
+         {
+            currSelect.push_back(currIdx);
+            currValue += val[currIdx];
+         }
+      }
+   }
+
+   if(bestSelect.size() == 0)
+      return false;
+
+   selectOut.resize(bestSelect.size());
+   for(uint32_t i=0; i<bestSelect.size(); i++)
+      selectOut[i] = candidates[bestSelect[i]];
+   return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Straight port of getSelectCoinsScores() from armoryengine.py
+bool CoinSelection::computeScores(vector<uint32_t> const & select,
+                                  uint64_t targetOutVal,
+                                  uint64_t minFee,
+                                  double * scoresOut)
+{
+   uint32_t nSelect = select.size();
+   if(nSelect == 0)
+      return false;
+
+   uint64_t totalIn = 0;
+   for(uint32_t i=0; i<nSelect; i++)
+      totalIn += coinValue_[select[i]];
+
+   // Abort if not enough coins
+   if(totalIn < targetOutVal+minFee)
+      return false;
+   uint64_t totalChange = totalIn - (targetOutVal+minFee);
+
+   ///////////////////
+   // Does this selection include any zero-conf tx?  How many addresses are
+   // linked together by this tx?  Also compute raw priority while we're here
+   addrMarkGen_++;
+   if(addrMarkGen_ == 0)
+   {
+      addrMark_.assign(numAddrIDs_, 0);
+      addrMarkGen_ = 1;
+   }
+
+   uint32_t numAddr    = 0;
+   double   noZeroConf = 1;
+   double   dPriority  = 0;
+   for(uint32_t i=0; i<nSelect; i++)
+   {
+      uint32_t idx = select[i];
+      if(addrMark_[coinAddrID_[idx]] != addrMarkGen_)
+      {
+         addrMark_[coinAddrID_[idx]] = addrMarkGen_;
+         numAddr++;
+      }
+
+      if(coinNumConf_[idx] == 0)
+         noZeroConf = 0;
+      else
+         dPriority += (double)coinValue_[idx] * (double)coinNumConf_[idx];
+   }
+   double numAddrFactor = 4.0/(double)((numAddr+1)*(numAddr+1));
+
+   ///////////////////
+   // Output anonymity:  if one output is 50.0 and the other is 27.383291,
+   // it's fairly obvious which one is the change.  If the diff is negative,
+   // the wrong answer starts to look like the correct one, so extra credit
+   int32_t tgtTrailingZeros = countTrailingZeros(targetOutVal);
+   int32_t chgTrailingZeros = countTrailingZeros(totalChange);
+   int32_t zeroDiff = tgtTrailingZeros - chgTrailingZeros;
+   double outAnonFactor = 0;
+   if(totalChange == 0)
+      outAnonFactor = 1;
+   else
+   {
+      if(zeroDiff == 2)
+         outAnonFactor = 0.2;
+      else if(zeroDiff == 1)
+         outAnonFactor = 0.7;
+      else if(zeroDiff < 1)
+         outAnonFactor = abs(zeroDiff) + 1;
+   }
+
+   // Equal-looking outputs are anonymous, but only matters if the trailing
+   // zeros aren't already giving it away
+   if(outAnonFactor > 0 && outAnonFactor <= 1 && totalChange != 0)
+   {
+      uint64_t outValDiff = (totalChange > targetOutVal ?
+                                 totalChange - targetOutVal :
+                                 targetOutVal - totalChange);
+      double diffPct = (double)outValDiff /
+                       (double)max(totalChange, targetOutVal);
+      if(diffPct < 0.20)
+         outAnonFactor *= 1;
+      else if(diffPct < 0.50)
+         outAnonFactor *= 0.7;
+      else if(diffPct < 1.0)
+         outAnonFactor *= 0.3;
+      else
+         outAnonFactor = 0;
+   }
+
+   ///////////////////
+   // Tx size:  we don't have signatures yet, but we assume that each txin is
+   // about 180 bytes, TxOuts are 35, and 10 other bytes in the Tx
+   uint32_t numBytes = 10 + 180*nSelect + 35*(totalChange==0 ? 1 : 2);
+   uint32_t numKb    = numBytes / 1000;
+
+   ///////////////////
+   // Priority:  above the 1-btc-after-1-day threshold we might get a free tx
+   dPriority /= (double)numBytes;
+   double priorityThresh = (double)(COINSEL_ONE_BTC * 144 / 250);
+   double priorityFactor;
+   if(dPriority < priorityThresh)
+      priorityFactor = 0;
+   else if(dPriority < 10.0*priorityThresh)
+      priorityFactor = 0.7;
+   else if(dPriority < 100.0*priorityThresh)
+      priorityFactor = 0.9;
+   else
+      priorityFactor = 1.0;
+
+   ///////////////////
+   // AllowFree:  no dust outputs, high enough priority, and small enough
+   bool haveDustOutputs = ((totalChange > 0 && totalChange < COINSEL_CENT) ||
+                            targetOutVal < COINSEL_CENT);
+   double isFreeAllowed = 0;
+   if(!haveDustOutputs && dPriority >= priorityThresh && numBytes <= 3500)
+      isFreeAllowed = 1;
+
+   ///////////////////
+   // If free is allowed, kB is irrelevant
+   double txSizeFactor;
+   if(isFreeAllowed > 0 || numKb < 1)
+      txSizeFactor = 1;
+   else if(numKb < 2)
+      txSizeFactor = 0.2;
+   else if(numKb < 3)
+      txSizeFactor = 0.1;
+   else if(numKb < 4)
+      txSizeFactor = 0;
+   else
+      txSizeFactor = -1;  // if this is huge, actually subtract score
+
+   scoresOut[SELECT_SCORE_ALLOWFREE]  = isFreeAllowed;
+   scoresOut[SELECT_SCORE_NOZEROCONF] = noZeroConf;
+   scoresOut[SELECT_SCORE_PRIORITY]   = priorityFactor;
+   scoresOut[SELECT_SCORE_NUMADDR]    = numAddrFactor;
+   scoresOut[SELECT_SCORE_TXSIZE]     = txSizeFactor;
+   scoresOut[SELECT_SCORE_OUTANONYM]  = outAnonFactor;
+   return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+double CoinSelection::evalIndices(vector<uint32_t> const & select,
+                                  uint64_t targetOutVal,
+                                  uint64_t minFee)
+{
+   double scores[SELECT_SCORE_NUM_FACTORS];
+   if(!computeScores(select, targetOutVal, minFee, scores))
+      return -1;
+
+   double score = 0;
+   score += weights_[SELECT_SCORE_NOZEROCONF] * scores[SELECT_SCORE_NOZEROCONF];
+   score += weights_[SELECT_SCORE_PRIORITY]   * scores[SELECT_SCORE_PRIORITY];
+   score += weights_[SELECT_SCORE_NUMADDR]    * scores[SELECT_SCORE_NUMADDR];
+   score += weights_[SELECT_SCORE_TXSIZE]     * scores[SELECT_SCORE_TXSIZE];
+   score += weights_[SELECT_SCORE_OUTANONYM]  * scores[SELECT_SCORE_OUTANONYM];
+
+   // If we're already paying a fee, why bother including this weight?
+   if(minFee == 0)
+      score += weights_[SELECT_SCORE_ALLOWFREE] * scores[SELECT_SCORE_ALLOWFREE];
+
+   return score;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Score a candidate and keep it if it's the best so far.  Ties go to the
+// earlier candidate, same as python's max()
+void CoinSelection::tryCandidate(vector<uint32_t> const & select,
+                                 uint64_t targetOutVal,
+                                 uint64_t minFee)
+{
+   numCandidatesEval_++;
+   double score = evalIndices(select, targetOutVal, minFee);
+   if(score > bestScore_)
+   {
+      bestScore_  = score;
+      bestSelect_ = select;
+   }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// If we selected only a few inputs, and there are other tiny outputs on the
+// same addresses, throw one or two in to help clear them out.  Only if the
+// tx has good priority already and isn't relying on output anonymity.
+void CoinSelection::addDustFromSameAddr(uint64_t targetOutVal, uint64_t minFee)
+{
+   double scores[SELECT_SCORE_NUM_FACTORS];
+   if(!computeScores(bestSelect_, targetOutVal, minFee, scores))
+      return;
+
+   if(bestSelect_.size() >= COINSEL_IDEAL_NUM_INPUTS ||
+      scores[SELECT_SCORE_PRIORITY] < 0.5 ||
+      scores[SELECT_SCORE_OUTANONYM] != 0)
+      return;
+
+   // Sort by LOWEST value, since we benefit most by clearing tiny outputs
+   uint32_t nCoin = coinValue_.size();
+   vector<double> negValue(nCoin);
+   vector<uint32_t> byValue(nCoin);
+   for(uint32_t i=0; i<nCoin; i++)
+   {
+      negValue[i] = -(double)coinValue_[i];
+      byValue[i]  = i;
+   }
+   stable_sort(byValue.begin(), byValue.end(), CompareKeyDescending(negValue));
+
+   vector<bool> isSelected(nCoin, false);
+   for(uint32_t i=0; i<bestSelect_.size(); i++)
+      isSelected[bestSelect_[i]] = true;
+
+   double maxPriority = 10.0 * COINSEL_ONE_BTC * 144.0 / 250.0;
+   uint32_t nOrig = bestSelect_.size();
+   for(uint32_t s=0; s<nOrig; s++)
+   {
+      uint32_t sel = bestSelect_[s];
+      for(uint32_t j=0; j<nCoin; j++)
+      {
+         uint32_t other = byValue[j];
+         if(coinAddrID_[sel]  == coinAddrID_[other]  &&
+            coinValue_[sel]   != coinValue_[other]   &&
+            coinNumConf_[sel] != coinNumConf_[other] &&
+            !isSelected[other] &&
+            coinNumConf_[other] > 0 &&
+            (double)coinValue_[other]*coinNumConf_[other] < maxPriority)
+         {
+            bestSelect_.push_back(other);
+            isSelected[other] = true;
+            if(bestSelect_.size() >= COINSEL_IDEAL_NUM_INPUTS)
+               return;
+         }
+      }
+   }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// The main event.  Same candidate lists as PySelectCoins, plus branch-and-
+// bound exact matches, all scored with the same metric.  The deterministic
+// sorts always get evaluated;  the exact-match search and random sorts only
+// run while there's still time left in the budget.
+vector<UnspentTxOut> CoinSelection::selectCoins(
+                                 vector<UnspentTxOut> const & unspentTxOuts,
+                                 uint64_t targetOutVal,
+                                 uint64_t minFee,
+                                 uint32_t numRand,
+                                 uint64_t margin)
+{
+   startClock();
+   loadCoins(unspentTxOuts);
+
+   uint64_t sumValue = 0;
+   for(uint32_t i=0; i<coinValue_.size(); i++)
+      sumValue += coinValue_[i];
+
+   if(sumValue < targetOutVal+minFee)
+   {
+      utxoListPtr_ = NULL;
+      return vector<UnspentTxOut>(0);
+   }
+
+   uint64_t targExact  = targetOutVal;
+   uint64_t targMargin = targetOutVal + margin;
+
+   vector<uint32_t> sorted;
+   vector<uint32_t> select;
+
+   // The single-input searches don't depend on the sort order at all
+   sortIndices(0, sorted);
+   selectSingleInputSingleValue(sorted, targExact, minFee, select);
+   tryCandidate(select, targetOutVal, minFee);
+   selectSingleInputSingleValue(sorted, targMargin, minFee, select);
+   tryCandidate(select, targetOutVal, minFee);
+   selectSingleInputDoubleValue(sorted, targExact, minFee, select);
+   tryCandidate(select, targetOutVal, minFee);
+   selectSingleInputDoubleValue(sorted, targMargin, minFee, select);
+   tryCandidate(select, targetOutVal, minFee);
+
+   for(uint32_t sortMethod=0; sortMethod<8; sortMethod++)
+   {
+      if(sortMethod > 0)
+      {
+         if(checkBudget())
+            break;
+         sortIndices(sortMethod, sorted);
+      }
+
+      selectMultiInputSingleValue(sorted, targExact, minFee, select);
+      tryCandidate(select, targetOutVal, minFee);
+      selectMultiInputSingleValue(sorted, targMargin, minFee, select);
+      tryCandidate(select, targetOutVal, minFee);
+      selectMultiInputDoubleValue(sorted, targExact, minFee, select);
+      tryCandidate(select, targetOutVal, minFee);
+      selectMultiInputDoubleValue(sorted, targMargin, minFee, select);
+      tryCandidate(select, targetOutVal, minFee);
+   }
+
+   // Exact match (no change output) using confirmed coins only
+   if(!checkBudget())
+   {
+      vector<double> key(coinValue_.size());
+      vector<uint32_t> candidates(0);
+      for(uint32_t i=0; i<coinValue_.size(); i++)
+      {
+         key[i] = (double)coinValue_[i];
+         if(coinNumConf_[i] > 0)
+            candidates.push_back(i);
+      }
+      stable_sort(candidates.begin(), candidates.end(), CompareKeyDescending(key));
+      if(selectBranchAndBound(candidates, targetOutVal+minFee, 0, select))
+         tryCandidate(select, targetOutVal, minFee);
+   }
+
+   // Throw in a couple random solutions, maybe we get lucky
+   for(uint32_t method=8; method<10; method++)
+   {
+      for(uint32_t i=0; i<numRand; i++)
+      {
+         if(checkBudget())
+            break;
+
+         sortIndices(method, sorted);
+         selectMultiInputSingleValue(sorted, targExact, minFee, select);
+         tryCandidate(select, targetOutVal, minFee);
+         selectMultiInputDoubleValue(sorted, targExact, minFee, select);
+         tryCandidate(select, targetOutVal, minFee);
+         selectMultiInputSingleValue(sorted, targMargin, minFee, select);
+         tryCandidate(select, targetOutVal, minFee);
+         selectMultiInputDoubleValue(sorted, targMargin, minFee, select);
+         tryCandidate(select, targetOutVal, minFee);
+      }
+   }
+
+   if(bestScore_ < 0)
+   {
+      utxoListPtr_ = NULL;
+      return vector<UnspentTxOut>(0);
+   }
+
+   addDustFromSameAddr(targetOutVal, minFee);
+
+   vector<UnspentTxOut> out = indicesToUtxoList(bestSelect_);
+   checkBudget();
+   utxoListPtr_ = NULL;
+   return out;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+vector<UnspentTxOut> CoinSelection::selectExactMatch(
+                                 vector<UnspentTxOut> const & unspentTxOuts,
+                                 uint64_t targetOutVal,
+                                 uint64_t minFee,
+                                 uint64_t maxOverage)
+{
+   startClock();
+   loadCoins(unspentTxOuts);
+
+   vector<double> key(coinValue_.size());
+   vector<uint32_t> candidates(coinValue_.size());
+   for(uint32_t i=0; i<coinValue_.size(); i++)
+   {
+      key[i] = (double)coinValue_[i];
+      candidates[i] = i;
+   }
+   stable_sort(candidates.begin(), candidates.end(), CompareKeyDescending(key));
+
+   vector<uint32_t> select;
+   vector<UnspentTxOut> out(0);
+   if(selectBranchAndBound(candidates, targetOutVal+minFee, maxOverage, select))
+      out = indicesToUtxoList(select);
+
+   checkBudget();
+   utxoListPtr_ = NULL;
+   return out;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+vector<float> CoinSelection::getSelectCoinsScores(
+                                 vector<UnspentTxOut> const & selection,
+                                 uint64_t targetOutVal,
+                                 uint64_t minFee)
+{
+   loadCoins(selection);
+   vector<uint32_t> select(selection.size());
+   for(uint32_t i=0; i<selection.size(); i++)
+      select[i] = i;
+
+   vector<float> out(0);
+   double scores[SELECT_SCORE_NUM_FACTORS];
+   if(computeScores(select, targetOutVal, minFee, scores))
+   {
+      out.resize(SELECT_SCORE_NUM_FACTORS);
+      for(uint32_t i=0; i<SELECT_SCORE_NUM_FACTORS; i++)
+         out[i] = (float)scores[i];
+   }
+   utxoListPtr_ = NULL;
+   return out;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+double CoinSelection::evalCoinSelect(vector<UnspentTxOut> const & selection,
+                                     uint64_t targetOutVal,
+                                     uint64_t minFee)
+{
+   loadCoins(selection);
+   vector<uint32_t> select(selection.size());
+   for(uint32_t i=0; i<selection.size(); i++)
+      select[i] = i;
+
+   double score = evalIndices(select, targetOutVal, minFee);
+   utxoListPtr_ = NULL;
+   return score;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+vector<UnspentTxOut> CoinSelection::sortCoins(
+                                 vector<UnspentTxOut> const & unspentTxOuts,
+                                 uint32_t sortMethod)
+{
+   loadCoins(unspentTxOuts);
+   vector<uint32_t> sorted;
+   sortIndices(sortMethod, sorted);
+   vector<UnspentTxOut> out = indicesToUtxoList(sorted);
+   utxoListPtr_ = NULL;
+   return out;
+}
+
+
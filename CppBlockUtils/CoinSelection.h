@@ -0,0 +1,184 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011, Alan C. Reiner    <alan.reiner@gmail.com>             //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _COINSELECTION_H_
+#define _COINSELECTION_H_
+
+#include <iostream>
+#include <vector>
+#include <map>
+
+#include "BinaryData.h"
+#include "BtcUtils.h"
+#include "BlockObj.h"
+
+
+#define COINSEL_ONE_BTC          100000000ULL
+#define COINSEL_CENT             1000000ULL
+#define COINSEL_IDEAL_NUM_INPUTS 5
+#define COINSEL_BNB_MAX_TRIES    100000
+
+using namespace std;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Indices into the score vector returned by getSelectCoinsScores, and into
+// the weights used to combine them.  Same order as IDX_* in armoryengine.py
+typedef enum
+{
+  SELECT_SCORE_ALLOWFREE,
+  SELECT_SCORE_NOZEROCONF,
+  SELECT_SCORE_PRIORITY,
+  SELECT_SCORE_NUMADDR,
+  SELECT_SCORE_TXSIZE,
+  SELECT_SCORE_OUTANONYM,
+  SELECT_SCORE_NUM_FACTORS
+} SELECT_SCORE_INDEX;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// This is a port of PySelectCoins and friends from armoryengine.py.  The
+// python version builds and scores ~100 candidate lists, each of which
+// requires sorting and copying the full UTXO list, which gets painfully
+// slow for wallets with tens of thousands of unspent outputs.  Here, we
+// copy out the three things we actually need from each UnspentTxOut (value,
+// numConf, and an integer ID for the recipient address), and then do all
+// the sorting and scoring on lists of indices into those arrays.
+//
+// On top of the python heuristics, we run a branch-and-bound search for
+// input sets that hit the target exactly (no change output), and we stop
+// generating new candidates once the time budget is used up.
+//
+// These methods would be static, but SWIG doesn't play nice with static
+// methods.  Use it like:   CoinSelection().selectCoins(utxoList, val, fee)
+class CoinSelection
+{
+public:
+   CoinSelection(void);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // The utxo list is usually the output of BtcWallet::getSpendableTxOutList
+   vector<UnspentTxOut> selectCoins(vector<UnspentTxOut> const & unspentTxOuts,
+                                    uint64_t targetOutVal,
+                                    uint64_t minFee=0,
+                                    uint32_t numRand=10,
+                                    uint64_t margin=COINSEL_CENT);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Branch-and-bound search for inputs summing to [target+fee,
+   // target+fee+maxOverage].  Returns an empty list if nothing found within
+   // COINSEL_BNB_MAX_TRIES or the time budget.
+   vector<UnspentTxOut> selectExactMatch(
+                                    vector<UnspentTxOut> const & unspentTxOuts,
+                                    uint64_t targetOutVal,
+                                    uint64_t minFee=0,
+                                    uint64_t maxOverage=0);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Same sub-scores as getSelectCoinsScores() in armoryengine.py, indexed by
+   // SELECT_SCORE_INDEX.  Returns an empty vector if the selection is empty
+   // or doesn't cover target+fee (python returned -1)
+   vector<float> getSelectCoinsScores(vector<UnspentTxOut> const & selection,
+                                      uint64_t targetOutVal,
+                                      uint64_t minFee);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Weighted sum of the sub-scores.  Returns -1 for an invalid selection
+   double evalCoinSelect(vector<UnspentTxOut> const & selection,
+                         uint64_t targetOutVal,
+                         uint64_t minFee);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Sort methods 0-9, identical to PySortCoins (8 and 9 are randomized)
+   vector<UnspentTxOut> sortCoins(vector<UnspentTxOut> const & unspentTxOuts,
+                                  uint32_t sortMethod);
+
+   /////////////////////////////////////////////////////////////////////////////
+   void     setWeight(uint32_t idx, double w);
+   double   getWeight(uint32_t idx) const;
+   void     setTimeBudget(double sec)       { timeBudgetSec_ = sec;     }
+   double   getTimeBudget(void) const       { return timeBudgetSec_;    }
+
+   // Some stats about the last selectCoins/selectExactMatch call
+   uint32_t getNumCandidatesEval(void) const { return numCandidatesEval_; }
+   uint32_t getNumBnbTries(void) const       { return numBnbTries_;       }
+   bool     wasBudgetExceeded(void) const    { return budgetExceeded_;    }
+   double   getLastSelectSec(void) const     { return lastSelectSec_;     }
+
+private:
+
+   void     loadCoins(vector<UnspentTxOut> const & unspentTxOuts);
+   void     sortIndices(uint32_t sortMethod, vector<uint32_t> & idxOut);
+
+   void     selectSingleInputSingleValue(vector<uint32_t> const & sorted,
+                                         uint64_t target,
+                                         uint64_t minFee,
+                                         vector<uint32_t> & selectOut);
+   void     selectMultiInputSingleValue( vector<uint32_t> const & sorted,
+                                         uint64_t target,
+                                         uint64_t minFee,
+                                         vector<uint32_t> & selectOut);
+   void     selectSingleInputDoubleValue(vector<uint32_t> const & sorted,
+                                         uint64_t target,
+                                         uint64_t minFee,
+                                         vector<uint32_t> & selectOut);
+   void     selectMultiInputDoubleValue( vector<uint32_t> const & sorted,
+                                         uint64_t target,
+                                         uint64_t minFee,
+                                         vector<uint32_t> & selectOut);
+   bool     selectBranchAndBound(vector<uint32_t> const & candidates,
+                                 uint64_t target,
+                                 uint64_t maxOverage,
+                                 vector<uint32_t> & selectOut);
+
+   bool     computeScores(vector<uint32_t> const & select,
+                          uint64_t targetOutVal,
+                          uint64_t minFee,
+                          double * scoresOut);
+   double   evalIndices(vector<uint32_t> const & select,
+                        uint64_t targetOutVal,
+                        uint64_t minFee);
+   void     tryCandidate(vector<uint32_t> const & select,
+                         uint64_t targetOutVal,
+                         uint64_t minFee);
+   void     addDustFromSameAddr(uint64_t targetOutVal, uint64_t minFee);
+
+   void     startClock(void);
+   bool     checkBudget(void);
+
+   vector<UnspentTxOut> indicesToUtxoList(vector<uint32_t> const & select);
+
+private:
+   double   weights_[SELECT_SCORE_NUM_FACTORS];
+   double   timeBudgetSec_;
+
+   // Flat copies of the relevant fields of the utxo list we are working on
+   vector<UnspentTxOut> const * utxoListPtr_;
+   vector<uint64_t>     coinValue_;
+   vector<uint32_t>     coinNumConf_;
+   vector<uint32_t>     coinAddrID_;
+   uint32_t             numAddrIDs_;
+
+   // Used to count distinct addresses in a selection without a set<>
+   vector<uint32_t>     addrMark_;
+   uint32_t             addrMarkGen_;
+
+   // Best candidate found so far
+   vector<uint32_t>     bestSelect_;
+   double               bestScore_;
+
+   double               startSec_;
+   uint32_t             numCandidatesEval_;
+   uint32_t             numBnbTries_;
+   bool                 budgetExceeded_;
+   double               lastSelectSec_;
+};
+
+
+#endif
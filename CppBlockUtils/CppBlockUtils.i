@@ -15,9 +15,11 @@
 #define SWIG_PYTHON_EXTRA_NATIVE_CONTAINERS
 #include "BlockObj.h"
 #include "BlockObjRef.h"
+#include "TxValidation.h"
 #include "BlockUtils.h"
 #include "BtcUtils.h"
 #include "EncryptionUtils.h"
+#include "CoinSelection.h"
 %}
 
 %include "std_string.i"
@@ -96,8 +98,10 @@ namespace std
 /* With our typemaps, we can finally include our other objects */
 %include "BlockObj.h"
 %include "BlockObjRef.h"
+%include "TxValidation.h"
 %include "BlockUtils.h"
 %include "BtcUtils.h"
 %include "EncryptionUtils.h"
+%include "CoinSelection.h"
 
 
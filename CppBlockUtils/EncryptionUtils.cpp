@@ -2,6 +2,15 @@
 #include "integer.h"
 #include "oids.h"
 
+#include <pthread.h>
+#include <fstream>
+#include <ctime>
+#include <cstdio>
+
+#ifdef USE_NATIVE_SECP256K1
+   #include "Secp256k1.h"
+#endif
+
 //#include <openssl/ec.h>
 //#include <openssl/ecdsa.h>
 //#include <openssl/obj_mac.h>
@@ -18,6 +27,7 @@ SecureBinaryData & SecureBinaryData::append(SecureBinaryData & sbd2)
    if(sbd2.getSize()==0) 
       return (*this);
 
+   SecureAllocScope sas;
    if(getSize()==0) 
       BinaryData::copyFrom(sbd2.getPtr(), sbd2.getSize());
    else
@@ -40,6 +50,7 @@ SecureBinaryData SecureBinaryData::operator+(SecureBinaryData & sbd2) const
 /////////////////////////////////////////////////////////////////////////////
 SecureBinaryData & SecureBinaryData::operator=(SecureBinaryData const & sbd2)
 { 
+   SecureAllocScope sas;
    copyFrom(sbd2.getPtr(), sbd2.getSize() );
    lockData(); 
    return (*this);
@@ -60,7 +71,10 @@ bool SecureBinaryData::operator==(SecureBinaryData const & sbd2) const
 // Swap endianness of the bytes in the index range [pos1, pos2)
 SecureBinaryData SecureBinaryData::copySwapEndian(size_t pos1, size_t pos2) const
 {
-   return SecureBinaryData(BinaryData::copySwapEndian(pos1, pos2));
+   // Swapped in the secure copy, so there's no plain BinaryData copy
+   SecureBinaryData out(*this);
+   out.swapEndian(pos1, pos2);
+   return out;
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -94,6 +108,19 @@ KdfRomix::KdfRomix(uint32_t memReqts, uint32_t numIter, SecureBinaryData salt) :
 
 /////////////////////////////////////////////////////////////////////////////
 void KdfRomix::computeKdfParams(double targetComputeSec, uint32_t maxMemReqts)
+{
+   // With a target of 0s there's nothing to time
+   KdfCalibration calib;
+   if(targetComputeSec != 0)
+      calib.calibrate(maxMemReqts);
+   computeKdfParams(calib, targetComputeSec, maxMemReqts);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void KdfRomix::computeKdfParams(KdfCalibration const & calib,
+                                double targetComputeSec, 
+                                uint32_t maxMemReqts)
 {
    // Create a random salt, even though this is probably unnecessary:
    // the variation in numIter and memReqts is probably effective enough
@@ -105,63 +132,53 @@ void KdfRomix::computeKdfParams(double targetComputeSec, uint32_t maxMemReqts)
    {
       numIterations_ = 1;
       memoryReqtBytes_ = 1024;
+      sequenceCount_ = memoryReqtBytes_ / hashOutputBytes_;
       return;
    }
 
+   if(!calib.isValid())
+   {
+      KdfCalibration newCalib;
+      newCalib.calibrate(maxMemReqts);
+      computeKdfParams(newCalib, targetComputeSec, maxMemReqts);
+      return;
+   }
 
    // Here, we pick the largest memory reqt that allows the executing system
    // to compute the KDF is less than the target time.  A maximum can be 
    // specified, in case the target system is likely to be memory-limited
-   // more than compute-speed limited
-   SecureBinaryData testKey("This is an example key to test KDF iteration speed");
-
-   // Start the search for a memory value at 1kB
+   // more than compute-speed limited.  Doubling from 1kB, stop at the first
+   // size where one iteration takes more than a quarter of the target.
    memoryReqtBytes_ = 1024;
-   double approxSec = 0;
-   while(approxSec <= targetComputeSec/4 && memoryReqtBytes_ < maxMemReqts)
+   double iterSec = 0;
+   while(iterSec <= targetComputeSec/4 && memoryReqtBytes_ < maxMemReqts)
    {
       memoryReqtBytes_ *= 2;
-
-      sequenceCount_ = memoryReqtBytes_ / hashOutputBytes_;
-      lookupTable_.resize(memoryReqtBytes_);
-
-      TIMER_RESTART("KDF_Mem_Search");
-      testKey = DeriveKey_OneIter(testKey);
-      TIMER_STOP("KDF_Mem_Search");
-      approxSec = TIMER_READ_SEC("KDF_Mem_Search");
+      iterSec = calib.predictIterSec(memoryReqtBytes_);
    }
 
    // Recompute here, in case we didn't enter the search above 
    sequenceCount_ = memoryReqtBytes_ / hashOutputBytes_;
-   lookupTable_.resize(memoryReqtBytes_);
-
+   iterSec = calib.predictIterSec(memoryReqtBytes_);
 
-   // Depending on the search above (or if a low max memory was chosen, 
-   // we may need to do multiple iterations to achieve the desired compute
-   // time on this system.
-   double allItersSec = 0;
-   uint32_t numTest = 1;
-   while(allItersSec < 0.02)
-   {
-      numTest *= 2;
-      TIMER_RESTART("KDF_Time_Search");
-      for(uint32_t i=0; i<numTest; i++)
-      {
-         SecureBinaryData testKey("This is an example key to test KDF iteration speed");
-         testKey = DeriveKey_OneIter(testKey);
-      }
-      TIMER_STOP("KDF_Time_Search");
-      allItersSec = TIMER_READ_SEC("KDF_Time_Search");
+   // The calibration stops at small sizes, so for a long target the size
+   // picked is usually past the largest one it timed.  Time it once rather
+   // than trust the extrapolation, and back off if it's over the target
+   while(memoryReqtBytes_ > calib.getMaxMemTested())
+   {
+      iterSec = KdfCalibration::sampleIterSec(memoryReqtBytes_, 1);
+      if(iterSec <= targetComputeSec || memoryReqtBytes_ <= 1024)
+         break;
+      memoryReqtBytes_ /= 2;
+      sequenceCount_ = memoryReqtBytes_ / hashOutputBytes_;
+      iterSec = calib.predictIterSec(memoryReqtBytes_);
    }
 
-   double perIterSec  = allItersSec / numTest;
-   numIterations_ = (uint32_t)(targetComputeSec / (perIterSec+0.0005));
+   // Depending on the search above (or if a low max memory was chosen), 
+   // we may need to do multiple iterations to achieve the desired compute
+   // time on this system
+   numIterations_ = (uint32_t)(targetComputeSec / (iterSec+0.0005));
    numIterations_ = (numIterations_ < 1 ? 1 : numIterations_);
-   //cout << "System speed test results    :  " << endl;
-   //cout << "   Total test of the KDF took:  " << allItersSec*1000 << " ms" << endl;
-   //cout << "                   to execute:  " << numTest << " iterations" << endl;
-   //cout << "   Target computation time is:  " << targetComputeSec*1000 << " ms" << endl;
-   //cout << "   Setting numIterations to:    " << numIterations_ << endl;
 }
 
 
@@ -193,25 +210,23 @@ void KdfRomix::printKdfParams(void)
 
 
 /////////////////////////////////////////////////////////////////////////////
-SecureBinaryData KdfRomix::DeriveKey_OneIter(SecureBinaryData const & password)
+void KdfRomix::romixOneIter(uint8_t * workspace,
+                            uint32_t  inputSize,
+                            CryptoPP::SHA512 & sha512) const
 {
-   static CryptoPP::SHA512 sha512;
-
-   // Concatenate the salt/IV to the password
-   SecureBinaryData saltedPassword = password + salt_; 
-   
-   // Prepare the lookup table
-   lookupTable_.resize(memoryReqtBytes_);
-   lookupTable_.fill(0);
    uint32_t const HSZ = hashOutputBytes_;
-   uint8_t* frontOfLUT = lookupTable_.getPtr();
+   uint8_t* frontOfLUT = workspace;
+   uint8_t* X          = workspace + memoryReqtBytes_;
+   uint8_t* Y          = X + HSZ;
+   uint8_t* input      = getWorkspaceInput(workspace);
    uint8_t* nextRead  = NULL;
    uint8_t* nextWrite = NULL;
 
+   // Concatenate the salt/IV to the password
+   memcpy(input + inputSize, salt_.getPtr(), salt_.getSize());
+
    // First hash to seed the lookup table, input is variable length anyway
-   sha512.CalculateDigest(frontOfLUT, 
-                          saltedPassword.getPtr(), 
-                          saltedPassword.getSize());
+   sha512.CalculateDigest(frontOfLUT, input, inputSize + salt_.getSize());
 
    // Compute <sequenceCount_> consecutive hashes of the passphrase
    // Every iteration is stored in the next 64-bytes in the Lookup table
@@ -219,19 +234,18 @@ SecureBinaryData KdfRomix::DeriveKey_OneIter(SecureBinaryData const & password)
    {
       // Compute hash of slot i, put result in slot i+1
       nextRead  = frontOfLUT + nByte;
-      nextWrite = nextRead + hashOutputBytes_;
-      sha512.CalculateDigest(nextWrite, nextRead, hashOutputBytes_);
+      nextWrite = nextRead + HSZ;
+      sha512.CalculateDigest(nextWrite, nextRead, HSZ);
    }
 
    // LookupTable should be complete, now start lookup sequence.
    // Start with the last hash from the previous step
-   SecureBinaryData X(frontOfLUT + memoryReqtBytes_ - HSZ, HSZ);
-   SecureBinaryData Y(HSZ);
+   memcpy(X, frontOfLUT + memoryReqtBytes_ - HSZ, HSZ);
 
    // We "integerize" a hash value by taking the last 4 bytes of
    // as a uint32_t, and take modulo sequenceCount
-   uint64_t* X64ptr = (uint64_t*)(X.getPtr());
-   uint64_t* Y64ptr = (uint64_t*)(Y.getPtr());
+   uint64_t* X64ptr = (uint64_t*)X;
+   uint64_t* Y64ptr = (uint64_t*)Y;
    uint64_t* V64ptr = NULL;
    uint32_t newIndex;
    uint32_t const nXorOps = HSZ/sizeof(uint64_t);
@@ -241,35 +255,364 @@ SecureBinaryData KdfRomix::DeriveKey_OneIter(SecureBinaryData const & password)
    for(uint32_t nSeq=0; nSeq<nLookups; nSeq++)
    {
       // Interpret last 4 bytes of last result (mod seqCt) as next LUT index
-      newIndex = *(uint32_t*)(X.getPtr()+HSZ-4) % sequenceCount_;
+      newIndex = *(uint32_t*)(X+HSZ-4) % sequenceCount_;
 
       // V represents the hash result at <newIndex>
       V64ptr = (uint64_t*)(frontOfLUT + HSZ*newIndex);
 
       // xor X with V, and store the result in X
-      for(int i=0; i<nXorOps; i++)
+      for(uint32_t i=0; i<nXorOps; i++)
          *(Y64ptr+i) = *(X64ptr+i) ^ *(V64ptr+i);
 
       // Hash the xor'd data to get the next index for lookup
-      sha512.CalculateDigest(X.getPtr(), Y.getPtr(), HSZ);
+      sha512.CalculateDigest(X, Y, HSZ);
    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+SecureBinaryData KdfRomix::DeriveKey_OneIter(SecureBinaryData const & password) const
+{
+   CryptoPP::SHA512 sha512;
+   SecureBinaryData workspace(getWorkspaceSize(password.getSize()));
+   memcpy(getWorkspaceInput(workspace.getPtr()), password.getPtr(), password.getSize());
+   romixOneIter(workspace.getPtr(), password.getSize(), sha512);
+
    // Truncate the final result to get the final key
-   lookupTable_.destroy();
-   return X.getSliceCopy(0,kdfOutputBytes_);
+   return SecureBinaryData(workspace.getPtr() + memoryReqtBytes_, kdfOutputBytes_);
 }
 
 /////////////////////////////////////////////////////////////////////////////
-SecureBinaryData KdfRomix::DeriveKey(SecureBinaryData const & password)
+// The buffer is allocated and locked once, and each iteration's key is 
+// copied straight from X into the input slot for the next one
+SecureBinaryData KdfRomix::DeriveKey(SecureBinaryData const & password) const
 {
-   SecureBinaryData masterKey(password);
-   for(uint32_t i=0; i<numIterations_; i++)
-      masterKey = DeriveKey_OneIter(masterKey);
+   if(numIterations_ == 0)
+      return SecureBinaryData(password);
+
+   CryptoPP::SHA512 sha512;
+   uint32_t maxInputSize = max((uint32_t)password.getSize(), kdfOutputBytes_);
+   SecureBinaryData workspace(getWorkspaceSize(maxInputSize));
+   uint8_t * X     = workspace.getPtr() + memoryReqtBytes_;
+   uint8_t * input = getWorkspaceInput(workspace.getPtr());
+
+   memcpy(input, password.getPtr(), password.getSize());
+   romixOneIter(workspace.getPtr(), password.getSize(), sha512);
+   for(uint32_t i=1; i<numIterations_; i++)
+   {
+      memcpy(input, X, kdfOutputBytes_);
+      romixOneIter(workspace.getPtr(), kdfOutputBytes_, sha512);
+   }
    
-   return SecureBinaryData(masterKey);
+   return SecureBinaryData(X, kdfOutputBytes_);
 }
 
 
 
+/////////////////////////////////////////////////////////////////////////////
+uint32_t KdfRomixBatch::addKdf(KdfRomix const & kdf, 
+                               SecureBinaryData const & password)
+{
+   kdfs_.push_back(kdf);
+   passwords_.push_back(password);
+   keys_.push_back(SecureBinaryData(0));
+   return kdfs_.size()-1;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void KdfRomixBatch::clear(void)
+{
+   kdfs_.clear();
+   passwords_.clear();
+   keys_.clear();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Each thread takes the next derivation that nobody's started yet
+struct KdfBatchJob
+{
+   vector<KdfRomix> const *          kdfs_;
+   vector<SecureBinaryData> const *  passwords_;
+   vector<SecureBinaryData> *        keys_;
+   uint32_t                          nextIdx_;
+   pthread_mutex_t                   lock_;
+};
+
+static void* kdfBatchThread(void* jobPtr)
+{
+   KdfBatchJob & job = *(KdfBatchJob*)jobPtr;
+   while(true)
+   {
+      pthread_mutex_lock(&job.lock_);
+      uint32_t idx = job.nextIdx_++;
+      pthread_mutex_unlock(&job.lock_);
+      if(idx >= job.kdfs_->size())
+         break;
+
+      // Different indices, so no locking needed for the result
+      (*job.keys_)[idx] = (*job.kdfs_)[idx].DeriveKey((*job.passwords_)[idx]);
+   }
+   return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void KdfRomixBatch::deriveAll(uint32_t numThreads)
+{
+   if(numThreads == 0)
+   {
+#ifdef _SC_NPROCESSORS_ONLN
+      long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+      numThreads = (numCores > 0 ? (uint32_t)numCores : 1);
+#else
+      numThreads = 1;
+#endif
+   }
+
+   KdfBatchJob job;
+   job.kdfs_      = &kdfs_;
+   job.passwords_ = &passwords_;
+   job.keys_      = &keys_;
+   job.nextIdx_   = 0;
+   pthread_mutex_init(&job.lock_, NULL);
+
+   numThreads = max((uint32_t)1, min(numThreads, (uint32_t)kdfs_.size()));
+   vector<pthread_t> threads(numThreads-1);
+   uint32_t numStarted = 0;
+   for(uint32_t t=0; t<threads.size(); t++, numStarted++)
+      if(pthread_create(&threads[t], NULL, kdfBatchThread, &job) != 0)
+         break;
+
+   // This thread does its share too, and all of it if none could be started
+   kdfBatchThread(&job);
+   for(uint32_t t=0; t<numStarted; t++)
+      pthread_join(threads[t], NULL);
+   pthread_mutex_destroy(&job.lock_);
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+KdfCalibration::KdfCalibration(void) :
+   isValid_(false),
+   fixedSecPerIter_(0),
+   secPerByte_(0),
+   maxMemTested_(0),
+   numSizesTested_(0),
+   maxFitError_(0)
+{
+   // Nothing to do here
+}
+
+/////////////////////////////////////////////////////////////////////////////
+double KdfCalibration::sampleIterSec(uint32_t memReqtBytes, uint32_t numSamples)
+{
+   KdfRomix kdf(memReqtBytes, 1, SecureBinaryData().GenerateRandom(32));
+   SecureBinaryData testKey("This is an example key to test KDF iteration speed");
+   uint32_t const testKeySize = testKey.getSize();
+   CryptoPP::SHA512 sha512;
+
+   SecureBinaryData workspace(kdf.getWorkspaceSize(testKeySize));
+   uint8_t * input = kdf.getWorkspaceInput(workspace.getPtr());
+   memcpy(input, testKey.getPtr(), testKeySize);
+
+   // The first run pages in the buffer, and tells us how many iterations
+   // it takes to make a sample long enough to time accurately
+   double startSec = UniversalTimer::getMonotonicSec();
+   kdf.romixOneIter(workspace.getPtr(), testKeySize, sha512);
+   double firstSec = UniversalTimer::getMonotonicSec() - startSec;
+   uint32_t itersPerSample = 1;
+   if(firstSec < KDF_CALIBRATION_MIN_SAMPLE_SEC)
+      itersPerSample += (uint32_t)(KDF_CALIBRATION_MIN_SAMPLE_SEC / 
+                                   max(firstSec, 1e-7));
+
+   vector<double> samples(numSamples);
+   for(uint32_t s=0; s<numSamples; s++)
+   {
+      startSec = UniversalTimer::getMonotonicSec();
+      for(uint32_t i=0; i<itersPerSample; i++)
+      {
+         memcpy(input, testKey.getPtr(), testKeySize);
+         kdf.romixOneIter(workspace.getPtr(), testKeySize, sha512);
+      }
+      double sampleSec = UniversalTimer::getMonotonicSec() - startSec;
+      samples[s] = sampleSec / itersPerSample;
+   }
+
+   // The median ignores the samples that got interrupted
+   sort(samples.begin(), samples.end());
+   return samples[numSamples/2];
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void KdfCalibration::calibrate(uint32_t maxMemReqts)
+{
+   vector<double> mems;
+   vector<double> secs;
+   uint32_t mem = 1024;
+   while(true)
+   {
+      double sec = sampleIterSec(mem, KDF_CALIBRATION_SAMPLES);
+      mems.push_back((double)mem);
+      secs.push_back(sec);
+      if(sec >= KDF_CALIBRATION_MAX_ITER_SEC || mem >= maxMemReqts ||
+         mem >= (1U<<30))
+         break;
+      mem *= 2;
+   }
+
+   // Weighted least squares with weights 1/sec^2, so every size counts by
+   // its relative error.  A negative intercept is just noise:  refit 
+   // through the origin
+   double sw=0, swm=0, swmm=0, sws=0, swms=0;
+   for(uint32_t i=0; i<mems.size(); i++)
+   {
+      double w = 1.0 / (secs[i]*secs[i]);
+      sw   += w;
+      swm  += w * mems[i];
+      swmm += w * mems[i] * mems[i];
+      sws  += w * secs[i];
+      swms += w * mems[i] * secs[i];
+   }
+   double det = sw*swmm - swm*swm;
+   fixedSecPerIter_ = (det > 0 ? (swmm*sws - swm*swms) / det : 0);
+   secPerByte_      = (det > 0 ? (sw*swms - swm*sws) / det : 0);
+   if(fixedSecPerIter_ < 0 || secPerByte_ <= 0)
+   {
+      fixedSecPerIter_ = 0;
+      secPerByte_      = swms / swmm;
+   }
+
+   maxMemTested_   = mem;
+   numSizesTested_ = mems.size();
+   maxFitError_    = 0;
+   for(uint32_t i=0; i<mems.size(); i++)
+   {
+      double pred = fixedSecPerIter_ + secPerByte_*mems[i];
+      maxFitError_ = max(maxFitError_, fabs(pred - secs[i]) / secs[i]);
+   }
+   isValid_ = (secPerByte_ > 0);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+double KdfCalibration::predictIterSec(uint32_t memReqtBytes) const
+{
+   return fixedSecPerIter_ + secPerByte_ * (double)memReqtBytes;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool KdfCalibration::spotCheck(void) const
+{
+   if(!isValid_)
+      return false;
+
+   uint32_t mem = min((uint32_t)(64*1024), maxMemTested_);
+   double ratio = sampleIterSec(mem, 3) / predictIterSec(mem);
+   return (ratio <= KDF_CALIBRATION_MAX_DRIFT && 
+           ratio >= 1.0/KDF_CALIBRATION_MAX_DRIFT);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Costs are stored as integer femtoseconds, the fit error in millionths
+BinaryData KdfCalibration::serialize(void) const
+{
+   BinaryWriter bw;
+   bw.put_uint32_t(KDF_PROFILE_VERSION);
+   bw.put_uint64_t((uint64_t)(fixedSecPerIter_*1e15 + 0.5));
+   bw.put_uint64_t((uint64_t)(secPerByte_*1e15 + 0.5));
+   bw.put_uint32_t(maxMemTested_);
+   bw.put_uint32_t(numSizesTested_);
+   bw.put_uint32_t((uint32_t)(min(maxFitError_, 1000.0)*1e6 + 0.5));
+
+   BinaryData profile = bw.getData();
+   profile.append(BtcUtils::getHash256(profile).getSliceCopy(0,4));
+   return profile;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool KdfCalibration::unserialize(BinaryData const & profile)
+{
+   isValid_ = false;
+   uint32_t const bodySize = 4 + 8 + 8 + 4 + 4 + 4;
+   if(profile.getSize() != bodySize + 4)
+      return false;
+   if( !(BtcUtils::getHash256(profile.getPtr(), bodySize).getSliceCopy(0,4)
+             == profile.getSliceCopy(bodySize, 4)) )
+      return false;
+
+   BinaryRefReader brr(profile.getPtr(), bodySize);
+   if(brr.get_uint32_t() != KDF_PROFILE_VERSION)
+      return false;
+   fixedSecPerIter_ = brr.get_uint64_t() * 1e-15;
+   secPerByte_      = brr.get_uint64_t() * 1e-15;
+   maxMemTested_    = brr.get_uint32_t();
+   numSizesTested_  = brr.get_uint32_t();
+   maxFitError_     = brr.get_uint32_t() * 1e-6;
+   isValid_ = (secPerByte_ > 0);
+   return isValid_;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool KdfCalibration::writeToFile(string filename) const
+{
+   if(!isValid_)
+      return false;
+
+   BinaryData profile = serialize();
+   string tempname = filename + ".tmp";
+   ofstream os(tempname.c_str(), ios::out | ios::binary);
+   os.write((char const *)profile.getPtr(), profile.getSize());
+   os.close();
+   if(os.fail() || rename(tempname.c_str(), filename.c_str()) != 0)
+   {
+      cout << "***ERROR: Could not write KDF profile: " 
+           << filename.c_str() << endl;
+      cerr << "***ERROR: Could not write KDF profile: " 
+           << filename.c_str() << endl;
+      return false;
+   }
+   return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool KdfCalibration::readFromFile(string filename)
+{
+   BinaryData profile(0);
+   ifstream is(filename.c_str(), ios::in | ios::binary);
+   if(is)
+   {
+      is.seekg(0, ios::end);
+      uint32_t filesize = (uint32_t)is.tellg();
+      is.seekg(0, ios::beg);
+      profile.resize(filesize);
+      is.read((char*)profile.getPtr(), filesize);
+      is.close();
+   }
+   return unserialize(profile);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool KdfCalibration::loadOrCalibrate(string filename, uint32_t maxMemReqts)
+{
+   if(readFromFile(filename) && spotCheck())
+      return true;
+
+   calibrate(maxMemReqts);
+   writeToFile(filename);
+   return false;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void KdfCalibration::printProfile(void) const
+{
+   cout << "KDF Calibration:" << endl;
+   cout << "   Valid        : " << (isValid_ ? "yes" : "no") << endl;
+   cout << "   Fixed/iter   : " << fixedSecPerIter_*1e6 << " us" << endl;
+   cout << "   Per kB/iter  : " << secPerByte_*1024*1e6 << " us" << endl;
+   cout << "   Sizes tested : " << numSizesTested_ << " (up to " 
+                                << maxMemTested_/1024 << " kB)" << endl;
+   cout << "   Max fit error: " << maxFitError_*100 << " %" << endl;
+}
+
+
 
 
 /////////////////////////////////////////////////////////////////////////////
@@ -346,6 +689,121 @@ SecureBinaryData CryptoAES::Decrypt(SecureBinaryData & data,
    return unencrData;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// Each thread takes the next chunk of records that nobody's started yet
+struct AesRekeyJob
+{
+   uint8_t *                keyData_;
+   uint32_t                 numRecords_;
+   SecureBinaryData const * oldKey_;
+   SecureBinaryData const * newKey_;
+   uint32_t                 nextIdx_;
+   pthread_mutex_t          lock_;
+};
+
+static void* aesRekeyThread(void* jobPtr)
+{
+   AesRekeyJob & job = *(AesRekeyJob*)jobPtr;
+
+   // Only the IV changes from one record to the next, so the key schedules
+   // are computed here once.  Any IV will do to start with
+   BTC_AES_MODE<BTC_AES>::Decryption aes_dec;
+   BTC_AES_MODE<BTC_AES>::Encryption aes_enc;
+   aes_dec.SetKeyWithIV( (byte*)job.oldKey_->getPtr(), 
+                                job.oldKey_->getSize(), 
+                         (byte*)job.keyData_ + 32);
+   aes_enc.SetKeyWithIV( (byte*)job.newKey_->getPtr(), 
+                                job.newKey_->getSize(), 
+                         (byte*)job.keyData_ + 32);
+
+   while(true)
+   {
+      pthread_mutex_lock(&job.lock_);
+      uint32_t start = job.nextIdx_;
+      job.nextIdx_ += AES_REKEY_PER_CHUNK;
+      pthread_mutex_unlock(&job.lock_);
+      if(start >= job.numRecords_)
+         break;
+
+      // The plaintext key only ever exists in the (locked) record itself
+      uint32_t end = min(start + AES_REKEY_PER_CHUNK, job.numRecords_);
+      for(uint32_t i=start; i<end; i++)
+      {
+         byte* privKey = (byte*)job.keyData_ + i*AES_REKEY_RECORD_SIZE;
+         byte* iv      = privKey + 32;
+         aes_dec.Resynchronize(iv);
+         aes_dec.ProcessData(privKey, privKey, 32);
+         aes_enc.Resynchronize(iv);
+         aes_enc.ProcessData(privKey, privKey, 32);
+      }
+   }
+   return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool CryptoAES::ReencryptBatch(SecureBinaryData & keyData,
+                               SecureBinaryData & oldKey,
+                               SecureBinaryData & newKey,
+                               uint32_t numThreads)
+{
+   if(keyData.getSize() % AES_REKEY_RECORD_SIZE != 0)
+   {
+      cout << "***ERROR: Re-encrypt data is not whole records" << endl;
+      cerr << "***ERROR: Re-encrypt data is not whole records" << endl;
+      return false;
+   }
+
+   uint32_t keySizes[2] = { (uint32_t)oldKey.getSize(), 
+                            (uint32_t)newKey.getSize() };
+   for(uint32_t k=0; k<2; k++)
+   {
+      if(keySizes[k]!=16 && keySizes[k]!=24 && keySizes[k]!=32)
+      {
+         cout << "***ERROR: Invalid AES key size: " << keySizes[k] << endl;
+         cerr << "***ERROR: Invalid AES key size: " << keySizes[k] << endl;
+         return false;
+      }
+   }
+
+   uint32_t numRecords = keyData.getSize() / AES_REKEY_RECORD_SIZE;
+   if(numRecords == 0)
+      return true;
+
+   if(numThreads == 0)
+   {
+#ifdef _SC_NPROCESSORS_ONLN
+      long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+      numThreads = (numCores > 0 ? (uint32_t)numCores : 1);
+#else
+      numThreads = 1;
+#endif
+   }
+
+   AesRekeyJob job;
+   job.keyData_    = keyData.getPtr();
+   job.numRecords_ = numRecords;
+   job.oldKey_     = &oldKey;
+   job.newKey_     = &newKey;
+   job.nextIdx_    = 0;
+   pthread_mutex_init(&job.lock_, NULL);
+
+   uint32_t numChunks = (numRecords + AES_REKEY_PER_CHUNK - 1) / 
+                                                   AES_REKEY_PER_CHUNK;
+   numThreads = max((uint32_t)1, min(numThreads, numChunks));
+   vector<pthread_t> threads(numThreads-1);
+   uint32_t numStarted = 0;
+   for(uint32_t t=0; t<threads.size(); t++, numStarted++)
+      if(pthread_create(&threads[t], NULL, aesRekeyThread, &job) != 0)
+         break;
+
+   // This thread does its share too, and all of it if none could be started
+   aesRekeyThread(&job);
+   for(uint32_t t=0; t<numStarted; t++)
+      pthread_join(threads[t], NULL);
+   pthread_mutex_destroy(&job.lock_);
+   return true;
+}
+
 
 
 
@@ -425,6 +883,17 @@ SecureBinaryData CryptoECDSA::SerializePublicKey(BTC_PUBKEY const & pubKey)
 /////////////////////////////////////////////////////////////////////////////
 SecureBinaryData CryptoECDSA::ComputePublicKey(SecureBinaryData const & cppPrivKey)
 {
+#ifdef USE_NATIVE_SECP256K1
+   SecureBinaryData pubKey65(65);
+   if(cppPrivKey.getSize() != 32 ||
+      !Secp256k1::computePublicKey(cppPrivKey.getPtr(), pubKey65.getPtr()))
+   {
+      cerr << "***ERROR:  Invalid private key" << endl;
+      return SecureBinaryData(0);
+   }
+   return pubKey65;
+#endif
+
    BTC_PRIVKEY pk = ParsePrivateKey(cppPrivKey);
    BTC_PUBKEY  pub;
    pk.MakePublicKey(pub);
@@ -475,6 +944,14 @@ bool CryptoECDSA::CheckPubPrivKeyMatch(SecureBinaryData const & privKey32,
       cout << "   BinPub: " << pubKey65.toHexStr() << endl;
    }
 
+#ifdef USE_NATIVE_SECP256K1
+   SecureBinaryData computedPub(65);
+   if(privKey32.getSize() != 32 || pubKey65.getSize() != 65 ||
+      !Secp256k1::computePublicKey(privKey32.getPtr(), computedPub.getPtr()))
+      return false;
+   return computedPub == pubKey65;
+#endif
+
    BTC_PRIVKEY privKey = ParsePrivateKey(privKey32);
    BTC_PUBKEY  pubKey  = ParsePublicKey(pubKey65);
    return CheckPubPrivKeyMatch(privKey, pubKey);
@@ -487,6 +964,12 @@ bool CryptoECDSA::VerifyPublicKeyValid(SecureBinaryData const & pubKey65)
       cout << "BinPub: " << pubKey65.toHexStr() << endl;
    }
 
+#ifdef USE_NATIVE_SECP256K1
+   if(pubKey65.getSize() != 65)
+      return false;
+   return Secp256k1::isValidPublicKey(pubKey65.getPtr());
+#endif
+
    // Basically just copying the ParsePublicKey method, but without
    // the assert that would throw an error from C++
    SecureBinaryData pubXbin(pubKey65.getSliceRef( 1,32));
@@ -506,6 +989,47 @@ bool CryptoECDSA::VerifyPublicKeyValid(SecureBinaryData const & pubKey65)
    return cppPubKey.Validate(prng, 3);
 }
 
+/////////////////////////////////////////////////////////////////////////////
+SecureBinaryData CryptoECDSA::UncompressPublicKey(
+                                       SecureBinaryData const & pubKey33)
+{
+   if(pubKey33.getSize() != 33 || 
+      (pubKey33.getPtr()[0] != 0x02 && pubKey33.getPtr()[0] != 0x03))
+      return SecureBinaryData(0);
+
+#ifdef USE_NATIVE_SECP256K1
+   SecureBinaryData nativeKey65(65);
+   if(!Secp256k1::decompressPublicKey(pubKey33.getPtr(), nativeKey65.getPtr()))
+      return SecureBinaryData(0);
+   return nativeKey65;
+#endif
+
+   // y^2 = x^3 + 7, and since p = 3 mod 4, y = (x^3 + 7)^((p+1)/4) if 
+   // there is any y at all.  Pick the one with the requested parity
+   static CryptoPP::Integer const fieldP(
+      "FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFEFFFFFC2Fh");
+   static CryptoPP::Integer const sqrtExp = (fieldP + 1) / 4;
+
+   CryptoPP::Integer x;
+   x.Decode(pubKey33.getPtr()+1, 32, UNSIGNED);
+   if( !(x < fieldP) )
+      return SecureBinaryData(0);
+
+   CryptoPP::Integer y2 = (a_times_b_mod_c(x, x, fieldP) * x + 7) % fieldP;
+   CryptoPP::Integer y  = a_exp_b_mod_c(y2, sqrtExp, fieldP);
+   if(a_times_b_mod_c(y, y, fieldP) != y2)
+      return SecureBinaryData(0);
+
+   if(y.IsOdd() != (pubKey33.getPtr()[0] == 0x03))
+      y = fieldP - y;
+
+   SecureBinaryData pubKey65(65);
+   pubKey65.getPtr()[0] = 0x04;
+   x.Encode(pubKey65.getPtr()+1,  32, UNSIGNED);
+   y.Encode(pubKey65.getPtr()+33, 32, UNSIGNED);
+   return pubKey65;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 SecureBinaryData CryptoECDSA::SignData(SecureBinaryData const & binToSign, 
                                        SecureBinaryData const & binPrivKey)
@@ -516,6 +1040,29 @@ SecureBinaryData CryptoECDSA::SignData(SecureBinaryData const & binToSign,
       cout << "   BinSgn: " << binToSign.getSize() << " " << binToSign.toHexStr() << endl;
       cout << "   BinPrv: " << binPrivKey.getSize() << " " << binPrivKey.toHexStr() << endl;
    }
+
+#ifdef USE_NATIVE_SECP256K1
+   if(binPrivKey.getSize() != 32 || 
+      !Secp256k1::isValidPrivateKey(binPrivKey.getPtr()))
+   {
+      cerr << "***ERROR:  Invalid private key" << endl;
+      return SecureBinaryData(0);
+   }
+
+   // Same double-SHA256 that we get from passing a single hash to the
+   // Crypto++ signer.  Retry with a new nonce in the (absurdly unlikely)
+   // case that it produces r=0 or s=0
+   BinaryData hashVal = binToSign.getHash256();
+   SecureBinaryData sig(64);
+   SecureBinaryData nonce;
+   do
+   {
+      nonce = SecureBinaryData().GenerateRandom(32);
+   } while( !Secp256k1::signHash(hashVal.getPtr(), binPrivKey.getPtr(),
+                                 nonce.getPtr(),   sig.getPtr()) );
+   return sig;
+#endif
+
    BTC_PRIVKEY cppPrivKey = ParsePrivateKey(binPrivKey);
    return SignData(binToSign, cppPrivKey);
 }
@@ -560,6 +1107,15 @@ bool CryptoECDSA::VerifyData(SecureBinaryData const & binMessage,
       cout << "   BinPub: " << pubkey65B.toHexStr() << endl;
    }
 
+#ifdef USE_NATIVE_SECP256K1
+   if(binSignature.getSize() != 64 || pubkey65B.getSize() != 65)
+      return false;
+   BinaryData hashVal = binMessage.getHash256();
+   return Secp256k1::verifyHash(hashVal.getPtr(), 
+                                binSignature.getPtr(), 
+                                pubkey65B.getPtr());
+#endif
+
    BTC_PUBKEY cppPubKey = ParsePublicKey(pubkey65B);
    return VerifyData(binMessage, binSignature, cppPubKey);
 }
@@ -591,6 +1147,27 @@ bool CryptoECDSA::VerifyData(SecureBinaryData const & binMessage,
                                               binSignature.getSize());
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// The chaincode xor'd with hash256 of the pubkey is what we multiply by to
+// get the next key in the chain
+static BinaryData getChainMultiplier(uint8_t const * pubKey,
+                                     uint32_t        pubKeySize,
+                                     SecureBinaryData const & chainCode)
+{
+   BinaryData chainMod  = BtcUtils::getHash256(pubKey, pubKeySize);
+   BinaryData chainOrig = chainCode.getRawCopy();
+   BinaryData chainXor(32);
+      
+   for(uint8_t i=0; i<8; i++)
+   {
+      uint8_t offset = 4*i;
+      *(uint32_t*)(chainXor.getPtr()+offset) =
+                           *(uint32_t*)( chainMod.getPtr()+offset) ^ 
+                           *(uint32_t*)(chainOrig.getPtr()+offset);
+   }
+   return chainXor;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 // Deterministically generate new private key using a chaincode
 // Changed:  added using the hash of the public key to the mix
@@ -626,17 +1203,18 @@ SecureBinaryData CryptoECDSA::ComputeChainedPrivateKey(
    }
 
    // Adding extra entropy to chaincode by xor'ing with hash256 of pubkey
-   BinaryData chainMod  = binPubKey.getHash256();
-   BinaryData chainOrig = chainCode.getRawCopy();
-   BinaryData chainXor(32);
-      
-   for(uint8_t i=0; i<8; i++)
-   {
-      uint8_t offset = 4*i;
-      *(uint32_t*)(chainXor.getPtr()+offset) =
-                           *(uint32_t*)( chainMod.getPtr()+offset) ^ 
-                           *(uint32_t*)(chainOrig.getPtr()+offset);
-   }
+   BinaryData chainXor = getChainMultiplier(binPubKey.getPtr(), 
+                                            binPubKey.getSize(), 
+                                            chainCode);
+
+#ifdef USE_NATIVE_SECP256K1
+   SecureBinaryData newPriv32(32);
+   if(binPrivKey.getSize() != 32 ||
+      !Secp256k1::multiplyPrivateKey(binPrivKey.getPtr(), chainXor.getPtr(),
+                                     newPriv32.getPtr()))
+      return SecureBinaryData(0);
+   return newPriv32;
+#endif
 
    // Hard-code the order of the group
    static SecureBinaryData SECP256K1_ORDER_BE = SecureBinaryData().CreateFromHex(
@@ -676,17 +1254,18 @@ SecureBinaryData CryptoECDSA::ComputeChainedPublicKey(
            "fffffffffffffffffffffffffffffffebaaedce6af48a03bbfd25e8cd0364141");
 
    // Added extra entropy to chaincode by xor'ing with hash256 of pubkey
-   BinaryData chainMod  = binPubKey.getHash256();
-   BinaryData chainOrig = chainCode.getRawCopy();
-   BinaryData chainXor(32);
-      
-   for(uint8_t i=0; i<8; i++)
-   {
-      uint8_t offset = 4*i;
-      *(uint32_t*)(chainXor.getPtr()+offset) =
-                           *(uint32_t*)( chainMod.getPtr()+offset) ^ 
-                           *(uint32_t*)(chainOrig.getPtr()+offset);
-   }
+   BinaryData chainXor = getChainMultiplier(binPubKey.getPtr(), 
+                                            binPubKey.getSize(), 
+                                            chainCode);
+
+#ifdef USE_NATIVE_SECP256K1
+   SecureBinaryData newPub65(65);
+   if(binPubKey.getSize() != 65 ||
+      !Secp256k1::multiplyPublicKey(binPubKey.getPtr(), chainXor.getPtr(),
+                                    newPub65.getPtr()))
+      return SecureBinaryData(0);
+   return newPub65;
+#endif
 
    // Parse the chaincode as a big-endian integer
    CryptoPP::Integer chaincode;
@@ -701,6 +1280,650 @@ SecureBinaryData CryptoECDSA::ComputeChainedPublicKey(
    return CryptoECDSA::SerializePublicKey(newPubKey);
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// Interleave the keys with their hash160s (all computed in one batch)
+static SecureBinaryData packChainedKeys(SecureBinaryData const & allPrivKeys,
+                                        SecureBinaryData const & allPubKeys,
+                                        uint32_t numAddr)
+{
+   BinaryData allHash160(20*numAddr);
+   if(numAddr > 0)
+      BtcUtils::getHash160Batch(allPubKeys.getPtr(), 65, numAddr, 
+                                allHash160.getPtr());
+
+   uint32_t privSize = allPrivKeys.getSize() / (numAddr==0 ? 1 : numAddr);
+   uint32_t recSize  = privSize + 65 + 20;
+   SecureBinaryData packed(recSize * numAddr);
+   for(uint32_t i=0; i<numAddr; i++)
+   {
+      uint8_t * rec = packed.getPtr() + recSize*i;
+      memcpy(rec,             allPrivKeys.getPtr() + privSize*i, privSize);
+      memcpy(rec+privSize,    allPubKeys.getPtr()  + 65*i,       65);
+      memcpy(rec+privSize+65, allHash160.getPtr()  + 20*i,       20);
+   }
+   return packed;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+SecureBinaryData CryptoECDSA::ComputeChainedPublicKeyBatch(
+                                SecureBinaryData const & binPubKey,
+                                SecureBinaryData const & chainCode,
+                                uint32_t numAddr)
+{
+   if(binPubKey.getSize() != 65 || chainCode.getSize() != 32)
+   {
+      cerr << "***ERROR:  Invalid public key or chaincode" << endl;
+      return SecureBinaryData(0);
+   }
+
+#ifdef USE_NATIVE_SECP256K1
+   // Every link is a multiple of the root:  Q_i = (c_0 * ... * c_i) * Q.
+   // For a long batch, precompute multiples of Q once, and then each link
+   // is a cheap fixed-base multiply by the running product of multipliers
+   Secp256k1FixedPoint rootMultiples;
+   bool useTable = (numAddr >= 16 && 
+                    rootMultiples.setPublicKey(binPubKey.getPtr()));
+   SecureBinaryData rootMult(32);
+   rootMult.fill(0x00);
+   rootMult.getPtr()[31] = 0x01;
+#endif
+
+   SecureBinaryData allPubKeys(65*numAddr);
+   for(uint32_t i=0; i<numAddr; i++)
+   {
+      uint8_t const * prevPub = (i==0 ? binPubKey.getPtr() : 
+                                        allPubKeys.getPtr() + 65*(i-1));
+      uint8_t * newPub = allPubKeys.getPtr() + 65*i;
+#ifdef USE_NATIVE_SECP256K1
+      BinaryData chainXor = getChainMultiplier(prevPub, 65, chainCode);
+      bool success;
+      if(useTable)
+         success = Secp256k1::multiplyPrivateKey(rootMult.getPtr(), 
+                                                 chainXor.getPtr(),
+                                                 rootMult.getPtr()) &&
+                   rootMultiples.multiply(rootMult.getPtr(), newPub);
+      else
+         success = Secp256k1::multiplyPublicKey(prevPub, chainXor.getPtr(), 
+                                                newPub);
+      if(!success)
+         return SecureBinaryData(0);
+#else
+      SecureBinaryData nextPub = ComputeChainedPublicKey(
+                                    SecureBinaryData(prevPub, 65), chainCode);
+      if(nextPub.getSize() != 65)
+         return SecureBinaryData(0);
+      memcpy(newPub, nextPub.getPtr(), 65);
+#endif
+   }
+
+   return packChainedKeys(SecureBinaryData(0), allPubKeys, numAddr);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+SecureBinaryData CryptoECDSA::ComputeChainedPrivateKeyBatch(
+                                SecureBinaryData const & binPrivKey,
+                                SecureBinaryData const & chainCode,
+                                uint32_t numAddr,
+                                SecureBinaryData binPubKey)
+{
+   if( binPubKey.getSize()==0 )
+      binPubKey = ComputePublicKey(binPrivKey);
+
+   if(binPrivKey.getSize() != 32 || binPubKey.getSize() != 65 || 
+      chainCode.getSize() != 32)
+   {
+      cerr << "***ERROR:  Invalid private key, public key or chaincode" << endl;
+      return SecureBinaryData(0);
+   }
+
+   SecureBinaryData allPrivKeys(32*numAddr);
+   SecureBinaryData allPubKeys(65*numAddr);
+   for(uint32_t i=0; i<numAddr; i++)
+   {
+      uint8_t const * prevPriv = (i==0 ? binPrivKey.getPtr() : 
+                                         allPrivKeys.getPtr() + 32*(i-1));
+      uint8_t const * prevPub  = (i==0 ? binPubKey.getPtr() : 
+                                         allPubKeys.getPtr() + 65*(i-1));
+      uint8_t * newPriv = allPrivKeys.getPtr() + 32*i;
+      uint8_t * newPub  = allPubKeys.getPtr()  + 65*i;
+#ifdef USE_NATIVE_SECP256K1
+      BinaryData chainXor = getChainMultiplier(prevPub, 65, chainCode);
+      if(!Secp256k1::multiplyPrivateKey(prevPriv, chainXor.getPtr(), newPriv) ||
+         !Secp256k1::computePublicKey(newPriv, newPub))
+         return SecureBinaryData(0);
+#else
+      SecureBinaryData nextPriv = ComputeChainedPrivateKey(
+                                    SecureBinaryData(prevPriv, 32), chainCode,
+                                    SecureBinaryData(prevPub,  65));
+      SecureBinaryData nextPub  = ComputePublicKey(nextPriv);
+      if(nextPriv.getSize() != 32 || nextPub.getSize() != 65)
+         return SecureBinaryData(0);
+      memcpy(newPriv, nextPriv.getPtr(), 32);
+      memcpy(newPub,  nextPub.getPtr(),  65);
+#endif
+   }
+
+   return packChainedKeys(allPrivKeys, allPubKeys, numAddr);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// Batched signature verification
+//
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+// What we keep per public key:  with the native code it's the key with its 
+// wNAF table, otherwise a Crypto++ key that has already been through 
+// Validate(), so the verifiers don't need to do it again
+#ifdef USE_NATIVE_SECP256K1
+   typedef Secp256k1PublicKey VERIFY_PUBKEY;
+#else
+   typedef BTC_PUBKEY         VERIFY_PUBKEY;
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Keys are only added to or read from the cache under the lock, and batches
+// work from their own copies, so one batch can't evict a key out from under 
+// another.  When it fills up, we just start over.
+static map<BinaryData, VERIFY_PUBKEY> verifyPubKeyCache_;
+static pthread_mutex_t                verifyPubKeyCacheLock_ = 
+                                                   PTHREAD_MUTEX_INITIALIZER;
+
+/////////////////////////////////////////////////////////////////////////////
+static bool parseVerifyPubKey(BinaryData const & pubKey, VERIFY_PUBKEY & key)
+{
+   if(pubKey.getSize() != 65)
+      return false;
+
+#ifdef USE_NATIVE_SECP256K1
+   return key.setPublicKey(pubKey.getPtr());
+#else
+   static CryptoPP::AutoSeededRandomPool prng;
+   key = CryptoECDSA::ParsePublicKey(SecureBinaryData(pubKey));
+   return key.Validate(prng, 3);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Shared by the VerifyBatch threads.  Only nextIdx_ changes while they run,
+// under the lock, and each result slot is written by exactly one thread
+struct SigVerifyJob
+{
+   vector<BinaryData> const *    messages_;
+   vector<BinaryData> const *    signatures_;
+   vector<VERIFY_PUBKEY> const * keys_;
+   vector<int32_t> const *       keyIdx_;   // -1 if the key didn't parse
+   vector<int> *                 results_;
+   uint32_t                      nextIdx_;
+   pthread_mutex_t               lock_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+static void* sigVerifyThread(void* jobPtr)
+{
+   SigVerifyJob & job = *(SigVerifyJob*)jobPtr;
+   uint32_t numSigs = job.results_->size();
+
+   // BtcUtils::getHash256 shares one static hasher, so each thread has its own
+   CryptoPP::SHA256 sha256;
+   uint8_t hashVal[32];
+   while(true)
+   {
+      pthread_mutex_lock(&job.lock_);
+      uint32_t chunkStart = job.nextIdx_;
+      job.nextIdx_ = min(numSigs, chunkStart + SIG_VERIFY_PER_CHUNK);
+      uint32_t chunkEnd = job.nextIdx_;
+      pthread_mutex_unlock(&job.lock_);
+
+      if(chunkStart >= chunkEnd)
+         break;
+
+      for(uint32_t i=chunkStart; i<chunkEnd; i++)
+      {
+         int32_t k = (*job.keyIdx_)[i];
+         BinaryData const & msg = (*job.messages_)[i];
+         BinaryData const & sig = (*job.signatures_)[i];
+         if(k < 0)
+         {
+            (*job.results_)[i] = 0;
+            continue;
+         }
+
+#ifdef USE_NATIVE_SECP256K1
+         if(sig.getSize() != 64)
+         {
+            (*job.results_)[i] = 0;
+            continue;
+         }
+         sha256.CalculateDigest(hashVal, msg.getPtr(), msg.getSize());
+         sha256.CalculateDigest(hashVal, hashVal, 32);
+         (*job.results_)[i] = (*job.keys_)[k].verifyHash(hashVal, sig.getPtr());
+#else
+         // First SHA256 here, the verifier does the second one
+         sha256.CalculateDigest(hashVal, msg.getPtr(), msg.getSize());
+         BTC_VERIFIER verifier((*job.keys_)[k]);
+         (*job.results_)[i] = verifier.VerifyMessage(hashVal, 32,
+                                                     sig.getPtr(), 
+                                                     sig.getSize());
+#endif
+      }
+   }
+   return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+vector<int> CryptoECDSA::VerifyBatch(vector<BinaryData> const & messages,
+                                     vector<BinaryData> const & signatures,
+                                     vector<BinaryData> const & pubKeys,
+                                     uint32_t numThreads)
+{
+   uint32_t numSigs = messages.size();
+   if(signatures.size() != numSigs || pubKeys.size() != numSigs)
+   {
+      cerr << "***ERROR:  VerifyBatch needs one sig and pubkey per message" << endl;
+      return vector<int>(numSigs, 0);
+   }
+
+   // Look up or parse each distinct key once, before any threads start
+   vector<VERIFY_PUBKEY> keys;
+   vector<int32_t>       keyIdx(numSigs, -1);
+   map<BinaryData, int32_t> batchKeys;
+   map<BinaryData, int32_t>::iterator batchIter;
+   pthread_mutex_lock(&verifyPubKeyCacheLock_);
+   for(uint32_t i=0; i<numSigs; i++)
+   {
+      batchIter = batchKeys.find(pubKeys[i]);
+      if(batchIter != batchKeys.end())
+      {
+         keyIdx[i] = batchIter->second;
+         continue;
+      }
+
+      int32_t k = -1;
+      map<BinaryData, VERIFY_PUBKEY>::iterator cacheIter;
+      cacheIter = verifyPubKeyCache_.find(pubKeys[i]);
+      if(cacheIter != verifyPubKeyCache_.end())
+      {
+         k = keys.size();
+         keys.push_back(cacheIter->second);
+      }
+      else
+      {
+         VERIFY_PUBKEY key;
+         if(parseVerifyPubKey(pubKeys[i], key))
+         {
+            k = keys.size();
+            keys.push_back(key);
+            if(verifyPubKeyCache_.size() >= SIG_VERIFY_PUBKEY_CACHE_SIZE)
+               verifyPubKeyCache_.clear();
+            verifyPubKeyCache_[pubKeys[i]] = key;
+         }
+      }
+      batchKeys[pubKeys[i]] = k;
+      keyIdx[i] = k;
+   }
+   pthread_mutex_unlock(&verifyPubKeyCacheLock_);
+
+   if(numThreads == 0)
+   {
+#ifdef _SC_NPROCESSORS_ONLN
+      long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+      numThreads = (numCores > 0 ? (uint32_t)numCores : 1);
+#else
+      numThreads = 1;
+#endif
+   }
+
+   vector<int> results(numSigs, 0);
+   SigVerifyJob job;
+   job.messages_   = &messages;
+   job.signatures_ = &signatures;
+   job.keys_       = &keys;
+   job.keyIdx_     = &keyIdx;
+   job.results_    = &results;
+   job.nextIdx_    = 0;
+   pthread_mutex_init(&job.lock_, NULL);
+
+   uint32_t maxThreads = numSigs/SIG_VERIFY_PER_CHUNK + 1;
+   numThreads = min(numThreads, maxThreads);
+   vector<pthread_t> threads(numThreads-1);
+   uint32_t numStarted = 0;
+   for(uint32_t t=0; t<threads.size(); t++, numStarted++)
+      if(pthread_create(&threads[t], NULL, sigVerifyThread, &job) != 0)
+         break;
+
+   // This thread does its share too, and all of it if none could be started
+   sigVerifyThread(&job);
+   for(uint32_t t=0; t<numStarted; t++)
+      pthread_join(threads[t], NULL);
+   pthread_mutex_destroy(&job.lock_);
+
+   return results;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// Batched signing
+//
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+static uint8_t const SECP256K1_ORDER_BYTES[32] = 
+   { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 
+     0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xfe,
+     0xba, 0xae, 0xdc, 0xe6, 0xaf, 0x48, 0xa0, 0x3b, 
+     0xbf, 0xd2, 0x5e, 0x8c, 0xd0, 0x36, 0x41, 0x41 };
+
+/////////////////////////////////////////////////////////////////////////////
+// x mod n, for 32-byte big-endian x.  2^256 < 2n, so one subtraction does it
+static void reduceModOrder(uint8_t * x32)
+{
+   if(memcmp(x32, SECP256K1_ORDER_BYTES, 32) < 0)
+      return;
+
+   int borrow = 0;
+   for(int i=31; i>=0; i--)
+   {
+      int diff = (int)x32[i] - (int)SECP256K1_ORDER_BYTES[i] - borrow;
+      borrow = (diff < 0 ? 1 : 0);
+      x32[i] = (uint8_t)(diff + 256*borrow);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Deterministic nonces, RFC 6979 section 3.2 with HMAC-SHA256.  The nonce
+// is a function of the private key and the hash being signed, so a batch
+// doesn't pull 32 bytes from the PRNG per signature, and a bad PRNG can't 
+// leak the key through a repeated nonce.  K, V and the HMAC scratch space
+// are in a SecureBinaryData, so they're zeroed when this goes away.
+class Rfc6979Nonce
+{
+public:
+   Rfc6979Nonce(void) : work_(RFC6979_WORK_SIZE), numOut_(0) {}
+
+   void init(uint8_t const * privKey32, uint8_t const * hash32)
+   {
+      uint8_t * K   = work_.getPtr();
+      uint8_t * V   = K + 32;
+      uint8_t * msg = V + 32;    // V || 0x00/0x01 || privKey || hash mod n
+
+      memset(K, 0x00, 32);
+      memset(V, 0x01, 32);
+      memcpy(msg+33, privKey32, 32);
+      memcpy(msg+65, hash32,    32);
+      reduceModOrder(msg+65);
+
+      for(uint8_t sep=0; sep<2; sep++)
+      {
+         memcpy(msg, V, 32);
+         msg[32] = sep;
+         hmac(msg, 97, K);
+         hmac(V,   32, V);
+      }
+      numOut_ = 0;
+   }
+
+   // Each call gives the next candidate.  The caller checks it's in [1,n-1]
+   // and that it makes a valid signature, and asks again if not
+   void next(uint8_t * nonceOut32)
+   {
+      uint8_t * K   = work_.getPtr();
+      uint8_t * V   = K + 32;
+      uint8_t * msg = V + 32;
+      if(numOut_ > 0)
+      {
+         memcpy(msg, V, 32);
+         msg[32] = 0x00;
+         hmac(msg, 33, K);
+         hmac(V,   32, V);
+      }
+      hmac(V, 32, V);
+      memcpy(nonceOut32, V, 32);
+      numOut_++;
+   }
+
+private:
+   // HMAC-SHA256 keyed with K.  out32 may be the same as msg
+   void hmac(uint8_t const * msg, size_t msgLen, uint8_t * out32)
+   {
+      uint8_t const * K = work_.getPtr();
+      uint8_t * inner = work_.getPtr() + 64 + 97;   // pad || msg
+      uint8_t * outer = inner + 64 + 97;            // pad || inner hash
+
+      for(uint32_t i=0; i<64; i++)
+      {
+         uint8_t keyByte = (i<32 ? K[i] : 0x00);
+         inner[i] = keyByte ^ 0x36;
+         outer[i] = keyByte ^ 0x5c;
+      }
+      memcpy(inner+64, msg, msgLen);
+      sha256_.CalculateDigest(outer+64, inner, 64+msgLen);
+      sha256_.CalculateDigest(out32, outer, 64+32);
+   }
+
+   // K(32) V(32) msg(97) inner(64+97) outer(64+32)
+   enum { RFC6979_WORK_SIZE = 32 + 32 + 97 + 161 + 96 };
+
+   CryptoPP::SHA256 sha256_;
+   SecureBinaryData work_;
+   uint32_t         numOut_;
+};
+
+
+#ifndef USE_NATIVE_SECP256K1
+   // Crypto++ only precomputes powers of the base point if asked.  Each 
+   // signing thread uses its own copy, since ECP keeps scratch space 
+   // in the curve object
+   typedef CryptoPP::DL_GroupParameters_EC<CryptoPP::ECP> SIGN_GROUP_PARAMS;
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Shared by the SignBatch threads.  Only nextIdx_ changes while they run,
+// under the lock, and each signature slot is written by exactly one thread
+struct SigSignJob
+{
+   vector<BinaryData> const * messages_;
+   vector<int> const *        keyIdx_;
+   SecureBinaryData const *   privKeys_;
+   SecureBinaryData *         sigs_;
+#ifndef USE_NATIVE_SECP256K1
+   SIGN_GROUP_PARAMS const *  params_;
+#endif
+   uint32_t                   nextIdx_;
+   pthread_mutex_t            lock_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+static void* sigSignThread(void* jobPtr)
+{
+   SigSignJob & job = *(SigSignJob*)jobPtr;
+   uint32_t numSigs = job.messages_->size();
+
+   CryptoPP::SHA256 sha256;
+   Rfc6979Nonce rfc6979;
+   SecureBinaryData nonces(32*SIG_SIGN_PER_CHUNK);
+   uint8_t hashes[32*SIG_SIGN_PER_CHUNK];
+
+#ifdef USE_NATIVE_SECP256K1
+   uint8_t const * keys[SIG_SIGN_PER_CHUNK];
+   bool            sigOK[SIG_SIGN_PER_CHUNK];
+#else
+   SIGN_GROUP_PARAMS params(*job.params_);
+   CryptoPP::Integer const & n = params.GetSubgroupOrder();
+#endif
+
+   while(true)
+   {
+      pthread_mutex_lock(&job.lock_);
+      uint32_t chunkStart = job.nextIdx_;
+      job.nextIdx_ = min(numSigs, chunkStart + SIG_SIGN_PER_CHUNK);
+      uint32_t chunkEnd = job.nextIdx_;
+      pthread_mutex_unlock(&job.lock_);
+
+      if(chunkStart >= chunkEnd)
+         break;
+
+      uint32_t nChunk = chunkEnd - chunkStart;
+      uint8_t * sigsOut = job.sigs_->getPtr() + 64*chunkStart;
+      for(uint32_t j=0; j<nChunk; j++)
+      {
+         // Same double-SHA256 that SignData signs
+         BinaryData const & msg = (*job.messages_)[chunkStart+j];
+         uint8_t * hashVal = hashes + 32*j;
+         sha256.CalculateDigest(hashVal, msg.getPtr(), msg.getSize());
+         sha256.CalculateDigest(hashVal, hashVal, 32);
+
+         uint8_t const * privKey = job.privKeys_->getPtr() + 
+                                   32*(*job.keyIdx_)[chunkStart+j];
+         rfc6979.init(privKey, hashVal);
+         rfc6979.next(nonces.getPtr() + 32*j);
+
+#ifdef USE_NATIVE_SECP256K1
+         keys[j] = privKey;
+      }
+
+      // k*G comes out of the precomputed comb table, and the whole chunk 
+      // shares one field inversion and one scalar inversion
+      Secp256k1::signHashBatch(hashes, keys, nonces.getPtr(), 
+                               sigsOut, sigOK, nChunk);
+
+      // Practically never:  the first nonce was out of range or made r or
+      // s zero, so go through the RFC 6979 candidates after it
+      for(uint32_t j=0; j<nChunk; j++)
+      {
+         if(sigOK[j])
+            continue;
+         rfc6979.init(keys[j], hashes + 32*j);
+         rfc6979.next(nonces.getPtr());
+         do
+         {
+            rfc6979.next(nonces.getPtr());
+         } while( !Secp256k1::signHash(hashes + 32*j, keys[j],
+                                       nonces.getPtr(), sigsOut + 64*j) );
+      }
+#else
+         CryptoPP::Integer e(hashVal, 32, UNSIGNED);
+         CryptoPP::Integer d(privKey, 32, UNSIGNED);
+         CryptoPP::Integer r, s;
+         uint8_t * nonce = nonces.getPtr() + 32*j;
+         while(true)
+         {
+            CryptoPP::Integer k(nonce, 32, UNSIGNED);
+            if(!k.IsZero() && k < n)
+            {
+               // k*G from the precomputed powers of the base point
+               r = params.ConvertElementToInteger(params.ExponentiateBase(k)) % n;
+               s = a_times_b_mod_c(k.InverseMod(n), e + a_times_b_mod_c(d,r,n), n);
+               if(!r.IsZero() && !s.IsZero())
+                  break;
+            }
+            rfc6979.next(nonce);
+         }
+         r.Encode(sigsOut + 64*j,      32, UNSIGNED);
+         s.Encode(sigsOut + 64*j + 32, 32, UNSIGNED);
+      }
+#endif
+   }
+   return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+SecureBinaryData CryptoECDSA::SignBatch(vector<BinaryData> const & messages,
+                                        vector<int> const & keyIndices,
+                                        SecureBinaryData const & privKeys,
+                                        uint32_t numThreads)
+{
+   uint32_t numSigs = messages.size();
+   uint32_t numKeys = privKeys.getSize() / 32;
+   if(keyIndices.size() != numSigs || privKeys.getSize() != 32*numKeys)
+   {
+      cerr << "***ERROR:  SignBatch needs one key index per message, "
+           << "and 32-byte keys" << endl;
+      return SecureBinaryData(0);
+   }
+
+   for(uint32_t i=0; i<numSigs; i++)
+   {
+      if(keyIndices[i] < 0 || (uint32_t)keyIndices[i] >= numKeys)
+      {
+         cerr << "***ERROR:  SignBatch key index out of range" << endl;
+         return SecureBinaryData(0);
+      }
+   }
+
+   // Check each key once here, rather than once per signature
+#ifndef USE_NATIVE_SECP256K1
+   SIGN_GROUP_PARAMS params(CryptoPP::ASN1::secp256k1());
+   CryptoPP::Integer const & n = params.GetSubgroupOrder();
+#endif
+   for(uint32_t k=0; k<numKeys; k++)
+   {
+      uint8_t const * privKey = privKeys.getPtr() + 32*k;
+#ifdef USE_NATIVE_SECP256K1
+      bool isValid = Secp256k1::isValidPrivateKey(privKey);
+#else
+      CryptoPP::Integer d(privKey, 32, UNSIGNED);
+      bool isValid = (!d.IsZero() && d < n);
+#endif
+      if(!isValid)
+      {
+         cerr << "***ERROR:  Invalid private key" << endl;
+         return SecureBinaryData(0);
+      }
+   }
+
+   if(numSigs == 0)
+      return SecureBinaryData(0);
+
+#ifndef USE_NATIVE_SECP256K1
+   params.Precompute();
+#endif
+
+   if(numThreads == 0)
+   {
+#ifdef _SC_NPROCESSORS_ONLN
+      long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+      numThreads = (numCores > 0 ? (uint32_t)numCores : 1);
+#else
+      numThreads = 1;
+#endif
+   }
+
+   SecureBinaryData sigs(64*numSigs);
+   SigSignJob job;
+   job.messages_ = &messages;
+   job.keyIdx_   = &keyIndices;
+   job.privKeys_ = &privKeys;
+   job.sigs_     = &sigs;
+#ifndef USE_NATIVE_SECP256K1
+   job.params_   = &params;
+#endif
+   job.nextIdx_  = 0;
+   pthread_mutex_init(&job.lock_, NULL);
+
+   uint32_t maxThreads = numSigs/SIG_SIGN_PER_CHUNK + 1;
+   numThreads = min(numThreads, maxThreads);
+   vector<pthread_t> threads(numThreads-1);
+   uint32_t numStarted = 0;
+   for(uint32_t t=0; t<threads.size(); t++, numStarted++)
+      if(pthread_create(&threads[t], NULL, sigSignThread, &job) != 0)
+         break;
+
+   // This thread does its share too, and all of it if none could be started
+   sigSignThread(&job);
+   for(uint32_t t=0; t<numStarted; t++)
+      pthread_join(threads[t], NULL);
+   pthread_mutex_destroy(&job.lock_);
+
+   return sigs;
+}
+
 
 
 
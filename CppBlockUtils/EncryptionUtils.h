@@ -41,7 +41,8 @@
 //
 // The computeKdfParams method well test the speed of the system it is running
 // on, and try to pick the largest memory-size the system can compute in less
-// than 0.25s (or specified target).  
+// than 0.25s (or specified target).  The timing is done by KdfCalibration,
+// which can be saved to a file so it only has to be done once per machine.
 //
 //
 // NOTE:  If you are getting an error about invalid argument types, from python,
@@ -104,6 +105,36 @@
 // to computer on a CPU than a GPU.
 #define DEFAULT_KDF_MAX_MEMORY 32*1024*1024
 
+// Sizes of the records packed end-to-end by the Compute*Batch methods:
+//    public:   [pubKey65 | hash160]
+//    private:  [privKey32 | pubKey65 | hash160]
+#define CHAINED_PUBKEY_RECORD_SIZE   85
+#define CHAINED_PRIVKEY_RECORD_SIZE  117
+
+// How many parsed public keys CryptoECDSA::VerifyBatch holds onto between
+// calls, and how many signatures its threads take at a time
+#define SIG_VERIFY_PUBKEY_CACHE_SIZE 8192
+#define SIG_VERIFY_PER_CHUNK         32
+
+// How many signatures the CryptoECDSA::SignBatch threads take at a time
+#define SIG_SIGN_PER_CHUNK           16
+
+// KdfCalibration takes this many timed samples of each memory size and uses
+// the median.  Each sample runs enough iterations to take at least
+// MIN_SAMPLE_SEC, and sizes stop going up once one iteration takes
+// MAX_ITER_SEC.  A saved profile is re-timed at one size when it's loaded,
+// and thrown out if that is off from the prediction by more than MAX_DRIFT
+#define KDF_CALIBRATION_SAMPLES         5
+#define KDF_CALIBRATION_MIN_SAMPLE_SEC  0.001
+#define KDF_CALIBRATION_MAX_ITER_SEC    0.015
+#define KDF_CALIBRATION_MAX_DRIFT       1.5
+#define KDF_PROFILE_VERSION             1
+
+// Records for CryptoAES::ReencryptBatch:  [encrPrivKey32 | iv16].  Its 
+// threads take this many records at a time
+#define AES_REKEY_RECORD_SIZE  48
+#define AES_REKEY_PER_CHUNK    1024
+
 using namespace std;
 
 
@@ -132,21 +163,23 @@ using namespace std;
 class SecureBinaryData : public BinaryData
 {
 public:
-   // We want regular BinaryData, but page-locked and secure destruction
+   // We want regular BinaryData, but page-locked and secure destruction.
+   // Anything that allocates does it in a SecureAllocScope, so the buffer
+   // comes from the (already locked) SecureArena when it fits
    SecureBinaryData(void) : BinaryData() 
                    { lockData(); }
-   SecureBinaryData(uint32_t sz) : BinaryData(sz) 
-                   { lockData(); }
-   SecureBinaryData(BinaryData const & data) : BinaryData(data) 
-                   { lockData(); }
-   SecureBinaryData(uint8_t const * inData, size_t sz) : BinaryData(inData, sz)
-                   { lockData(); }
-   SecureBinaryData(uint8_t const * d0, uint8_t const * d1) : BinaryData(d0, d1)
-                   { lockData(); }
-   SecureBinaryData(string const & str) : BinaryData(str)
-                   { lockData(); }
-   SecureBinaryData(BinaryDataRef const & bdRef) : BinaryData(bdRef)
-                   { lockData(); }
+   SecureBinaryData(uint32_t sz) : BinaryData() 
+                   { SecureAllocScope sas; resize(sz); }
+   SecureBinaryData(BinaryData const & data) : BinaryData() 
+                   { SecureAllocScope sas; copyFrom(data); lockData(); }
+   SecureBinaryData(uint8_t const * inData, size_t sz) : BinaryData()
+                   { SecureAllocScope sas; copyFrom(inData, sz); lockData(); }
+   SecureBinaryData(uint8_t const * d0, uint8_t const * d1) : BinaryData()
+                   { SecureAllocScope sas; copyFrom(d0, d1); lockData(); }
+   SecureBinaryData(string const & str) : BinaryData()
+                   { SecureAllocScope sas; copyFrom(str); lockData(); }
+   SecureBinaryData(BinaryDataRef const & bdRef) : BinaryData()
+                   { SecureAllocScope sas; copyFrom(bdRef); lockData(); }
 
    ~SecureBinaryData(void) { destroy(); }
 
@@ -156,16 +189,24 @@ public:
    uint8_t       *   getPtr(void)        { return BinaryData::getPtr();  }
    size_t            getSize(void) const { return BinaryData::getSize(); }
    SecureBinaryData  copy(void)    const { return SecureBinaryData(getPtr(), getSize());}
+   SecureBinaryData  getSliceCopy(int32_t start, uint32_t nBytes) const
+                        { return SecureBinaryData(getSliceRef(start, nBytes)); }
    
    string toHexStr(bool BE=false) const { return BinaryData::toHexStr(BE);}
    string toBinStr(void) const          { return BinaryData::toBinStr();  }
 
-   SecureBinaryData(SecureBinaryData const & sbd2) : 
-           BinaryData(sbd2.getPtr(), sbd2.getSize()) { lockData(); }
+   SecureBinaryData(SecureBinaryData const & sbd2) : BinaryData()
+   {
+      SecureAllocScope sas; 
+      copyFrom(sbd2.getPtr(), sbd2.getSize()); 
+      lockData(); 
+   }
 
 
-   void resize(size_t sz)  { BinaryData::resize(sz);  lockData(); }
-   void reserve(size_t sz) { BinaryData::reserve(sz); lockData(); }
+   void resize(size_t sz)  
+               { SecureAllocScope sas; BinaryData::resize(sz);  lockData(); }
+   void reserve(size_t sz) 
+               { SecureAllocScope sas; BinaryData::reserve(sz); lockData(); }
 
 
    BinaryData    getRawCopy(void) const { return BinaryData(getPtr(), getSize()); }
@@ -187,9 +228,12 @@ public:
    // SecureBinaryData().GenerateRandom(32), etc
    SecureBinaryData GenerateRandom(uint32_t numBytes);
 
+   // Arena memory is locked already, and other secure buffers may share 
+   // its pages, so only heap buffers (too big for the arena) are locked 
+   // and unlocked here
    void lockData(void)
    {
-      if(getSize() > 0)
+      if(getSize() > 0 && !SecureArena::contains(getPtr()))
          mlock(getPtr(), getSize());
    }
 
@@ -198,7 +242,8 @@ public:
       if(getSize() > 0)
       {
          fill(0x00);
-         munlock(getPtr(), getSize());
+         if(!SecureArena::contains(getPtr()))
+            munlock(getPtr(), getSize());
       }
       resize(0);
    }
@@ -208,6 +253,8 @@ public:
 
 
 
+class KdfCalibration;
+
 ////////////////////////////////////////////////////////////////////////////////
 // A memory-bound key-derivation function -- uses a variation of Colin 
 // Percival's ROMix algorithm: http://www.tarsnap.com/scrypt/scrypt.pdf
@@ -231,6 +278,15 @@ public:
    void computeKdfParams(double   targetComputeSec=0.25, 
                          uint32_t maxMemReqtsBytes=DEFAULT_KDF_MAX_MEMORY);
 
+   /////////////////////////////////////////////////////////////////////////////
+   // Same thing, but the memory and iterations come from the cost model of
+   // an existing calibration.  Returns right away unless the memory picked
+   // is more than the calibration timed:  then it runs that size once to 
+   // get the iteration count, instead of extrapolating
+   void computeKdfParams(KdfCalibration const & calib,
+                         double   targetComputeSec=0.25, 
+                         uint32_t maxMemReqtsBytes=DEFAULT_KDF_MAX_MEMORY);
+
    /////////////////////////////////////////////////////////////////////////////
    void usePrecomputedKdfParams(uint32_t memReqts, 
                                 uint32_t numIter, 
@@ -240,10 +296,13 @@ public:
    void printKdfParams(void);
 
    /////////////////////////////////////////////////////////////////////////////
-   SecureBinaryData DeriveKey_OneIter(SecureBinaryData const & password);
+   SecureBinaryData DeriveKey_OneIter(SecureBinaryData const & password) const;
 
    /////////////////////////////////////////////////////////////////////////////
-   SecureBinaryData DeriveKey(SecureBinaryData const & password);
+   // All the iterations share one locked work buffer, and nothing in the
+   // object is modified, so several threads can derive keys at once (with 
+   // the same object or different ones)
+   SecureBinaryData DeriveKey(SecureBinaryData const & password) const;
 
    /////////////////////////////////////////////////////////////////////////////
    string       getHashFunctionName(void) const { return hashFunctionName_; }
@@ -252,6 +311,20 @@ public:
    SecureBinaryData   getSalt(void) const       { return salt_; }
    
 private:
+   friend class KdfCalibration;
+
+   /////////////////////////////////////////////////////////////////////////////
+   // The work buffer is [lookupTable | X | Y | input | salt], where the input 
+   // is the password on the first iteration and the previous key after that.
+   // One iteration reads the input from its slot and leaves the key in X.
+   uint32_t getWorkspaceSize(uint32_t maxInputSize) const
+               { return memoryReqtBytes_ + 2*hashOutputBytes_ + 
+                        maxInputSize + salt_.getSize(); }
+   uint8_t * getWorkspaceInput(uint8_t * workspace) const
+               { return workspace + memoryReqtBytes_ + 2*hashOutputBytes_; }
+   void      romixOneIter(uint8_t * workspace,
+                          uint32_t  inputSize,
+                          CryptoPP::SHA512 & sha512) const;
 
    string   hashFunctionName_;  // name of hash function to use (only one)
    uint32_t hashOutputBytes_;
@@ -259,7 +332,6 @@ private:
 
    uint32_t memoryReqtBytes_;
    uint32_t sequenceCount_;
-   SecureBinaryData lookupTable_;
    SecureBinaryData salt_;            // prob not necessary amidst numIter, memReqts
                                 // but I guess it can't hurt
 
@@ -269,6 +341,98 @@ private:
 };
 
 
+////////////////////////////////////////////////////////////////////////////////
+// How long one KdfRomix iteration takes on this machine, as a function of
+// the memory requirement:
+//
+//    iterSec = fixedSecPerIter + secPerByte * memReqtBytes
+//
+// The samples are timed with a monotonic clock (wall time, not the CPU time 
+// UniversalTimer reads), and fit with least-squares on relative error, since
+// they span several orders of magnitude.  Sizes above the largest one timed
+// are extrapolated, and come out fast once the lookup table no longer fits
+// in cache, which is why KdfRomix::computeKdfParams times those itself.
+//
+// Keep one of these around (loadOrCalibrate) and KdfRomix::computeKdfParams
+// doesn't have to time anything when a new wallet is created.
+class KdfCalibration
+{
+public:
+   KdfCalibration(void);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Times sizes from 1 kB up, about a quarter second in all
+   void   calibrate(uint32_t maxMemReqtsBytes=DEFAULT_KDF_MAX_MEMORY);
+
+   // Re-time one mid-size sample:  false if the machine is now slower or
+   // faster than the profile by more than KDF_CALIBRATION_MAX_DRIFT
+   bool   spotCheck(void) const;
+
+   double predictIterSec(uint32_t memReqtBytes) const;
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Profile files are versioned and checksummed, and written to a temp 
+   // file first.  loadOrCalibrate reads the file if it exists and passes 
+   // the spot check, otherwise it calibrates and (re)writes it.  Returns 
+   // true if the profile came from the file.
+   BinaryData serialize(void) const;
+   bool       unserialize(BinaryData const & profile);
+   bool       writeToFile(string filename) const;
+   bool       readFromFile(string filename);
+   bool       loadOrCalibrate(string filename,
+                              uint32_t maxMemReqtsBytes=DEFAULT_KDF_MAX_MEMORY);
+
+   /////////////////////////////////////////////////////////////////////////////
+   bool     isValid(void) const              { return isValid_;         }
+   double   getFixedSecPerIter(void) const   { return fixedSecPerIter_; }
+   double   getSecPerByte(void) const        { return secPerByte_;      }
+   uint32_t getMaxMemTested(void) const      { return maxMemTested_;    }
+   uint32_t getNumSizesTested(void) const    { return numSizesTested_;  }
+   double   getMaxFitError(void) const       { return maxFitError_;     }
+   void     printProfile(void) const;
+
+private:
+   friend class KdfRomix;
+
+   // Median seconds per iteration over numSamples timed samples
+   static double sampleIterSec(uint32_t memReqtBytes, uint32_t numSamples);
+
+   bool     isValid_;
+   double   fixedSecPerIter_;
+   double   secPerByte_;
+   uint32_t maxMemTested_;
+   uint32_t numSizesTested_;
+   double   maxFitError_;      // worst relative residual of the fit
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Derive several keys at once, each with its own KDF parameters (like 
+// unlocking a few wallets), one derivation per thread.  Every thread holds
+// the lookup table of the KDF it's running, so numThreads also limits how 
+// much memory this takes.
+class KdfRomixBatch
+{
+public:
+   KdfRomixBatch(void) {}
+
+   // Returns the index to get the key with
+   uint32_t addKdf(KdfRomix const & kdf, SecureBinaryData const & password);
+
+   // numThreads=0 means one per core
+   void     deriveAll(uint32_t numThreads=0);
+
+   uint32_t         getNumKdf(void) const     { return kdfs_.size(); }
+   SecureBinaryData getKey(uint32_t i) const  { return keys_[i];     }
+   void             clear(void);
+
+private:
+   vector<KdfRomix>          kdfs_;
+   vector<SecureBinaryData>  passwords_;
+   vector<SecureBinaryData>  keys_;
+};
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // Leverage CryptoPP library for AES encryption/decryption
 class CryptoAES
@@ -285,6 +449,21 @@ public:
    SecureBinaryData Decrypt(SecureBinaryData & data, 
                             SecureBinaryData & key,
                             SecureBinaryData   iv);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // For changing the passphrase of a whole wallet in one call.  keyData is
+   // AES_REKEY_RECORD_SIZE records packed end-to-end, and each private key
+   // is decrypted with oldKey and encrypted with newKey right where it is,
+   // with the same IV.  The key schedules are set up once per thread, not
+   // once per key.  numThreads=0 means one per core.
+   //
+   // A wrong oldKey can't be detected here (it just makes garbage), so check
+   // it before calling this.  Returns false, with keyData untouched, if a 
+   // key isn't a valid AES key size or keyData isn't whole records.
+   bool ReencryptBatch(SecureBinaryData & keyData,
+                       SecureBinaryData & oldKey,
+                       SecureBinaryData & newKey,
+                       uint32_t numThreads=0);
 };
 
 
@@ -297,6 +476,10 @@ public:
 //
 // These methods might as well just be static methods, but SWIG doesn't like
 // static methods.  So we will invoke these via CryptoECDSA().Function()
+//
+// If built with USE_NATIVE_SECP256K1, the SecureBinaryData methods use the
+// curve-specific code in Secp256k1.h instead of Crypto++.  The methods that
+// take BTC_PRIVKEY/BTC_PUBKEY objects always go through Crypto++.
 class CryptoECDSA
 {
 public:
@@ -357,6 +540,11 @@ public:
    /////////////////////////////////////////////////////////////////////////////
    bool VerifyPublicKeyValid(SecureBinaryData const & pubKey65);
 
+   /////////////////////////////////////////////////////////////////////////////
+   // 33-byte compressed public key (0x02/0x03 + x) to the 65-byte form the 
+   // rest of these methods use.  Empty if it isn't a point on the curve
+   SecureBinaryData UncompressPublicKey(SecureBinaryData const & pubKey33);
+
    /////////////////////////////////////////////////////////////////////////////
    bool CheckPubPrivKeyMatch(SecureBinaryData const & privKey32,
                              SecureBinaryData const & pubKey65);
@@ -388,6 +576,47 @@ public:
    // Deterministically generate new private key using a chaincode
    SecureBinaryData ComputeChainedPublicKey(SecureBinaryData const & binPubKey,
                                             SecureBinaryData const & chainCode);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // The next numAddr links of the chain after binPubKey, in one call.  Comes
+   // back as numAddr [pubKey65 | hash160] records, packed end-to-end.  Empty
+   // if anything fails.
+   SecureBinaryData ComputeChainedPublicKeyBatch(
+                                    SecureBinaryData const & binPubKey,
+                                    SecureBinaryData const & chainCode,
+                                    uint32_t numAddr);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Same, starting from a private key:  [privKey32 | pubKey65 | hash160]
+   SecureBinaryData ComputeChainedPrivateKeyBatch(
+                                    SecureBinaryData const & binPrivKey,
+                                    SecureBinaryData const & chainCode,
+                                    uint32_t numAddr,
+                                    SecureBinaryData binPubKey=SecureBinaryData());
+
+   /////////////////////////////////////////////////////////////////////////////
+   // VerifyData on every (messages[i], signatures[i], pubKeys[i]), spread
+   // over numThreads threads (0 means one per core).  Returns 1 or 0 for 
+   // each.  Each distinct public key is parsed and validated once, and the 
+   // last SIG_VERIFY_PUBKEY_CACHE_SIZE of them are remembered for later 
+   // batches, since the same keys tend to show up over and over.
+   vector<int> VerifyBatch(vector<BinaryData> const & messages,
+                           vector<BinaryData> const & signatures,
+                           vector<BinaryData> const & pubKeys,
+                           uint32_t numThreads=0);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Sign every messages[i] (UN-HASHED, like SignData) with private key 
+   // keyIndices[i] of privKeys, which is 32-byte keys packed end-to-end.  
+   // Comes back as the 64-byte r||s signatures, packed in the same order.  
+   // Each key is checked once, the nonces are deterministic (RFC 6979) 
+   // instead of coming from the PRNG, and k*G uses the precomputed table
+   // for the base point.  Spread over numThreads threads (0 means one per 
+   // core).  Empty if any index or key is bad.
+   SecureBinaryData SignBatch(vector<BinaryData> const & messages,
+                              vector<int> const & keyIndices,
+                              SecureBinaryData const & privKeys,
+                              uint32_t numThreads=0);
 };
 
 
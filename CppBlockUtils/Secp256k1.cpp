@@ -0,0 +1,1537 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011, Alan C. Reiner    <alan.reiner@gmail.com>             //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include "Secp256k1.h"
+#include "SecureArena.h"
+
+typedef unsigned __int128 uint128_t;
+
+
+#define FE_MASK52   0xFFFFFFFFFFFFFULL
+#define FE_MASK48   0x0FFFFFFFFFFFFULL
+#define FE_R        0x1000003D1ULL      // 2^256 mod p
+#define FE_R4       0x1000003D10ULL     // 2^260 mod p
+
+// Window sizes for the wNAF expansions, and table sizes that go with them
+#define WNAF_WINDOW_G   8
+#define WNAF_WINDOW_Q   5
+#define WNAF_TABLE_G    (1 << (WNAF_WINDOW_G-2))
+#define WNAF_TABLE_Q    (1 << (WNAF_WINDOW_Q-2))
+#define WNAF_MAX_LEN    257
+
+// Fixed-base table for k*G:  GEN_COMB_WINDOWS windows of 4 bits each
+#define GEN_COMB_WINDOWS 64
+
+
+////////////////////////////////////////////////////////////////////////////////
+static inline uint64_t readBE64(uint8_t const * ptr)
+{
+   uint64_t out = 0;
+   for(int i=0; i<8; i++)
+      out = (out << 8) | ptr[i];
+   return out;
+}
+
+static inline void writeBE64(uint8_t * ptr, uint64_t val)
+{
+   for(int i=7; i>=0; i--)
+   {
+      ptr[i] = (uint8_t)val;
+      val >>= 8;
+   }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// Field elements mod p = 2^256 - 2^32 - 977
+//
+// The value is n[0] + n[1]*2^52 + n[2]*2^104 + n[3]*2^156 + n[4]*2^208.
+// Anything that comes out of feMul or feNormalizeWeak has n[0..3] < 2^52
+// and n[4] < 2^49 (call that magnitude 1), but is not necessarily fully
+// reduced.  feAdd and feMulInt let the limbs grow; feMul accepts any limbs
+// below 2^60.  feNegate(r,a,m) needs a to be of magnitude m or less.
+//
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+struct Fe
+{
+   uint64_t n[5];
+};
+
+/////////////////////////////////////////////////////////////////////////////
+static inline void feSetInt(Fe & r, uint64_t a)
+{
+   r.n[0] = a;
+   r.n[1] = r.n[2] = r.n[3] = r.n[4] = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Fold anything above bit 256 back into the bottom, and carry
+static void feNormalizeWeak(Fe & r)
+{
+   uint64_t t0=r.n[0], t1=r.n[1], t2=r.n[2], t3=r.n[3], t4=r.n[4];
+
+   uint64_t x = t4 >> 48;
+   t4 &= FE_MASK48;
+   t0 += x * FE_R;
+   t1 += t0 >> 52;  t0 &= FE_MASK52;
+   t2 += t1 >> 52;  t1 &= FE_MASK52;
+   t3 += t2 >> 52;  t2 &= FE_MASK52;
+   t4 += t3 >> 52;  t3 &= FE_MASK52;
+
+   r.n[0]=t0; r.n[1]=t1; r.n[2]=t2; r.n[3]=t3; r.n[4]=t4;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Fully reduce to [0, p)
+static void feNormalize(Fe & r)
+{
+   feNormalizeWeak(r);
+
+   // Value is now below 2^257, so at most two more folds of bit 256
+   while(r.n[4] >> 48)
+      feNormalizeWeak(r);
+
+   bool geP = (r.n[4] == FE_MASK48 &&
+               (r.n[3] & r.n[2] & r.n[1]) == FE_MASK52 &&
+               r.n[0] >= 0xFFFFEFFFFFC2FULL);
+   if(geP)
+   {
+      // r - p = r + (2^256 - p) - 2^256
+      r.n[0] += FE_R;
+      r.n[1] += r.n[0] >> 52;  r.n[0] &= FE_MASK52;
+      r.n[2] += r.n[1] >> 52;  r.n[1] &= FE_MASK52;
+      r.n[3] += r.n[2] >> 52;  r.n[2] &= FE_MASK52;
+      r.n[4] += r.n[3] >> 52;  r.n[3] &= FE_MASK52;
+      r.n[4] &= FE_MASK48;
+   }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static bool feIsZero(Fe const & a)
+{
+   Fe t = a;
+   feNormalize(t);
+   return (t.n[0] | t.n[1] | t.n[2] | t.n[3] | t.n[4]) == 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static bool feEqual(Fe const & a, Fe const & b)
+{
+   Fe ta = a;
+   Fe tb = b;
+   feNormalize(ta);
+   feNormalize(tb);
+   return memcmp(ta.n, tb.n, sizeof(ta.n)) == 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Returns false if the 32 bytes are not below p
+static bool feSetBytes(Fe & r, uint8_t const * b32)
+{
+   uint64_t w3 = readBE64(b32);
+   uint64_t w2 = readBE64(b32+8);
+   uint64_t w1 = readBE64(b32+16);
+   uint64_t w0 = readBE64(b32+24);
+
+   r.n[0] =   w0 & FE_MASK52;
+   r.n[1] = ( w0 >> 52) | ((w1 & 0xFFFFFFFFFFULL) << 12);
+   r.n[2] = ( w1 >> 40) | ((w2 & 0xFFFFFFFULL   ) << 24);
+   r.n[3] = ( w2 >> 28) | ((w3 & 0xFFFFULL      ) << 36);
+   r.n[4] =   w3 >> 16;
+
+   Fe t = r;
+   feNormalize(t);
+   return memcmp(t.n, r.n, sizeof(t.n)) == 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static void feGetBytes(uint8_t * out32, Fe const & a)
+{
+   Fe t = a;
+   feNormalize(t);
+   writeBE64(out32+24,  t.n[0]        | (t.n[1] << 52));
+   writeBE64(out32+16, (t.n[1] >> 12) | (t.n[2] << 40));
+   writeBE64(out32+ 8, (t.n[2] >> 24) | (t.n[3] << 28));
+   writeBE64(out32   , (t.n[3] >> 36) | (t.n[4] << 16));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static inline void feAdd(Fe & r, Fe const & a)
+{
+   r.n[0] += a.n[0];
+   r.n[1] += a.n[1];
+   r.n[2] += a.n[2];
+   r.n[3] += a.n[3];
+   r.n[4] += a.n[4];
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static inline void feMulInt(Fe & r, uint32_t k)
+{
+   r.n[0] *= k;
+   r.n[1] *= k;
+   r.n[2] *= k;
+   r.n[3] *= k;
+   r.n[4] *= k;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// r = 2(m+1)p - a, which keeps every limb positive
+static inline void feNegate(Fe & r, Fe const & a, uint32_t m)
+{
+   r.n[0] = 0xFFFFEFFFFFC2FULL * 2 * (m+1) - a.n[0];
+   r.n[1] = 0xFFFFFFFFFFFFFULL * 2 * (m+1) - a.n[1];
+   r.n[2] = 0xFFFFFFFFFFFFFULL * 2 * (m+1) - a.n[2];
+   r.n[3] = 0xFFFFFFFFFFFFFULL * 2 * (m+1) - a.n[3];
+   r.n[4] = 0x0FFFFFFFFFFFFULL * 2 * (m+1) - a.n[4];
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Takes a product in ten 52-bit columns (the last one unbounded), and folds
+// the top five down using 2^260 = 0x1000003D10 (mod p)
+static inline void feReduce(Fe & r, uint64_t const * c, uint128_t c9)
+{
+   uint64_t t0, t1, t2, t3, t4;
+   uint128_t u;
+   u =             (uint128_t)c[5] * FE_R4 + c[0];  t0 = (uint64_t)u & FE_MASK52;
+   u = (u >> 52) + (uint128_t)c[6] * FE_R4 + c[1];  t1 = (uint64_t)u & FE_MASK52;
+   u = (u >> 52) + (uint128_t)c[7] * FE_R4 + c[2];  t2 = (uint64_t)u & FE_MASK52;
+   u = (u >> 52) + (uint128_t)c[8] * FE_R4 + c[3];  t3 = (uint64_t)u & FE_MASK52;
+   u = (u >> 52) +            c9   * FE_R4 + c[4];  t4 = (uint64_t)u & FE_MASK48;
+
+   // Everything from bit 256 up folds back in with 2^256 = 0x1000003D1
+   u = (u >> 48) * FE_R + t0;   t0 = (uint64_t)u & FE_MASK52;
+   u = (u >> 52) + t1;          t1 = (uint64_t)u & FE_MASK52;
+   u = (u >> 52) + t2;          t2 = (uint64_t)u & FE_MASK52;
+   u = (u >> 52) + t3;          t3 = (uint64_t)u & FE_MASK52;
+   t4 += (uint64_t)(u >> 52);
+
+   r.n[0]=t0; r.n[1]=t1; r.n[2]=t2; r.n[3]=t3; r.n[4]=t4;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// r may alias a or b
+static void feMul(Fe & r, Fe const & a, Fe const & b)
+{
+   uint64_t const a0=a.n[0], a1=a.n[1], a2=a.n[2], a3=a.n[3], a4=a.n[4];
+   uint64_t const b0=b.n[0], b1=b.n[1], b2=b.n[2], b3=b.n[3], b4=b.n[4];
+   uint64_t c[9];
+   uint128_t acc;
+
+   acc  = (uint128_t)a0*b0;
+   c[0] = (uint64_t)acc & FE_MASK52;  acc >>= 52;
+   acc += (uint128_t)a0*b1 + (uint128_t)a1*b0;
+   c[1] = (uint64_t)acc & FE_MASK52;  acc >>= 52;
+   acc += (uint128_t)a0*b2 + (uint128_t)a1*b1 + (uint128_t)a2*b0;
+   c[2] = (uint64_t)acc & FE_MASK52;  acc >>= 52;
+   acc += (uint128_t)a0*b3 + (uint128_t)a1*b2 + (uint128_t)a2*b1 +
+          (uint128_t)a3*b0;
+   c[3] = (uint64_t)acc & FE_MASK52;  acc >>= 52;
+   acc += (uint128_t)a0*b4 + (uint128_t)a1*b3 + (uint128_t)a2*b2 +
+          (uint128_t)a3*b1 + (uint128_t)a4*b0;
+   c[4] = (uint64_t)acc & FE_MASK52;  acc >>= 52;
+   acc += (uint128_t)a1*b4 + (uint128_t)a2*b3 + (uint128_t)a3*b2 +
+          (uint128_t)a4*b1;
+   c[5] = (uint64_t)acc & FE_MASK52;  acc >>= 52;
+   acc += (uint128_t)a2*b4 + (uint128_t)a3*b3 + (uint128_t)a4*b2;
+   c[6] = (uint64_t)acc & FE_MASK52;  acc >>= 52;
+   acc += (uint128_t)a3*b4 + (uint128_t)a4*b3;
+   c[7] = (uint64_t)acc & FE_MASK52;  acc >>= 52;
+   acc += (uint128_t)a4*b4;
+   c[8] = (uint64_t)acc & FE_MASK52;  acc >>= 52;
+
+   feReduce(r, c, acc);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Same as feMul(r,a,a), but each cross term is only computed once
+static void feSqr(Fe & r, Fe const & a)
+{
+   uint64_t const a0=a.n[0], a1=a.n[1], a2=a.n[2], a3=a.n[3], a4=a.n[4];
+   uint64_t const d0=2*a0, d1=2*a1, d2=2*a2, d3=2*a3;
+   uint64_t c[9];
+   uint128_t acc;
+
+   acc  = (uint128_t)a0*a0;
+   c[0] = (uint64_t)acc & FE_MASK52;  acc >>= 52;
+   acc += (uint128_t)d0*a1;
+   c[1] = (uint64_t)acc & FE_MASK52;  acc >>= 52;
+   acc += (uint128_t)d0*a2 + (uint128_t)a1*a1;
+   c[2] = (uint64_t)acc & FE_MASK52;  acc >>= 52;
+   acc += (uint128_t)d0*a3 + (uint128_t)d1*a2;
+   c[3] = (uint64_t)acc & FE_MASK52;  acc >>= 52;
+   acc += (uint128_t)d0*a4 + (uint128_t)d1*a3 + (uint128_t)a2*a2;
+   c[4] = (uint64_t)acc & FE_MASK52;  acc >>= 52;
+   acc += (uint128_t)d1*a4 + (uint128_t)d2*a3;
+   c[5] = (uint64_t)acc & FE_MASK52;  acc >>= 52;
+   acc += (uint128_t)d2*a4 + (uint128_t)a3*a3;
+   c[6] = (uint64_t)acc & FE_MASK52;  acc >>= 52;
+   acc += (uint128_t)d3*a4;
+   c[7] = (uint64_t)acc & FE_MASK52;  acc >>= 52;
+   acc += (uint128_t)a4*a4;
+   c[8] = (uint64_t)acc & FE_MASK52;  acc >>= 52;
+
+   feReduce(r, c, acc);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static inline void feSqrN(Fe & r, Fe const & a, int n)
+{
+   r = a;
+   for(int i=0; i<n; i++)
+      feSqr(r, r);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// a^(p-2).  The binary expansion of p-2 has blocks of 1s of lengths 1, 2,
+// 22 and 223, so we build 2^k-1 powers for those with an addition chain:
+// 255 squarings and 15 multiplies
+static void feInverse(Fe & r, Fe const & a)
+{
+   Fe x2, x3, x6, x9, x11, x22, x44, x88, x176, x220, x223, t;
+
+   feSqr(x2, a);           feMul(x2, x2, a);
+   feSqr(x3, x2);          feMul(x3, x3, a);
+   feSqrN(x6,   x3,   3);  feMul(x6,   x6,   x3);
+   feSqrN(x9,   x6,   3);  feMul(x9,   x9,   x3);
+   feSqrN(x11,  x9,   2);  feMul(x11,  x11,  x2);
+   feSqrN(x22,  x11, 11);  feMul(x22,  x22,  x11);
+   feSqrN(x44,  x22, 22);  feMul(x44,  x44,  x22);
+   feSqrN(x88,  x44, 44);  feMul(x88,  x88,  x44);
+   feSqrN(x176, x88, 88);  feMul(x176, x176, x88);
+   feSqrN(x220, x176,44);  feMul(x220, x220, x44);
+   feSqrN(x223, x220, 3);  feMul(x223, x223, x3);
+
+   feSqrN(t, x223, 23);    feMul(t, t, x22);
+   feSqrN(t, t,     5);    feMul(t, t, a);
+   feSqrN(t, t,     3);    feMul(t, t, x2);
+   feSqrN(t, t,     2);    feMul(r, t, a);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// r = a^((p+1)/4), which is a square root of a if there is one.  Same chain
+// as feInverse up to x223, since (p+1)/4 has blocks of 1s of lengths 2, 22
+// and 223.  Returns false if a is not a square.
+static bool feSqrt(Fe & r, Fe const & a)
+{
+   Fe x2, x3, x6, x9, x11, x22, x44, x88, x176, x220, x223, t;
+
+   feSqr(x2, a);           feMul(x2, x2, a);
+   feSqr(x3, x2);          feMul(x3, x3, a);
+   feSqrN(x6,   x3,   3);  feMul(x6,   x6,   x3);
+   feSqrN(x9,   x6,   3);  feMul(x9,   x9,   x3);
+   feSqrN(x11,  x9,   2);  feMul(x11,  x11,  x2);
+   feSqrN(x22,  x11, 11);  feMul(x22,  x22,  x11);
+   feSqrN(x44,  x22, 22);  feMul(x44,  x44,  x22);
+   feSqrN(x88,  x44, 44);  feMul(x88,  x88,  x44);
+   feSqrN(x176, x88, 88);  feMul(x176, x176, x88);
+   feSqrN(x220, x176,44);  feMul(x220, x220, x44);
+   feSqrN(x223, x220, 3);  feMul(x223, x223, x3);
+
+   feSqrN(t, x223, 23);    feMul(t, t, x22);
+   feSqrN(t, t,     6);    feMul(t, t, x2);
+   feSqrN(r, t,     2);
+
+   feSqr(t, r);
+   return feEqual(t, a);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// Scalars mod the group order n.  Four 64-bit words, least significant
+// first, always fully reduced.
+//
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+struct Scalar
+{
+   uint64_t d[4];
+};
+
+static uint64_t const SECP256K1_N[4] = { 0xBFD25E8CD0364141ULL,
+                                         0xBAAEDCE6AF48A03BULL,
+                                         0xFFFFFFFFFFFFFFFEULL,
+                                         0xFFFFFFFFFFFFFFFFULL };
+
+// 2^256 - n, which is only 129 bits
+static uint64_t const SECP256K1_NC[3] = { 0x402DA1732FC9BEBFULL,
+                                          0x4551231950B75FC4ULL,
+                                          0x0000000000000001ULL };
+
+/////////////////////////////////////////////////////////////////////////////
+static bool wordsGeN(uint64_t const * d)
+{
+   for(int i=3; i>=0; i--)
+   {
+      if(d[i] != SECP256K1_N[i])
+         return d[i] > SECP256K1_N[i];
+   }
+   return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// d += 2^256 - n, dropping the carry out of the top word.  This is d - n
+// whenever d >= n, or d+2^256 had overflowed.
+static void wordsAddNC(uint64_t * d)
+{
+   uint128_t c = 0;
+   for(int i=0; i<4; i++)
+   {
+      c += (uint128_t)d[i] + (i<3 ? SECP256K1_NC[i] : 0);
+      d[i] = (uint64_t)c;
+      c >>= 64;
+   }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// out[0..nOut) += a*b
+static void wordsMulAdd(uint64_t * out, int nOut,
+                        uint64_t const * a, int na,
+                        uint64_t const * b, int nb)
+{
+   for(int i=0; i<na; i++)
+   {
+      uint128_t c = 0;
+      for(int j=0; j<nb; j++)
+      {
+         c += (uint128_t)a[i] * b[j] + out[i+j];
+         out[i+j] = (uint64_t)c;
+         c >>= 64;
+      }
+      for(int k=i+nb; c!=0 && k<nOut; k++)
+      {
+         c += out[k];
+         out[k] = (uint64_t)c;
+         c >>= 64;
+      }
+   }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Reduces mod n.  Returns true if the input was already below n.
+static bool scSetBytes(Scalar & r, uint8_t const * b32)
+{
+   r.d[3] = readBE64(b32);
+   r.d[2] = readBE64(b32+8);
+   r.d[1] = readBE64(b32+16);
+   r.d[0] = readBE64(b32+24);
+   if(!wordsGeN(r.d))
+      return true;
+
+   wordsAddNC(r.d);
+   return false;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static void scGetBytes(uint8_t * out32, Scalar const & a)
+{
+   writeBE64(out32,    a.d[3]);
+   writeBE64(out32+8,  a.d[2]);
+   writeBE64(out32+16, a.d[1]);
+   writeBE64(out32+24, a.d[0]);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static inline bool scIsZero(Scalar const & a)
+{
+   return (a.d[0] | a.d[1] | a.d[2] | a.d[3]) == 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static inline bool scEqual(Scalar const & a, Scalar const & b)
+{
+   return memcmp(a.d, b.d, sizeof(a.d)) == 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static void scAdd(Scalar & r, Scalar const & a, Scalar const & b)
+{
+   uint128_t c = 0;
+   for(int i=0; i<4; i++)
+   {
+      c += (uint128_t)a.d[i] + b.d[i];
+      r.d[i] = (uint64_t)c;
+      c >>= 64;
+   }
+   if(c || wordsGeN(r.d))
+      wordsAddNC(r.d);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// 512-bit product, then fold the high half down with 2^256 = 2^256-n
+// (mod n) until it fits:  512 -> 385 -> 258 -> 256 bits
+static void scMul(Scalar & r, Scalar const & a, Scalar const & b)
+{
+   uint64_t l[8] = {0};
+   wordsMulAdd(l, 8, a.d, 4, b.d, 4);
+
+   uint64_t m[7] = {l[0], l[1], l[2], l[3], 0, 0, 0};
+   wordsMulAdd(m, 7, l+4, 4, SECP256K1_NC, 3);
+
+   uint64_t p[5] = {m[0], m[1], m[2], m[3], 0};
+   wordsMulAdd(p, 5, m+4, 3, SECP256K1_NC, 3);
+
+   uint64_t q[5] = {p[0], p[1], p[2], p[3], 0};
+   wordsMulAdd(q, 5, p+4, 1, SECP256K1_NC, 3);
+
+   if(q[4])
+      wordsAddNC(q);
+   if(wordsGeN(q))
+      wordsAddNC(q);
+
+   memcpy(r.d, q, sizeof(r.d));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// a^(n-2), four bits at a time
+static void scInverse(Scalar & r, Scalar const & a)
+{
+   static uint8_t const NM2[32] = {
+      0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFE,
+      0xBA,0xAE,0xDC,0xE6,0xAF,0x48,0xA0,0x3B,0xBF,0xD2,0x5E,0x8C,0xD0,0x36,0x41,0x3F };
+
+   Scalar pow[16];
+   memset(pow[0].d, 0, sizeof(pow[0].d));
+   pow[0].d[0] = 1;
+   pow[1] = a;
+   for(int i=2; i<16; i++)
+      scMul(pow[i], pow[i-1], a);
+
+   Scalar t = pow[0];
+   for(int i=0; i<64; i++)
+   {
+      for(int j=0; j<4; j++)
+         scMul(t, t, t);
+      uint8_t nib = (i%2==0 ? NM2[i/2] >> 4 : NM2[i/2] & 0x0F);
+      if(nib)
+         scMul(t, t, pow[nib]);
+   }
+   r = t;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Bits [offset, offset+count) of the scalar, anything past bit 255 is zero
+static inline int scGetBits(Scalar const & a, int offset, int count)
+{
+   int out = 0;
+   for(int i=0; i<count; i++)
+   {
+      int bit = offset + i;
+      if(bit < 256 && ((a.d[bit>>6] >> (bit & 63)) & 1))
+         out |= (1 << i);
+   }
+   return out;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Width-w NAF:  every nonzero digit is odd, |digit| < 2^(w-1), and any
+// two nonzero digits are at least w positions apart.  Returns the number of
+// digits up to and including the last nonzero one.
+static int scWnaf(int * wnaf, Scalar const & a, int w)
+{
+   memset(wnaf, 0, WNAF_MAX_LEN*sizeof(int));
+
+   int lastSet = -1;
+   int carry   = 0;
+   int bit     = 0;
+   while(bit < WNAF_MAX_LEN)
+   {
+      if(scGetBits(a, bit, 1) == carry)
+      {
+         bit++;
+         continue;
+      }
+
+      int now = w;
+      if(now > WNAF_MAX_LEN - bit)
+         now = WNAF_MAX_LEN - bit;
+
+      int word = scGetBits(a, bit, now) + carry;
+      carry = (word >> (w-1)) & 1;
+      word -= carry << w;
+
+      wnaf[bit] = word;
+      lastSet = bit;
+      bit += now;
+   }
+   return lastSet + 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// Points on y^2 = x^3 + 7.  Ge is affine, Gej is Jacobian (x=X/Z^2,
+// y=Y/Z^3).  All coordinates coming out of these functions are magnitude 1.
+//
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+struct Ge
+{
+   Fe   x;
+   Fe   y;
+   bool infinity;
+};
+
+struct Gej
+{
+   Fe   x;
+   Fe   y;
+   Fe   z;
+   bool infinity;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+static inline void gejSetInfinity(Gej & r)
+{
+   r.infinity = true;
+   feSetInt(r.x, 0);
+   feSetInt(r.y, 0);
+   feSetInt(r.z, 0);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static inline void gejSetGe(Gej & r, Ge const & a)
+{
+   r.infinity = a.infinity;
+   r.x = a.x;
+   r.y = a.y;
+   feSetInt(r.z, 1);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static bool geIsOnCurve(Ge const & a)
+{
+   Fe y2, x3;
+   feSqr(y2, a.y);
+   feSqr(x3, a.x);
+   feMul(x3, x3, a.x);
+   Fe seven;
+   feSetInt(seven, 7);
+   feAdd(x3, seven);
+   return feEqual(y2, x3);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static void geSetGej(Ge & r, Gej const & a)
+{
+   r.infinity = a.infinity;
+   if(a.infinity)
+      return;
+
+   Fe zi, zi2, zi3;
+   feInverse(zi, a.z);
+   feSqr(zi2, zi);
+   feMul(zi3, zi2, zi);
+   feMul(r.x, a.x, zi2);
+   feMul(r.y, a.y, zi3);
+   feNormalize(r.x);
+   feNormalize(r.y);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Convert a whole array to affine with a single field inversion, by
+// inverting the product of all the Z's.  None of the inputs may be infinity
+static void geSetAllGej(Ge * r, Gej const * a, uint32_t num)
+{
+   if(num == 0)
+      return;
+
+   Fe * prod = new Fe[num];
+   prod[0] = a[0].z;
+   for(uint32_t i=1; i<num; i++)
+      feMul(prod[i], prod[i-1], a[i].z);
+
+   Fe inv;
+   feInverse(inv, prod[num-1]);
+   for(uint32_t i=num-1; ; i--)
+   {
+      // inv is currently 1/(z[0]*...*z[i])
+      Fe zi;
+      if(i > 0)
+      {
+         feMul(zi, inv, prod[i-1]);
+         feMul(inv, inv, a[i].z);
+      }
+      else
+         zi = inv;
+
+      Fe zi2, zi3;
+      feSqr(zi2, zi);
+      feMul(zi3, zi2, zi);
+      r[i].infinity = false;
+      feMul(r[i].x, a[i].x, zi2);
+      feMul(r[i].y, a[i].y, zi3);
+      feNormalize(r[i].x);
+      feNormalize(r[i].y);
+
+      if(i == 0)
+         break;
+   }
+   delete[] prod;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// S = 4XY^2,  M = 3X^2,  X' = M^2 - 2S,  Y' = M(S - X') - 8Y^4,  Z' = 2YZ
+// secp256k1 has no points of order 2, so Y is never zero here.
+static void gejDouble(Gej & r, Gej const & a)
+{
+   if(a.infinity)
+   {
+      gejSetInfinity(r);
+      return;
+   }
+
+   Fe y2, s, m, z3, x3, y3, t;
+
+   feSqr(y2, a.y);
+   feMul(s, a.x, y2);
+   feMulInt(s, 4);                  // mag 4
+   feSqr(m, a.x);
+   feMulInt(m, 3);                  // mag 3
+   feMul(z3, a.y, a.z);
+   feMulInt(z3, 2);
+
+   feSqr(x3, m);
+   feNegate(t, s, 4);
+   feMulInt(t, 2);
+   feAdd(x3, t);
+   feNormalizeWeak(x3);
+
+   feNegate(y3, x3, 1);
+   feAdd(y3, s);
+   feMul(y3, y3, m);
+   feSqr(t, y2);
+   feNegate(t, t, 1);
+   feMulInt(t, 8);
+   feAdd(y3, t);
+
+   r.infinity = false;
+   r.x = x3;
+   r.y = y3;
+   r.z = z3;
+   feNormalizeWeak(r.y);
+   feNormalizeWeak(r.z);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Shared tail of the two addition formulas.  With H = U2-U1, R = S2-S1:
+//    X' = R^2 - H^3 - 2*U1*H^2,   Y' = R(U1*H^2 - X') - S1*H^3
+static void gejAddFinish(Gej & r, Fe const & u1, Fe const & s1,
+                         Fe const & h, Fe const & rr, Fe const & z3)
+{
+   Fe h2, h3, v, x3, y3, t;
+
+   feSqr(h2, h);
+   feMul(h3, h, h2);
+   feMul(v, u1, h2);
+
+   feSqr(x3, rr);
+   feNegate(t, h3, 1);
+   feAdd(x3, t);
+   t = v;
+   feMulInt(t, 2);
+   feNegate(t, t, 2);
+   feAdd(x3, t);
+   feNormalizeWeak(x3);
+
+   feNegate(y3, x3, 1);
+   feAdd(y3, v);
+   feMul(y3, y3, rr);
+   feMul(t, s1, h3);
+   feNegate(t, t, 1);
+   feAdd(y3, t);
+
+   r.infinity = false;
+   r.x = x3;
+   r.y = y3;
+   r.z = z3;
+   feNormalizeWeak(r.y);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// r = a + b, with b affine.  r may alias a.
+static void gejAddGe(Gej & r, Gej const & a, Ge const & b)
+{
+   if(b.infinity)
+   {
+      r = a;
+      return;
+   }
+   if(a.infinity)
+   {
+      gejSetGe(r, b);
+      return;
+   }
+
+   Fe z12, u2, s2, h, rr;
+   feSqr(z12, a.z);
+   feMul(u2, b.x, z12);
+   feMul(s2, b.y, z12);
+   feMul(s2, s2, a.z);
+
+   feNegate(h, a.x, 1);
+   feAdd(h, u2);
+   feNegate(rr, a.y, 1);
+   feAdd(rr, s2);
+
+   if(feIsZero(h))
+   {
+      if(feIsZero(rr))
+         gejDouble(r, a);
+      else
+         gejSetInfinity(r);
+      return;
+   }
+
+   Fe z3;
+   feMul(z3, a.z, h);
+   Fe u1 = a.x;
+   Fe s1 = a.y;
+   gejAddFinish(r, u1, s1, h, rr, z3);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// r = a + b, both Jacobian.  r may alias either one.
+static void gejAdd(Gej & r, Gej const & a, Gej const & b)
+{
+   if(a.infinity)
+   {
+      r = b;
+      return;
+   }
+   if(b.infinity)
+   {
+      r = a;
+      return;
+   }
+
+   Fe z12, z22, u1, u2, s1, s2, h, rr;
+   feSqr(z12, a.z);
+   feSqr(z22, b.z);
+   feMul(u1, a.x, z22);
+   feMul(u2, b.x, z12);
+   feMul(s1, a.y, z22);
+   feMul(s1, s1, b.z);
+   feMul(s2, b.y, z12);
+   feMul(s2, s2, a.z);
+
+   feNegate(h, u1, 1);
+   feAdd(h, u2);
+   feNegate(rr, s1, 1);
+   feAdd(rr, s2);
+
+   if(feIsZero(h))
+   {
+      if(feIsZero(rr))
+         gejDouble(r, a);
+      else
+         gejSetInfinity(r);
+      return;
+   }
+
+   Fe z3;
+   feMul(z3, a.z, b.z);
+   feMul(z3, z3, h);
+   gejAddFinish(r, u1, s1, h, rr, z3);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Add table[(|n|-1)/2], negated if n<0.  The table holds odd multiples.
+static inline void gejAddOddMultiple(Gej & r, Ge const * table, int n)
+{
+   if(n > 0)
+      gejAddGe(r, r, table[(n-1)/2]);
+   else
+   {
+      Ge neg = table[(-n-1)/2];
+      feNegate(neg.y, neg.y, 1);
+      gejAddGe(r, r, neg);
+   }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// table[i] = (2i+1)*a, for i in [0, num)
+static void geOddMultiples(Ge * table, Ge const & a, uint32_t num)
+{
+   Gej * jac = new Gej[num];
+   Gej a2;
+   gejSetGe(jac[0], a);
+   gejDouble(a2, jac[0]);
+   for(uint32_t i=1; i<num; i++)
+      gejAdd(jac[i], jac[i-1], a2);
+   geSetAllGej(table, jac, num);
+   delete[] jac;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// Fixed-base multiplication:  pts[i][d] = d * 16^i * P + U_i, for d in 
+// [0,15], so k*P is one lookup and one mixed addition per 4-bit window of k.
+// The k here is secret (nonces, private keys), so every window does the
+// same work:  the lookup reads all 16 entries, and the U_i offsets (which 
+// sum to zero) mean a zero nibble still adds a real point.
+//
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+struct Secp256k1CombTable
+{
+   Ge pts[GEN_COMB_WINDOWS][16];
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// U, the point whose x is this string.  Nobody knows its discrete log with
+// respect to anything, so no partial sum in ecmultComb hits a special case
+static void geCombOffset(Ge & r)
+{
+   static uint8_t const X[33] = "The scalar for this x is unknown";
+
+   Fe y2, seven;
+   r.infinity = false;
+   feSetBytes(r.x, X);
+   feSqr(y2, r.x);
+   feMul(y2, y2, r.x);
+   feSetInt(seven, 7);
+   feAdd(y2, seven);
+   feSqrt(r.y, y2);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Fill in the whole table in Jacobian, then convert it with one inversion.
+// U_i = 2^i * U, except the last one, which cancels all the others
+static void buildCombTable(Secp256k1CombTable & table, Ge const & p)
+{
+   uint32_t const numPts = GEN_COMB_WINDOWS * 16;
+   Gej * jac = new Gej[numPts];
+   Gej base, offset, offsetSum;
+   Ge u;
+   geCombOffset(u);
+   gejSetGe(base, p);
+   gejSetGe(offset, u);
+   gejSetInfinity(offsetSum);
+   for(uint32_t i=0; i<GEN_COMB_WINDOWS; i++)
+   {
+      Gej * row = jac + 16*i;
+      if(i < GEN_COMB_WINDOWS-1)
+      {
+         row[0] = offset;
+         gejAdd(offsetSum, offsetSum, offset);
+         gejDouble(offset, offset);
+      }
+      else
+      {
+         row[0] = offsetSum;
+         feNegate(row[0].y, offsetSum.y, 1);
+      }
+
+      for(uint32_t d=1; d<16; d++)
+         gejAdd(row[d], row[d-1], base);
+
+      for(uint32_t b=0; b<4; b++)
+         gejDouble(base, base);
+   }
+   geSetAllGej(&table.pts[0][0], jac, numPts);
+   delete[] jac;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// r = row[idx], reading every entry so the memory access doesn't depend on
+// idx.  The mask is all ones for the entry we want, without branching
+static inline void geCombLookup(Ge & r, Ge const * row, uint32_t idx)
+{
+   r = row[0];
+   for(uint32_t d=1; d<16; d++)
+   {
+      uint64_t mask = 0 - (uint64_t)(((d ^ idx) - 1) >> 31);
+      for(uint32_t j=0; j<5; j++)
+      {
+         r.x.n[j] ^= mask & (r.x.n[j] ^ row[d].x.n[j]);
+         r.y.n[j] ^= mask & (r.y.n[j] ^ row[d].y.n[j]);
+      }
+   }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static void ecmultComb(Gej & r, Secp256k1CombTable const & table, 
+                       Scalar const & k)
+{
+   Ge add;
+   gejSetInfinity(r);
+   for(uint32_t i=0; i<GEN_COMB_WINDOWS; i++)
+   {
+      uint32_t nib = (uint32_t)(k.d[i/16] >> (4*(i%16))) & 0x0F;
+      geCombLookup(add, table.pts[i], nib);
+      gejAddGe(r, r, add);
+   }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// Precomputed multiples of the generator.  Built once, on first use;
+// function-local statics are initialized thread-safely by GCC, so it
+// doesn't matter which thread gets here first.
+//
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+class GeneratorTables
+{
+public:
+   GeneratorTables(void);
+
+   Secp256k1CombTable comb_;
+
+   // odd_[i] = (2i+1) * G
+   Ge odd_[WNAF_TABLE_G];
+};
+
+/////////////////////////////////////////////////////////////////////////////
+GeneratorTables::GeneratorTables(void)
+{
+   static uint8_t const GX[32] = {
+      0x79,0xBE,0x66,0x7E,0xF9,0xDC,0xBB,0xAC,0x55,0xA0,0x62,0x95,0xCE,0x87,0x0B,0x07,
+      0x02,0x9B,0xFC,0xDB,0x2D,0xCE,0x28,0xD9,0x59,0xF2,0x81,0x5B,0x16,0xF8,0x17,0x98 };
+   static uint8_t const GY[32] = {
+      0x48,0x3A,0xDA,0x77,0x26,0xA3,0xC4,0x65,0x5D,0xA4,0xFB,0xFC,0x0E,0x11,0x08,0xA8,
+      0xFD,0x17,0xB4,0x48,0xA6,0x85,0x54,0x19,0x9C,0x47,0xD0,0x8F,0xFB,0x10,0xD4,0xB8 };
+
+   Ge g;
+   g.infinity = false;
+   feSetBytes(g.x, GX);
+   feSetBytes(g.y, GY);
+
+   geOddMultiples(odd_, g, WNAF_TABLE_G);
+   buildCombTable(comb_, g);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static GeneratorTables const & getGeneratorTables(void)
+{
+   static GeneratorTables tables;
+   return tables;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static inline void ecmultGen(Gej & r, Scalar const & k)
+{
+   ecmultComb(r, getGeneratorTables().comb_, k);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Odd multiples of a public key, for the wNAF in ecmult.  This is all that
+// needs to be kept around to verify many signatures from the same key.
+struct Secp256k1OddMultiples
+{
+   Ge pts[WNAF_TABLE_Q];
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// r = na*A + ng*G, interleaving the two wNAF expansions so they share all
+// the doublings.  Either scalar may be zero.  tableA holds the odd multiples
+// of A, and may be NULL (meaning na is taken as zero).
+static void ecmultTable(Gej & r, Secp256k1OddMultiples const * tableA, 
+                        Scalar const & na, Scalar const & ng)
+{
+   GeneratorTables const & tables = getGeneratorTables();
+
+   int wnafA[WNAF_MAX_LEN];
+   int wnafG[WNAF_MAX_LEN];
+   int lenA = 0;
+   int lenG = 0;
+
+   if(tableA != NULL && !scIsZero(na))
+      lenA = scWnaf(wnafA, na, WNAF_WINDOW_Q);
+   if(!scIsZero(ng))
+      lenG = scWnaf(wnafG, ng, WNAF_WINDOW_G);
+
+   gejSetInfinity(r);
+   for(int i=(lenA>lenG ? lenA : lenG)-1; i>=0; i--)
+   {
+      gejDouble(r, r);
+      if(i < lenA && wnafA[i] != 0)
+         gejAddOddMultiple(r, tableA->pts, wnafA[i]);
+      if(i < lenG && wnafG[i] != 0)
+         gejAddOddMultiple(r, tables.odd_, wnafG[i]);
+   }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static void ecmult(Gej & r, Ge const & a, Scalar const & na, Scalar const & ng)
+{
+   // No table to build if the A term is zero
+   if(a.infinity || scIsZero(na))
+   {
+      ecmultTable(r, NULL, na, ng);
+      return;
+   }
+
+   Secp256k1OddMultiples tableA;
+   geOddMultiples(tableA.pts, a, WNAF_TABLE_Q);
+   ecmultTable(r, &tableA, na, ng);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static bool parsePublicKey(Ge & r, uint8_t const * pubKey65)
+{
+   if(pubKey65[0] != 0x04)
+      return false;
+
+   r.infinity = false;
+   if(!feSetBytes(r.x, pubKey65+1) || !feSetBytes(r.y, pubKey65+33))
+      return false;
+
+   return geIsOnCurve(r);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// 0x02 or 0x03 (the parity of y), then x
+static bool parseCompressedPublicKey(Ge & r, uint8_t const * pubKey33)
+{
+   if(pubKey33[0] != 0x02 && pubKey33[0] != 0x03)
+      return false;
+
+   r.infinity = false;
+   if(!feSetBytes(r.x, pubKey33+1))
+      return false;
+
+   Fe y2, seven;
+   feSqr(y2, r.x);
+   feMul(y2, y2, r.x);
+   feSetInt(seven, 7);
+   feAdd(y2, seven);
+   if(!feSqrt(r.y, y2))
+      return false;
+
+   uint8_t yBytes[32];
+   feGetBytes(yBytes, r.y);
+   if((yBytes[31] & 0x01) != (pubKey33[0] & 0x01))
+   {
+      feNegate(r.y, r.y, 1);
+      feNormalize(r.y);
+   }
+   return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static void serializePublicKey(uint8_t * pubKeyOut65, Ge const & a)
+{
+   pubKeyOut65[0] = 0x04;
+   feGetBytes(pubKeyOut65+1,  a.x);
+   feGetBytes(pubKeyOut65+33, a.y);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Parse a scalar that must already be in [1, n-1]
+static bool parseScalarStrict(Scalar & r, uint8_t const * b32)
+{
+   return scSetBytes(r, b32) && !scIsZero(r);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// Secp256k1 public methods
+//
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+bool Secp256k1::isValidPrivateKey(uint8_t const * privKey32)
+{
+   Scalar d;
+   return parseScalarStrict(d, privKey32);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool Secp256k1::isValidPublicKey(uint8_t const * pubKey65)
+{
+   Ge q;
+   return parsePublicKey(q, pubKey65);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool Secp256k1::decompressPublicKey(uint8_t const * pubKey33,
+                                    uint8_t       * pubKeyOut65)
+{
+   Ge q;
+   if(!parseCompressedPublicKey(q, pubKey33))
+      return false;
+
+   serializePublicKey(pubKeyOut65, q);
+   return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool Secp256k1::computePublicKey(uint8_t const * privKey32,
+                                 uint8_t       * pubKeyOut65)
+{
+   Scalar d;
+   if(!parseScalarStrict(d, privKey32))
+      return false;
+
+   Gej pj;
+   Ge  p;
+   ecmultGen(pj, d);
+   geSetGej(p, pj);
+   serializePublicKey(pubKeyOut65, p);
+   return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool Secp256k1::multiplyPublicKey(uint8_t const * pubKey65,
+                                  uint8_t const * scalar32,
+                                  uint8_t       * pubKeyOut65)
+{
+   Ge q;
+   if(!parsePublicKey(q, pubKey65))
+      return false;
+
+   Scalar k, zero;
+   scSetBytes(k, scalar32);
+   memset(zero.d, 0, sizeof(zero.d));
+   if(scIsZero(k))
+      return false;
+
+   Gej pj;
+   Ge  p;
+   ecmult(pj, q, k, zero);
+   geSetGej(p, pj);
+   serializePublicKey(pubKeyOut65, p);
+   return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool Secp256k1::multiplyPrivateKey(uint8_t const * privKey32,
+                                   uint8_t const * scalar32,
+                                   uint8_t       * privKeyOut32)
+{
+   Scalar a, b, r;
+   scSetBytes(a, privKey32);
+   scSetBytes(b, scalar32);
+   scMul(r, a, b);
+   if(scIsZero(r))
+      return false;
+
+   scGetBytes(privKeyOut32, r);
+   return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// r = x(k*G) mod n,  s = (e + r*d) / k  mod n
+bool Secp256k1::signHash(uint8_t const * hash32,
+                         uint8_t const * privKey32,
+                         uint8_t const * nonce32,
+                         uint8_t       * sigOut64)
+{
+   Scalar d, k, e;
+   if(!parseScalarStrict(d, privKey32) || !parseScalarStrict(k, nonce32))
+      return false;
+   scSetBytes(e, hash32);
+
+   Gej Rj;
+   Ge  R;
+   ecmultGen(Rj, k);
+   geSetGej(R, Rj);
+
+   uint8_t xBytes[32];
+   Scalar r;
+   feGetBytes(xBytes, R.x);
+   scSetBytes(r, xBytes);
+   if(scIsZero(r))
+      return false;
+
+   Scalar s, kInv;
+   scMul(s, r, d);
+   scAdd(s, s, e);
+   scInverse(kInv, k);
+   scMul(s, s, kInv);
+   if(scIsZero(s))
+      return false;
+
+   scGetBytes(sigOut64,    r);
+   scGetBytes(sigOut64+32, s);
+
+   // Don't leave the nonce and key lying around on the stack.  A memset
+   // here is a dead store the compiler is free to drop
+   SecureArena::secureZero(&d,    sizeof(d));
+   SecureArena::secureZero(&k,    sizeof(k));
+   SecureArena::secureZero(&kInv, sizeof(kInv));
+   return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Same math as signHash.  The R's are made affine together (geSetAllGej), 
+// and the k's are inverted together:  invert the product of all of them, 
+// then peel off one at a time walking back down the prefix products
+void Secp256k1::signHashBatch(uint8_t const *       hashes32,
+                              uint8_t const * const * privKeys32,
+                              uint8_t const *       nonces32,
+                              uint8_t       *       sigsOut64,
+                              bool          *       sigOK,
+                              uint32_t              num)
+{
+   if(num == 0)
+      return;
+
+   // Only the ones with a valid key and nonce go into the batch
+   Scalar   * d    = new Scalar[num];
+   Scalar   * k    = new Scalar[num];
+   Scalar   * prod = new Scalar[num];
+   Gej      * Rj   = new Gej[num];
+   Ge       * R    = new Ge[num];
+   uint32_t * idx  = new uint32_t[num];
+   uint32_t   nOK  = 0;
+   for(uint32_t i=0; i<num; i++)
+   {
+      sigOK[i] = false;
+      if(!parseScalarStrict(d[nOK], privKeys32[i]) ||
+         !parseScalarStrict(k[nOK], nonces32 + 32*i))
+         continue;
+
+      ecmultGen(Rj[nOK], k[nOK]);
+      prod[nOK] = k[nOK];
+      if(nOK > 0)
+         scMul(prod[nOK], prod[nOK-1], k[nOK]);
+      idx[nOK++] = i;
+   }
+
+   if(nOK > 0)
+   {
+      geSetAllGej(R, Rj, nOK);
+
+      Scalar inv, kInv;
+      scInverse(inv, prod[nOK-1]);
+      for(uint32_t j=nOK-1; ; j--)
+      {
+         // inv is currently 1/(k[0]*...*k[j])
+         if(j > 0)
+         {
+            scMul(kInv, inv, prod[j-1]);
+            scMul(inv, inv, k[j]);
+         }
+         else
+            kInv = inv;
+
+         uint32_t i = idx[j];
+         uint8_t xBytes[32];
+         Scalar r, s, e;
+         feGetBytes(xBytes, R[j].x);
+         scSetBytes(r, xBytes);
+         scSetBytes(e, hashes32 + 32*i);
+         scMul(s, r, d[j]);
+         scAdd(s, s, e);
+         scMul(s, s, kInv);
+         if(!scIsZero(r) && !scIsZero(s))
+         {
+            scGetBytes(sigsOut64 + 64*i,    r);
+            scGetBytes(sigsOut64 + 64*i+32, s);
+            sigOK[i] = true;
+         }
+
+         // s held r*d partway through, which gives away the key
+         SecureArena::secureZero(&r, sizeof(r));
+         SecureArena::secureZero(&s, sizeof(s));
+         SecureArena::secureZero(&e, sizeof(e));
+         if(j == 0)
+            break;
+      }
+      SecureArena::secureZero(&inv,  sizeof(inv));
+      SecureArena::secureZero(&kInv, sizeof(kInv));
+   }
+
+   // Don't leave the nonces and keys lying around on the heap.  These are
+   // freed right after, so a plain memset would be a dead store
+   SecureArena::secureZero(d,    num*sizeof(Scalar));
+   SecureArena::secureZero(k,    num*sizeof(Scalar));
+   SecureArena::secureZero(prod, num*sizeof(Scalar));
+   delete[] d;
+   delete[] k;
+   delete[] prod;
+   delete[] Rj;
+   delete[] R;
+   delete[] idx;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Accept if x(u1*G + u2*Q) = r (mod n), where u1 = e/s and u2 = r/s
+static bool verifyWithTable(uint8_t const * hash32,
+                            uint8_t const * sig64,
+                            Secp256k1OddMultiples const & tableQ)
+{
+   Scalar r, s, e;
+   if(!parseScalarStrict(r, sig64) || !parseScalarStrict(s, sig64+32))
+      return false;
+   scSetBytes(e, hash32);
+
+   Scalar sInv, u1, u2;
+   scInverse(sInv, s);
+   scMul(u1, e, sInv);
+   scMul(u2, r, sInv);
+
+   Gej Rj;
+   Ge  R;
+   ecmultTable(Rj, &tableQ, u2, u1);
+   if(Rj.infinity)
+      return false;
+   geSetGej(R, Rj);
+
+   uint8_t xBytes[32];
+   Scalar xr;
+   feGetBytes(xBytes, R.x);
+   scSetBytes(xr, xBytes);
+   return scEqual(xr, r);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool Secp256k1::verifyHash(uint8_t const * hash32,
+                           uint8_t const * sig64,
+                           uint8_t const * pubKey65)
+{
+   Ge q;
+   if(!parsePublicKey(q, pubKey65))
+      return false;
+
+   Secp256k1OddMultiples tableQ;
+   geOddMultiples(tableQ.pts, q, WNAF_TABLE_Q);
+   return verifyWithTable(hash32, sig64, tableQ);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// Secp256k1FixedPoint
+//
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+Secp256k1FixedPoint::Secp256k1FixedPoint(void) : 
+   table_(NULL)
+{
+   // Nothing to do here
+}
+
+/////////////////////////////////////////////////////////////////////////////
+Secp256k1FixedPoint::~Secp256k1FixedPoint(void)
+{
+   delete table_;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool Secp256k1FixedPoint::setPublicKey(uint8_t const * pubKey65)
+{
+   Ge q;
+   if(!parsePublicKey(q, pubKey65))
+      return false;
+
+   if(table_ == NULL)
+      table_ = new Secp256k1CombTable;
+   buildCombTable(*table_, q);
+   return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool Secp256k1FixedPoint::multiply(uint8_t const * scalar32,
+                                   uint8_t       * pubKeyOut65) const
+{
+   if(table_ == NULL)
+      return false;
+
+   Scalar k;
+   scSetBytes(k, scalar32);
+   if(scIsZero(k))
+      return false;
+
+   Gej pj;
+   Ge  p;
+   ecmultComb(pj, *table_, k);
+   geSetGej(p, pj);
+   serializePublicKey(pubKeyOut65, p);
+   return true;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// Secp256k1PublicKey
+//
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+Secp256k1PublicKey::Secp256k1PublicKey(void) : 
+   table_(NULL)
+{
+   // Nothing to do here
+}
+
+/////////////////////////////////////////////////////////////////////////////
+Secp256k1PublicKey::Secp256k1PublicKey(Secp256k1PublicKey const & pk) :
+   table_(NULL)
+{
+   if(pk.table_ != NULL)
+      table_ = new Secp256k1OddMultiples(*pk.table_);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+Secp256k1PublicKey & Secp256k1PublicKey::operator=(Secp256k1PublicKey const & pk)
+{
+   if(this == &pk)
+      return *this;
+
+   delete table_;
+   table_ = NULL;
+   if(pk.table_ != NULL)
+      table_ = new Secp256k1OddMultiples(*pk.table_);
+   return *this;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+Secp256k1PublicKey::~Secp256k1PublicKey(void)
+{
+   delete table_;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool Secp256k1PublicKey::setPublicKey(uint8_t const * pubKey65)
+{
+   delete table_;
+   table_ = NULL;
+
+   Ge q;
+   if(!parsePublicKey(q, pubKey65))
+      return false;
+
+   table_ = new Secp256k1OddMultiples;
+   geOddMultiples(table_->pts, q, WNAF_TABLE_Q);
+   return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool Secp256k1PublicKey::verifyHash(uint8_t const * hash32,
+                                    uint8_t const * sig64) const
+{
+   if(table_ == NULL)
+      return false;
+   return verifyWithTable(hash32, sig64, *table_);
+}
@@ -0,0 +1,171 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011, Alan C. Reiner    <alan.reiner@gmail.com>             //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Specialized secp256k1 arithmetic.  When built with USE_NATIVE_SECP256K1,
+// the SecureBinaryData methods of CryptoECDSA use this instead of the
+// generic Crypto++ ECP code.
+//
+// Crypto++ treats secp256k1 like any other prime curve:  every field op goes
+// through the variable-length Integer class, and every CryptoECDSA call
+// builds and validates a new DL_PublicKey object.  Here, everything about
+// the curve is hard-coded:
+//
+//    -- Field elements are 5x52-bit limbs, so products accumulate in 128-bit
+//       integers and reduction mod p = 2^256 - 0x1000003D1 is a few shifts
+//    -- Points are kept in Jacobian coordinates, and we add affine points
+//       to them whenever we can
+//    -- k*G uses a precomputed table of d*16^i*G (64 windows of 15 points),
+//       so a public key is 64 point additions and no doublings
+//    -- a*G + b*Q (verify) and b*Q (chained public keys) share doublings
+//       between two wNAF expansions, using a precomputed table of odd
+//       multiples of G
+//
+// The tables are built on first use (~100 kB).  All inputs and outputs are
+// big-endian byte strings:  32-byte private keys and scalars, 65-byte
+// uncompressed public keys, and 64-byte r||s signatures, which is the same
+// thing the Crypto++ signer and verifier produce and consume.
+//
+// None of this is constant-time, so it is no more resistant to side-channel
+// attacks than the Crypto++ code it replaces.
+//
+// The field arithmetic needs unsigned __int128 (GCC/Clang on 64-bit).
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _SECP256K1_H_
+#define _SECP256K1_H_
+
+#include <stdint.h>
+#include <cstddef>
+
+
+class Secp256k1
+{
+public:
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Private keys must be in [1, n-1]
+   static bool isValidPrivateKey(uint8_t const * privKey32);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Checks the 0x04 prefix, that x,y < p, and that the point is on the curve
+   static bool isValidPublicKey(uint8_t const * pubKey65);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // 33-byte compressed key (0x02/0x03 and x) to the 65-byte form.  Fails if
+   // x is not the x-coordinate of a point on the curve
+   static bool decompressPublicKey(uint8_t const * pubKey33,
+                                   uint8_t       * pubKeyOut65);
+
+   /////////////////////////////////////////////////////////////////////////////
+   static bool computePublicKey(uint8_t const * privKey32,
+                                uint8_t       * pubKeyOut65);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // pubKeyOut = (scalar mod n) * pubKey.  Fails if the scalar is 0 mod n
+   static bool multiplyPublicKey(uint8_t const * pubKey65,
+                                 uint8_t const * scalar32,
+                                 uint8_t       * pubKeyOut65);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // privKeyOut = a*b mod n.  Fails if the result is zero
+   static bool multiplyPrivateKey(uint8_t const * privKey32,
+                                  uint8_t const * scalar32,
+                                  uint8_t       * privKeyOut32);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // The hash is the final 32-byte digest, interpreted as a big-endian
+   // integer.  The nonce must be fresh random data from the caller; this
+   // returns false if it is out of range or produced r=0 or s=0, in which
+   // case the caller should try again with a new nonce.
+   static bool signHash(uint8_t const * hash32,
+                        uint8_t const * privKey32,
+                        uint8_t const * nonce32,
+                        uint8_t       * sigOut64);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // signHash for num signatures, with one field inversion and one scalar 
+   // inversion for all of them instead of one of each per signature.  The 
+   // hashes, nonces and signatures are packed end-to-end; the keys are 
+   // pointers, since signatures often share one.  sigOK[i] is what signHash
+   // would have returned, and only those signatures are written.
+   static void signHashBatch(uint8_t const *         hashes32,
+                             uint8_t const * const * privKeys32,
+                             uint8_t const *         nonces32,
+                             uint8_t       *         sigsOut64,
+                             bool          *         sigOK,
+                             uint32_t                num);
+
+   /////////////////////////////////////////////////////////////////////////////
+   static bool verifyHash(uint8_t const * hash32,
+                          uint8_t const * sig64,
+                          uint8_t const * pubKey65);
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Precomputed multiples of one public key, for computing k*Q for many k and
+// the same Q (like walking a chain of chained public keys, which are all 
+// multiples of the root key).  The table is built the same way as the one 
+// for G, with a single shared inversion, and costs about as much as ten 
+// multiplyPublicKey calls.  After that, each multiply() is a comb walk, 
+// about as fast as computePublicKey.
+struct Secp256k1CombTable;
+
+class Secp256k1FixedPoint
+{
+public:
+   Secp256k1FixedPoint(void);
+   ~Secp256k1FixedPoint(void);
+
+   bool setPublicKey(uint8_t const * pubKey65);
+
+   // pubKeyOut = (scalar mod n) * Q.  Fails if no key set, or scalar = 0
+   bool multiply(uint8_t const * scalar32, uint8_t * pubKeyOut65) const;
+
+private:
+   // ~90 kB of table, so no copying
+   Secp256k1FixedPoint(Secp256k1FixedPoint const &);
+   Secp256k1FixedPoint & operator=(Secp256k1FixedPoint const &);
+
+   Secp256k1CombTable * table_;
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// A parsed and validated public key, with the small table of its multiples
+// that verifyHash builds on every call.  Verifying many signatures against
+// the same key this way skips the parsing, the curve check and one field
+// inversion per signature.  Copyable (the table is under 1 kB), and safe to
+// verify with from several threads at once.
+struct Secp256k1OddMultiples;
+
+class Secp256k1PublicKey
+{
+public:
+   Secp256k1PublicKey(void);
+   Secp256k1PublicKey(Secp256k1PublicKey const & pk);
+   Secp256k1PublicKey & operator=(Secp256k1PublicKey const & pk);
+   ~Secp256k1PublicKey(void);
+
+   // Fails (and leaves the object invalid) if not a point on the curve
+   bool setPublicKey(uint8_t const * pubKey65);
+   bool isValid(void) const { return table_ != NULL; }
+
+   bool verifyHash(uint8_t const * hash32, uint8_t const * sig64) const;
+
+private:
+   Secp256k1OddMultiples * table_;
+};
+
+
+#endif
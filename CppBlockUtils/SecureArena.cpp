@@ -0,0 +1,251 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011, Alan C. Reiner    <alan.reiner@gmail.com>             //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include <iostream>
+#include <cstring>
+#include <pthread.h>
+
+#ifdef _MSC_VER
+   #include <windows.h>
+#else
+   #include <sys/mman.h>
+   #include <unistd.h>
+#endif
+
+#include "SecureArena.h"
+
+using namespace std;
+
+
+SECURE_ARENA_TLS uint32_t SecureArena::scopeDepth_ = 0;
+uint8_t * SecureArena::regionStart_ = NULL;
+uint8_t * SecureArena::regionEnd_   = NULL;
+
+// Everything else is only touched with the lock held
+static pthread_mutex_t arenaLock = PTHREAD_MUTEX_INITIALIZER;
+static bool       arenaInitTried    = false;
+static uint8_t *  arenaCommitTop    = NULL;   // end of readable memory
+static uint8_t *  arenaBumpPtr      = NULL;   // never handed out past here
+static uint8_t *  freeLists[SECURE_ARENA_NUM_CLASSES];
+static uint64_t   numBlocksInUse    = 0;
+static uint64_t   numBytesInUse     = 0;
+static uint64_t   numBytesUnlocked  = 0;
+static uint64_t   numCommits        = 0;
+static uint64_t   numHeapFallbacks  = 0;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Multiples of 16 up to 256 (classes 0-15), then 512, 1024, ... 64 kB
+static uint32_t getSizeClass(size_t nBytes)
+{
+   if(nBytes <= 16)
+      return 0;
+   if(nBytes <= 256)
+      return (uint32_t)((nBytes+15)/16) - 1;
+
+   uint32_t c = 16;
+   size_t classSize = 512;
+   while(classSize < nBytes)
+   {
+      classSize *= 2;
+      c++;
+   }
+   return c;
+}
+
+static size_t getClassSize(uint32_t c)
+{
+   return (c < 16 ? 16*(c+1) : ((size_t)512) << (c-16));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Through a volatile pointer, so the compiler can't decide the stores are
+// dead because the memory is about to be freed
+void SecureArena::secureZero(void * ptr, size_t nBytes)
+{
+   volatile uint8_t * p = (volatile uint8_t *)ptr;
+   while(nBytes--)
+      *p++ = 0;
+}
+
+static size_t getPageSize(void)
+{
+#ifdef _MSC_VER
+   SYSTEM_INFO si;
+   GetSystemInfo(&si);
+   return (size_t)si.dwPageSize;
+#else
+   return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Reserve the address range, with nothing readable yet.  The first page is
+// never committed, so it's the guard in front
+bool SecureArena::initRegion(void)
+{
+   arenaInitTried = true;
+   size_t pageSize = getPageSize();
+#ifdef _MSC_VER
+   void * base = VirtualAlloc(NULL, SECURE_ARENA_RESERVE_SIZE,
+                              MEM_RESERVE, PAGE_NOACCESS);
+   if(base == NULL)
+      return false;
+#else
+   void * base = mmap(NULL, SECURE_ARENA_RESERVE_SIZE, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+   if(base == MAP_FAILED)
+      return false;
+#endif
+
+   for(uint32_t c=0; c<SECURE_ARENA_NUM_CLASSES; c++)
+      freeLists[c] = NULL;
+
+   arenaCommitTop = (uint8_t*)base + pageSize;
+   arenaBumpPtr   = arenaCommitTop;
+   regionEnd_     = (uint8_t*)base + SECURE_ARENA_RESERVE_SIZE;
+   regionStart_   = arenaCommitTop;
+   return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Reserve the region during static initialization, so regionStart_ and 
+// regionEnd_ are written before contains() can be called from two threads.
+// Static constructors in other files may get to allocate() first;  that's 
+// still single-threaded, and then this does nothing
+struct SecureArenaEagerInit
+{
+   SecureArenaEagerInit(void)
+   {
+      pthread_mutex_lock(&arenaLock);
+      if(!arenaInitTried)
+         SecureArena::initRegion();
+      pthread_mutex_unlock(&arenaLock);
+   }
+};
+
+static SecureArenaEagerInit secureArenaEagerInit;
+
+////////////////////////////////////////////////////////////////////////////////
+// Make the next chunk readable and lock it.  The pages after it are still
+// inaccessible, so running off the end of the last block faults
+bool SecureArena::commitMore(void)
+{
+   if(arenaCommitTop + SECURE_ARENA_COMMIT_SIZE > regionEnd_)
+      return false;
+
+#ifdef _MSC_VER
+   if(VirtualAlloc(arenaCommitTop, SECURE_ARENA_COMMIT_SIZE,
+                   MEM_COMMIT, PAGE_READWRITE) == NULL)
+      return false;
+   bool isLocked = (VirtualLock(arenaCommitTop, SECURE_ARENA_COMMIT_SIZE) != 0);
+#else
+   if(mprotect(arenaCommitTop, SECURE_ARENA_COMMIT_SIZE,
+               PROT_READ | PROT_WRITE) != 0)
+      return false;
+   bool isLocked = (mlock(arenaCommitTop, SECURE_ARENA_COMMIT_SIZE) == 0);
+#endif
+
+   if(!isLocked)
+   {
+      if(numBytesUnlocked == 0)
+         cerr << "***WARNING: Could not lock secure memory (RLIMIT_MEMLOCK?)"
+              << endl;
+      numBytesUnlocked += SECURE_ARENA_COMMIT_SIZE;
+   }
+
+   arenaCommitTop += SECURE_ARENA_COMMIT_SIZE;
+   numCommits++;
+   return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void * SecureArena::allocate(size_t nBytes)
+{
+   if(nBytes > SECURE_ARENA_MAX_BLOCK)
+      return NULL;
+
+   uint32_t c = getSizeClass(nBytes);
+   size_t classSize = getClassSize(c);
+   uint8_t * block = NULL;
+
+   pthread_mutex_lock(&arenaLock);
+   if(!arenaInitTried)
+      initRegion();
+
+   if(freeLists[c] != NULL)
+   {
+      // The next pointer is the only thing left in a freed block
+      block = freeLists[c];
+      memcpy(&freeLists[c], block, sizeof(uint8_t*));
+      secureZero(block, sizeof(uint8_t*));
+   }
+   else if(regionStart_ != NULL)
+   {
+      bool haveRoom = true;
+      while(haveRoom && arenaBumpPtr + classSize > arenaCommitTop)
+         haveRoom = commitMore();
+
+      if(haveRoom)
+      {
+         block = arenaBumpPtr;
+         arenaBumpPtr += classSize;
+      }
+   }
+
+   if(block != NULL)
+   {
+      numBlocksInUse++;
+      numBytesInUse += classSize;
+   }
+   else if(numHeapFallbacks++ == 0)
+      cerr << "***WARNING: Secure memory arena is full, using the heap" << endl;
+   pthread_mutex_unlock(&arenaLock);
+   return block;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void SecureArena::deallocate(void * ptr, size_t nBytes)
+{
+   uint32_t c = getSizeClass(nBytes);
+   size_t classSize = getClassSize(c);
+
+   // Nothing needs the lock for this part
+   secureZero(ptr, classSize);
+
+   pthread_mutex_lock(&arenaLock);
+   memcpy(ptr, &freeLists[c], sizeof(uint8_t*));
+   freeLists[c] = (uint8_t*)ptr;
+   numBlocksInUse--;
+   numBytesInUse -= classSize;
+   pthread_mutex_unlock(&arenaLock);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Stats are read under the lock, so each one is consistent by itself
+static uint64_t readStat(uint64_t const & stat)
+{
+   pthread_mutex_lock(&arenaLock);
+   uint64_t val = stat;
+   pthread_mutex_unlock(&arenaLock);
+   return val;
+}
+
+uint64_t SecureArena::getNumBlocksInUse(void)   { return readStat(numBlocksInUse);   }
+uint64_t SecureArena::getNumBytesInUse(void)    { return readStat(numBytesInUse);    }
+uint64_t SecureArena::getNumBytesUnlocked(void) { return readStat(numBytesUnlocked); }
+uint64_t SecureArena::getNumCommits(void)       { return readStat(numCommits);       }
+uint64_t SecureArena::getNumHeapFallbacks(void) { return readStat(numHeapFallbacks); }
+
+uint64_t SecureArena::getNumBytesCommitted(void)
+{
+   return readStat(numCommits) * SECURE_ARENA_COMMIT_SIZE;
+}
@@ -0,0 +1,141 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011, Alan C. Reiner    <alan.reiner@gmail.com>             //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Page-locked memory for SecureBinaryData.
+//
+// SecureBinaryData used to mlock/munlock its own buffer every time it was
+// created, resized or assigned.  That's a syscall per small key, mlock'd
+// pages aren't counted (so unlocking one key unlocks every other key on
+// the same page), and whatever buffer the vector left behind when it grew
+// went back to the heap still holding key material.
+//
+// Instead, all the SecureBinaryData buffers come out of one region:
+//
+//    -- The whole address range is reserved up front, behind a guard page.
+//       It's made readable and locked SECURE_ARENA_COMMIT_SIZE at a time as
+//       it fills up, and the not-yet-committed part is the guard at the end
+//    -- Blocks come in size classes (multiples of 16 bytes up to 256, then
+//       powers of two up to SECURE_ARENA_MAX_BLOCK), each with a free list
+//    -- Freed blocks are zeroed before they go on the free list
+//
+// So once a program has been running a while, making and destroying keys
+// doesn't make any syscalls at all.  Bigger buffers (like large KDF lookup
+// tables), and anything after the whole range is used, come from the heap
+// and are mlock'd by SecureBinaryData like before.
+//
+// BinaryData allocates with SecureArena::allocateBuffer, which only goes to
+// the arena while a SecureAllocScope is open on the calling thread (which 
+// the SecureBinaryData methods do).  A buffer allocated in a scope stays 
+// secure:  if it's grown through a BinaryData method, the new buffer comes
+// from the arena too, and the bytes it drops (on a shrinking resize, or 
+// when it's freed, arena or heap) are zeroed.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _SECURE_ARENA_H_
+#define _SECURE_ARENA_H_
+
+#include <cstddef>
+#include <new>
+#include <stdint.h>
+
+#ifdef _MSC_VER
+   #define SECURE_ARENA_TLS __declspec(thread)
+#else
+   #define SECURE_ARENA_TLS __thread
+#endif
+
+// Address space reserved for the arena, and how much of it gets committed
+// and locked each time it grows.  An mlock past RLIMIT_MEMLOCK fails, and
+// that part of the arena is still used, just not locked 
+#define SECURE_ARENA_RESERVE_SIZE   (128*1024*1024)
+#define SECURE_ARENA_COMMIT_SIZE    (1024*1024)
+#define SECURE_ARENA_MAX_BLOCK      (64*1024)
+#define SECURE_ARENA_NUM_CLASSES    24
+
+
+class SecureArena
+{
+public:
+   // NULL if nBytes is too big, or the arena is used up
+   static void * allocate(size_t nBytes);
+
+   // nBytes must be what was asked for in allocate (the same size class)
+   static void   deallocate(void * ptr, size_t nBytes);
+
+   // No lock:  the region is set up while the library is loaded, before 
+   // any other thread can be running, and never changes after that
+   static bool contains(void const * ptr)
+   {
+      return ( (uint8_t const *)ptr >= regionStart_ &&
+               (uint8_t const *)ptr <  regionEnd_ );
+   }
+
+   static bool isSecureScope(void) { return scopeDepth_ > 0; }
+
+   // memset(0) that isn't optimized away, for memory about to be freed
+   static void secureZero(void * ptr, size_t nBytes);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // What BinaryData allocates its buffers with:  the arena inside a 
+   // SecureAllocScope or if secure (when it fits), otherwise the heap.  
+   // Buffers go back to wherever they came from, by their address
+   static uint8_t * allocateBuffer(size_t nBytes, bool secure=false)
+   {
+      if(nBytes > 0 && (secure || scopeDepth_ > 0))
+      {
+         void * ptr = allocate(nBytes);
+         if(ptr != NULL)
+            return (uint8_t*)ptr;
+      }
+      return (uint8_t*)::operator new(nBytes);
+   }
+
+   static void freeBuffer(uint8_t * ptr, size_t nBytes)
+   {
+      if(contains(ptr))
+         deallocate(ptr, nBytes);
+      else
+         ::operator delete(ptr);
+   }
+
+   /////////////////////////////////////////////////////////////////////////////
+   static uint64_t getNumBlocksInUse(void);
+   static uint64_t getNumBytesInUse(void);
+   static uint64_t getNumBytesCommitted(void);
+   static uint64_t getNumBytesUnlocked(void);
+   static uint64_t getNumCommits(void);      // = syscalls made since startup
+   static uint64_t getNumHeapFallbacks(void); // fit a class, but arena full
+
+private:
+   friend class SecureAllocScope;
+   friend struct SecureArenaEagerInit;
+
+   static bool initRegion(void);
+   static bool commitMore(void);
+
+   static SECURE_ARENA_TLS uint32_t scopeDepth_;
+   static uint8_t *                 regionStart_;
+   static uint8_t *                 regionEnd_;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// While one of these exists, BinaryData buffers allocated on this thread
+// come from the arena
+class SecureAllocScope
+{
+public:
+   SecureAllocScope(void)  { SecureArena::scopeDepth_++; }
+   ~SecureAllocScope(void) { SecureArena::scopeDepth_--; }
+};
+
+
+#endif
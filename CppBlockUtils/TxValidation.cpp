@@ -0,0 +1,549 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011, Alan C. Reiner    <alan.reiner@gmail.com>             //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "TxValidation.h"
+#include "EncryptionUtils.h"
+
+
+/////////////////////////////////////////////////////////////////////////////
+SigCheckCache::SigCheckCache(uint32_t maxEntries) :
+   maxEntries_(maxEntries),
+   numHits_(0),
+   numMisses_(0)
+{
+   pthread_mutex_init(&lock_, NULL);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+SigCheckCache::~SigCheckCache(void)
+{
+   pthread_mutex_destroy(&lock_);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Hashing it all down keeps the entries small, and the message hash is
+// already a hash of everything the signature covers
+BinaryData SigCheckCache::getKey(BinaryData const & msgHash32,
+                                 BinaryData const & sig64,
+                                 BinaryData const & pubKey65)
+{
+   BinaryWriter bw(32 + 64 + 65);
+   bw.put_BinaryData(msgHash32);
+   bw.put_BinaryData(sig64);
+   bw.put_BinaryData(pubKey65);
+
+   // Not BtcUtils::getHash256, whose hasher is shared by every caller
+   BinaryData key(32);
+   CryptoPP::SHA256 sha256;
+   sha256.CalculateDigest(key.getPtr(), bw.getData().getPtr(), 
+                                        bw.getData().getSize());
+   return key;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool SigCheckCache::contains(BinaryData const & key)
+{
+   pthread_mutex_lock(&lock_);
+   bool found = (entries_.find(key) != entries_.end());
+   if(found)
+      numHits_++;
+   else
+      numMisses_++;
+   pthread_mutex_unlock(&lock_);
+   return found;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void SigCheckCache::insert(BinaryData const & key)
+{
+   pthread_mutex_lock(&lock_);
+   if(maxEntries_ > 0 && entries_.insert(key).second)
+   {
+      arrival_.push_back(key);
+      while(entries_.size() > maxEntries_)
+         evictOldest();
+   }
+   pthread_mutex_unlock(&lock_);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void SigCheckCache::clear(void)
+{
+   pthread_mutex_lock(&lock_);
+   entries_.clear();
+   arrival_.clear();
+   numHits_   = 0;
+   numMisses_ = 0;
+   pthread_mutex_unlock(&lock_);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void SigCheckCache::setMaxEntries(uint32_t n)
+{
+   pthread_mutex_lock(&lock_);
+   maxEntries_ = n;
+   while(entries_.size() > maxEntries_)
+      evictOldest();
+   pthread_mutex_unlock(&lock_);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+uint32_t SigCheckCache::getNumEntries(void)
+{
+   pthread_mutex_lock(&lock_);
+   uint32_t n = entries_.size();
+   pthread_mutex_unlock(&lock_);
+   return n;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Caller holds the lock
+void SigCheckCache::evictOldest(void)
+{
+   entries_.erase(arrival_.front());
+   arrival_.pop_front();
+}
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+uint32_t ScriptCheckBatch::addTxIn(TxRef & tx,
+                                   uint32_t inIdx,
+                                   BinaryDataRef prevOutScript,
+                                   bool evalP2SH)
+{
+   uint32_t resultIdx = results_.size();
+   results_.push_back(TXIN_CHECK_PENDING);
+
+   TxInRef txin = tx.getTxInRef(inIdx);
+   vector<BinaryDataRef> pushes;
+   if( !getScriptPushes(txin.getScriptRef(), pushes) )
+      results_[resultIdx] = TXIN_CHECK_NONSTANDARD;
+   else
+      results_[resultIdx] = queueScript(tx, inIdx, prevOutScript, pushes,
+                                        evalP2SH, resultIdx);
+   return resultIdx;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+uint32_t ScriptCheckBatch::addTxInNoPrevOut(void)
+{
+   results_.push_back(TXIN_CHECK_NO_PREVOUT);
+   return results_.size()-1;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Either decides the TxIn right here, or queues its signature checks and
+// returns TXIN_CHECK_PENDING
+TXIN_CHECK_RESULT ScriptCheckBatch::queueScript(
+                                       TxRef & tx,
+                                       uint32_t inIdx,
+                                       BinaryDataRef script,
+                                       vector<BinaryDataRef> const & pushes,
+                                       bool evalP2SH,
+                                       uint32_t resultIdx)
+{
+   uint32_t sz = script.getSize();
+   uint8_t const * s = script.getPtr();
+   uint32_t nPush = pushes.size();
+
+   // Extra items under the ones a script uses don't make it fail, so we
+   // always take the signatures and keys from the top of the stack
+   vector<BinaryDataRef> sigs;
+   vector<BinaryDataRef> keys;
+
+   if( sz == 25               &&
+       s[0]  == OP_DUP        &&
+       s[1]  == OP_HASH160    &&
+       s[2]  == 20            &&
+       s[23] == OP_EQUALVERIFY &&
+       s[24] == OP_CHECKSIG    )
+   {
+      // Pay-to-pubkey-hash:  <sig> <pubkey>
+      if(nPush < 2)
+         return TXIN_CHECK_INVALID;
+      if( !(BtcUtils::getHash160(pushes[nPush-1]) == BinaryDataRef(s+3, 20)) )
+         return TXIN_CHECK_INVALID;
+      sigs.push_back(pushes[nPush-2]);
+      keys.push_back(pushes[nPush-1]);
+   }
+   else if( (sz == 67 && s[0] == 65 && s[66] == OP_CHECKSIG) ||
+            (sz == 35 && s[0] == 33 && s[34] == OP_CHECKSIG) )
+   {
+      // Pay-to-pubkey:  <sig>
+      if(nPush < 1)
+         return TXIN_CHECK_INVALID;
+      sigs.push_back(pushes[nPush-1]);
+      keys.push_back(BinaryDataRef(s+1, sz-2));
+   }
+   else if( sz >= 3                     &&
+            s[0]    >= OP_1             && s[0]    <= OP_16 &&
+            s[sz-2] >= OP_1             && s[sz-2] <= OP_16 &&
+            s[sz-1] == OP_CHECKMULTISIG )
+   {
+      // Bare multisig:  OP_0 <sig>...<sig>  (the OP_0 is eaten by a bug in
+      // OP_CHECKMULTISIG, and can be anything)
+      uint32_t m = s[0]    - OP_1 + 1;
+      uint32_t n = s[sz-2] - OP_1 + 1;
+      if( !getScriptPushes(BinaryDataRef(s+1, sz-3), keys) ||
+          keys.size() != n || m > n )
+         return TXIN_CHECK_NONSTANDARD;
+      if(nPush < m+1)
+         return TXIN_CHECK_INVALID;
+      sigs.assign(pushes.end()-m, pushes.end());
+   }
+   else if( sz == 23            &&
+            s[0]  == OP_HASH160 &&
+            s[1]  == 20         &&
+            s[22] == OP_EQUAL    )
+   {
+      // Pay-to-script-hash:  <whatever the redeem script needs> <script>
+      if(nPush < 1)
+         return TXIN_CHECK_INVALID;
+      if( !(BtcUtils::getHash160(pushes[nPush-1]) == BinaryDataRef(s+2, 20)) )
+         return TXIN_CHECK_INVALID;
+      if(!evalP2SH)
+         return TXIN_CHECK_VALID;
+
+      vector<BinaryDataRef> innerPushes(pushes.begin(), pushes.end()-1);
+      return queueScript(tx, inIdx, pushes[nPush-1], innerPushes,
+                         false, resultIdx);
+   }
+   else
+      return TXIN_CHECK_NONSTANDARD;
+
+   queueMultiSig(tx, inIdx, script, sigs, keys, resultIdx);
+   return TXIN_CHECK_PENDING;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void ScriptCheckBatch::queueMultiSig(TxRef & tx,
+                                     uint32_t inIdx,
+                                     BinaryDataRef subscript,
+                                     vector<BinaryDataRef> const & sigs,
+                                     vector<BinaryDataRef> const & keys,
+                                     uint32_t resultIdx)
+{
+   uint32_t m = sigs.size();
+   uint32_t n = keys.size();
+
+   pending_.push_back(PendingTxIn());
+   PendingTxIn & ptx = pending_.back();
+   ptx.resultIdx_ = resultIdx;
+   ptx.numSigs_   = m;
+   ptx.numKeys_   = n;
+   ptx.checks_.assign(m*n, (int32_t)SIG_CHECK_FALSE);
+
+   BinaryData preimage;
+   BinaryData sig64;
+   for(uint32_t isig=0; isig<m; isig++)
+   {
+      // An empty signature is just a failed check, anything we can't turn
+      // into a message and (r,s) means we can't say either way
+      int32_t sigState = SIG_CHECK_FALSE;
+      uint32_t sigSize = sigs[isig].getSize();
+      if(sigSize > 0)
+      {
+         uint32_t hashType = sigs[isig][sigSize-1];
+         preimage = getSigHashPreimage(tx, inIdx, subscript, hashType);
+         if(preimage.getSize() == 0 ||
+            !parseDERSignature(sigs[isig].getSliceRef(0, sigSize-1), sig64))
+            sigState = SIG_CHECK_UNKNOWN;
+         else
+            sigState = 0;
+      }
+
+      // CHECKMULTISIG only ever tries sig i against keys i..i+(n-m), and
+      // never past the first one it matches, so keys after a cache hit 
+      // don't need checking
+      bool cacheHit = false;
+      for(uint32_t ikey=isig; ikey<=isig+(n-m) && !cacheHit; ikey++)
+      {
+         int32_t & check = ptx.checks_[isig*n + ikey];
+         if(sigState < 0)
+            check = sigState;
+         else
+            check = queueSigCheck(preimage, sig64, keys[ikey]);
+         cacheHit = (check == SIG_CHECK_CACHED);
+      }
+   }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+int32_t ScriptCheckBatch::queueSigCheck(BinaryData const & preimage,
+                                        BinaryData const & sig64,
+                                        BinaryDataRef pubKey)
+{
+   BinaryData pubKey65;
+   if(pubKey.getSize() == 65 && pubKey[0] == 0x04)
+      pubKey65 = pubKey;
+   else if(pubKey.getSize() == 33 && (pubKey[0] == 0x02 || pubKey[0] == 0x03))
+   {
+      SecureBinaryData pub33(pubKey);
+      pubKey65 = CryptoECDSA().UncompressPublicKey(pub33).getRawCopy();
+      if(pubKey65.getSize() != 65)
+         return SIG_CHECK_FALSE;
+   }
+   else
+      return SIG_CHECK_UNKNOWN;
+
+   if(sigCache_ != NULL)
+   {
+      BinaryData key = SigCheckCache::getKey(BtcUtils::getHash256(preimage),
+                                             sig64, pubKey65);
+      if(sigCache_->contains(key))
+      {
+         numCacheHits_++;
+         return SIG_CHECK_CACHED;
+      }
+      sigCacheKeys_.push_back(key);
+   }
+
+   sigMsgs_.push_back(preimage);
+   sigSigs_.push_back(sig64);
+   sigPubKeys_.push_back(pubKey65);
+   numSigChecks_++;
+   return (int32_t)(sigMsgs_.size()-1);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void ScriptCheckBatch::verifyAll(uint32_t numThreads)
+{
+   vector<int> sigOK;
+   if(sigMsgs_.size() > 0)
+      sigOK = CryptoECDSA().VerifyBatch(sigMsgs_, sigSigs_, sigPubKeys_,
+                                        numThreads);
+
+   if(sigCache_ != NULL && addToCache_)
+      for(uint32_t i=0; i<sigOK.size(); i++)
+         if(sigOK[i] != 0)
+            sigCache_->insert(sigCacheKeys_[i]);
+
+   // Walk the sigs and keys the way OP_CHECKMULTISIG does:  each sig has to
+   // match a key after the one the previous sig matched
+   for(uint32_t p=0; p<pending_.size(); p++)
+   {
+      PendingTxIn & ptx = pending_[p];
+      uint32_t m = ptx.numSigs_;
+      uint32_t n = ptx.numKeys_;
+      TXIN_CHECK_RESULT result = TXIN_CHECK_VALID;
+      uint32_t isig = 0;
+      uint32_t ikey = 0;
+      while(isig < m)
+      {
+         if(m - isig > n - ikey)
+         {
+            result = TXIN_CHECK_INVALID;
+            break;
+         }
+
+         int32_t check = ptx.checks_[isig*n + ikey];
+         if(check == SIG_CHECK_UNKNOWN)
+         {
+            result = TXIN_CHECK_NONSTANDARD;
+            break;
+         }
+         if(check == SIG_CHECK_CACHED || (check >= 0 && sigOK[check] != 0))
+            isig++;
+         ikey++;
+      }
+      results_[ptx.resultIdx_] = result;
+   }
+
+   pending_.clear();
+   sigMsgs_.clear();
+   sigSigs_.clear();
+   sigPubKeys_.clear();
+   sigCacheKeys_.clear();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+uint32_t ScriptCheckBatch::countResults(TXIN_CHECK_RESULT r) const
+{
+   uint32_t count = 0;
+   for(uint32_t i=0; i<results_.size(); i++)
+      if(results_[i] == r)
+         count++;
+   return count;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+void ScriptCheckBatch::clear(void)
+{
+   results_.clear();
+   pending_.clear();
+   sigMsgs_.clear();
+   sigSigs_.clear();
+   sigPubKeys_.clear();
+   sigCacheKeys_.clear();
+   numSigChecks_ = 0;
+   numCacheHits_ = 0;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+BinaryData ScriptCheckBatch::getSigHashPreimage(TxRef & tx,
+                                                uint32_t inIdx,
+                                                BinaryDataRef subscript,
+                                                uint32_t hashType)
+{
+   uint32_t baseType     = hashType & 0x1f;
+   bool     anyoneCanPay = (hashType & SIGHASH_ANYONECANPAY) != 0;
+   uint32_t nIn          = tx.getNumTxIn();
+   uint32_t nOut         = tx.getNumTxOut();
+   if(inIdx >= nIn || (baseType == SIGHASH_SINGLE && inIdx >= nOut))
+      return BinaryData(0);
+
+   BinaryDataRef txBytes = tx.serializeRef();
+   BinaryWriter bw(tx.getSize() + subscript.getSize() + 8);
+   bw.put_BinaryDataRef(txBytes.getSliceRef(0, 4));
+
+   // TxIns:  outpoint, script (only ours), sequence (zeroed for the others
+   // under NONE and SINGLE, so they can be replaced)
+   bw.put_var_int(anyoneCanPay ? 1 : nIn);
+   for(uint32_t i=0; i<nIn; i++)
+   {
+      if(anyoneCanPay && i != inIdx)
+         continue;
+
+      uint32_t inStart = tx.getTxInOffset(i);
+      uint32_t inEnd   = tx.getTxInOffset(i+1);
+      bw.put_BinaryDataRef(txBytes.getSliceRef(inStart, 36));
+      if(i == inIdx)
+      {
+         bw.put_var_int(subscript.getSize());
+         bw.put_BinaryDataRef(subscript);
+      }
+      else
+         bw.put_var_int(0);
+
+      if(i != inIdx && (baseType == SIGHASH_NONE || baseType == SIGHASH_SINGLE))
+         bw.put_uint32_t(0);
+      else
+         bw.put_BinaryDataRef(txBytes.getSliceRef(inEnd-4, 4));
+   }
+
+   // TxOuts:  none, ours with blanks before it, or all of them
+   uint32_t outStart = tx.getTxOutOffset(0);
+   uint32_t outEnd   = tx.getTxOutOffset(nOut);
+   if(baseType == SIGHASH_NONE)
+      bw.put_var_int(0);
+   else if(baseType == SIGHASH_SINGLE)
+   {
+      bw.put_var_int(inIdx+1);
+      for(uint32_t i=0; i<inIdx; i++)
+      {
+         bw.put_uint64_t(UINT64_MAX);
+         bw.put_var_int(0);
+      }
+      uint32_t ourStart = tx.getTxOutOffset(inIdx);
+      uint32_t ourEnd   = tx.getTxOutOffset(inIdx+1);
+      bw.put_BinaryDataRef(txBytes.getSliceRef(ourStart, ourEnd-ourStart));
+   }
+   else
+   {
+      bw.put_var_int(nOut);
+      bw.put_BinaryDataRef(txBytes.getSliceRef(outStart, outEnd-outStart));
+   }
+
+   // Lock time, and the full hash type
+   bw.put_BinaryDataRef(txBytes.getSliceRef(outEnd, 4));
+   bw.put_uint32_t(hashType);
+   return bw.getData();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// 0x30 <len> 0x02 <rlen> <r> 0x02 <slen> <s>.  Like the OpenSSL parser the
+// Satoshi client used, we let r and s have extra leading zero bytes, and
+// ignore anything after the sequence.
+bool ScriptCheckBatch::parseDERSignature(BinaryDataRef derSig, BinaryData & sig64)
+{
+   uint32_t sz = derSig.getSize();
+   uint8_t const * p = derSig.getPtr();
+   if(sz < 8 || p[0] != 0x30 || p[1] + 2u > sz)
+      return false;
+
+   sig64.resize(64);
+   memset(sig64.getPtr(), 0, 64);
+
+   uint32_t pos = 2;
+   uint32_t seqEnd = 2 + p[1];
+   for(uint32_t part=0; part<2; part++)
+   {
+      if(pos + 2 > seqEnd || p[pos] != 0x02)
+         return false;
+      uint32_t len = p[pos+1];
+      pos += 2;
+      if(len == 0 || pos + len > seqEnd)
+         return false;
+
+      uint8_t const * num = p + pos;
+      pos += len;
+      while(len > 0 && num[0] == 0x00)
+      {
+         num++;
+         len--;
+      }
+      if(len > 32)
+         return false;
+      memcpy(sig64.getPtr() + 32*part + (32-len), num, len);
+   }
+   return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+bool ScriptCheckBatch::getScriptPushes(BinaryDataRef script,
+                                       vector<BinaryDataRef> & pushes)
+{
+   // What OP_1NEGATE and OP_1-OP_16 push, so they can be referenced too
+   static uint8_t const SMALL_INTS[17] = { 0x81, 
+                                           1,  2,  3,  4,  5,  6,  7,  8,
+                                           9, 10, 11, 12, 13, 14, 15, 16 };
+   pushes.clear();
+   uint32_t sz = script.getSize();
+   uint8_t const * s = script.getPtr();
+   uint32_t i = 0;
+   while(i < sz)
+   {
+      uint8_t op = s[i++];
+      uint32_t len;
+      if(op == OP_1NEGATE || (op >= OP_1 && op <= OP_16))
+      {
+         uint32_t n = (op == OP_1NEGATE ? 0 : op - OP_1 + 1);
+         pushes.push_back(BinaryDataRef(SMALL_INTS+n, 1));
+         continue;
+      }
+      else if(op < OP_PUSHDATA1)
+         len = op;
+      else if(op == OP_PUSHDATA1 && i+1 <= sz)
+      {
+         len = s[i];
+         i += 1;
+      }
+      else if(op == OP_PUSHDATA2 && i+2 <= sz)
+      {
+         len = *(uint16_t*)(s+i);
+         i += 2;
+      }
+      else if(op == OP_PUSHDATA4 && i+4 <= sz)
+      {
+         len = *(uint32_t*)(s+i);
+         i += 4;
+      }
+      else
+         return false;
+
+      if(len > sz - i)
+         return false;
+      pushes.push_back(BinaryDataRef(s+i, len));
+      i += len;
+   }
+   return true;
+}
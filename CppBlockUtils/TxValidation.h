@@ -0,0 +1,226 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  Copyright (C) 2011, Alan C. Reiner    <alan.reiner@gmail.com>             //
+//  Distributed under the GNU Affero General Public License (AGPL v3)         //
+//  See LICENSE or http://www.gnu.org/licenses/agpl.html                      //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Script and signature checks for TxIns.
+//
+// TxIns are queued up with the script of the TxOut they spend, and then all
+// their signatures are checked at once with CryptoECDSA::VerifyBatch, which
+// spreads them over threads.  The BDM resolves the TxOuts (see
+// BlockDataManager_FullRAM::checkBlockScripts), this only needs the scripts.
+//
+// This is not a general script interpreter.  It evaluates the TxOut script
+// forms that make up nearly the whole blockchain:
+//
+//    -- pay-to-pubkey-hash:  OP_DUP OP_HASH160 <20> OP_EQUALVERIFY OP_CHECKSIG
+//    -- pay-to-pubkey:       <pubkey> OP_CHECKSIG
+//    -- bare multisig:       OP_m <pubkey>...<pubkey> OP_n OP_CHECKMULTISIG
+//    -- pay-to-script-hash:  OP_HASH160 <20> OP_EQUAL, wrapping any of the
+//                            above (BIP16, only after P2SH_ACTIVATION_TIME)
+//
+// with push-only TxIn scripts.  Anything else comes back NONSTANDARD, not
+// VALID or INVALID, and so do signatures we can't decode and hash types we
+// can't represent as a message (the SIGHASH_SINGLE out-of-range case).
+// Nothing here checks amounts or whether a TxOut was already spent.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _TXVALIDATION_H_
+#define _TXVALIDATION_H_
+
+#include <vector>
+#include <set>
+#include <deque>
+#include <pthread.h>
+
+#include "BinaryData.h"
+#include "BtcUtils.h"
+#include "BlockObj.h"
+#include "BlockObjRef.h"
+
+// BIP16:  pay-to-script-hash redeem scripts are evaluated in blocks with
+// timestamps from here on.  Before that, the TxOut was just a hash match
+#define P2SH_ACTIVATION_TIME  1333238400
+
+#define SIGHASH_ALL           0x01
+#define SIGHASH_NONE          0x02
+#define SIGHASH_SINGLE        0x03
+#define SIGHASH_ANYONECANPAY  0x80
+
+// Signatures that already verified, kept so the same (message, key, sig)
+// doesn't go through the EC math twice.  About 200 bytes per entry
+#define SIG_CACHE_DEFAULT_MAX_ENTRIES  100000
+
+using namespace std;
+
+
+typedef enum
+{
+   TXIN_CHECK_VALID,
+   TXIN_CHECK_INVALID,
+   TXIN_CHECK_NONSTANDARD,   // a script form we don't evaluate
+   TXIN_CHECK_NO_PREVOUT,    // couldn't find the TxOut it spends
+   TXIN_CHECK_PENDING        // queued, verifyAll() not called yet
+}  TXIN_CHECK_RESULT;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Set of signature checks that passed.  The BDM fills it while checking 
+// zero-conf tx as they arrive, and the block checks look here first, so 
+// the signatures of tx we've already seen only cost the hashing when they
+// get mined.  Only successes go in, so a hit always means valid.  When
+// full, the oldest entries are dropped first.  Safe to use from several
+// threads at once.
+class SigCheckCache
+{
+public:
+   SigCheckCache(uint32_t maxEntries=SIG_CACHE_DEFAULT_MAX_ENTRIES);
+   ~SigCheckCache(void);
+
+   // 32-byte key for the hash256 of the signed message, the 64-byte r||s 
+   // signature, and the 65-byte public key
+   static BinaryData getKey(BinaryData const & msgHash32,
+                            BinaryData const & sig64,
+                            BinaryData const & pubKey65);
+
+   bool     contains(BinaryData const & key);
+   void     insert(BinaryData const & key);
+   void     clear(void);
+
+   void     setMaxEntries(uint32_t n);
+   uint32_t getMaxEntries(void) const { return maxEntries_;      }
+   uint32_t getNumEntries(void);
+   uint64_t getNumHits(void) const    { return numHits_;         }
+   uint64_t getNumMisses(void) const  { return numMisses_;       }
+
+private:
+   // Has a mutex, so no copying
+   SigCheckCache(SigCheckCache const &);
+   SigCheckCache & operator=(SigCheckCache const &);
+
+   void evictOldest(void);
+
+   pthread_mutex_t    lock_;
+   set<HashString>    entries_;
+   deque<HashString>  arrival_;
+   uint32_t           maxEntries_;
+   uint64_t           numHits_;
+   uint64_t           numMisses_;
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+class ScriptCheckBatch
+{
+public:
+   ScriptCheckBatch(void) : 
+      numSigChecks_(0), 
+      numCacheHits_(0), 
+      sigCache_(NULL), 
+      addToCache_(false) {}
+
+   // Skip signatures found in the cache.  If addVerified, the ones that do
+   // get verified (successfully) are put in it
+   void setSigCache(SigCheckCache * cache, bool addVerified=false)
+                              { sigCache_ = cache; addToCache_ = addVerified; }
+
+   /////////////////////////////////////////////////////////////////////////////
+   // Queue TxIn inIdx of tx, which spends a TxOut with prevOutScript.  The
+   // messages to verify are built right away, so nothing needs to stay put
+   // until verifyAll.  Returns the index to get the result with.
+   uint32_t addTxIn(TxRef & tx,
+                    uint32_t inIdx,
+                    BinaryDataRef prevOutScript,
+                    bool evalP2SH=true);
+
+   // For a TxIn whose TxOut couldn't be found
+   uint32_t addTxInNoPrevOut(void);
+
+   // Check every signature queued since the last clear().  numThreads is
+   // passed on to CryptoECDSA::VerifyBatch (0 means one per core)
+   void verifyAll(uint32_t numThreads=0);
+
+   /////////////////////////////////////////////////////////////////////////////
+   uint32_t          getNumTxIn(void) const      { return results_.size(); }
+   TXIN_CHECK_RESULT getResult(uint32_t i) const { return results_[i];     }
+   uint32_t          getNumSigChecks(void) const { return numSigChecks_;   }
+   uint32_t          getNumPendingSigChecks(void) const 
+                                             { return sigMsgs_.size();     }
+   uint32_t          getNumSigCacheHits(void) const { return numCacheHits_; }
+   uint32_t          countResults(TXIN_CHECK_RESULT r) const;
+   void              clear(void);
+
+   /////////////////////////////////////////////////////////////////////////////
+   // The message a TxIn signature signs (its hash256 is what's actually
+   // signed):  the tx with every TxIn script empty except inIdx's, which is
+   // the subscript, trimmed according to hashType, with hashType appended
+   // as 4 bytes.  Empty for SIGHASH_SINGLE with no matching TxOut, where
+   // the Satoshi client signs the number 1 instead of any message.
+   static BinaryData getSigHashPreimage(TxRef & tx,
+                                        uint32_t inIdx,
+                                        BinaryDataRef subscript,
+                                        uint32_t hashType);
+
+   // DER-encoded (r,s), without the hash-type byte, to 64-byte r||s
+   static bool parseDERSignature(BinaryDataRef derSig, BinaryData & sig64);
+
+   // The data pushed by a push-only script, including the one-byte numbers
+   // from OP_1NEGATE and OP_1-OP_16.  False if there's anything else in it,
+   // or it runs off the end
+   static bool getScriptPushes(BinaryDataRef script,
+                               vector<BinaryDataRef> & pushes);
+
+private:
+   // Signature-check outcomes that don't need the EC math
+   enum { SIG_CHECK_FALSE = -1, SIG_CHECK_UNKNOWN = -2, SIG_CHECK_CACHED = -3 };
+
+   // A queued TxIn is m signatures against n keys, checked in order like
+   // OP_CHECKMULTISIG (single-sig forms are 1-of-1).  checks_ is m x n: an
+   // index into the sig* vectors, or one of the SIG_CHECK_* values.  Pairs
+   // that CHECKMULTISIG can never try are left as SIG_CHECK_FALSE.
+   struct PendingTxIn
+   {
+      uint32_t        resultIdx_;
+      uint32_t        numSigs_;
+      uint32_t        numKeys_;
+      vector<int32_t> checks_;
+   };
+
+   TXIN_CHECK_RESULT queueScript(TxRef & tx,
+                                 uint32_t inIdx,
+                                 BinaryDataRef script,
+                                 vector<BinaryDataRef> const & pushes,
+                                 bool evalP2SH,
+                                 uint32_t resultIdx);
+   void queueMultiSig(TxRef & tx,
+                      uint32_t inIdx,
+                      BinaryDataRef subscript,
+                      vector<BinaryDataRef> const & sigs,
+                      vector<BinaryDataRef> const & keys,
+                      uint32_t resultIdx);
+   int32_t queueSigCheck(BinaryData const & preimage,
+                         BinaryData const & sig64,
+                         BinaryDataRef pubKey);
+
+   vector<TXIN_CHECK_RESULT> results_;
+   vector<PendingTxIn>       pending_;
+   vector<BinaryData>        sigMsgs_;
+   vector<BinaryData>        sigSigs_;
+   vector<BinaryData>        sigPubKeys_;
+   vector<BinaryData>        sigCacheKeys_;   // only with a cache
+   uint32_t                  numSigChecks_;
+   uint32_t                  numCacheHits_;
+   SigCheckCache *           sigCache_;
+   bool                      addToCache_;
+};
+
+
+#endif
@@ -10,8 +10,29 @@
 #include <fstream>
 #include "UniversalTimer.h"
 
+#ifdef _MSC_VER
+   #include <windows.h>
+#else
+   #include <time.h>
+#endif
+
 using namespace std;
 
+////////////////////////////////////////////////////////////////////////////////
+double UniversalTimer::getMonotonicSec(void)
+{
+#ifdef _MSC_VER
+   LARGE_INTEGER freq, count;
+   QueryPerformanceFrequency(&freq);
+   QueryPerformanceCounter(&count);
+   return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (double)ts.tv_sec + 1e-9*(double)ts.tv_nsec;
+#endif
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // START UhiversalTimer::timer methods
 ////////////////////////////////////////////////////////////////////////////////
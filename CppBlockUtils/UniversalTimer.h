@@ -88,6 +88,11 @@ public:
    void printCSV(string filename, bool excludeZeros=false);
    void print(ostream & os=cout, bool excludeZeros=false);
    void print(string filename, bool excludeZeros=false);
+
+   // Wall-clock seconds since some arbitrary point.  Unlike time(0) it never
+   // jumps when the system time is changed, and unlike clock() it doesn't
+   // add up the CPU time of every thread in the process
+   static double getMonotonicSec(void);
 protected:
    UniversalTimer(void) : most_recent_key_("") { }
 private:
@@ -137,6 +137,7 @@ else:
 
 BLK0001_PATH    = os.path.join(BTC_HOME_DIR, 'blk0001.dat')
 SETTINGS_PATH   = os.path.join(BTC_HOME_DIR, 'ArmorySettings.txt')
+KDF_PROFILE_PATH = os.path.join(ARMORY_HOME_DIR, 'kdfprofile.bin')
 
 print 'Detected Operating system:', OS_NAME
 print '   User home-directory   :', USER_HOME_DIR
@@ -304,7 +305,8 @@ YEAR     = 365*DAY
 ################################################################################
 try:
    import CppBlockUtils as Cpp
-   from CppBlockUtils import KdfRomix, CryptoECDSA, CryptoAES, SecureBinaryData
+   from CppBlockUtils import KdfRomix, KdfCalibration, CryptoECDSA, CryptoAES
+   from CppBlockUtils import SecureBinaryData
 except:
    print '***ERROR:  C++ block utilities not available.'
    print '           Make sure that you have the SWIG-compiled modules'
@@ -326,6 +328,18 @@ except:
 TheBDM = Cpp.BlockDataManager().getBDM()
 
 
+################################################################################
+# How fast this machine runs the KDF.  Timed the first time a wallet needs
+# KDF params, and kept in the Armory home dir so later wallets don't wait
+TheKdfProfile = None
+def getKdfProfile():
+   global TheKdfProfile
+   if TheKdfProfile==None:
+      TheKdfProfile = KdfCalibration()
+      TheKdfProfile.loadOrCalibrate(KDF_PROFILE_PATH)
+   return TheKdfProfile
+
+
 
 # Define all the hashing functions we're going to need.  We don't actually
 # use any of the first three directly (sha1, sha256, ripemd160), we only
@@ -1577,19 +1591,7 @@ class PyBtcAddress(object):
       try:
          secureMsg = SecureBinaryData(binMsg)
          sig = CryptoECDSA().SignData(secureMsg, self.binPrivKey32_Plain)
-         sigstr = sig.toBinStr()
-         # We add an extra 0 byte to the beginning of each value to guarantee
-         # that they are interpretted as unsigned integers.  Not always necessary
-         # but it doesn't hurt to always do it.
-         rBin   = '\x00' + sigstr[:32 ]
-         sBin   = '\x00' + sigstr[ 32:]
-         rSize  = int_to_binary(len(rBin))
-         sSize  = int_to_binary(len(sBin))
-         rsSize = int_to_binary(len(rBin) + len(sBin) + 4)
-         sigScr = '\x30' + rsSize + \
-                  '\x02' + rSize + rBin + \
-                  '\x02' + sSize + sBin
-         return sigScr
+         return createDERSignature(sig.toBinStr())
       except:
          print 'Failed signature generation'
       finally:
@@ -1777,6 +1779,84 @@ class PyBtcAddress(object):
          return newAddr
 
 
+   #############################################################################
+   def extendAddressChainBatch(self, numAddr, secureKdfOutput=None):
+      """
+      Same as calling extendAddressChain() numAddr times down the chain, but
+      all the EC math and hashing is done in one call into C++.  Returns the
+      list of new addresses in chain order, or None if this address has a
+      private key that we cannot decrypt right now (the caller should fall
+      back to extendAddressChain, which handles that case).
+      """
+      if not self.chaincode.getSize() == 32:
+         raise KeyDataError, 'No chaincode has been defined to extend chain'
+
+      if self.hasPrivKey() and self.isLocked and not secureKdfOutput:
+         return None
+
+      newAddrList = []
+      if self.hasPrivKey():
+         wasLocked = self.isLocked
+         if self.useEncryption and self.isLocked:
+            self.unlock(secureKdfOutput)
+
+         if self.hasPubKey():
+            allKeys = CryptoECDSA().ComputeChainedPrivateKeyBatch( \
+                                    self.binPrivKey32_Plain, \
+                                    self.chaincode, numAddr, \
+                                    self.binPublicKey65)
+         else:
+            allKeys = CryptoECDSA().ComputeChainedPrivateKeyBatch( \
+                                    self.binPrivKey32_Plain, \
+                                    self.chaincode, numAddr)
+         if not allKeys.getSize() == numAddr*Cpp.CHAINED_PRIVKEY_RECORD_SIZE:
+            raise KeyDataError, 'Failed to extend chain'
+
+         for i in range(numAddr):
+            rec = i*Cpp.CHAINED_PRIVKEY_RECORD_SIZE
+            newPriv = allKeys.getSliceCopy(rec, 32)
+            newPub  = allKeys.getSliceCopy(rec+32, 65)
+            new160  = allKeys.getSliceCopy(rec+97, 20).toBinStr()
+
+            # The keys came out of the same C++ call, no need to recheck them
+            newAddr = PyBtcAddress()
+            newAddr.createFromPlainKeyData(newPriv, new160, \
+                                          IV16=SecureBinaryData().GenerateRandom(16), \
+                                          publicKey65=newPub, skipCheck=True)
+            newAddr.useEncryption = self.useEncryption
+            newAddr.isInitialized = True
+            newAddr.chaincode     = self.chaincode
+            newAddr.chainIndex    = self.chainIndex+1+i
+            if newAddr.useEncryption:
+               newAddr.lock(secureKdfOutput)
+               if not wasLocked:
+                  newAddr.unlock(secureKdfOutput)
+            newAddrList.append(newAddr)
+
+         if self.useEncryption and wasLocked:
+            self.lock()
+      else:
+         if not self.hasPubKey():
+            raise KeyDataError, 'No public key available to extend chain'
+         allKeys = CryptoECDSA().ComputeChainedPublicKeyBatch( \
+                                    self.binPublicKey65, self.chaincode, numAddr)
+         if not allKeys.getSize() == numAddr*Cpp.CHAINED_PUBKEY_RECORD_SIZE:
+            raise KeyDataError, 'Failed to extend chain'
+
+         for i in range(numAddr):
+            rec = i*Cpp.CHAINED_PUBKEY_RECORD_SIZE
+            newAddr = PyBtcAddress()
+            newAddr.binPublicKey65 = allKeys.getSliceCopy(rec, 65)
+            newAddr.addrStr20      = allKeys.getSliceCopy(rec+65, 20).toBinStr()
+            newAddr.useEncryption  = self.useEncryption
+            newAddr.isInitialized  = True
+            newAddr.chaincode      = self.chaincode
+            newAddr.chainIndex     = self.chainIndex+1+i
+            newAddrList.append(newAddr)
+
+      return newAddrList
+
+
    def serialize(self):
       """
       We define here a binary serialization scheme that will write out ALL
@@ -3855,6 +3935,59 @@ def getUnspentTxOutsForAddrList(addr160List, utxoType='Sweep'):
 
 
 
+################################################################################
+def createDERSignature(sig64):
+   """
+   64-byte r||s signature, as it comes out of CryptoECDSA, to DER
+   """
+   # We add an extra 0 byte to the beginning of each value to guarantee
+   # that they are interpretted as unsigned integers.  Not always necessary
+   # but it doesn't hurt to always do it.
+   rBin   = '\x00' + sig64[:32 ]
+   sBin   = '\x00' + sig64[ 32:]
+   rSize  = int_to_binary(len(rBin))
+   sSize  = int_to_binary(len(sBin))
+   rsSize = int_to_binary(len(rBin) + len(sBin) + 4)
+   sigScr = '\x30' + rsSize + \
+            '\x02' + rSize + rBin + \
+            '\x02' + sSize + sBin
+   return sigScr
+
+
+################################################################################
+def generateDERSignatureBatch(addrList, msgList):
+   """
+   Same as addrList[i].generateDERSignature(msgList[i]) for every i, but all
+   signed in one CryptoECDSA call, with each private key passed in once.
+   The addresses must already be unlocked.
+   """
+   if len(msgList)==0:
+      return []
+
+   keyIndex   = {}
+   packedKeys = SecureBinaryData()
+   cppMsgs    = Cpp.vector_BinaryData()
+   cppIdx     = Cpp.vector_int()
+   for addr,msg in zip(addrList, msgList):
+      if not addr.hasPrivKey():
+         raise KeyDataError, 'Cannot sign for address without private key!'
+      if addr.isLocked:
+         raise WalletLockError, "Cannot sign Tx when private key is locked!"
+      a160 = addr.getAddr160()
+      if not keyIndex.has_key(a160):
+         keyIndex[a160] = len(keyIndex)
+         packedKeys.append(addr.binPrivKey32_Plain)
+      cppMsgs.push_back(msg)
+      cppIdx.push_back(keyIndex[a160])
+
+   sigs = CryptoECDSA().SignBatch(cppMsgs, cppIdx, packedKeys)
+   packedKeys.destroy()
+   if not sigs.getSize()==64*len(msgList):
+      raise KeyDataError, 'Failed signature generation'
+   sigstr = sigs.toBinStr()
+   return [createDERSignature(sigstr[64*i:64*(i+1)]) for i in range(len(msgList))]
+
+
 ################################################################################
 # NOTE:  This method was actually used to create the Blockchain-reorg unit-
 #        test, and hence why coinbase transactions are supported.  However,
@@ -3878,6 +4011,7 @@ def getUnspentTxOutsForAddrList(addr160List, utxoType='Sweep'):
 #
 # Of course, we usually don't have the private keys of the dst addrs...
 #
+################################################################################
 def PyCreateAndSignTx(srcTxOuts, dstAddrsVals):
    newTx = PyTx()
    newTx.version    = 1
@@ -3935,45 +4069,47 @@ def PyCreateAndSignTx(srcTxOuts, dstAddrsVals):
    # Now we apply the ultra-complicated signature procedure
    # We need a copy of the Tx with all the txin scripts blanked out
    txCopySerialized = newTx.serialize()
+   if coinbaseTx:
+      return newTx
+
+   # All the messages first, then every input is signed in one batch
+   hashCode1  = int_to_binary(1, widthBytes=1)
+   hashCode4  = int_to_binary(1, widthBytes=4)
+   srcAddrs   = []
+   preHashMsgs = []
    for i in range(numInputs):
-      if coinbaseTx:
-         pass
-      else:
-         txCopy     = PyTx().unserialize(txCopySerialized)
-         srcAddr    = srcTxOuts[i][0]
-         txoutIdx   = srcTxOuts[i][2]
-         prevTxOut  = srcTxOuts[i][1].outputs[txoutIdx]
-         binToSign  = ''
-
-         assert(srcAddr.hasPrivKey())
+      txCopy     = PyTx().unserialize(txCopySerialized)
+      srcAddr    = srcTxOuts[i][0]
+      txoutIdx   = srcTxOuts[i][2]
+      prevTxOut  = srcTxOuts[i][1].outputs[txoutIdx]
 
-         # Only implemented one type of hashing:  SIGHASH_ALL
-         hashType   = 1  # SIGHASH_ALL
-         hashCode1  = int_to_binary(1, widthBytes=1)
-         hashCode4  = int_to_binary(1, widthBytes=4)
+      assert(srcAddr.hasPrivKey())
 
-         # Copy the script of the TxOut we're spending, into the txIn script
-         txCopy.inputs[i].binScript = prevTxOut.binScript
-         preHashMsg = txCopy.serialize() + hashCode4
+      # Only implemented one type of hashing:  SIGHASH_ALL
+      # Copy the script of the TxOut we're spending, into the txIn script
+      txCopy.inputs[i].binScript = prevTxOut.binScript
+      srcAddrs.append(srcAddr)
+      preHashMsgs.append(txCopy.serialize() + hashCode4)
 
-         # CppBlockUtils::CryptoECDSA modules do the hashing for us
-         ##binToSign = hash256(preHashMsg)
-         ##binToSign = binary_switchEndian(binToSign)
+   # CppBlockUtils::CryptoECDSA modules do the hashing for us
+   signatures = generateDERSignatureBatch(srcAddrs, preHashMsgs)
 
-         signature = srcAddr.generateDERSignature(preHashMsg)
-
-
-         # If we are spending a Coinbase-TxOut, only need sig, no pubkey
-         # Don't forget to tack on the one-byte hashcode and consider it part of sig
-         if len(prevTxOut.binScript) > 30:
-            sigLenInBinary = int_to_binary(len(signature) + 1)
-            newTx.inputs[i].binScript = sigLenInBinary + signature + hashCode1
-         else:
-            pubkey = srcAddr.binPublicKey65.toBinStr()
-            sigLenInBinary    = int_to_binary(len(signature) + 1)
-            pubkeyLenInBinary = int_to_binary(len(pubkey)   )
-            newTx.inputs[i].binScript = sigLenInBinary    + signature + hashCode1 + \
-                                        pubkeyLenInBinary + pubkey
+   for i in range(numInputs):
+      srcAddr   = srcAddrs[i]
+      signature = signatures[i]
+      prevTxOut = srcTxOuts[i][1].outputs[srcTxOuts[i][2]]
+
+      # If we are spending a Coinbase-TxOut, only need sig, no pubkey
+      # Don't forget to tack on the one-byte hashcode and consider it part of sig
+      if len(prevTxOut.binScript) > 30:
+         sigLenInBinary = int_to_binary(len(signature) + 1)
+         newTx.inputs[i].binScript = sigLenInBinary + signature + hashCode1
+      else:
+         pubkey = srcAddr.binPublicKey65.toBinStr()
+         sigLenInBinary    = int_to_binary(len(signature) + 1)
+         pubkeyLenInBinary = int_to_binary(len(pubkey)   )
+         newTx.inputs[i].binScript = sigLenInBinary    + signature + hashCode1 + \
+                                     pubkeyLenInBinary + pubkey
 
    #############################
    # Finally, our tx is complete!
@@ -5416,12 +5552,29 @@ class PyBtcWallet(object):
    def setBlockchainSyncFlag(self, syncYes=True):
       self.doBlockchainSync = syncYes
 
+   #############################################################################
+   def getScanStatePath(self):
+      return os.path.splitext(self.getWalletPath())[0] + '.scanstate'
+
    #############################################################################
    def syncWithBlockchain(self):
       if not self.doBlockchainSync==BLOCKCHAIN_DONOTUSE:
          assert(TheBDM.isInitialized())
-         TheBDM.scanBlockchainForTx(self.cppWallet, self.lastSyncBlockNum)
+         prevSyncBlockNum = self.lastSyncBlockNum
+         if self.lastSyncBlockNum==0 and not self.walletPath=='':
+            # The BDM falls back to a full rescan if the snapshot is missing,
+            # corrupt, or its top block is no longer in the main chain
+            TheBDM.readWalletScanStateFile(self.cppWallet, \
+                                           self.getScanStatePath())
+         else:
+            TheBDM.scanBlockchainForTx(self.cppWallet, self.lastSyncBlockNum)
          self.lastSyncBlockNum = TheBDM.getTopBlockHeader().getBlockHeight()
+
+         # Only write a new snapshot if we scanned something new
+         if not self.walletPath=='' and \
+            not self.lastSyncBlockNum==prevSyncBlockNum:
+            TheBDM.writeWalletScanStateFile(self.cppWallet, \
+                                            self.getScanStatePath())
       else:
          print '***WARNING: Blockchain-sync requested, but current wallet'
          print '            is set to BLOCKCHAIN_DONOTUSE'
@@ -5822,6 +5975,44 @@ class PyBtcWallet(object):
       # In the future we will enable first/last seen, but not yet
       self.cppWallet.addAddress_5_(new160, 0, 0, 0, 0)
       return new160
+
+
+   #############################################################################
+   def computeNextAddressBatch(self, numAddr):
+      """
+      Extend the chain by numAddr addresses from the tip, with a single
+      C++ call for the keys and a single wallet-file update for all of them.
+      Falls back to computeNextAddress() when the batch can't be used.
+      """
+      if numAddr<=0:
+         return []
+
+      tipAddr = self.addrMap[self.lastComputedChainAddr160]
+      newAddrList = tipAddr.extendAddressChainBatch(numAddr, self.kdfKey)
+      if newAddrList==None:
+         return [self.computeNextAddress() for i in range(numAddr)]
+
+      updateList = []
+      for newAddr in newAddrList:
+         updateList.append([WLT_UPDATE_ADD, WLT_DATATYPE_KEYDATA, \
+                                             newAddr.getAddr160(), newAddr])
+      newDataLocs = self.walletFileSafeUpdate(updateList)
+
+      new160List = []
+      for newAddr,dataLoc in zip(newAddrList, newDataLocs):
+         new160 = newAddr.getAddr160()
+         self.addrMap[new160] = newAddr
+         self.addrMap[new160].walletByteLoc = dataLoc + 21
+         self.linearAddr160List.append(new160)
+         self.chainIndexMap[newAddr.chainIndex] = new160
+         self.cppWallet.addAddress_5_(new160, 0, 0, 0, 0)
+         new160List.append(new160)
+
+      lastAddr = newAddrList[-1]
+      if lastAddr.chainIndex > self.lastComputedChainIndex:
+         self.lastComputedChainAddr160 = lastAddr.getAddr160()
+         self.lastComputedChainIndex = lastAddr.chainIndex
+      return new160List
       
 
 
@@ -5833,8 +6024,10 @@ class PyBtcWallet(object):
 
       gap = self.lastComputedChainIndex - self.highestUsedChainIndex
       numToCreate = max(numPool - gap, 0)
-      for i in range(numToCreate):
+      if numToCreate==1:
          self.computeNextAddress()
+      elif numToCreate>1:
+         self.computeNextAddressBatch(numToCreate)
       return self.lastComputedChainIndex
          
    #############################################################################
@@ -6160,7 +6353,7 @@ class PyBtcWallet(object):
                  computer's specific speed/memory capabilities.
       """
       kdf = KdfRomix()
-      kdf.computeKdfParams(targetSec, long(maxMem))
+      kdf.computeKdfParams(getKdfProfile(), targetSec, long(maxMem))
 
       mem   = kdf.getMemoryReqtBytes()
       nIter = kdf.getNumIterations()
@@ -6302,12 +6495,37 @@ class PyBtcWallet(object):
             self.useEncryption = oldUsedEncryption
             # Restore the old flag just in case the file write fails
 
+         # On a passphrase change, the stored encrypted keys are re-keyed all
+         # at once in C++, instead of a decrypt and encrypt per address.  The
+         # IVs stay the same, and so do the plaintext keys (if unlocked)
          newAddrMap  = {}
+         bulkAddrs   = []
          for addr160,addr in self.addrMap.iteritems():
             newAddrMap[addr160] = addr.copy()
-            newAddrMap[addr160].enableKeyEncryption(generateIVIfNecessary=True)
-            newAddrMap[addr160].changeEncryptionKey(oldKdfKey, newKdfKey)
             newAddrMap[addr160].walletByteLoc = addr.walletByteLoc
+            newAddr = newAddrMap[addr160]
+            if oldUsedEncryption and newUsesEncryption and \
+               newAddr.hasPrivKey() and newAddr.useEncryption and \
+               newAddr.binPrivKey32_Encr.getSize()==32 and \
+               newAddr.binInitVect16.getSize()==16 and \
+               not newAddr.keyChanged and not newAddr.createPrivKeyNextUnlock:
+               bulkAddrs.append(newAddr)
+            else:
+               newAddr.enableKeyEncryption(generateIVIfNecessary=True)
+               newAddr.changeEncryptionKey(oldKdfKey, newKdfKey)
+
+         if len(bulkAddrs)>0:
+            keyData = SecureBinaryData(''.join([a.binPrivKey32_Encr.toBinStr() + \
+                                                a.binInitVect16.toBinStr() \
+                                                      for a in bulkAddrs]))
+            if not CryptoAES().ReencryptBatch(keyData, oldKdfKey, newKdfKey):
+               raise EncryptionError, 'Could not re-encrypt private keys'
+            recSize = Cpp.AES_REKEY_RECORD_SIZE
+            for i,a in enumerate(bulkAddrs):
+               a.binPrivKey32_Encr = keyData.getSliceCopy(i*recSize, 32)
+            keyData.destroy()
+
+         for addr160,addr in self.addrMap.iteritems():
             walletUpdateInfo.append( \
                [WLT_UPDATE_MODIFY, addr.walletByteLoc, newAddrMap[addr160].serialize()])
 
@@ -7275,6 +7493,9 @@ class PyBtcWallet(object):
 
       # The TxOut script is already in the TxIn script location, correctly
       # But we still need to blank out all other scripts when signing
+      hashCode1   = int_to_binary(hashcode, widthBytes=1)
+      hashCode4   = int_to_binary(hashcode, widthBytes=4)
+      preHashMsgs = []
       for addrObj,idx, sigIdx in wltAddr:
          if addrObj.isLocked:
             if self.kdfKey:
@@ -7292,10 +7513,13 @@ class PyBtcWallet(object):
             if not i==idx:
                txCopy.inputs[i].binScript = ''
 
-         hashCode1  = int_to_binary(hashcode, widthBytes=1)
-         hashCode4  = int_to_binary(hashcode, widthBytes=4)
-         preHashMsg = txCopy.serialize() + hashCode4
-         signature  = addrObj.generateDERSignature(preHashMsg) + hashCode1
+         preHashMsgs.append(txCopy.serialize() + hashCode4)
+
+      # Every input we can sign for, in one batch
+      allSigs = generateDERSignatureBatch([w[0] for w in wltAddr], preHashMsgs)
+
+      for (addrObj,idx,sigIdx),sig in zip(wltAddr, allSigs):
+         signature = sig + hashCode1
 
          # Now we attach a binary signature or full script, depending on the type
          if txdp.scriptTypes[idx]==TXOUT_SCRIPT_COINBASE:
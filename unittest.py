@@ -995,6 +995,42 @@ if Test_EncryptedAddress:
    printpassorfail(priv2 == priv2b)
 
 
+   #############################################################################
+   # fillAddressPool uses the batch version for more than one address.  20
+   # links is enough to take the public-key batch through its table path
+   print '\n\nBatch chain extension vs. one link at a time (20 links)'
+   nLinks = 20
+   addr0 = PyBtcAddress().createFromPlainKeyData(privKey, addr20)
+   addr0.markAsRootAddr(chaincode)
+   privBatch = addr0.extendAddressChainBatch(nLinks)
+   privIter  = [addr0]
+   for i in range(nLinks):
+      privIter.append(privIter[-1].extendAddressChain())
+   privIter = privIter[1:]
+
+   pubRoot = PyBtcAddress().createFromPublicKeyData(addr0.binPublicKey65)
+   pubRoot.markAsRootAddr(chaincode)
+   pubBatch = pubRoot.extendAddressChainBatch(nLinks)
+   pubIter  = [pubRoot]
+   for i in range(nLinks):
+      pubIter.append(pubIter[-1].extendAddressChain())
+   pubIter = pubIter[1:]
+
+   print '   Private keys match:',
+   printpassorfail(len(privBatch)==nLinks and all( \
+      [privBatch[i].binPrivKey32_Plain == privIter[i].binPrivKey32_Plain and \
+       privBatch[i].binPublicKey65     == privIter[i].binPublicKey65     and \
+       privBatch[i].getAddr160()       == privIter[i].getAddr160()       and \
+       privBatch[i].chainIndex         == privIter[i].chainIndex \
+                                             for i in range(nLinks)]))
+   print '   Public keys match: ',
+   printpassorfail(len(pubBatch)==nLinks and all( \
+      [pubBatch[i].binPublicKey65 == pubIter[i].binPublicKey65  and \
+       pubBatch[i].getAddr160()   == pubIter[i].getAddr160()    and \
+       pubBatch[i].binPublicKey65 == privIter[i].binPublicKey65 \
+                                             for i in range(nLinks)]))
+
+
 ################################################################################
 ################################################################################
 if Test_EncryptedWallet: